@@ -1,160 +1,344 @@
-#include "Channel.hpp"
-
-Channel::Channel(const std::string &name) : _name(name),
-                                            _topic(""),
-                                            _key(""),
-                                            _userLimit(0),
-                                            _inviteOnly(false),
-                                            _topicProtected(true)
-{
-}
-
-Channel::~Channel() {}
-
-const std::string &Channel::getName() const
-{
-    return _name;
-}
-
-const std::string &Channel::getTopic() const
-{
-    return _topic;
-}
-
-void Channel::setTopic(const std::string &topic)
-{
-    _topic = topic;
-}
-
-bool Channel::hasTopic() const
-{
-    return !_topic.empty();
-}
-
-void Channel::addClient(Client *client)
-{
-    _clients.insert(client);
-}
-
-void Channel::removeClient(Client *client)
-{
-    _clients.erase(client);
-    _operators.erase(client);
-}
-
-bool Channel::hasClient(Client *client) const
-{
-    return _clients.find(client) != _clients.end();
-}
-
-void Channel::addOperator(Client *client)
-{
-    _operators.insert(client);
-}
-
-bool Channel::isOperator(Client *client) const
-{
-    return _operators.find(client) != _operators.end();
-}
-
-const std::set<Client *> &Channel::getClients() const
-{
-    return _clients;
-}
-
-void Channel::addInvited(Client *client)
-{
-    _invited.insert(client);
-}
-
-bool Channel::isInvited(Client *client) const
-{
-    return (_invited.find(client) != _invited.end());
-}
-
-std::string Channel::getUserList() const
-{
-    std::string list;
-    for (std::set<Client *>::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
-    {
-        if (isOperator(*it))
-            list += "@" + (*it)->getNickname() + " ";
-        else
-            list += (*it)->getNickname() + " ";
-    }
-    if (!list.empty())
-        list.erase(list.size() - 1); // remove trailing space
-    return list;
-}
-
-void Channel::setInviteOnly(bool status)
-{
-    _inviteOnly = status;
-}
-
-bool Channel::isInviteOnly() const
-{
-    return _inviteOnly;
-}
-
-void Channel::setTopicProtected(bool status)
-{
-    _topicProtected = status;
-}
-
-bool Channel::isTopicProtected() const
-{
-    return _topicProtected;
-}
-
-void Channel::removeOperator(Client *client)
-{
-    _operators.erase(client);
-}
-
-void Channel::setKey(const std::string &key)
-{
-    _key = key;
-}
-
-bool Channel::hasKey() const
-{
-    return !_key.empty();
-}
-
-const std::string &Channel::getKey() const
-{
-    return _key;
-}
-
-void Channel::setUserLimit(long limit)
-{
-    _userLimit = limit;
-}
-
-long Channel::getUserLimit() const
-{
-    return _userLimit;
-}
-
-std::string Channel::getModes() const
-{
-    std::string modes = "+";
-    std::string params = "";
-
-    if (_inviteOnly)
-        modes += 'i';
-    if (_topicProtected)
-        modes += 't';
-
-    if (_userLimit > 0)
-    {
-        modes += 'l';
-        std::ostringstream oss;
-        oss << _userLimit;
-        params += " " + oss.str();
-    }
-    if (modes.length() == 1)
-        return "";
-    return modes + params;
-}
\ No newline at end of file
+#include "Channel.hpp"
+#include "MemoryStats.hpp"
+
+Channel::Channel(const std::string &name) : _name(name),
+                                            _topic(""),
+                                            _key(""),
+                                            _userLimit(0),
+                                            _inviteOnly(false),
+                                            _topicProtected(true),
+                                            _creationTime(time(NULL)),
+                                            _topicTime(0),
+                                            _history(NULL),
+                                            _sizeIndex(NULL)
+{
+}
+
+Channel::~Channel()
+{
+    if (_sizeIndex)
+        _sizeIndex->erase(std::make_pair(_clients.size(), _name));
+    delete _history;
+}
+
+const std::string &Channel::getName() const
+{
+    return _name;
+}
+
+const std::string &Channel::getTopic() const
+{
+    return _topic;
+}
+
+void Channel::setTopic(const std::string &topic)
+{
+    _topic = topic;
+    _topicTime = time(NULL);
+}
+
+bool Channel::hasTopic() const
+{
+    return !_topic.empty();
+}
+
+void Channel::addClient(Client *client)
+{
+    size_t oldSize = _clients.size();
+    _clients.insert(client);
+    client->addChannel(this);
+    reindex(oldSize);
+}
+
+void Channel::removeClient(Client *client)
+{
+    size_t oldSize = _clients.size();
+    _clients.erase(client);
+    client->removeChannel(this);
+    _operators.erase(client);
+    _banCache.erase(client);
+    reindex(oldSize);
+}
+
+void Channel::reindex(size_t oldSize)
+{
+    if (!_sizeIndex || oldSize == _clients.size())
+        return;
+    _sizeIndex->erase(std::make_pair(oldSize, _name));
+    _sizeIndex->insert(std::make_pair(_clients.size(), _name));
+}
+
+void Channel::setSizeIndex(ChannelSizeIndex *index)
+{
+    _sizeIndex = index;
+    _sizeIndex->insert(std::make_pair(_clients.size(), _name));
+}
+
+bool Channel::hasClient(Client *client) const
+{
+    return _clients.find(client) != _clients.end();
+}
+
+void Channel::addOperator(Client *client)
+{
+    _operators.insert(client);
+}
+
+bool Channel::isOperator(Client *client) const
+{
+    return _operators.find(client) != _operators.end();
+}
+
+const std::set<Client *> &Channel::getClients() const
+{
+    return _clients;
+}
+
+void Channel::addInvited(Client *client)
+{
+    _invited.insert(client);
+}
+
+bool Channel::isInvited(Client *client) const
+{
+    return (_invited.find(client) != _invited.end());
+}
+
+void Channel::removeInvited(Client *client)
+{
+    _invited.erase(client);
+}
+
+const std::set<Client *> &Channel::getInvited() const
+{
+    return _invited;
+}
+
+std::string Channel::getUserList() const
+{
+    std::string list;
+    for (std::set<Client *>::const_iterator it = _clients.begin(); it != _clients.end(); ++it)
+    {
+        if (isOperator(*it))
+            list += "@" + (*it)->getNickname() + " ";
+        else
+            list += (*it)->getNickname() + " ";
+    }
+    if (!list.empty())
+        list.erase(list.size() - 1); // remove trailing space
+    return list;
+}
+
+void Channel::setInviteOnly(bool status)
+{
+    _inviteOnly = status;
+}
+
+bool Channel::isInviteOnly() const
+{
+    return _inviteOnly;
+}
+
+void Channel::setTopicProtected(bool status)
+{
+    _topicProtected = status;
+}
+
+bool Channel::isTopicProtected() const
+{
+    return _topicProtected;
+}
+
+void Channel::removeOperator(Client *client)
+{
+    _operators.erase(client);
+}
+
+void Channel::setKey(const std::string &key)
+{
+    _key = key;
+}
+
+bool Channel::hasKey() const
+{
+    return !_key.empty();
+}
+
+const std::string &Channel::getKey() const
+{
+    return _key;
+}
+
+void Channel::setUserLimit(long limit)
+{
+    _userLimit = limit;
+}
+
+long Channel::getUserLimit() const
+{
+    return _userLimit;
+}
+
+std::string Channel::getModes() const
+{
+    std::string modes = "+";
+    std::string params = "";
+
+    if (_inviteOnly)
+        modes += 'i';
+    if (_topicProtected)
+        modes += 't';
+
+    if (_userLimit > 0)
+    {
+        modes += 'l';
+        std::ostringstream oss;
+        oss << _userLimit;
+        params += " " + oss.str();
+    }
+    if (modes.length() == 1)
+        return "";
+    return modes + params;
+}
+
+std::vector<MaskEntry> &Channel::maskList(char list)
+{
+    return list == 'e' ? _excepts : _bans;
+}
+
+const std::vector<MaskEntry> &Channel::getMasks(char list) const
+{
+    return list == 'e' ? _excepts : _bans;
+}
+
+void Channel::rebuildMatcher(char list)
+{
+    MaskMatcher &matcher = list == 'e' ? _exceptMatcher : _banMatcher;
+    std::vector<MaskEntry> &entries = maskList(list);
+    matcher.clear();
+    for (size_t i = 0; i < entries.size(); ++i)
+        matcher.add(entries[i].mask);
+    _banCache.clear();
+}
+
+bool Channel::addMask(char list, const std::string &mask, const std::string &setter, time_t when)
+{
+    std::vector<MaskEntry> &entries = maskList(list);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].mask == mask)
+            return false;
+    }
+    MaskEntry entry;
+    entry.mask = mask;
+    entry.setter = setter;
+    entry.when = when;
+    entries.push_back(entry);
+    (list == 'e' ? _exceptMatcher : _banMatcher).add(mask);
+    _banCache.clear();
+    return true;
+}
+
+bool Channel::removeMask(char list, const std::string &mask)
+{
+    std::vector<MaskEntry> &entries = maskList(list);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].mask == mask)
+        {
+            entries.erase(entries.begin() + i);
+            rebuildMatcher(list);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Banned and not excepted. Members are answered from a cache that is dropped
+// when either list changes and ignored once the member's nick or user changes.
+bool Channel::isBanned(Client *client)
+{
+    if (_bans.empty())
+        return false;
+    std::map<Client *, std::pair<unsigned, bool> >::iterator it = _banCache.find(client);
+    if (it != _banCache.end() && it->second.first == client->getMaskVersion())
+        return it->second.second;
+
+    std::string mask = client->getFullMask();
+    bool banned = _banMatcher.matches(mask) && !_exceptMatcher.matches(mask);
+    if (hasClient(client))
+        _banCache[client] = std::make_pair(client->getMaskVersion(), banned);
+    return banned;
+}
+
+// "nick" -> "nick!*@*", "user@host" -> "*!user@host", "nick!user" -> "nick!user@*"
+std::string Channel::normalizeMask(const std::string &mask)
+{
+    size_t bang = mask.find('!');
+    size_t at = mask.find('@');
+    if (bang == std::string::npos && at == std::string::npos)
+        return mask + "!*@*";
+    if (bang == std::string::npos)
+        return "*!" + mask;
+    if (at == std::string::npos)
+        return mask + "@*";
+    return mask;
+}
+
+time_t Channel::getCreationTime() const
+{
+    return _creationTime;
+}
+
+void Channel::setCreationTime(time_t ts)
+{
+    _creationTime = ts;
+}
+
+time_t Channel::getTopicTime() const
+{
+    return _topicTime;
+}
+
+void Channel::setTopicTime(time_t ts)
+{
+    _topicTime = ts;
+}
+
+ChannelHistory *Channel::getHistory() const
+{
+    return _history;
+}
+
+void Channel::setHistory(ChannelHistory *history)
+{
+    _history = history;
+}
+
+size_t ChannelMemory::total() const
+{
+    return object + strings + members + masks + history;
+}
+
+size_t Channel::membershipBytes()
+{
+    return MemoryStats::TREE_NODE_OVERHEAD + sizeof(Client *) + MemoryStats::TREE_NODE_OVERHEAD + sizeof(Channel *);
+}
+
+void Channel::memoryUsage(ChannelMemory &usage) const
+{
+    usage.object = sizeof(Channel);
+    usage.strings = MemoryStats::stringBytes(_name) + MemoryStats::stringBytes(_topic) + MemoryStats::stringBytes(_key);
+    usage.members = MemoryStats::setBytes(_clients) + MemoryStats::setBytes(_operators) +
+                    MemoryStats::setBytes(_invited) + MemoryStats::mapBytes(_banCache);
+    usage.masks = MemoryStats::vectorBytes(_bans) + MemoryStats::vectorBytes(_excepts) +
+                  _banMatcher.memoryBytes() + _exceptMatcher.memoryBytes();
+    for (int list = 0; list < 2; ++list)
+    {
+        const std::vector<MaskEntry> &entries = list ? _excepts : _bans;
+        for (size_t i = 0; i < entries.size(); ++i)
+            usage.masks += MemoryStats::stringBytes(entries[i].mask) + MemoryStats::stringBytes(entries[i].setter);
+    }
+    usage.history = _history ? sizeof(ChannelHistory) + _history->indexBytes() : 0;
+    usage.mapped = _history ? _history->mappedBytes() : 0;
+}
@@ -1,62 +1,128 @@
-#ifndef CHANNEL_HPP
-#define CHANNEL_HPP
-
-#include <string>
-#include <set>
-#include <map>
-#include "Client.hpp"
-#include <sstream>
-
-class Channel
-{
-private:
-	std::string _name;
-	std::string _topic;
-	std::string _key;
-	std::set<Client *> _clients;
-	std::set<Client *> _invited;
-	std::set<Client *> _operators;
-	long _userLimit;
-	bool _inviteOnly;
-	bool _topicProtected;
-
-public:
-	Channel(const std::string &name);
-	~Channel();
-
-	const std::string &getName() const;
-	const std::string &getTopic() const;
-	const std::set<Client *> &getClients() const;
-	std::string getUserList() const;
-
-	// Client management
-	void setTopic(const std::string &topic);
-	void addClient(Client *client);
-	void removeClient(Client *client);
-	bool hasClient(Client *client) const;
-	void addInvited(Client *client);
-	bool isInvited(Client *client) const;
-
-	// Operator management
-	void addOperator(Client *client);
-	void removeOperator(Client *client);
-	bool isOperator(Client *client) const;
-
-	// Mode setters & Getters
-	void setInviteOnly(bool status);
-	bool isInviteOnly() const;
-
-	void setTopicProtected(bool status);
-	bool isTopicProtected() const;
-	bool hasTopic() const;
-
-	void setKey(const std::string &key);
-	bool hasKey() const;
-	const std::string& getKey() const;
-
-	void setUserLimit(long limit);
-	long getUserLimit() const;
-
-	std::string getModes() const;
-};
-#endif
+#ifndef CHANNEL_HPP
+#define CHANNEL_HPP
+
+#include <string>
+#include <set>
+#include <vector>
+#include <map>
+#include "Client.hpp"
+#include "ChannelHistory.hpp"
+#include "MaskMatcher.hpp"
+#include <sstream>
+#include <ctime>
+#include <utility>
+
+// (member count, name) of every channel, kept up to date by the channels themselves
+typedef std::set<std::pair<size_t, std::string> > ChannelSizeIndex;
+
+// One +b / +e entry, as shown in the 367 / 348 listings
+struct MaskEntry
+{
+	std::string mask;
+	std::string setter;
+	time_t when;
+};
+
+// Bytes held by one channel (see MemoryStats.hpp), reported by MEMSTATS
+struct ChannelMemory
+{
+	size_t object;	// the Channel itself
+	size_t strings; // name, topic, key
+	size_t members; // member, operator and invite sets, ban cache
+	size_t masks;	// +b / +e entries and their matchers
+	size_t history; // in-memory history index (the log itself is mapped)
+	size_t mapped;	// history file mapping, not counted in total()
+
+	size_t total() const;
+};
+
+class Channel
+{
+private:
+	std::string _name;
+	std::string _topic;
+	std::string _key;
+	std::set<Client *> _clients;
+	std::set<Client *> _invited;
+	std::set<Client *> _operators;
+	long _userLimit;
+	bool _inviteOnly;
+	bool _topicProtected;
+	time_t _creationTime;
+	time_t _topicTime;
+	ChannelHistory *_history; // NULL until the first message when history is enabled
+	ChannelSizeIndex *_sizeIndex;
+	std::vector<MaskEntry> _bans;
+	std::vector<MaskEntry> _excepts;
+	MaskMatcher _banMatcher;
+	MaskMatcher _exceptMatcher;
+	std::map<Client *, std::pair<unsigned, bool> > _banCache; // member -> (mask version, banned)
+
+	void reindex(size_t oldSize);
+	std::vector<MaskEntry> &maskList(char list);
+	void rebuildMatcher(char list);
+
+	Channel(const Channel &);
+	Channel &operator=(const Channel &);
+
+public:
+	Channel(const std::string &name);
+	~Channel();
+
+	const std::string &getName() const;
+	const std::string &getTopic() const;
+	const std::set<Client *> &getClients() const;
+	std::string getUserList() const;
+
+	// Client management
+	void setTopic(const std::string &topic);
+	void addClient(Client *client);
+	void removeClient(Client *client);
+	bool hasClient(Client *client) const;
+	void addInvited(Client *client);
+	bool isInvited(Client *client) const;
+	void removeInvited(Client *client);
+	const std::set<Client *> &getInvited() const;
+
+	// Operator management
+	void addOperator(Client *client);
+	void removeOperator(Client *client);
+	bool isOperator(Client *client) const;
+
+	// Mode setters & Getters
+	void setInviteOnly(bool status);
+	bool isInviteOnly() const;
+
+	void setTopicProtected(bool status);
+	bool isTopicProtected() const;
+	bool hasTopic() const;
+
+	void setKey(const std::string &key);
+	bool hasKey() const;
+	const std::string& getKey() const;
+
+	void setUserLimit(long limit);
+	long getUserLimit() const;
+
+	std::string getModes() const;
+
+	time_t getCreationTime() const;
+	void setCreationTime(time_t ts);
+	time_t getTopicTime() const;
+	void setTopicTime(time_t ts);
+	void setSizeIndex(ChannelSizeIndex *index);
+
+	// Ban ('b') and exception ('e') lists
+	bool addMask(char list, const std::string &mask, const std::string &setter, time_t when);
+	bool removeMask(char list, const std::string &mask);
+	const std::vector<MaskEntry> &getMasks(char list) const;
+	bool isBanned(Client *client);
+	static std::string normalizeMask(const std::string &mask);
+
+	ChannelHistory *getHistory() const;
+	void setHistory(ChannelHistory *history);
+
+	void memoryUsage(ChannelMemory &usage) const;
+	static size_t membershipBytes(); // member entry plus the member's channel entry, as charged to the client
+};
+#endif
@@ -0,0 +1,295 @@
+#include "ChannelHistory.hpp"
+#include "MemoryStats.hpp"
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+namespace
+{
+	struct FileHeader
+	{
+		char magic[8];
+		unsigned long long capacity;
+		unsigned long long end;
+		unsigned long long nextMsgid;
+	};
+
+	struct RecordHeader
+	{
+		unsigned int length;
+		unsigned int flags;
+		long long time;
+		unsigned long long msgid;
+	};
+
+	const char MAGIC[8] = {'I', 'R', 'C', 'H', 'I', 'S', 'T', '1'};
+	const size_t DATA_START = 64;
+	const size_t MIN_CAPACITY = 64 * 1024;
+
+	size_t recordSize(size_t length)
+	{
+		return sizeof(RecordHeader) + ((length + 7) & ~static_cast<size_t>(7));
+	}
+
+	bool entryBefore(const ChannelHistory::Entry &entry, long long timeMs)
+	{
+		return entry.time < timeMs;
+	}
+
+	bool msgidBefore(const ChannelHistory::Entry &entry, unsigned long long msgid)
+	{
+		return entry.msgid < msgid;
+	}
+}
+
+ChannelHistory::ChannelHistory() : _fd(-1), _map(NULL), _capacity(0), _maxAgeMs(0) {}
+
+ChannelHistory::~ChannelHistory()
+{
+	if (_map)
+		munmap(_map, _capacity);
+	if (_fd != -1)
+		close(_fd);
+}
+
+bool ChannelHistory::open(const std::string &path, size_t capacity, long long maxAgeSeconds)
+{
+	_path = path;
+	_maxAgeMs = maxAgeSeconds * 1000;
+	_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+	if (_fd < 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	struct stat st;
+	if (fstat(_fd, &st) < 0)
+		return false;
+
+	FileHeader header;
+	bool valid = static_cast<size_t>(st.st_size) >= DATA_START &&
+				 pread(_fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+				 std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+				 header.capacity == static_cast<unsigned long long>(st.st_size) &&
+				 header.end >= DATA_START && header.end <= header.capacity;
+	if (valid)
+		_capacity = header.capacity;
+	else
+	{
+		_capacity = std::max(capacity, MIN_CAPACITY);
+		if (ftruncate(_fd, 0) < 0 || ftruncate(_fd, _capacity) < 0)
+		{
+			perror("ftruncate");
+			return false;
+		}
+	}
+	void *map = mmap(NULL, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		return false;
+	}
+	_map = static_cast<char *>(map);
+	if (!valid)
+	{
+		std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.capacity = _capacity;
+		header.end = DATA_START;
+		header.nextMsgid = 1;
+		std::memcpy(_map, &header, sizeof(header));
+	}
+
+	// Rebuild the index; a torn record at the tail (crash mid-append) is cut off
+	size_t end = endOffset();
+	size_t offset = DATA_START;
+	while (offset + sizeof(RecordHeader) <= end)
+	{
+		RecordHeader record;
+		std::memcpy(&record, _map + offset, sizeof(record));
+		if (offset + recordSize(record.length) > end)
+			break;
+		Entry e;
+		e.time = _index.empty() ? record.time : std::max(record.time, _index.back().time);
+		e.msgid = record.msgid;
+		e.offset = offset;
+		_index.push_back(e);
+		offset += recordSize(record.length);
+	}
+	if (offset != end)
+		setEndOffset(offset);
+	return true;
+}
+
+size_t ChannelHistory::endOffset() const
+{
+	FileHeader header;
+	std::memcpy(&header, _map, sizeof(header));
+	return header.end;
+}
+
+void ChannelHistory::setEndOffset(size_t end)
+{
+	FileHeader header;
+	std::memcpy(&header, _map, sizeof(header));
+	header.end = end;
+	std::memcpy(_map, &header, sizeof(header));
+}
+
+// Drop expired records and, if space is still short, the oldest ones until a
+// quarter of the file is free, then slide the survivors to the front.
+void ChannelHistory::compact(size_t needed, long long now)
+{
+	size_t keep = 0;
+	while (keep < _index.size() && _maxAgeMs > 0 && _index[keep].time < now - _maxAgeMs)
+		keep++;
+
+	size_t end = endOffset();
+	size_t limit = std::min((_capacity - DATA_START) * 3 / 4, _capacity - DATA_START - needed);
+	while (keep < _index.size() && end - _index[keep].offset > limit)
+		keep++;
+	if (keep == 0)
+		return;
+
+	size_t from = keep < _index.size() ? _index[keep].offset : end;
+	size_t shift = from - DATA_START;
+	std::memmove(_map + DATA_START, _map + from, end - from);
+	_index.erase(_index.begin(), _index.begin() + keep);
+	for (size_t i = 0; i < _index.size(); ++i)
+		_index[i].offset -= shift;
+	setEndOffset(end - shift);
+}
+
+bool ChannelHistory::append(const std::string &line, long long timeMs)
+{
+	return append(line.data(), line.size(), timeMs);
+}
+
+bool ChannelHistory::append(const char *line, size_t length, long long timeMs)
+{
+	if (!_map)
+		return false;
+	size_t need = recordSize(length);
+	if (need > _capacity - DATA_START)
+		return false;
+	// A wall clock stepped back (NTP) must not unsort the index: lookups by
+	// time and expiry both binary search or scan it in order
+	if (!_index.empty() && timeMs < _index.back().time)
+		timeMs = _index.back().time;
+	if (endOffset() + need > _capacity ||
+		(!_index.empty() && _maxAgeMs > 0 && _index[0].time < timeMs - _maxAgeMs))
+		compact(need, timeMs);
+
+	FileHeader header;
+	std::memcpy(&header, _map, sizeof(header));
+	size_t offset = header.end;
+
+	RecordHeader record;
+	record.length = length;
+	record.flags = 0;
+	record.time = timeMs;
+	record.msgid = header.nextMsgid++;
+	std::memcpy(_map + offset, &record, sizeof(record));
+	std::memcpy(_map + offset + sizeof(record), line, length);
+
+	// Publish the record only once it is fully written
+	header.end = offset + need;
+	std::memcpy(_map, &header, sizeof(header));
+
+	Entry e;
+	e.time = record.time;
+	e.msgid = record.msgid;
+	e.offset = offset;
+	_index.push_back(e);
+	return true;
+}
+
+size_t ChannelHistory::size() const
+{
+	return _index.size();
+}
+
+size_t ChannelHistory::indexBytes() const
+{
+	return MemoryStats::vectorBytes(_index) + MemoryStats::stringBytes(_path);
+}
+
+size_t ChannelHistory::mappedBytes() const
+{
+	return _map ? _capacity : 0;
+}
+
+const ChannelHistory::Entry &ChannelHistory::entry(size_t i) const
+{
+	return _index[i];
+}
+
+const char *ChannelHistory::payload(size_t i, size_t &length) const
+{
+	RecordHeader record;
+	std::memcpy(&record, _map + _index[i].offset, sizeof(record));
+	length = record.length;
+	return _map + _index[i].offset + sizeof(record);
+}
+
+size_t ChannelHistory::lowerBoundTime(long long timeMs) const
+{
+	return std::lower_bound(_index.begin(), _index.end(), timeMs, entryBefore) - _index.begin();
+}
+
+bool ChannelHistory::findMsgid(unsigned long long msgid, size_t &pos) const
+{
+	pos = std::lower_bound(_index.begin(), _index.end(), msgid, msgidBefore) - _index.begin();
+	return pos < _index.size() && _index[pos].msgid == msgid;
+}
+
+long long ChannelHistory::nowMs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<long long>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+std::string ChannelHistory::formatTime(long long timeMs)
+{
+	time_t seconds = timeMs / 1000;
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+	char buffer[32];
+	size_t n = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buffer + n, sizeof(buffer) - n, ".%03dZ", static_cast<int>(timeMs % 1000));
+	return buffer;
+}
+
+bool ChannelHistory::parseTime(const std::string &text, long long &timeMs)
+{
+	struct tm tm;
+	std::memset(&tm, 0, sizeof(tm));
+	int ms = 0;
+	if (sscanf(text.c_str(), "%d-%d-%dT%d:%d:%d.%dZ", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			   &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &ms) < 6)
+		return false;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	timeMs = static_cast<long long>(timegm(&tm)) * 1000 + ms;
+	return true;
+}
+
+std::string ChannelHistory::pathFor(const std::string &dir, const std::string &channel)
+{
+	// Hex-encode the name: channel names may contain characters unsafe in paths
+	static const char digits[] = "0123456789abcdef";
+	std::string path = dir + "/";
+	for (size_t i = 0; i < channel.size(); ++i)
+	{
+		unsigned char c = channel[i];
+		path += digits[c >> 4];
+		path += digits[c & 15];
+	}
+	return path + ".hist";
+}
@@ -0,0 +1,62 @@
+#ifndef CHANNELHISTORY_HPP
+#define CHANNELHISTORY_HPP
+
+#include <string>
+#include <vector>
+
+// Append-only message log for one channel, kept in a memory-mapped file.
+//
+// File layout: a fixed header followed by records
+//   [u32 length][u32 flags][i64 time ms][u64 msgid][payload, padded to 8]
+// The payload is the relayed line without CRLF, so replay copies it from
+// the mapping into the send queue as is. An in-memory index (time, msgid,
+// offset) is rebuilt by scanning the file when it is opened. Times never go
+// backwards in the index, even if the wall clock does.
+class ChannelHistory
+{
+public:
+	struct Entry
+	{
+		long long time;
+		unsigned long long msgid;
+		size_t offset;
+	};
+
+private:
+	std::string _path;
+	int _fd;
+	char *_map;
+	size_t _capacity;
+	long long _maxAgeMs;
+	std::vector<Entry> _index;
+
+	ChannelHistory(const ChannelHistory &);
+	ChannelHistory &operator=(const ChannelHistory &);
+
+	void compact(size_t needed, long long now);
+	size_t endOffset() const;
+	void setEndOffset(size_t end);
+
+public:
+	ChannelHistory();
+	~ChannelHistory();
+
+	bool open(const std::string &path, size_t capacity, long long maxAgeSeconds);
+	bool append(const std::string &line, long long timeMs);
+	bool append(const char *line, size_t length, long long timeMs);
+
+	size_t size() const;
+	size_t indexBytes() const;	// heap used by the in-memory index
+	size_t mappedBytes() const; // file mapping (page cache, not heap)
+	const Entry &entry(size_t i) const;
+	const char *payload(size_t i, size_t &length) const;
+	size_t lowerBoundTime(long long timeMs) const;				 // first entry at or after timeMs
+	bool findMsgid(unsigned long long msgid, size_t &pos) const; // exact match
+
+	static long long nowMs();
+	static std::string formatTime(long long timeMs);
+	static bool parseTime(const std::string &text, long long &timeMs);
+	static std::string pathFor(const std::string &dir, const std::string &channel);
+};
+
+#endif
@@ -1,77 +1,468 @@
-#include "Client.hpp"
-
-Client::Client(int fd) : _fd(fd), _hasSentPass(false), _hasSentNick(false),
-	  _hasSentUser(false), _isRegistered(false) {}
-
-Client::~Client() {}
-
-int Client::getFd() const
-{
-	return _fd;
-}
-
-const std::string &Client::getNickname() const
-{
-	return _nickname;
-}
-
-const std::string &Client::getUsername() const
-{
-	return _username;
-}
-
-bool Client::isRegistered() const
-{
-	return _isRegistered;
-}
-
-bool Client::hasSentPass() const
-{
-	return _hasSentPass;
-}
-
-bool Client::hasSentNick() const
-{
-	return _hasSentNick;
-}
-
-bool Client::hasSentUser() const
-{
-	return _hasSentUser;
-}
-
-void Client::setNickname(const std::string &nick)
-{
-	_nickname = nick;
-	_hasSentNick = true;
-}
-
-void Client::setUsername(const std::string &user)
-{
-	_username = user;
-	_hasSentUser = true;
-}
-
-void Client::setPassAccepted(bool ok)
-{
-	_hasSentPass = ok;
-}
-
-void Client::markRegistered()
-{
-	_isRegistered = true;
-}
-
-std::string Client::getFullMask() const {
-	return _nickname + "!" + _username + "@" + "ircserver";
-}
-
-const std::string& Client::getBuffer() const
-{
-    return _buffer;
-}
-
-void Client::setBuffer(const std::string& buffer)
-{
-    _buffer = buffer;
-}
\ No newline at end of file
+#include "Client.hpp"
+#include "MemoryStats.hpp"
+#include "StreamCompressor.hpp"
+#include "WebSocket.hpp"
+#include "ResumeSession.hpp"
+#include <algorithm>
+
+struct ClientExtras
+{
+	std::string linkName;	 // Peer server name for (pending) server links
+	std::string account;	 // Account logged into with SASL (empty = none)
+	std::string saslBuffer;	 // AUTHENTICATE payload received so far (base64)
+	SaslStep saslStep;
+	unsigned long saslSerial; // Identifies the pending check, so a stale result is ignored
+
+	ClientExtras() : saslStep(SASL_NONE), saslSerial(0) {}
+};
+
+namespace
+{
+	const std::string NONE;
+}
+
+Client::Client(int fd) : _fd(fd), _maskVersion(0), _caps(0), _ssl(NULL), _signonTime(time(NULL)),
+	  _lastActivity(time(NULL)), _uplink(NULL), _compressor(NULL), _websocket(NULL), _session(NULL),
+	  _extras(NULL), _hasSentPass(false), _hasSentNick(false), _hasSentUser(false), _isRegistered(false),
+	  _tlsHandshakeDone(false), _sendInFlight(false), _isServerLink(false), _linkConnecting(false),
+	  _isServerOperator(false), _capNegotiating(false), _publisher(false) {}
+
+Client::~Client()
+{
+	delete _compressor;
+	delete _websocket;
+	delete _session;
+	delete _extras;
+}
+
+ClientExtras &Client::extras()
+{
+	if (!_extras)
+		_extras = new ClientExtras();
+	return *_extras;
+}
+
+int Client::getFd() const
+{
+	return _fd;
+}
+
+const std::string &Client::getNickname() const
+{
+	return _nickname;
+}
+
+const std::string &Client::getUsername() const
+{
+	return _username.str();
+}
+
+bool Client::isRegistered() const
+{
+	return _isRegistered;
+}
+
+bool Client::hasSentPass() const
+{
+	return _hasSentPass;
+}
+
+bool Client::hasSentNick() const
+{
+	return _hasSentNick;
+}
+
+bool Client::hasSentUser() const
+{
+	return _hasSentUser;
+}
+
+void Client::setNickname(const std::string &nick)
+{
+	_nickname = nick;
+	_hasSentNick = true;
+	_maskVersion++;
+}
+
+void Client::setUsername(const std::string &user)
+{
+	_username = user;
+	_hasSentUser = true;
+	_maskVersion++;
+}
+
+void Client::setPassAccepted(bool ok)
+{
+	_hasSentPass = ok;
+}
+
+void Client::markRegistered()
+{
+	_isRegistered = true;
+}
+
+unsigned Client::getMaskVersion() const
+{
+	return _maskVersion;
+}
+
+std::string Client::getFullMask() const {
+	return _nickname + "!" + _username.str() + "@" + getHost();
+}
+
+const std::string& Client::getBuffer() const
+{
+    return _buffer;
+}
+
+void Client::setBuffer(const std::string& buffer)
+{
+    // Storage follows the partial line: none without one, and no capacity
+    // left over from a long line that has since been handled
+    if (buffer.empty())
+        std::string().swap(_buffer);
+    else if (_buffer.capacity() > 2 * buffer.size())
+        std::string(buffer).swap(_buffer);
+    else
+        _buffer = buffer;
+}
+
+SSL *Client::getSsl() const
+{
+	return _ssl;
+}
+
+void Client::setSsl(SSL *ssl)
+{
+	_ssl = ssl;
+	_tlsHandshakeDone = false;
+}
+
+bool Client::isTlsHandshaking() const
+{
+	return _ssl && !_tlsHandshakeDone;
+}
+
+void Client::markTlsHandshakeDone()
+{
+	_tlsHandshakeDone = true;
+}
+
+std::string &Client::getSendQueue()
+{
+	return _sendQueue;
+}
+
+size_t Client::pendingOutput() const
+{
+	return _sendQueue.size() + (_compressor ? _compressor->wireSize() : 0);
+}
+
+bool Client::isSendInFlight() const
+{
+	return _sendInFlight;
+}
+
+void Client::setSendInFlight(bool inFlight)
+{
+	_sendInFlight = inFlight;
+}
+
+const std::string &Client::getHostname() const
+{
+	return _hostname.str();
+}
+
+void Client::setHostname(const std::string &host)
+{
+	_hostname = host;
+	_maskVersion++;
+}
+
+const std::string &Client::getHost() const
+{
+	static const std::string serverHost = "ircserver";
+	return _hostname.empty() ? serverHost : _hostname.str();
+}
+
+const std::string &Client::getRealname() const
+{
+	return _realname;
+}
+
+void Client::setRealname(const std::string &realname)
+{
+	_realname = realname;
+}
+
+time_t Client::getSignonTime() const
+{
+	return _signonTime;
+}
+
+void Client::setSignonTime(time_t ts)
+{
+	_signonTime = ts;
+}
+
+const std::set<Channel *> &Client::getChannels() const
+{
+	return _channels;
+}
+
+void Client::addChannel(Channel *channel)
+{
+	_channels.insert(channel);
+}
+
+void Client::removeChannel(Channel *channel)
+{
+	_channels.erase(channel);
+}
+
+bool Client::isRemote() const
+{
+	return _uplink != NULL;
+}
+
+Client *Client::getUplink() const
+{
+	return _uplink;
+}
+
+void Client::setUplink(Client *link)
+{
+	_uplink = link;
+}
+
+bool Client::isServerLink() const
+{
+	return _isServerLink;
+}
+
+void Client::markServerLink()
+{
+	_isServerLink = true;
+	_linkConnecting = false;
+}
+
+const std::string &Client::getLinkName() const
+{
+	return _extras ? _extras->linkName : NONE;
+}
+
+void Client::setLinkName(const std::string &name)
+{
+	if (_extras || !name.empty())
+		extras().linkName = name;
+}
+
+bool Client::isLinkConnecting() const
+{
+	return _linkConnecting;
+}
+
+void Client::setLinkConnecting(bool connecting)
+{
+	_linkConnecting = connecting;
+}
+
+StreamCompressor *Client::getCompressor() const
+{
+	return _compressor;
+}
+
+void Client::setCompressor(StreamCompressor *compressor)
+{
+	delete _compressor;
+	_compressor = compressor;
+}
+
+WebSocket *Client::getWebSocket() const
+{
+	return _websocket;
+}
+
+void Client::setWebSocket(WebSocket *websocket)
+{
+	delete _websocket;
+	_websocket = websocket;
+}
+
+bool Client::isPublisher() const
+{
+	return _publisher;
+}
+
+void Client::markPublisher()
+{
+	_publisher = true;
+}
+
+ResumeSession *Client::getSession() const
+{
+	return _session;
+}
+
+void Client::setSession(ResumeSession *session)
+{
+	delete _session;
+	_session = session;
+}
+
+bool Client::isDetached() const
+{
+	return _session && _session->isDetached();
+}
+
+void Client::releaseConnection()
+{
+	_fd = -1;
+	_ssl = NULL;
+	_tlsHandshakeDone = false;
+	std::string().swap(_buffer);
+	std::string().swap(_sendQueue);
+	_sendInFlight = false;
+	_capNegotiating = false;
+	delete _compressor;
+	_compressor = NULL;
+	delete _websocket;
+	_websocket = NULL;
+}
+
+// Identity (nick, channels, account, ...) stays; the socket and everything
+// about the byte stream on it comes from `other`
+void Client::takeConnection(Client &other)
+{
+	std::swap(_fd, other._fd);
+	std::swap(_ssl, other._ssl);
+	_buffer.swap(other._buffer);
+	_sendQueue.swap(other._sendQueue);
+	std::swap(_lastActivity, other._lastActivity);
+	std::swap(_caps, other._caps);
+	// Bit-fields: no references to them, so no std::swap
+	bool handshakeDone = _tlsHandshakeDone, inFlight = _sendInFlight, negotiating = _capNegotiating;
+	_tlsHandshakeDone = other._tlsHandshakeDone;
+	_sendInFlight = other._sendInFlight;
+	_capNegotiating = other._capNegotiating;
+	other._tlsHandshakeDone = handshakeDone;
+	other._sendInFlight = inFlight;
+	other._capNegotiating = negotiating;
+	std::swap(_compressor, other._compressor);
+	std::swap(_websocket, other._websocket);
+}
+
+bool Client::isServerOperator() const
+{
+	return _isServerOperator;
+}
+
+void Client::setServerOperator(bool oper)
+{
+	_isServerOperator = oper;
+}
+
+bool Client::isCapNegotiating() const
+{
+	return _capNegotiating;
+}
+
+void Client::setCapNegotiating(bool negotiating)
+{
+	_capNegotiating = negotiating;
+}
+
+bool Client::hasCap(unsigned cap) const
+{
+	return (_caps & cap) != 0;
+}
+
+void Client::setCap(unsigned cap, bool enabled)
+{
+	if (enabled)
+		_caps |= cap;
+	else
+		_caps &= ~cap;
+}
+
+unsigned Client::getCaps() const
+{
+	return _caps;
+}
+
+const std::string &Client::getAccount() const
+{
+	return _extras ? _extras->account : NONE;
+}
+
+void Client::setAccount(const std::string &account)
+{
+	if (_extras || !account.empty())
+		extras().account = account;
+}
+
+SaslStep Client::getSaslStep() const
+{
+	return _extras ? _extras->saslStep : SASL_NONE;
+}
+
+void Client::setSaslStep(SaslStep step)
+{
+	if (_extras || step != SASL_NONE)
+		extras().saslStep = step;
+}
+
+std::string &Client::getSaslBuffer()
+{
+	return extras().saslBuffer;
+}
+
+unsigned long Client::getSaslSerial() const
+{
+	return _extras ? _extras->saslSerial : 0;
+}
+
+void Client::setSaslSerial(unsigned long serial)
+{
+	extras().saslSerial = serial;
+}
+
+time_t Client::getLastActivity() const
+{
+	return _lastActivity;
+}
+
+void Client::touch(time_t now)
+{
+	_lastActivity = now;
+}
+
+size_t ClientMemory::total() const
+{
+	return object + strings + recvBuffer + sendQueue + compression;
+}
+
+void Client::memoryUsage(ClientMemory &usage) const
+{
+	usage.object = sizeof(Client) + (_extras ? sizeof(ClientExtras) : 0);
+	usage.strings = MemoryStats::stringBytes(_nickname) + MemoryStats::stringBytes(_realname);
+	if (_extras)
+		usage.strings += MemoryStats::stringBytes(_extras->linkName) + MemoryStats::stringBytes(_extras->account) +
+						 MemoryStats::stringBytes(_extras->saslBuffer);
+	usage.recvBuffer = MemoryStats::stringBytes(_buffer) + (_websocket ? _websocket->memoryBytes() : 0);
+	usage.sendQueue = MemoryStats::stringBytes(_sendQueue);
+	usage.compression = _compressor ? _compressor->memoryBytes() : 0;
+}
+
+// Give back buffer capacity left over from a burst: strings keep their largest
+// size forever otherwise. A queue owned by an in-flight send is left alone.
+size_t Client::compactBuffers()
+{
+	size_t before = MemoryStats::stringBytes(_buffer) + MemoryStats::stringBytes(_sendQueue);
+	if (MemoryStats::stringBytes(_buffer) && _buffer.capacity() > _buffer.size() * 2)
+		std::string(_buffer).swap(_buffer);
+	if (!_sendInFlight && MemoryStats::stringBytes(_sendQueue) && _sendQueue.capacity() > _sendQueue.size() * 2)
+		std::string(_sendQueue).swap(_sendQueue);
+	size_t after = MemoryStats::stringBytes(_buffer) + MemoryStats::stringBytes(_sendQueue);
+	return before > after ? before - after : 0;
+}
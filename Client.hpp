@@ -1,40 +1,179 @@
-#ifndef CLIENT_HPP
-#define CLIENT_HPP
-
-#include <string>
-
-class Client
-{
-private:
-	int _fd;
-	std::string _nickname;
-	std::string _username;
-	std::string _hostname;
-	std::string _buffer;
-	bool _hasSentPass;
-	bool _hasSentNick;
-	bool _hasSentUser;
-	bool _isRegistered;
-
-public:
-	Client(int fd);
-	~Client();
-
-	int getFd() const;
-	const std::string &getNickname() const;
-	const std::string &getUsername() const;
-	bool isRegistered() const;
-	void setNickname(const std::string &nick);
-	void setUsername(const std::string &user);
-	void setPassAccepted(bool ok);
-	void markRegistered();
-	bool hasSentPass() const;
-	bool hasSentNick() const;
-	bool hasSentUser() const;
-	std::string getFullMask() const;
-
-	const std::string &getBuffer() const;
-	void setBuffer(const std::string &buffer);
-};
-
-#endif
+#ifndef CLIENT_HPP
+#define CLIENT_HPP
+
+#include <string>
+#include <set>
+#include <ctime>
+#include "TlsContext.hpp"
+#include "InternedString.hpp"
+
+class Channel;
+class StreamCompressor;
+class WebSocket;
+class ResumeSession;
+
+// Bytes held by one connection (see MemoryStats.hpp), reported by MEMSTATS
+struct ClientMemory
+{
+	size_t object;	   // the Client itself
+	size_t strings;	   // nick, realname, link name, account (user and host are interned)
+	size_t recvBuffer; // partial input line
+	size_t sendQueue;  // output not yet handed to the kernel
+	size_t compression; // zlib state and compressed output (COMPRESS)
+
+	size_t total() const;
+};
+
+// SASL exchange state (AUTHENTICATE)
+enum SaslStep
+{
+	SASL_NONE,	  // no exchange in progress
+	SASL_STARTED, // mechanism accepted, collecting the client's response
+	SASL_PENDING  // credentials are being checked on a worker thread
+};
+
+// Capabilities a client can enable with CAP REQ
+enum ClientCap
+{
+	CAP_SASL = 1,
+	CAP_RESUME = 2,		  // draft/resume-0.5
+	CAP_BATCH = 4,		  // CHATHISTORY replies come as a batch
+	CAP_SERVER_TIME = 8,  // replayed lines carry time=
+	CAP_MESSAGE_TAGS = 16 // replayed lines carry msgid=; tags on input are accepted
+};
+
+// Link and SASL state: only server links and clients authenticating with
+// SASL carry it, so it is allocated on first use
+struct ClientExtras;
+
+// An idle registered client should cost well under a kilobyte: values shared
+// by many users are interned, rarely used state lives in ClientExtras, flags
+// are single bits, and buffers hold storage only while they have content.
+class Client
+{
+private:
+	int _fd;
+	unsigned _maskVersion;		// Bumped whenever nick!user@host changes (ban cache key)
+	unsigned _caps;				// ClientCap bits enabled with CAP REQ
+	std::string _nickname;
+	InternedString _username;
+	InternedString _hostname;
+	std::string _realname;
+	std::string _buffer;		// Partial input line; no storage while none is pending
+	std::string _sendQueue;		// Outbound bytes not yet handed to the kernel
+	SSL *_ssl;					// NULL for plaintext connections
+	time_t _signonTime;			// Nick timestamp, older wins a collision between servers
+	time_t _lastActivity;		// Last time input arrived from this connection
+	Client *_uplink;			// Server link a remote user is reached through (NULL if local)
+	StreamCompressor *_compressor; // COMPRESS DEFLATE state, NULL for a plain stream
+	WebSocket *_websocket;		   // set for connections from a WebSocket listener
+	ResumeSession *_session;	   // set once a resume token was issued (CAP draft/resume-0.5)
+	ClientExtras *_extras;		   // NULL until a link name, account or SASL exchange needs it
+	std::set<Channel *> _channels; // joined; kept by Channel::addClient and removeClient
+	bool _hasSentPass : 1;
+	bool _hasSentNick : 1;
+	bool _hasSentUser : 1;
+	bool _isRegistered : 1;
+	bool _tlsHandshakeDone : 1;
+	bool _sendInFlight : 1;		// io_uring: a send for this client is pending
+	bool _isServerLink : 1;		// This connection is another ircserv instance
+	bool _linkConnecting : 1;	// Outbound link still waiting for connect() to finish
+	bool _isServerOperator : 1; // Authenticated with OPER
+	bool _capNegotiating : 1;	// CAP LS/REQ seen before registration: wait for CAP END
+	bool _publisher : 1;		// binary publish API connection, not an IRC user
+
+	ClientExtras &extras();
+
+public:
+	Client(int fd);
+	~Client();
+
+	int getFd() const;
+	const std::string &getNickname() const;
+	const std::string &getUsername() const;
+	bool isRegistered() const;
+	void setNickname(const std::string &nick);
+	void setUsername(const std::string &user);
+	void setPassAccepted(bool ok);
+	void markRegistered();
+	bool hasSentPass() const;
+	bool hasSentNick() const;
+	bool hasSentUser() const;
+	std::string getFullMask() const;
+	unsigned getMaskVersion() const;
+
+	const std::string &getBuffer() const;
+	void setBuffer(const std::string &buffer);
+
+	SSL *getSsl() const;
+	void setSsl(SSL *ssl);
+	bool isTlsHandshaking() const;
+	void markTlsHandshakeDone();
+
+	const std::string &getHostname() const;
+	void setHostname(const std::string &host);
+	const std::string &getHost() const; // hostname, or the server name while none is known
+	const std::string &getRealname() const;
+	void setRealname(const std::string &realname);
+	time_t getSignonTime() const;
+	void setSignonTime(time_t ts);
+
+	// Channel membership, as seen from the member (WHOIS)
+	const std::set<Channel *> &getChannels() const;
+	void addChannel(Channel *channel);
+	void removeChannel(Channel *channel);
+
+	// Server links
+	bool isRemote() const;
+	Client *getUplink() const;
+	void setUplink(Client *link);
+	bool isServerLink() const;
+	void markServerLink();
+	const std::string &getLinkName() const;
+	void setLinkName(const std::string &name);
+	bool isLinkConnecting() const;
+	void setLinkConnecting(bool connecting);
+
+	std::string &getSendQueue();
+	size_t pendingOutput() const; // queued text plus compressed bytes not yet written
+	StreamCompressor *getCompressor() const;
+	void setCompressor(StreamCompressor *compressor); // takes ownership
+	WebSocket *getWebSocket() const;
+	void setWebSocket(WebSocket *websocket); // takes ownership
+	bool isSendInFlight() const;
+	void setSendInFlight(bool inFlight);
+
+	bool isServerOperator() const;
+	void setServerOperator(bool oper);
+	bool isPublisher() const;
+	void markPublisher();
+
+	// Resumable sessions
+	ResumeSession *getSession() const;
+	void setSession(ResumeSession *session); // takes ownership
+	bool isDetached() const;				 // session kept without a connection
+	void releaseConnection();				 // the socket is gone: forget everything tied to it
+	void takeConnection(Client &other);		 // swap connections with a fresh client (RESUME)
+
+	// CAP / SASL
+	bool isCapNegotiating() const;
+	void setCapNegotiating(bool negotiating);
+	bool hasCap(unsigned cap) const;
+	void setCap(unsigned cap, bool enabled);
+	unsigned getCaps() const;
+	const std::string &getAccount() const;
+	void setAccount(const std::string &account);
+	SaslStep getSaslStep() const;
+	void setSaslStep(SaslStep step);
+	std::string &getSaslBuffer();
+	unsigned long getSaslSerial() const;
+	void setSaslSerial(unsigned long serial);
+
+	// Memory accounting
+	time_t getLastActivity() const;
+	void touch(time_t now);
+	void memoryUsage(ClientMemory &usage) const;
+	size_t compactBuffers();
+};
+
+#endif
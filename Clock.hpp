@@ -0,0 +1,18 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <ctime>
+
+// Time for measuring intervals (loop lag, benchmarks): CLOCK_MONOTONIC never
+// steps when the wall clock is set.
+namespace Clock
+{
+	inline long long monotonicNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+	}
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include "HistoryCommands.hpp"
+#include "Server.hpp"
+#include "Channel.hpp"
+#include "Client.hpp"
+#include "ChannelHistory.hpp"
+#include <sstream>
+#include <cstdlib>
+
+namespace HistoryCommands
+{
+    static void fail(Server *server, Client *client, const std::string &code, const std::string &rest)
+    {
+        server->sendToClient(client, ":ircserver FAIL CHATHISTORY " + code + " " + rest);
+    }
+
+    // Position of a timestamp=/msgid= reference. With after=true the position is just past it.
+    static bool resolveReference(ChannelHistory *history, const std::string &ref, bool after, size_t &pos)
+    {
+        if (ref.compare(0, 10, "timestamp=") == 0)
+        {
+            long long timeMs;
+            if (!ChannelHistory::parseTime(ref.substr(10), timeMs))
+                return false;
+            pos = history->lowerBoundTime(after ? timeMs + 1 : timeMs);
+            return true;
+        }
+        if (ref.compare(0, 6, "msgid=") == 0)
+        {
+            char *end = NULL;
+            unsigned long long msgid = std::strtoull(ref.c_str() + 6, &end, 10);
+            if (*end != '\0' || !history->findMsgid(msgid, pos))
+                return false;
+            if (after)
+                pos++;
+            return true;
+        }
+        return false;
+    }
+
+    // Replay [first, last). Each line is copied from the mapped log into the
+    // send queue: only the tag prefix is built per message, and only with the
+    // tags the client enabled (batch, server-time, message-tags).
+    static void sendBatch(Server *server, Client *client, ChannelHistory *history, const std::string &target,
+                          size_t first, size_t last)
+    {
+        static unsigned long batchCounter = 0;
+        std::ostringstream id;
+        if (client->hasCap(CAP_BATCH))
+        {
+            id << "h" << ++batchCounter;
+            server->sendToClient(client, ":ircserver BATCH +" + id.str() + " chathistory " + target);
+        }
+        for (size_t i = first; i < last; ++i)
+        {
+            const ChannelHistory::Entry &entry = history->entry(i);
+            std::ostringstream tags;
+            if (client->hasCap(CAP_BATCH))
+                tags << ";batch=" << id.str();
+            if (client->hasCap(CAP_SERVER_TIME))
+                tags << ";time=" << ChannelHistory::formatTime(entry.time);
+            if (client->hasCap(CAP_MESSAGE_TAGS))
+                tags << ";msgid=" << entry.msgid;
+            std::string prefix = tags.str();
+            if (!prefix.empty())
+                prefix = "@" + prefix.substr(1) + " ";
+            size_t length;
+            const char *payload = history->payload(i, length);
+
+            struct iovec parts[3];
+            parts[0].iov_base = const_cast<char *>(prefix.data());
+            parts[0].iov_len = prefix.size();
+            parts[1].iov_base = const_cast<char *>(payload);
+            parts[1].iov_len = length;
+            parts[2].iov_base = const_cast<char *>("\r\n");
+            parts[2].iov_len = 2;
+            server->sendParts(client, parts, 3);
+        }
+        if (client->hasCap(CAP_BATCH))
+            server->sendToClient(client, ":ircserver BATCH -" + id.str());
+    }
+
+    void handleChatHistoryCommand(Server *server, Client *client, const std::string &args)
+    {
+        if (!client->isRegistered())
+            return;
+
+        std::istringstream iss(args);
+        std::string subcommand, target, ref, ref2, limitStr;
+        iss >> subcommand >> target >> ref;
+        if (subcommand == "BETWEEN")
+            iss >> ref2;
+        iss >> limitStr;
+        for (size_t i = 0; i < subcommand.size(); ++i)
+            subcommand[i] = std::toupper(subcommand[i]);
+
+        long limit = std::atol(limitStr.c_str());
+        if (target.empty() || ref.empty() || limit <= 0)
+        {
+            fail(server, client, "NEED_MORE_PARAMS", subcommand + " :Missing parameters");
+            return;
+        }
+        if (limit > server->getConfig().historyMaxLimit)
+            limit = server->getConfig().historyMaxLimit;
+
+        Channel *channel = server->getChannel(target);
+        if (!channel || !channel->hasClient(client))
+        {
+            fail(server, client, "INVALID_TARGET", subcommand + " " + target + " :Messages could not be retrieved");
+            return;
+        }
+        ChannelHistory *history = server->historyFor(channel);
+        if (!history)
+        {
+            fail(server, client, "MESSAGE_ERROR", subcommand + " " + target + " :History is not available");
+            return;
+        }
+
+        size_t count = history->size();
+        size_t first = 0;
+        size_t last = 0;
+        bool ok = true;
+        if (subcommand == "LATEST")
+        {
+            size_t from = 0;
+            if (ref != "*")
+                ok = resolveReference(history, ref, true, from);
+            last = count;
+            first = count - from > static_cast<size_t>(limit) ? count - limit : from;
+        }
+        else if (subcommand == "BEFORE")
+        {
+            ok = resolveReference(history, ref, false, last);
+            first = last > static_cast<size_t>(limit) ? last - limit : 0;
+        }
+        else if (subcommand == "AFTER")
+        {
+            ok = resolveReference(history, ref, true, first);
+            last = std::min(count, first + limit);
+        }
+        else if (subcommand == "AROUND")
+        {
+            size_t center;
+            ok = resolveReference(history, ref, false, center);
+            first = center > static_cast<size_t>(limit / 2) ? center - limit / 2 : 0;
+            last = std::min(count, first + limit);
+        }
+        else if (subcommand == "BETWEEN")
+        {
+            // Bounds are exclusive; when the first one is the later, the newest messages are kept
+            size_t p1, p2;
+            ok = resolveReference(history, ref, false, p1) && resolveReference(history, ref2, false, p2);
+            bool forward = ok && p1 <= p2;
+            size_t lo, hi;
+            ok = ok && resolveReference(history, forward ? ref : ref2, true, lo) &&
+                 resolveReference(history, forward ? ref2 : ref, false, hi);
+            if (ok && forward)
+            {
+                first = lo;
+                last = std::min(hi, lo + limit);
+            }
+            else if (ok)
+            {
+                last = hi;
+                first = hi > lo + limit ? hi - limit : lo;
+            }
+        }
+        else
+        {
+            fail(server, client, "INVALID_PARAMS", subcommand + " :Unknown subcommand");
+            return;
+        }
+        if (!ok)
+        {
+            fail(server, client, "INVALID_PARAMS", subcommand + " " + ref + " :Invalid message reference");
+            return;
+        }
+        if (first > last)
+            first = last;
+        sendBatch(server, client, history, target, first, last);
+    }
+}
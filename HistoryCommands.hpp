@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+class Client;
+class Server;
+
+namespace HistoryCommands
+{
+    void handleChatHistoryCommand(Server *server, Client *client, const std::string &args);
+}
@@ -0,0 +1,750 @@
+#include "Server.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// Hot restart: the running process forks and execs the (possibly upgraded)
+// binary with one end of a socketpair as fd 3. The old process serializes its
+// state, passes every listening and client socket over SCM_RIGHTS, waits for
+// the new process to acknowledge, then exits. Connected users see nothing.
+//
+// Wire format on the socketpair:
+//   [u32 snapshot length][u32 fd count][snapshot bytes]
+//   then the fds in batches, one dummy byte per sendmsg
+// and a single '1' byte back from the new process once it has taken over.
+
+namespace
+{
+	const char SNAPSHOT_MAGIC[8] = {'I', 'R', 'C', 'S', 'N', 'A', 'P', 'B'};
+	const size_t FDS_PER_MESSAGE = 200;
+	const int HANDOVER_TIMEOUT_MS = 10000;
+	const int DRAIN_TIMEOUT_MS = 1000;
+
+	// Closes every descriptor from 'first' up, however many clients there are:
+	// close_range() where the kernel has it, otherwise up to RLIMIT_NOFILE
+	void closeFrom(int first)
+	{
+#ifdef SYS_close_range
+		if (syscall(SYS_close_range, first, ~0U, 0) == 0)
+			return;
+#endif
+		struct rlimit limit;
+		long last = 1 << 20;
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+			last = limit.rlim_cur;
+		for (long fd = first; fd < last; ++fd)
+			close(fd);
+	}
+
+	enum ClientFlags
+	{
+		FLAG_PASS = 1,
+		FLAG_NICK = 2,
+		FLAG_USER = 4,
+		FLAG_REGISTERED = 8,
+		FLAG_SERVER_LINK = 16,
+		FLAG_SERVER_OPERATOR = 32,
+		FLAG_CAP_NEGOTIATING = 64,
+		FLAG_CAP_SASL = 128
+	};
+
+	enum MemberRef
+	{
+		REF_LOCAL,
+		REF_REMOTE,
+		REF_DETACHED
+	};
+
+	class SnapshotWriter
+	{
+	private:
+		std::string &_out;
+
+	public:
+		SnapshotWriter(std::string &out) : _out(out) {}
+
+		void put8(unsigned char v) { _out += static_cast<char>(v); }
+		void put32(unsigned int v)
+		{
+			for (int i = 0; i < 4; ++i)
+				_out += static_cast<char>((v >> (8 * i)) & 0xFF);
+		}
+		void put64(long long v)
+		{
+			unsigned long long u = static_cast<unsigned long long>(v);
+			for (int i = 0; i < 8; ++i)
+				_out += static_cast<char>((u >> (8 * i)) & 0xFF);
+		}
+		void putString(const std::string &s)
+		{
+			put32(s.size());
+			_out += s;
+		}
+	};
+
+	class SnapshotReader
+	{
+	private:
+		const std::string &_in;
+		size_t _pos;
+		bool _ok;
+
+		bool need(size_t n)
+		{
+			if (_pos + n > _in.size())
+				_ok = false;
+			return _ok;
+		}
+
+	public:
+		SnapshotReader(const std::string &in) : _in(in), _pos(0), _ok(true) {}
+
+		bool ok() const { return _ok; }
+		unsigned char get8()
+		{
+			if (!need(1))
+				return 0;
+			return static_cast<unsigned char>(_in[_pos++]);
+		}
+		unsigned int get32()
+		{
+			if (!need(4))
+				return 0;
+			unsigned int v = 0;
+			for (int i = 0; i < 4; ++i)
+				v |= static_cast<unsigned int>(static_cast<unsigned char>(_in[_pos++])) << (8 * i);
+			return v;
+		}
+		long long get64()
+		{
+			if (!need(8))
+				return 0;
+			unsigned long long v = 0;
+			for (int i = 0; i < 8; ++i)
+				v |= static_cast<unsigned long long>(static_cast<unsigned char>(_in[_pos++])) << (8 * i);
+			return static_cast<long long>(v);
+		}
+		std::string getString()
+		{
+			unsigned int n = get32();
+			if (!need(n))
+				return std::string();
+			std::string s = _in.substr(_pos, n);
+			_pos += n;
+			return s;
+		}
+		bool getMagic()
+		{
+			if (!need(sizeof(SNAPSHOT_MAGIC)) || _in.compare(_pos, sizeof(SNAPSHOT_MAGIC), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+				return _ok = false;
+			_pos += sizeof(SNAPSHOT_MAGIC);
+			return true;
+		}
+	};
+
+	bool writeAll(int fd, const char *data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t n = write(fd, data, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	bool readAll(int fd, char *data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t n = read(fd, data, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			data += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	bool sendFds(int sock, const std::vector<int> &fds)
+	{
+		for (size_t start = 0; start < fds.size(); start += FDS_PER_MESSAGE)
+		{
+			size_t count = std::min(FDS_PER_MESSAGE, fds.size() - start);
+			std::vector<char> control(CMSG_SPACE(count * sizeof(int)), 0);
+			char dummy = 'F';
+			struct iovec iov = {&dummy, 1};
+			struct msghdr msg;
+			std::memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = &control[0];
+			msg.msg_controllen = control.size();
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+			std::memcpy(CMSG_DATA(cmsg), &fds[start], count * sizeof(int));
+			if (sendmsg(sock, &msg, 0) != 1)
+				return false;
+		}
+		return true;
+	}
+
+	bool recvFds(int sock, size_t total, std::vector<int> &fds)
+	{
+		while (fds.size() < total)
+		{
+			size_t count = std::min(FDS_PER_MESSAGE, total - fds.size());
+			std::vector<char> control(CMSG_SPACE(count * sizeof(int)), 0);
+			char dummy;
+			struct iovec iov = {&dummy, 1};
+			struct msghdr msg;
+			std::memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = &control[0];
+			msg.msg_controllen = control.size();
+			if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1)
+				return false;
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+				return false;
+			size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			size_t first = fds.size();
+			fds.resize(first + received);
+			std::memcpy(&fds[first], CMSG_DATA(cmsg), received * sizeof(int));
+		}
+		return true;
+	}
+
+	long long elapsedMs(const struct timeval &since)
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		return (now.tv_sec - since.tv_sec) * 1000LL + (now.tv_usec - since.tv_usec) / 1000;
+	}
+}
+
+// Everything a new process needs to carry on: listeners, local connections with
+// their unread input and unsent output, the remote part of the network, channels.
+// Fds are referenced by their position in `fds`, the order they are passed in.
+void Server::writeSnapshot(std::string &out, std::vector<int> &fds)
+{
+	std::map<Client *, unsigned> index;
+	SnapshotWriter w(out);
+	out.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+
+	w.put32(_listeners.size());
+	for (size_t i = 0; i < _listeners.size(); ++i)
+	{
+		w.put32(fds.size());
+		w.put32(_listeners[i].port);
+		w.put8(_listeners[i].kind);
+		w.putString(_listeners[i].host);
+		fds.push_back(_listeners[i].fd);
+	}
+
+	w.put32(_clients.size());
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		Client *c = it->second;
+		index[c] = fds.size();
+		w.put32(fds.size());
+		fds.push_back(it->first);
+		w.putString(c->getNickname());
+		w.putString(c->getUsername());
+		w.putString(c->getHostname());
+		w.putString(c->getRealname());
+		w.put8((c->hasSentPass() ? FLAG_PASS : 0) | (c->hasSentNick() ? FLAG_NICK : 0) |
+			   (c->hasSentUser() ? FLAG_USER : 0) | (c->isRegistered() ? FLAG_REGISTERED : 0) |
+			   (c->isServerLink() ? FLAG_SERVER_LINK : 0) | (c->isServerOperator() ? FLAG_SERVER_OPERATOR : 0) |
+			   (c->isCapNegotiating() ? FLAG_CAP_NEGOTIATING : 0) | (c->hasCap(CAP_SASL) ? FLAG_CAP_SASL : 0));
+		w.putString(c->getAccount());
+		w.put64(c->getSignonTime());
+		w.putString(c->getLinkName());
+		// LIST/WHO still deferred for overload go back in front of the unread input
+		std::string input;
+		for (std::deque<std::pair<int, std::string> >::iterator d = _deferredCommands.begin();
+			 d != _deferredCommands.end(); ++d)
+		{
+			if (d->first == it->first)
+				input += d->second + "\r\n";
+		}
+		w.putString(input + c->getBuffer());
+		w.putString(c->getSendQueue());
+		w.putString(c->getWebSocket() ? c->getWebSocket()->serialize() : "");
+		w.put8(c->isPublisher());
+		const MonitorIndex::Targets *monitored = _monitorIndex.targetsOf(c);
+		w.put32(monitored ? monitored->size() : 0);
+		if (monitored)
+		{
+			for (MonitorIndex::Targets::const_iterator m = monitored->begin(); m != monitored->end(); ++m)
+				w.putString(*m);
+		}
+		w.put32(c->getCaps());
+		w.putString(c->getSession() ? c->getSession()->serialize() : "");
+	}
+
+	// Sessions waiting for RESUME have no connection to hand over, only state
+	std::vector<Client *> detached;
+	for (std::map<std::string, Client *>::iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+	{
+		if (it->second->isDetached())
+			detached.push_back(it->second);
+	}
+	w.put32(detached.size());
+	for (size_t i = 0; i < detached.size(); ++i)
+	{
+		Client *c = detached[i];
+		w.putString(c->getNickname());
+		w.putString(c->getUsername());
+		w.putString(c->getHostname());
+		w.putString(c->getRealname());
+		w.put8(c->isServerOperator());
+		w.putString(c->getAccount());
+		w.put64(c->getSignonTime());
+		w.putString(c->getSession()->serialize());
+		const MonitorIndex::Targets *monitored = _monitorIndex.targetsOf(c);
+		w.put32(monitored ? monitored->size() : 0);
+		if (monitored)
+		{
+			for (MonitorIndex::Targets::const_iterator m = monitored->begin(); m != monitored->end(); ++m)
+				w.putString(*m);
+		}
+	}
+
+	w.put32(_remoteServers.size());
+	for (std::map<std::string, Client *>::iterator it = _remoteServers.begin(); it != _remoteServers.end(); ++it)
+	{
+		w.putString(it->first);
+		w.put32(index[it->second]);
+	}
+
+	w.put32(_remoteClients.size());
+	for (std::map<std::string, Client *>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+	{
+		Client *c = it->second;
+		w.putString(c->getNickname());
+		w.putString(c->getUsername());
+		w.putString(c->getHostname());
+		w.putString(c->getRealname());
+		w.put64(c->getSignonTime());
+		w.put32(index[c->getUplink()]);
+	}
+
+	w.put32(_channels.size());
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		Channel *channel = it->second;
+		w.putString(channel->getName());
+		w.putString(channel->getTopic());
+		w.putString(channel->getKey());
+		w.put64(channel->getUserLimit());
+		w.put8((channel->isInviteOnly() ? 1 : 0) | (channel->isTopicProtected() ? 2 : 0));
+		w.put64(channel->getCreationTime());
+		w.put64(channel->getTopicTime());
+		for (const char *list = "be"; *list; ++list)
+		{
+			const std::vector<MaskEntry> &entries = channel->getMasks(*list);
+			w.put32(entries.size());
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				w.putString(entries[i].mask);
+				w.putString(entries[i].setter);
+				w.put64(entries[i].when);
+			}
+		}
+
+		const std::set<Client *> *lists[2] = {&channel->getClients(), &channel->getInvited()};
+		for (int l = 0; l < 2; ++l)
+		{
+			w.put32(lists[l]->size());
+			for (std::set<Client *>::const_iterator m = lists[l]->begin(); m != lists[l]->end(); ++m)
+			{
+				if ((*m)->isRemote())
+				{
+					w.put8(REF_REMOTE);
+					w.putString((*m)->getNickname());
+				}
+				else if ((*m)->isDetached())
+				{
+					w.put8(REF_DETACHED);
+					w.putString((*m)->getSession()->getToken());
+				}
+				else
+				{
+					w.put8(REF_LOCAL);
+					w.put32(index[*m]);
+				}
+				w.put8(channel->isOperator(*m));
+			}
+		}
+	}
+
+	w.put32(_nextFilterId);
+	w.put32(_filterRules.size());
+	for (std::map<unsigned long, FilterRule>::const_iterator it = _filterRules.begin(); it != _filterRules.end(); ++it)
+	{
+		w.put32(it->first);
+		w.put8(it->second.action);
+		w.put64(it->second.hits);
+		w.putString(it->second.phrase);
+	}
+}
+
+bool Server::restoreSnapshot(int fd)
+{
+	unsigned int header[2];
+	std::string snapshot;
+	std::vector<int> fds;
+	if (!readAll(fd, reinterpret_cast<char *>(header), sizeof(header)))
+		return false;
+	snapshot.resize(header[0]);
+	if ((header[0] && !readAll(fd, &snapshot[0], header[0])) || !recvFds(fd, header[1], fds))
+		return false;
+
+	SnapshotReader r(snapshot);
+	if (!r.getMagic())
+		return false;
+
+	unsigned int count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		unsigned int idx = r.get32();
+		Listener listener;
+		listener.port = r.get32();
+		listener.kind = static_cast<ListenerKind>(r.get8());
+		listener.host = r.getString();
+		if (idx >= fds.size())
+			return false;
+		listener.fd = fds[idx];
+		_listeners.push_back(listener);
+	}
+
+	std::map<unsigned, Client *> local;
+	count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		unsigned int idx = r.get32();
+		if (idx >= fds.size())
+			return false;
+		Client *client = new Client(fds[idx]);
+		local[idx] = client;
+		_clients[fds[idx]] = client;
+		_pollFds.push_back(pollEntry(fds[idx], POLLIN));
+
+		std::string nick = r.getString();
+		std::string user = r.getString();
+		client->setHostname(r.getString());
+		client->setRealname(r.getString());
+		unsigned char flags = r.get8();
+		if (flags & FLAG_NICK)
+			client->setNickname(nick);
+		if (flags & FLAG_USER)
+			client->setUsername(user);
+		client->setPassAccepted(flags & FLAG_PASS);
+		client->setServerOperator(flags & FLAG_SERVER_OPERATOR);
+		client->setCapNegotiating(flags & FLAG_CAP_NEGOTIATING);
+		client->setCap(CAP_SASL, flags & FLAG_CAP_SASL);
+		client->setAccount(r.getString());
+		if (flags & FLAG_REGISTERED)
+		{
+			client->markRegistered();
+			_userIndex.add(client);
+		}
+		client->setSignonTime(r.get64());
+		client->setLinkName(r.getString());
+		if (flags & FLAG_SERVER_LINK)
+		{
+			client->markServerLink();
+			_links[client->getLinkName()] = client;
+		}
+		client->setBuffer(r.getString());
+		if (client->getBuffer().find('\n') != std::string::npos)
+			_inputBacklog.insert(fds[idx]);
+		client->getSendQueue() = r.getString();
+		std::string websocket = r.getString();
+		if (!websocket.empty())
+		{
+			client->setWebSocket(new WebSocket());
+			if (!client->getWebSocket()->restore(websocket))
+				return false;
+		}
+		if (r.get8())
+			client->markPublisher();
+		unsigned int monitored = r.get32();
+		for (unsigned int m = 0; m < monitored && r.ok(); ++m)
+			_monitorIndex.add(client, r.getString());
+		client->setCap(r.get32(), true);
+		if (!restoreSession(client, r.getString()))
+			return false;
+	}
+
+	count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		Client *client = new Client(-1);
+		client->setNickname(r.getString());
+		client->setUsername(r.getString());
+		client->setHostname(r.getString());
+		client->setRealname(r.getString());
+		client->setServerOperator(r.get8());
+		client->setAccount(r.getString());
+		client->setPassAccepted(true);
+		client->markRegistered();
+		client->setSignonTime(r.get64());
+		std::string session = r.getString();
+		if (!restoreSession(client, session) || !client->isDetached())
+		{
+			delete client;
+			return false;
+		}
+		_userIndex.add(client);
+		unsigned int monitored = r.get32();
+		for (unsigned int m = 0; m < monitored && r.ok(); ++m)
+			_monitorIndex.add(client, r.getString());
+	}
+
+	count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		std::string name = r.getString();
+		_remoteServers[name] = local[r.get32()];
+	}
+
+	count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		Client *remote = new Client(-1);
+		remote->setNickname(r.getString());
+		remote->setUsername(r.getString());
+		remote->setHostname(r.getString());
+		remote->setRealname(r.getString());
+		remote->setSignonTime(r.get64());
+		remote->setUplink(local[r.get32()]);
+		remote->markRegistered();
+		_remoteClients[remote->getNickname()] = remote;
+		_userIndex.add(remote);
+	}
+
+	count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		Channel *channel = createChannel(r.getString());
+		std::string topic = r.getString();
+		if (!topic.empty())
+			channel->setTopic(topic);
+		channel->setKey(r.getString());
+		channel->setUserLimit(r.get64());
+		unsigned char modes = r.get8();
+		channel->setInviteOnly(modes & 1);
+		channel->setTopicProtected(modes & 2);
+		channel->setCreationTime(r.get64());
+		channel->setTopicTime(r.get64());
+		for (const char *list = "be"; *list; ++list)
+		{
+			unsigned int entries = r.get32();
+			for (unsigned int e = 0; e < entries && r.ok(); ++e)
+			{
+				std::string mask = r.getString();
+				std::string setter = r.getString();
+				channel->addMask(*list, mask, setter, r.get64());
+			}
+		}
+
+		for (int l = 0; l < 2; ++l)
+		{
+			unsigned int members = r.get32();
+			for (unsigned int m = 0; m < members && r.ok(); ++m)
+			{
+				Client *member = NULL;
+				unsigned char ref = r.get8();
+				if (ref == REF_REMOTE || ref == REF_DETACHED)
+				{
+					std::map<std::string, Client *> &named = ref == REF_REMOTE ? _remoteClients : _sessions;
+					std::map<std::string, Client *>::iterator it = named.find(r.getString());
+					if (it != named.end())
+						member = it->second;
+				}
+				else
+					member = local[r.get32()];
+				bool op = r.get8();
+				if (!member)
+					continue;
+				if (l == 1)
+					channel->addInvited(member);
+				else
+				{
+					channel->addClient(member);
+					if (op)
+						channel->addOperator(member);
+				}
+			}
+		}
+	}
+	_nextFilterId = r.get32();
+	count = r.get32();
+	for (unsigned int i = 0; i < count && r.ok(); ++i)
+	{
+		FilterRule rule;
+		rule.id = r.get32();
+		rule.action = static_cast<FilterAction>(r.get8() % (FILTER_KILL + 1));
+		rule.hits = r.get64();
+		rule.phrase = r.getString();
+		_filterRules[rule.id] = rule;
+	}
+	if (!r.ok())
+		return false;
+	if (!_filterRules.empty())
+		rebuildFilter(true);
+
+	char ack = '1';
+	if (!writeAll(fd, &ack, 1))
+		return false;
+	close(fd);
+	std::cout << "♻️  Resumed " << _clients.size() << " connection(s) and " << _channels.size()
+			  << " channel(s) from the previous process" << std::endl;
+	return true;
+}
+
+bool Server::restoreSession(Client *client, const std::string &state)
+{
+	if (state.empty())
+		return true;
+	ResumeSession *session = new ResumeSession("", _config.resumeBuffer);
+	client->setSession(session);
+	if (!session->restore(state))
+		return false;
+	_sessions[session->getToken()] = client;
+	return true;
+}
+
+void Server::hotRestart()
+{
+	std::cout << "♻️  Hot restart requested" << std::endl;
+
+	// TLS session state lives inside OpenSSL and zlib streams inside zlib, neither
+	// can be handed over; those clients (and links still connecting) leave
+	// cleanly and reconnect.
+	std::vector<int> dropped;
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		Client *c = it->second;
+		if (c->getSsl() || c->getCompressor() || c->isLinkConnecting() || (!c->getLinkName().empty() && !c->isServerLink()))
+			dropped.push_back(it->first);
+	}
+	for (size_t i = 0; i < dropped.size(); ++i)
+	{
+		if (_clients.count(dropped[i]))
+		{
+			sendToClient(_clients[dropped[i]], "ERROR :Server restarting, please reconnect");
+			disconnectClient(dropped[i]);
+		}
+	}
+
+	// SASL checks still on the worker threads finish and are applied first: their
+	// state (the pending serial) is not part of the snapshot
+	_workers.waitIdle();
+	processWorkerResults();
+	// Nor are deliveries to large channels still in progress: finish them
+	while (!_fanout.empty())
+		pumpFanout();
+
+	// io_uring keeps reading into provided buffers on its own: stop it and let
+	// every outstanding completion land before the state is written down
+	if (_useUring)
+	{
+		struct timeval start;
+		gettimeofday(&start, NULL);
+		std::vector<IoEvent> events;
+		_uring.pause();
+		flushQueuedSends();
+		while (!_uring.idle() && elapsedMs(start) < DRAIN_TIMEOUT_MS)
+		{
+			if (_uring.wait(events, 100) < 0)
+				break;
+			for (size_t i = 0; i < events.size(); ++i)
+				handleIoEvent(events[i]);
+			flushQueuedSends();
+		}
+	}
+
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+	{
+		perror("socketpair");
+		if (_useUring)
+			_uring.resume();
+		return;
+	}
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		close(pair[0]);
+		close(pair[1]);
+		if (_useUring)
+			_uring.resume();
+		return;
+	}
+	if (pid == 0)
+	{
+		if (pair[1] != 3)
+		{
+			dup2(pair[1], 3);
+			close(pair[1]);
+		}
+		closeFrom(4);
+		std::vector<std::string> args(_config.execArgs);
+		args.push_back("--resume-fd=3");
+		std::vector<char *> argv;
+		for (size_t i = 0; i < args.size(); ++i)
+			argv.push_back(const_cast<char *>(args[i].c_str()));
+		argv.push_back(NULL);
+		execv(_config.execPath.c_str(), &argv[0]);
+		perror("execv");
+		_exit(127);
+	}
+	close(pair[1]);
+
+	std::string snapshot;
+	std::vector<int> fds;
+	writeSnapshot(snapshot, fds);
+	unsigned int header[2] = {static_cast<unsigned int>(snapshot.size()), static_cast<unsigned int>(fds.size())};
+	bool sent = writeAll(pair[0], reinterpret_cast<char *>(header), sizeof(header)) &&
+				writeAll(pair[0], snapshot.data(), snapshot.size()) && sendFds(pair[0], fds);
+
+	char ack = 0;
+	struct pollfd reply = {pair[0], POLLIN, 0};
+	if (sent && poll(&reply, 1, HANDOVER_TIMEOUT_MS) == 1 && read(pair[0], &ack, 1) == 1 && ack == '1')
+	{
+		// The new process owns every socket now: leave without running destructors
+		// that would close or shut them down
+		std::cout << "♻️  Handed over to pid " << pid << std::endl;
+		_exit(0);
+	}
+
+	std::cerr << "Hot restart failed, keeping the current process" << std::endl;
+	close(pair[0]);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	if (_useUring)
+		_uring.resume();
+}
@@ -0,0 +1,73 @@
+#include "InternedString.hpp"
+#include "MemoryStats.hpp"
+
+InternedString::Pool &InternedString::pool()
+{
+	static Pool values;
+	return values;
+}
+
+InternedString::InternedString() : _entry(NULL) {}
+
+InternedString::InternedString(const InternedString &other) : _entry(other._entry)
+{
+	if (_entry)
+		++_entry->second;
+}
+
+InternedString::~InternedString()
+{
+	release();
+}
+
+void InternedString::release()
+{
+	if (_entry && --_entry->second == 0)
+		pool().erase(pool().find(_entry->first));
+	_entry = NULL;
+}
+
+InternedString &InternedString::operator=(const InternedString &other)
+{
+	if (other._entry)
+		++other._entry->second;
+	release();
+	_entry = other._entry;
+	return *this;
+}
+
+InternedString &InternedString::operator=(const std::string &value)
+{
+	if (_entry && _entry->first == value)
+		return *this;
+	release();
+	if (value.empty())
+		return *this;
+	_entry = &*pool().insert(std::make_pair(value, 0UL)).first;
+	++_entry->second;
+	return *this;
+}
+
+const std::string &InternedString::str() const
+{
+	static const std::string none;
+	return _entry ? _entry->first : none;
+}
+
+bool InternedString::empty() const
+{
+	return _entry == NULL;
+}
+
+size_t InternedString::poolSize()
+{
+	return pool().size();
+}
+
+size_t InternedString::memoryBytes()
+{
+	size_t bytes = MemoryStats::mapBytes(pool());
+	for (Pool::const_iterator it = pool().begin(); it != pool().end(); ++it)
+		bytes += MemoryStats::stringBytes(it->first);
+	return bytes;
+}
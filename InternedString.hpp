@@ -0,0 +1,35 @@
+#ifndef INTERNEDSTRING_HPP
+#define INTERNEDSTRING_HPP
+
+#include <string>
+#include <map>
+
+// A string kept once for every holder of the same value: thousands of users
+// behind one bouncer or NAT share a username and a host, and each of them
+// holds a pointer instead of a copy. Entries are reference counted and leave
+// the pool with their last holder. Main thread only, like the clients.
+class InternedString
+{
+private:
+	typedef std::map<std::string, unsigned long> Pool;
+
+	Pool::value_type *_entry; // NULL for the empty string
+
+	static Pool &pool();
+	void release();
+
+public:
+	InternedString();
+	InternedString(const InternedString &other);
+	~InternedString();
+	InternedString &operator=(const InternedString &other);
+	InternedString &operator=(const std::string &value);
+
+	const std::string &str() const;
+	bool empty() const;
+
+	static size_t poolSize();	 // distinct values held
+	static size_t memoryBytes(); // the pool itself, for MEMSTATS
+};
+
+#endif
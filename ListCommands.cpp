@@ -0,0 +1,217 @@
+#include "ListCommands.hpp"
+#include "ReplyStream.hpp"
+#include "Server.hpp"
+#include "Channel.hpp"
+#include "Client.hpp"
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+#include <ctime>
+#include <vector>
+
+namespace ListCommands
+{
+    // Index entries examined per chunk, so filters that reject almost every
+    // channel still hand control back to the loop regularly
+    static const size_t MAX_SCAN_PER_CHUNK = 4096;
+
+    // ELIST filters, all of which must hold (U, M, N, C and T)
+    struct ListFilter
+    {
+        size_t minUsers;
+        size_t maxUsers;
+        time_t createdAfter;  // 0 = no bound
+        time_t createdBefore;
+        time_t topicAfter;
+        time_t topicBefore;
+        std::vector<std::string> masks;   // at least one must match (if any)
+        std::vector<std::string> exclude; // !mask: none may match
+        std::vector<std::string> names;   // plain names are looked up directly
+
+        ListFilter() : minUsers(0), maxUsers(static_cast<size_t>(-1)), createdAfter(0), createdBefore(0),
+                       topicAfter(0), topicBefore(0) {}
+    };
+
+    // '*' matches any run of characters, '?' exactly one
+    bool matchMask(const std::string &mask, const std::string &name)
+    {
+        size_t m = 0, n = 0;
+        size_t starMask = std::string::npos, starName = 0;
+        while (n < name.size())
+        {
+            if (m < mask.size() && (mask[m] == '?' || std::tolower(mask[m]) == std::tolower(name[n])))
+            {
+                m++;
+                n++;
+            }
+            else if (m < mask.size() && mask[m] == '*')
+            {
+                starMask = m++;
+                starName = n;
+            }
+            else if (starMask != std::string::npos)
+            {
+                m = starMask + 1;
+                n = ++starName;
+            }
+            else
+                return false;
+        }
+        while (m < mask.size() && mask[m] == '*')
+            m++;
+        return m == mask.size();
+    }
+
+    static bool parseMinutes(const std::string &text, time_t now, time_t &when)
+    {
+        char *end = NULL;
+        long minutes = std::strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || minutes < 0)
+            return false;
+        when = now - minutes * 60;
+        return true;
+    }
+
+    static void parseFilter(const std::string &param, ListFilter &filter)
+    {
+        time_t now = time(NULL);
+        std::stringstream ss(param);
+        std::string token;
+        while (std::getline(ss, token, ','))
+        {
+            if (token.empty())
+                continue;
+            char *end = NULL;
+            if (token[0] == '>' || token[0] == '<')
+            {
+                long n = std::strtol(token.c_str() + 1, &end, 10);
+                if (token.size() == 1 || *end != '\0' || n < 0)
+                    continue;
+                if (token[0] == '>')
+                    filter.minUsers = n + 1;
+                else if (n == 0)
+                    filter.minUsers = 1, filter.maxUsers = 0;
+                else
+                    filter.maxUsers = n - 1;
+            }
+            else if ((token[0] == 'C' || token[0] == 'T') && token.size() > 2 && (token[1] == '<' || token[1] == '>'))
+            {
+                // C<n / T<n: created / topic set less than n minutes ago, > for more than
+                time_t when;
+                if (!parseMinutes(token.substr(2), now, when))
+                    continue;
+                time_t &bound = token[0] == 'C' ? (token[1] == '<' ? filter.createdAfter : filter.createdBefore)
+                                                : (token[1] == '<' ? filter.topicAfter : filter.topicBefore);
+                bound = when;
+            }
+            else if (token[0] == '!')
+                filter.exclude.push_back(token.substr(1));
+            else if (token.find_first_of("*?") != std::string::npos)
+                filter.masks.push_back(token);
+            else
+                filter.names.push_back(token);
+        }
+    }
+
+    class ListStream : public ReplyStream
+    {
+    private:
+        ListFilter _filter;
+        std::pair<size_t, std::string> _cursor; // last index entry visited, walking from the largest channel down
+        size_t _nextName;
+
+        bool accepts(Channel *channel) const
+        {
+            size_t users = channel->getClients().size();
+            if (users < _filter.minUsers || users > _filter.maxUsers)
+                return false;
+            if ((_filter.createdAfter && channel->getCreationTime() <= _filter.createdAfter) ||
+                (_filter.createdBefore && channel->getCreationTime() >= _filter.createdBefore))
+                return false;
+            if ((_filter.topicAfter || _filter.topicBefore) && !channel->hasTopic())
+                return false;
+            if ((_filter.topicAfter && channel->getTopicTime() <= _filter.topicAfter) ||
+                (_filter.topicBefore && channel->getTopicTime() >= _filter.topicBefore))
+                return false;
+            bool matched = _filter.masks.empty();
+            for (size_t i = 0; i < _filter.masks.size() && !matched; ++i)
+                matched = matchMask(_filter.masks[i], channel->getName());
+            for (size_t i = 0; i < _filter.exclude.size() && matched; ++i)
+                matched = !matchMask(_filter.exclude[i], channel->getName());
+            return matched;
+        }
+
+        static void sendEntry(Server *server, Client *client, Channel *channel)
+        {
+            std::ostringstream entry;
+            entry << "322 " << client->getNickname() << " " << channel->getName() << " "
+                  << channel->getClients().size() << " :" << channel->getTopic();
+            server->sendToClient(client, entry.str());
+        }
+
+    public:
+        ListStream(const ListFilter &filter) : _filter(filter), _nextName(0)
+        {
+            // Channels above the maximum are never visited
+            if (_filter.maxUsers == static_cast<size_t>(-1))
+                _cursor = std::make_pair(_filter.maxUsers, std::string());
+            else
+                _cursor = std::make_pair(_filter.maxUsers + 1, std::string());
+        }
+
+        bool produce(Server *server, Client *client, size_t budget)
+        {
+            std::string &queue = client->getSendQueue();
+            size_t limit = queue.size() + budget;
+            if (!_filter.names.empty())
+            {
+                while (_nextName < _filter.names.size() && queue.size() < limit)
+                {
+                    Channel *channel = server->getChannel(_filter.names[_nextName++]);
+                    if (channel && accepts(channel))
+                        sendEntry(server, client, channel);
+                }
+                if (_nextName < _filter.names.size())
+                    return true;
+            }
+            else
+            {
+                // Re-seek from the cursor on every step: channels may come and go between chunks
+                const ChannelSizeIndex &index = server->getChannelSizeIndex();
+                for (size_t scanned = 0; queue.size() < limit; ++scanned)
+                {
+                    if (scanned == MAX_SCAN_PER_CHUNK)
+                        return true;
+                    ChannelSizeIndex::const_iterator it = index.lower_bound(_cursor);
+                    if (it == index.begin())
+                        break;
+                    --it;
+                    if (it->first < _filter.minUsers)
+                        break;
+                    _cursor = *it;
+                    Channel *channel = server->getChannel(it->second);
+                    if (channel && accepts(channel))
+                        sendEntry(server, client, channel);
+                }
+                if (queue.size() >= limit)
+                    return true;
+            }
+            server->sendToClient(client, "323 " + client->getNickname() + " :End of /LIST");
+            return false;
+        }
+    };
+
+    // LIST [<filter>{,<filter>}]
+    void handleListCommand(Server *server, Client *client, const std::string &args)
+    {
+        if (!client->isRegistered())
+        {
+            server->sendError(client, "451", ":You have not registered");
+            return;
+        }
+        ListFilter filter;
+        parseFilter(args.substr(0, args.find(' ')), filter);
+        server->sendToClient(client, "321 " + client->getNickname() + " Channel :Users  Name");
+        server->startReplyStream(client, new ListStream(filter));
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <string>
+class Client;
+class Server;
+
+namespace ListCommands
+{
+    void handleListCommand(Server *server, Client *client, const std::string &args);
+    bool matchMask(const std::string &mask, const std::string &name);
+}
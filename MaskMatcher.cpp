@@ -0,0 +1,108 @@
+#include "MaskMatcher.hpp"
+#include "MemoryStats.hpp"
+#include <cctype>
+
+MaskMatcher::MaskMatcher() : _nodes(1), _count(0) {}
+
+void MaskMatcher::clear()
+{
+	_nodes.assign(1, Node());
+	_count = 0;
+}
+
+size_t MaskMatcher::size() const
+{
+	return _count;
+}
+
+size_t MaskMatcher::nodeCount() const
+{
+	return _nodes.size();
+}
+
+size_t MaskMatcher::memoryBytes() const
+{
+	size_t bytes = MemoryStats::vectorBytes(_nodes);
+	for (size_t i = 0; i < _nodes.size(); ++i)
+		bytes += MemoryStats::mapBytes(_nodes[i].children);
+	return bytes;
+}
+
+unsigned MaskMatcher::child(unsigned node, char c)
+{
+	unsigned next;
+	if (c == '*')
+		next = _nodes[node].star;
+	else if (c == '?')
+		next = _nodes[node].any;
+	else
+	{
+		std::map<char, unsigned>::iterator it = _nodes[node].children.find(c);
+		next = it == _nodes[node].children.end() ? 0 : it->second;
+	}
+	if (next)
+		return next;
+
+	next = _nodes.size();
+	_nodes.push_back(Node()); // may reallocate: index again below
+	if (c == '*')
+		_nodes[node].star = next;
+	else if (c == '?')
+		_nodes[node].any = next;
+	else
+		_nodes[node].children[c] = next;
+	return next;
+}
+
+void MaskMatcher::add(const std::string &mask)
+{
+	unsigned node = 0;
+	for (size_t i = mask.size(); i-- > 0;)
+	{
+		// "**" is the same as "*" and only widens the walk
+		if (mask[i] == '*' && i + 1 < mask.size() && mask[i + 1] == '*')
+			continue;
+		node = child(node, std::tolower(static_cast<unsigned char>(mask[i])));
+	}
+	_nodes[node].terminal++;
+	_count++;
+}
+
+// `seen` holds (node, position) pairs already explored after a '*', which keeps
+// masks like "*a*a*a*" from going exponential
+bool MaskMatcher::matchFrom(unsigned node, const std::string &text, size_t pos,
+							std::set<std::pair<unsigned, size_t> > &seen) const
+{
+	const Node &n = _nodes[node];
+	if (pos == text.size())
+	{
+		if (n.terminal)
+			return true;
+		return n.star && _nodes[n.star].terminal; // trailing '*' matches nothing too
+	}
+	std::map<char, unsigned>::const_iterator it = n.children.find(text[pos]);
+	if (it != n.children.end() && matchFrom(it->second, text, pos + 1, seen))
+		return true;
+	if (n.any && matchFrom(n.any, text, pos + 1, seen))
+		return true;
+	if (n.star)
+	{
+		for (size_t end = pos; end <= text.size(); ++end)
+		{
+			if (seen.insert(std::make_pair(n.star, end)).second && matchFrom(n.star, text, end, seen))
+				return true;
+		}
+	}
+	return false;
+}
+
+bool MaskMatcher::matches(const std::string &text) const
+{
+	if (_count == 0)
+		return false;
+	std::string reversed(text.rbegin(), text.rend());
+	for (size_t i = 0; i < reversed.size(); ++i)
+		reversed[i] = std::tolower(static_cast<unsigned char>(reversed[i]));
+	std::set<std::pair<unsigned, size_t> > seen;
+	return matchFrom(0, reversed, 0, seen);
+}
@@ -0,0 +1,45 @@
+#ifndef MASKMATCHER_HPP
+#define MASKMATCHER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+// A set of nick!user@host wildcard masks ('*', '?') compiled into one trie, so
+// testing a client against the whole set is a single walk instead of one
+// comparison per mask. Masks are stored reversed and lowercased: bans usually
+// end in a literal host part ("*!*@*.example.net"), so the first characters
+// read already prune the walk instead of fanning out on a leading '*'.
+class MaskMatcher
+{
+private:
+	struct Node
+	{
+		std::map<char, unsigned> children; // literal characters
+		unsigned any;	   // '?' child (0 = none, the root is never a child)
+		unsigned star;	   // '*' child
+		unsigned terminal; // masks ending at this node
+
+		Node() : any(0), star(0), terminal(0) {}
+	};
+
+	std::vector<Node> _nodes;
+	size_t _count;
+
+	unsigned child(unsigned node, char c);
+	bool matchFrom(unsigned node, const std::string &text, size_t pos,
+				   std::set<std::pair<unsigned, size_t> > &seen) const;
+
+public:
+	MaskMatcher();
+
+	void add(const std::string &mask);
+	void clear();
+	bool matches(const std::string &text) const;
+	size_t size() const;
+	size_t nodeCount() const;
+	size_t memoryBytes() const;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MEMORYSTATS_HPP
+#define MEMORYSTATS_HPP
+
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+// Approximate heap accounting for MEMSTATS: what was asked of the allocator
+// (string and vector capacity, tree nodes), not what it rounded that up to.
+namespace MemoryStats
+{
+	const size_t TREE_NODE_OVERHEAD = 4 * sizeof(void *); // color, parent, left, right
+	const size_t STRING_INLINE_CAPACITY = 15;			   // short strings live inside the object
+
+	inline size_t stringBytes(const std::string &s)
+	{
+		return s.capacity() > STRING_INLINE_CAPACITY ? s.capacity() + 1 : 0;
+	}
+
+	template <typename T>
+	size_t setBytes(const std::set<T> &s)
+	{
+		return s.size() * (TREE_NODE_OVERHEAD + sizeof(T));
+	}
+
+	template <typename K, typename V>
+	size_t mapBytes(const std::map<K, V> &m)
+	{
+		return m.size() * (TREE_NODE_OVERHEAD + sizeof(std::pair<const K, V>));
+	}
+
+	template <typename T>
+	size_t vectorBytes(const std::vector<T> &v)
+	{
+		return v.capacity() * sizeof(T);
+	}
+}
+
+#endif
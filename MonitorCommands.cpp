@@ -0,0 +1,185 @@
+#include "MonitorCommands.hpp"
+#include "MonitorIndex.hpp"
+#include "ReplyBuilder.hpp"
+#include "UserIndex.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include <sstream>
+#include <vector>
+
+namespace MonitorCommands
+{
+    // Registered user with this nickname, any case, local or remote
+    static Client *findUser(Server *server, const std::string &nick)
+    {
+        const UserIndex::Keys &nicks = server->getUserIndex().byField(UserIndex::BY_NICK);
+        UserIndex::Keys::const_iterator it = nicks.lower_bound(std::make_pair(MonitorIndex::key(nick), static_cast<Client *>(NULL)));
+        if (it != nicks.end() && it->first == MonitorIndex::key(nick))
+            return it->second;
+        return NULL;
+    }
+
+    // 730/731/732: comma-separated items, as many per line as fit in 512 bytes
+    static void sendList(Server *server, Client *client, int numeric, const std::vector<std::string> &items)
+    {
+        ReplyBuilder head;
+        head.source("ircserver").numeric(numeric).target(client).raw(" :", 2);
+        ReplyBuilder line = head;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            bool first = line.size() == head.size();
+            if (!first && items[i].size() + 1 > line.room())
+            {
+                server->sendToClient(client, line);
+                line = head;
+                first = true;
+            }
+            if (!first)
+                line.raw(",", 1);
+            line.raw(items[i]);
+        }
+        if (line.size() > head.size())
+            server->sendToClient(client, line);
+    }
+
+    static std::vector<std::string> splitTargets(const std::string &list)
+    {
+        std::vector<std::string> targets;
+        std::istringstream iss(list);
+        std::string target;
+        while (std::getline(iss, target, ','))
+        {
+            if (!target.empty())
+                targets.push_back(target);
+        }
+        return targets;
+    }
+
+    // Online targets as nick!user@host, offline ones as given
+    static void sendStatus(Server *server, Client *client, const std::vector<std::string> &targets)
+    {
+        std::vector<std::string> online;
+        std::vector<std::string> offline;
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            Client *user = findUser(server, targets[i]);
+            if (user)
+                online.push_back(user->getFullMask());
+            else
+                offline.push_back(targets[i]);
+        }
+        sendList(server, client, 730, online);
+        sendList(server, client, 731, offline);
+    }
+
+    static void addTargets(Server *server, Client *client, const std::string &list)
+    {
+        MonitorIndex &index = server->getMonitorIndex();
+        long limit = server->getConfig().monitorLimit;
+        std::vector<std::string> targets = splitTargets(list);
+        std::vector<std::string> added;
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            if (index.count(client) >= static_cast<size_t>(limit))
+            {
+                std::string rest;
+                for (size_t j = i; j < targets.size(); ++j)
+                    rest += (j > i ? "," : "") + targets[j];
+                ReplyBuilder full;
+                full.source("ircserver").numeric(734).target(client).param(limit).param(rest).trailing("Monitor list is full");
+                server->sendToClient(client, full);
+                break;
+            }
+            if (index.add(client, targets[i]))
+                added.push_back(targets[i]);
+        }
+        sendStatus(server, client, added);
+    }
+
+    // MONITOR + targets | - targets | C | L | S
+    void handleMonitorCommand(Server *server, Client *client, const std::string &args)
+    {
+        if (!client->isRegistered())
+            return;
+        if (args.empty())
+        {
+            server->sendError(client, "461", "MONITOR :Not enough parameters");
+            return;
+        }
+        MonitorIndex &index = server->getMonitorIndex();
+        char op = args[0];
+        std::string list = args.size() > 2 ? args.substr(2) : "";
+        if (op == '+' || op == '-')
+        {
+            if (list.empty())
+            {
+                server->sendError(client, "461", "MONITOR :Not enough parameters");
+                return;
+            }
+            if (op == '+')
+            {
+                addTargets(server, client, list);
+                return;
+            }
+            std::vector<std::string> targets = splitTargets(list);
+            for (size_t i = 0; i < targets.size(); ++i)
+                index.remove(client, targets[i]);
+        }
+        else if (op == 'C' || op == 'c')
+            index.clear(client);
+        else if (op == 'L' || op == 'l' || op == 'S' || op == 's')
+        {
+            std::vector<std::string> targets;
+            const MonitorIndex::Targets *watched = index.targetsOf(client);
+            if (watched)
+                targets.assign(watched->begin(), watched->end());
+            if (op == 'S' || op == 's')
+                sendStatus(server, client, targets);
+            else
+            {
+                sendList(server, client, 732, targets);
+                ReplyBuilder end;
+                end.source("ircserver").numeric(733).target(client).trailing("End of MONITOR list");
+                server->sendToClient(client, end);
+            }
+        }
+        else
+            server->sendError(client, "461", "MONITOR :Unknown subcommand");
+    }
+
+    void notifyOnline(Server *server, Client *user)
+    {
+        const MonitorIndex::Watchers *watchers = server->getMonitorIndex().watchersOf(user->getNickname());
+        if (!watchers)
+            return;
+        std::string mask = user->getFullMask();
+        for (MonitorIndex::Watchers::const_iterator it = watchers->begin(); it != watchers->end(); ++it)
+        {
+            ReplyBuilder reply;
+            reply.source("ircserver").numeric(730).target(*it).trailing(mask);
+            server->sendToClient(*it, reply);
+        }
+    }
+
+    void notifyOffline(Server *server, const std::string &nick)
+    {
+        const MonitorIndex::Watchers *watchers = server->getMonitorIndex().watchersOf(nick);
+        if (!watchers)
+            return;
+        for (MonitorIndex::Watchers::const_iterator it = watchers->begin(); it != watchers->end(); ++it)
+        {
+            ReplyBuilder reply;
+            reply.source("ircserver").numeric(731).target(*it).trailing(nick);
+            server->sendToClient(*it, reply);
+        }
+    }
+
+    // The old nick goes offline and the new one comes online; a change of case
+    // only is a new mask for the same watchers
+    void notifyNickChange(Server *server, Client *user, const std::string &oldNick)
+    {
+        if (MonitorIndex::key(oldNick) != MonitorIndex::key(user->getNickname()))
+            notifyOffline(server, oldNick);
+        notifyOnline(server, user);
+    }
+}
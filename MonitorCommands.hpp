@@ -0,0 +1,12 @@
+#pragma once
+#include <string>
+class Client;
+class Server;
+
+namespace MonitorCommands
+{
+    void handleMonitorCommand(Server *server, Client *client, const std::string &args);
+    void notifyOnline(Server *server, Client *user);
+    void notifyOffline(Server *server, const std::string &nick);
+    void notifyNickChange(Server *server, Client *user, const std::string &oldNick);
+}
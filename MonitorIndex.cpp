@@ -0,0 +1,87 @@
+#include "MonitorIndex.hpp"
+#include "UserIndex.hpp"
+#include "MemoryStats.hpp"
+
+std::string MonitorIndex::key(const std::string &nick)
+{
+	return UserIndex::key(UserIndex::BY_NICK, nick);
+}
+
+bool MonitorIndex::add(Client *watcher, const std::string &nick)
+{
+	std::string k = key(nick);
+	if (!_targets[watcher].insert(k).second)
+		return false;
+	_watchers[k].insert(watcher);
+	return true;
+}
+
+void MonitorIndex::remove(Client *watcher, const std::string &nick)
+{
+	std::map<Client *, Targets>::iterator targets = _targets.find(watcher);
+	if (targets == _targets.end())
+		return;
+	std::string k = key(nick);
+	if (!targets->second.erase(k))
+		return;
+	if (targets->second.empty())
+		_targets.erase(targets);
+	std::map<std::string, Watchers>::iterator watchers = _watchers.find(k);
+	watchers->second.erase(watcher);
+	if (watchers->second.empty())
+		_watchers.erase(watchers);
+}
+
+void MonitorIndex::clear(Client *watcher)
+{
+	std::map<Client *, Targets>::iterator targets = _targets.find(watcher);
+	if (targets == _targets.end())
+		return;
+	for (Targets::iterator it = targets->second.begin(); it != targets->second.end(); ++it)
+	{
+		std::map<std::string, Watchers>::iterator watchers = _watchers.find(*it);
+		watchers->second.erase(watcher);
+		if (watchers->second.empty())
+			_watchers.erase(watchers);
+	}
+	_targets.erase(targets);
+}
+
+size_t MonitorIndex::count(Client *watcher) const
+{
+	std::map<Client *, Targets>::const_iterator it = _targets.find(watcher);
+	return it == _targets.end() ? 0 : it->second.size();
+}
+
+const MonitorIndex::Watchers *MonitorIndex::watchersOf(const std::string &nick) const
+{
+	if (_watchers.empty())
+		return NULL;
+	std::map<std::string, Watchers>::const_iterator it = _watchers.find(key(nick));
+	return it == _watchers.end() ? NULL : &it->second;
+}
+
+const MonitorIndex::Targets *MonitorIndex::targetsOf(Client *watcher) const
+{
+	std::map<Client *, Targets>::const_iterator it = _targets.find(watcher);
+	return it == _targets.end() ? NULL : &it->second;
+}
+
+size_t MonitorIndex::size() const
+{
+	return _watchers.size();
+}
+
+size_t MonitorIndex::memoryBytes() const
+{
+	size_t bytes = MemoryStats::mapBytes(_watchers) + MemoryStats::mapBytes(_targets);
+	for (std::map<std::string, Watchers>::const_iterator it = _watchers.begin(); it != _watchers.end(); ++it)
+		bytes += MemoryStats::stringBytes(it->first) + MemoryStats::setBytes(it->second);
+	for (std::map<Client *, Targets>::const_iterator it = _targets.begin(); it != _targets.end(); ++it)
+	{
+		bytes += MemoryStats::setBytes(it->second);
+		for (Targets::const_iterator t = it->second.begin(); t != it->second.end(); ++t)
+			bytes += MemoryStats::stringBytes(*t);
+	}
+	return bytes;
+}
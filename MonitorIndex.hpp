@@ -0,0 +1,37 @@
+#ifndef MONITORINDEX_HPP
+#define MONITORINDEX_HPP
+
+#include <string>
+#include <set>
+#include <map>
+
+class Client;
+
+// MONITOR lists kept both ways: who watches a nickname (lowercased, as in
+// UserIndex), and what each client watches. A nick change, sign-on or quit
+// looks up its watchers directly, so presence costs O(watchers) per event
+// instead of every client polling for every friend.
+class MonitorIndex
+{
+public:
+	typedef std::set<Client *> Watchers;
+	typedef std::set<std::string> Targets;
+
+private:
+	std::map<std::string, Watchers> _watchers; // nick key -> clients monitoring it
+	std::map<Client *, Targets> _targets;		// client -> nick keys it monitors
+
+public:
+	bool add(Client *watcher, const std::string &nick); // false if already on the list
+	void remove(Client *watcher, const std::string &nick);
+	void clear(Client *watcher);
+	size_t count(Client *watcher) const;
+	const Watchers *watchersOf(const std::string &nick) const; // NULL when nobody watches it
+	const Targets *targetsOf(Client *watcher) const;
+	size_t size() const; // nicknames watched by anyone
+	size_t memoryBytes() const;
+
+	static std::string key(const std::string &nick);
+};
+
+#endif
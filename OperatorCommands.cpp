@@ -55,9 +55,11 @@ namespace OperatorCommands
             return;
         }
 
-        std::string message = ":" + client->getFullMask() + " KICK " + channelName + " " + targetName + " :" + client->getNickname() + "\r\n";
+        ReplyBuilder message;
+        message.source(client).command("KICK").param(channelName).param(targetName).trailing(client->getNickname());
         server->broadcastToChannels(channel, message, client, 0);
-        channel->removeClient(target);
+        server->propagateToLinks(message, channel);
+        server->removeFromChannel(channel, target); // after the KICK has reached them
     }
 
     void handleInviteCommand(Server *server, Client *inviter, const std::string &args)
@@ -112,7 +114,7 @@ namespace OperatorCommands
         channel->addInvited(targetClient);
 
         server->sendToClient(inviter, "341 " + inviter->getNickname() + " " + targetName + " " + channelName);
-        server->sendToClient(targetClient, ":" + inviter->getFullMask() + " INVITE " + targetName + " :" + channelName);
+        server->routeToClient(targetClient, ":" + inviter->getFullMask() + " INVITE " + targetName + " :" + channelName);
     }
     void handleTopicCommand(Server *server, Client *client, const std::string &args)
     {
@@ -161,10 +163,27 @@ namespace OperatorCommands
             std::string newTopic = args.substr(topicPos + 1);
             channel->setTopic(newTopic);
 
-            std::string topicMsg = ":" + client->getFullMask() + " TOPIC " + channelName + " :" + newTopic;
+            ReplyBuilder topicMsg;
+            topicMsg.source(client).command("TOPIC").param(channelName).trailing(newTopic);
             server->broadcastToChannels(channel, topicMsg, NULL, false); // Broadcast to all, including sender
+            server->propagateToLinks(topicMsg, channel);
         }
     }
+    // 367/368 for bans, 348/349 for exceptions
+    static void sendMaskList(Server *server, Client *client, Channel *channel, char list)
+    {
+        const std::vector<MaskEntry> &entries = channel->getMasks(list);
+        std::string prefix = (list == 'e' ? "348 " : "367 ") + client->getNickname() + " " + channel->getName() + " ";
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            std::ostringstream line;
+            line << prefix << entries[i].mask << " " << entries[i].setter << " " << entries[i].when;
+            server->sendToClient(client, line.str());
+        }
+        server->sendToClient(client, (list == 'e' ? "349 " : "368 ") + client->getNickname() + " " + channel->getName() +
+                                         (list == 'e' ? " :End of channel exception list" : " :End of channel ban list"));
+    }
+
     void handleModeCommand(Server *server, Client *client, const std::string &args)
     {
         if (!client->isRegistered())
@@ -194,17 +213,25 @@ namespace OperatorCommands
             return;
         }
 
+        bool addMode = true;
+        std::string params;
+        std::getline(iss, params); // Get the rest of the line for mode parameters
+        std::istringstream paramStream(params);
+
+        // Anyone may read the ban / exception lists
+        if (params.find_first_not_of(' ') == std::string::npos &&
+            (modeStr == "b" || modeStr == "+b" || modeStr == "e" || modeStr == "+e"))
+        {
+            sendMaskList(server, client, channel, modeStr[modeStr.size() - 1]);
+            return;
+        }
+
         if (!channel->isOperator(client))
         {
             server->sendError(client, "482", channelName + " :You're not channel operator");
             return;
         }
 
-        bool addMode = true;
-        std::string params;
-        std::getline(iss, params); // Get the rest of the line for mode parameters
-        std::istringstream paramStream(params);
-
         std::string fullModeChangeStr;
         std::string affectedParams;
 
@@ -293,6 +320,33 @@ namespace OperatorCommands
                 }
                 break;
             }
+            case 'b':
+            case 'e':
+            {
+                std::string mask;
+                paramStream >> mask;
+                if (mask.empty())
+                {
+                    sendMaskList(server, client, channel, mode);
+                    continue;
+                }
+                mask = Channel::normalizeMask(mask);
+                if (addMode)
+                {
+                    if (channel->getMasks(mode).size() >= static_cast<size_t>(server->getConfig().maxListEntries))
+                    {
+                        server->sendError(client, "478", channelName + " " + mask + " :Channel list is full");
+                        continue;
+                    }
+                    if (!channel->addMask(mode, mask, client->getFullMask(), time(NULL)))
+                        continue;
+                }
+                else if (!channel->removeMask(mode, mask))
+                    continue;
+                fullModeChangeStr += std::string(addMode ? "+" : "-") + mode;
+                affectedParams += " " + mask;
+                break;
+            }
             default:
                 server->sendError(client, "472", std::string(1, mode) + " :is unknown mode char to me");
                 break;
@@ -300,8 +354,10 @@ namespace OperatorCommands
         }
         if (!fullModeChangeStr.empty())
         {
-            std::string modeMsg = ":" + client->getFullMask() + " MODE " + channelName + " " + fullModeChangeStr + affectedParams;
+            ReplyBuilder modeMsg;
+            modeMsg.source(client).command("MODE").param(channelName).param(fullModeChangeStr).raw(affectedParams);
             server->broadcastToChannels(channel, modeMsg, NULL, false);
+            server->propagateToLinks(modeMsg, channel);
         }
     }
 
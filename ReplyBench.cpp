@@ -0,0 +1,152 @@
+#include "ReplyBuilder.hpp"
+#include "Client.hpp"
+#include "Clock.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+// Built as its own binary, never linked into ircserv: counting allocations
+// means replacing the global operator new for the whole process.
+
+namespace
+{
+	// Allocations are counted only while a scenario runs
+	bool g_countAllocations = false;
+	unsigned long g_allocations = 0;
+}
+
+void *operator new(std::size_t size) throw(std::bad_alloc)
+{
+	if (g_countAllocations)
+		++g_allocations;
+	void *p;
+	while (!(p = std::malloc(size ? size : 1)))
+	{
+		std::new_handler handler = std::set_new_handler(0);
+		std::set_new_handler(handler);
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+	return p;
+}
+
+void operator delete(void *p) throw()
+{
+	std::free(p);
+}
+
+// make reply-bench && ./reply-bench: heap allocations and time per reply for
+// the hot replies, formatted the old way (string concatenation) and with
+// ReplyBuilder. Both end with the line appended to a send queue, as sendParts
+// does.
+int main()
+{
+	const int ROUNDS = 200000;
+	Client sender(-1);
+	sender.setNickname("alice_wonder");
+	sender.setUsername("alice");
+	sender.setHostname("203.0.113.45.example.net");
+	std::vector<Client *> members;
+	for (int i = 0; i < 40; ++i)
+	{
+		char nick[16];
+		std::snprintf(nick, sizeof(nick), "member%02d", i);
+		members.push_back(new Client(-1));
+		members.back()->setNickname(nick);
+	}
+	std::string channel = "#market-data";
+	std::string message = ":EURUSD 1.08734 bid 1.08731 ask 1.08737 vol 1200000 ts 1718900000";
+	std::string queue;
+	queue.reserve(1 << 20);
+
+	std::cout << "reply                old allocs   new allocs    old ns    new ns" << std::endl;
+	for (int scenario = 0; scenario < 4; ++scenario)
+	{
+		unsigned long allocations[2];
+		long long elapsed[2];
+		for (int builder = 0; builder < 2; ++builder)
+		{
+			g_allocations = 0;
+			g_countAllocations = true;
+			long long start = Clock::monotonicNs();
+			for (int round = 0; round < ROUNDS; ++round)
+			{
+				if (queue.size() > (1 << 19))
+					queue.clear();
+				if (scenario == 0 && !builder)
+				{
+					// handlePrivMsgCommand before: head + receiver + tail per target
+					std::string head = ":" + sender.getFullMask() + " PRIVMSG ";
+					std::string tail = " " + message;
+					std::string line = head + channel + tail;
+					queue += line + "\r\n";
+				}
+				else if (scenario == 0)
+				{
+					ReplyBuilder reply;
+					reply.source(&sender).command("PRIVMSG").param(channel).raw(" ", 1).raw(message);
+					queue.append(reply.data(), reply.size());
+				}
+				else if (scenario == 1 && !builder)
+				{
+					// sendError before
+					std::string nick = sender.getNickname().empty() ? "*" : sender.getNickname();
+					std::string fullMsg = ":" + std::string("ircserver") + " " + "401" + " " + nick + " " + "bob" +
+										  " :No such nick/channel";
+					queue += fullMsg + "\r\n";
+				}
+				else if (scenario == 1)
+				{
+					ReplyBuilder reply;
+					reply.source("ircserver").numeric(401).target(&sender).param("bob").trailing("No such nick/channel");
+					queue.append(reply.data(), reply.size());
+				}
+				else if (scenario == 2 && !builder)
+				{
+					// JOIN echo before
+					queue += ":" + sender.getFullMask() + " JOIN :" + channel + "\r\n";
+				}
+				else if (scenario == 2)
+				{
+					ReplyBuilder reply;
+					reply.source(&sender).command("JOIN").trailing(channel);
+					queue.append(reply.data(), reply.size());
+				}
+				else if (scenario == 3 && !builder)
+				{
+					// 353 NAMES before
+					std::string namesList;
+					for (size_t i = 0; i < members.size(); ++i)
+						namesList += members[i]->getNickname() + " ";
+					namesList = namesList.substr(0, namesList.length() - 1);
+					queue += ":ircserver 353 " + sender.getNickname() + " = " + channel + " :" + namesList + "\r\n";
+				}
+				else
+				{
+					ReplyBuilder reply;
+					reply.source("ircserver").numeric(353).target(&sender).param("=").param(channel).raw(" :", 2);
+					for (size_t i = 0; i < members.size(); ++i)
+					{
+						if (i)
+							reply.raw(" ", 1);
+						reply.raw(members[i]->getNickname());
+					}
+					queue.append(reply.data(), reply.size());
+				}
+			}
+			elapsed[builder] = Clock::monotonicNs() - start;
+			g_countAllocations = false;
+			allocations[builder] = g_allocations;
+		}
+		static const char *const names[] = {"PRIVMSG relay", "401 via sendError", "JOIN echo", "353 NAMES (40)"};
+		std::printf("%-20s %11.2f %12.2f %9.1f %9.1f\n", names[scenario],
+					static_cast<double>(allocations[0]) / ROUNDS, static_cast<double>(allocations[1]) / ROUNDS,
+					static_cast<double>(elapsed[0]) / ROUNDS, static_cast<double>(elapsed[1]) / ROUNDS);
+	}
+	for (size_t i = 0; i < members.size(); ++i)
+		delete members[i];
+	return 0;
+}
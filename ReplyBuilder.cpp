@@ -0,0 +1,148 @@
+#include "ReplyBuilder.hpp"
+#include "Client.hpp"
+#include <cstdio>
+#include <cstring>
+
+ReplyBuilder::ReplyBuilder() : _length(0), _truncated(false)
+{
+	_buffer[0] = '\r';
+	_buffer[1] = '\n';
+}
+
+void ReplyBuilder::append(const char *data, size_t size)
+{
+	size_t fit = MAX_LINE - 2 - _length;
+	if (size > fit)
+	{
+		size = fit;
+		_truncated = true;
+	}
+	std::memcpy(_buffer + _length, data, size);
+	_length += size;
+	_buffer[_length] = '\r';
+	_buffer[_length + 1] = '\n';
+}
+
+void ReplyBuilder::separator()
+{
+	if (_length)
+		append(" ", 1);
+}
+
+ReplyBuilder &ReplyBuilder::source(const char *name)
+{
+	append(":", 1);
+	append(name, std::strlen(name));
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::source(const Client *client)
+{
+	append(":", 1);
+	append(client->getNickname().data(), client->getNickname().size());
+	append("!", 1);
+	append(client->getUsername().data(), client->getUsername().size());
+	append("@", 1);
+	append(client->getHost().data(), client->getHost().size());
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::command(const char *command)
+{
+	return param(command);
+}
+
+ReplyBuilder &ReplyBuilder::numeric(int code)
+{
+	char digits[3] = {static_cast<char>('0' + code / 100 % 10), static_cast<char>('0' + code / 10 % 10),
+					  static_cast<char>('0' + code % 10)};
+	separator();
+	append(digits, 3);
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::target(const Client *client)
+{
+	if (client->getNickname().empty())
+		return param("*");
+	return param(client->getNickname());
+}
+
+ReplyBuilder &ReplyBuilder::param(const std::string &value)
+{
+	separator();
+	append(value.data(), value.size());
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::param(const char *value)
+{
+	separator();
+	append(value, std::strlen(value));
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::param(long value)
+{
+	char digits[24];
+	int length = std::snprintf(digits, sizeof(digits), "%ld", value);
+	separator();
+	append(digits, length);
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::trailing(const std::string &text)
+{
+	separator();
+	append(":", 1);
+	append(text.data(), text.size());
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::trailing(const char *text)
+{
+	separator();
+	append(":", 1);
+	append(text, std::strlen(text));
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::raw(const char *data, size_t size)
+{
+	append(data, size);
+	return *this;
+}
+
+ReplyBuilder &ReplyBuilder::raw(const std::string &data)
+{
+	append(data.data(), data.size());
+	return *this;
+}
+
+const char *ReplyBuilder::data() const
+{
+	return _buffer;
+}
+
+size_t ReplyBuilder::size() const
+{
+	return _length + 2;
+}
+
+size_t ReplyBuilder::room() const
+{
+	return MAX_LINE - 2 - _length;
+}
+
+bool ReplyBuilder::truncated() const
+{
+	return _truncated;
+}
+
+void ReplyBuilder::clear()
+{
+	_length = 0;
+	_truncated = false;
+	_buffer[0] = '\r';
+	_buffer[1] = '\n';
+}
@@ -0,0 +1,53 @@
+#ifndef REPLYBUILDER_HPP
+#define REPLYBUILDER_HPP
+
+#include <string>
+#include <cstddef>
+
+class Client;
+
+// One IRC line formatted in place, without touching the heap: a reply is
+// usually built on the stack, then copied once into each recipient's send
+// queue. The 512-byte limit (CRLF included) is enforced while writing: a
+// parameter that does not fit is cut short and the line marked truncated.
+//
+//   ReplyBuilder reply;
+//   reply.source(client).command("PRIVMSG").param(channel).trailing(text);
+//   server->sendToClient(member, reply);
+class ReplyBuilder
+{
+public:
+	static const size_t MAX_LINE = 512;
+
+private:
+	char _buffer[MAX_LINE];
+	size_t _length; // bytes written so far; the CRLF always follows them
+	bool _truncated;
+
+	void append(const char *data, size_t size);
+	void separator();
+
+public:
+	ReplyBuilder();
+
+	ReplyBuilder &source(const char *name);		 // ":name", a server
+	ReplyBuilder &source(const Client *client);	 // ":nick!user@host"
+	ReplyBuilder &command(const char *command);
+	ReplyBuilder &numeric(int code); // always three digits
+	ReplyBuilder &target(const Client *client); // the nick, "*" before one is set
+	ReplyBuilder &param(const std::string &value);
+	ReplyBuilder &param(const char *value);
+	ReplyBuilder &param(long value);
+	ReplyBuilder &trailing(const std::string &text); // " :text", always last
+	ReplyBuilder &trailing(const char *text);
+	ReplyBuilder &raw(const char *data, size_t size); // appended as is, no separator
+	ReplyBuilder &raw(const std::string &data);
+
+	const char *data() const; // the line, CRLF included
+	size_t size() const;
+	size_t room() const; // bytes that still fit before the CRLF
+	bool truncated() const;
+	void clear();
+};
+
+#endif
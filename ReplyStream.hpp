@@ -0,0 +1,21 @@
+#ifndef REPLYSTREAM_HPP
+#define REPLYSTREAM_HPP
+
+#include <cstddef>
+
+class Server;
+class Client;
+
+// A reply too long to build in one go (LIST, WHO). The server asks for the next
+// chunk whenever the client's send queue has drained, one chunk per loop tick,
+// so a huge listing never stalls other clients or piles up in memory.
+class ReplyStream
+{
+public:
+	virtual ~ReplyStream() {}
+
+	// Queue about `budget` more bytes of replies; false once the reply is complete
+	virtual bool produce(Server *server, Client *client, size_t budget) = 0;
+};
+
+#endif
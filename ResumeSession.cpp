@@ -0,0 +1,170 @@
+#include "ResumeSession.hpp"
+#include "MemoryStats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <unistd.h>
+
+ResumeSession::ResumeSession(const std::string &token, size_t capacity)
+	: _token(token), _detachedAt(0), _capacity(capacity), _head(0), _used(0), _dropped(0)
+{
+}
+
+const std::string &ResumeSession::getToken() const
+{
+	return _token;
+}
+
+void ResumeSession::setToken(const std::string &token)
+{
+	_token = token;
+}
+
+bool ResumeSession::isDetached() const
+{
+	return _detachedAt != 0;
+}
+
+time_t ResumeSession::getDetachedAt() const
+{
+	return _detachedAt;
+}
+
+void ResumeSession::detach(time_t now)
+{
+	_detachedAt = now ? now : 1;
+	_ring.resize(_capacity);
+	_head = 0;
+	_used = 0;
+	_dropped = 0;
+}
+
+void ResumeSession::attach()
+{
+	_detachedAt = 0;
+	std::vector<char>().swap(_ring);
+	_head = 0;
+	_used = 0;
+}
+
+void ResumeSession::dropOldestLine()
+{
+	while (_used)
+	{
+		char c = _ring[_head];
+		_head = (_head + 1) % _capacity;
+		--_used;
+		if (c == '\n')
+			break;
+	}
+	++_dropped;
+}
+
+void ResumeSession::record(const struct iovec *parts, int count)
+{
+	size_t size = 0;
+	for (int i = 0; i < count; ++i)
+		size += parts[i].iov_len;
+	if (!isDetached() || size == 0)
+		return;
+	if (size > _capacity)
+	{
+		++_dropped;
+		return;
+	}
+	while (_capacity - _used < size)
+		dropOldestLine();
+	size_t tail = (_head + _used) % _capacity;
+	for (int i = 0; i < count; ++i)
+	{
+		const char *data = static_cast<const char *>(parts[i].iov_base);
+		size_t left = parts[i].iov_len;
+		while (left)
+		{
+			size_t chunk = std::min(left, _capacity - tail);
+			std::memcpy(&_ring[tail], data, chunk);
+			tail = (tail + chunk) % _capacity;
+			data += chunk;
+			left -= chunk;
+		}
+	}
+	_used += size;
+}
+
+std::vector<std::string> ResumeSession::takeMissed()
+{
+	std::vector<std::string> lines;
+	std::string line;
+	for (size_t i = 0; i < _used; ++i)
+	{
+		char c = _ring[(_head + i) % _capacity];
+		line += c;
+		if (c == '\n')
+		{
+			lines.push_back(line);
+			line.clear();
+		}
+	}
+	_head = 0;
+	_used = 0;
+	return lines;
+}
+
+unsigned long ResumeSession::getDropped() const
+{
+	return _dropped;
+}
+
+size_t ResumeSession::memoryBytes() const
+{
+	return sizeof(*this) + MemoryStats::stringBytes(_token) + MemoryStats::vectorBytes(_ring);
+}
+
+// token, detach time, dropped count, then the missed lines as they are
+std::string ResumeSession::serialize() const
+{
+	std::ostringstream out;
+	out << _token << ' ' << static_cast<long long>(_detachedAt) << ' ' << _dropped << ' ';
+	std::string state = out.str();
+	for (size_t i = 0; i < _used; ++i)
+		state += _ring[(_head + i) % _capacity];
+	return state;
+}
+
+bool ResumeSession::restore(const std::string &state)
+{
+	std::istringstream in(state);
+	long long detachedAt;
+	unsigned long dropped;
+	if (!(in >> _token >> detachedAt >> dropped) || in.get() != ' ')
+		return false;
+	attach();
+	if (!detachedAt)
+		return true;
+	detach(detachedAt);
+	std::string missed = state.substr(static_cast<size_t>(in.tellg()));
+	struct iovec part;
+	part.iov_base = const_cast<char *>(missed.data());
+	part.iov_len = missed.size();
+	record(&part, 1);
+	_dropped = dropped;
+	return true;
+}
+
+// 128 random bits, hex encoded
+std::string ResumeSession::newToken()
+{
+	unsigned char bytes[16];
+	int fd = open("/dev/urandom", O_RDONLY);
+	bool ok = fd >= 0 && read(fd, bytes, sizeof(bytes)) == static_cast<ssize_t>(sizeof(bytes));
+	if (fd >= 0)
+		close(fd);
+	if (!ok)
+		return "";
+	char hex[sizeof(bytes) * 2 + 1];
+	for (size_t i = 0; i < sizeof(bytes); ++i)
+		std::sprintf(hex + i * 2, "%02x", bytes[i]);
+	return std::string(hex, sizeof(bytes) * 2);
+}
@@ -0,0 +1,49 @@
+#ifndef RESUMESESSION_HPP
+#define RESUMESESSION_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <sys/uio.h>
+
+// A resumable session (CAP draft/resume-0.5). While its connection is up it is
+// only a token; once the connection drops, the user stays on the network and
+// every line meant for them lands in a ring of at most `capacity` bytes, oldest
+// lines dropped first, until they RESUME on a new connection or the grace
+// period runs out.
+class ResumeSession
+{
+private:
+	std::string _token;
+	time_t _detachedAt;		// 0 while a connection is attached
+	std::vector<char> _ring; // allocated on detach, released on attach
+	size_t _capacity;
+	size_t _head;			// first byte of the oldest line
+	size_t _used;
+	unsigned long _dropped; // lines pushed out of the ring since the detach
+
+	void dropOldestLine();
+
+public:
+	ResumeSession(const std::string &token, size_t capacity);
+
+	const std::string &getToken() const;
+	void setToken(const std::string &token);
+	bool isDetached() const;
+	time_t getDetachedAt() const;
+	void detach(time_t now);
+	void attach();
+
+	void record(const struct iovec *parts, int count); // one line, CRLF included
+	std::vector<std::string> takeMissed();			   // the missed lines in order, CRLF included
+	unsigned long getDropped() const;
+	size_t memoryBytes() const;
+
+	// Hot restart
+	std::string serialize() const;
+	bool restore(const std::string &state);
+
+	static std::string newToken();
+};
+
+#endif
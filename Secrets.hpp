@@ -0,0 +1,32 @@
+#ifndef SECRETS_HPP
+#define SECRETS_HPP
+
+#include <string>
+#include <cstring>
+
+// Checks of client-supplied credentials against stored ones (SASL password
+// hashes, publisher tokens, link and operator passwords).
+namespace Secrets
+{
+	// Compares every byte whatever the first difference, so timing says
+	// nothing about how much of the secret matched
+	inline bool equal(const char *given, size_t length, const std::string &expected)
+	{
+		unsigned char diff = length != expected.size();
+		for (size_t i = 0; i < length && i < expected.size(); ++i)
+			diff |= given[i] ^ expected[i];
+		return diff == 0;
+	}
+
+	inline bool equal(const char *given, const std::string &expected)
+	{
+		return equal(given, std::strlen(given), expected);
+	}
+
+	inline bool equal(const std::string &given, const std::string &expected)
+	{
+		return equal(given.data(), given.size(), expected);
+	}
+}
+
+#endif
@@ -1,583 +1,1831 @@
-#include "Server.hpp"
-#include <iostream>
-#include <cstdio>
-#include <cstring>
-#include <cstdlib>
-#include <unistd.h>
-#include <netinet/in.h>
-#include <fcntl.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <cctype>
-#include <sstream>
-#include "OperatorCommands.hpp"
-
-Server::Server(int port, const std::string &password) : _port(port), _password(password), _serverSocket(-1) {}
-
-Server::~Server()
-{
-	// Delete all dynamically allocated clients
-	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-	{
-		delete it->second;
-	}
-	_clients.clear();
-	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
-	{
-		delete it->second;
-	}
-	_channels.clear();
-	if (_serverSocket != -1)
-		close(_serverSocket);
-}
-
-void Server::start()
-{
-	_serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-	if (_serverSocket < 0)
-	{
-		perror("socket");
-		exit(1);
-	}
-
-	// Set socket options
-	int opt = 1;
-	if (setsockopt(_serverSocket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-	{
-		perror("setsockopt");
-		exit(1);
-	}
-
-	// Make socket non-blocking
-	if (fcntl(_serverSocket, F_SETFL, O_NONBLOCK) < 0)
-	{
-		perror("fcntl");
-		exit(1);
-	}
-
-	struct sockaddr_in addr;
-	std::memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(_port);
-
-	if (bind(_serverSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-	{
-		perror("bind");
-		exit(1);
-	}
-	if (listen(_serverSocket, 10) < 0)
-	{
-		perror("listen");
-		exit(1);
-	}
-	std::cout << "✅ Server listening on port " << _port << std::endl;
-	// Simple event loop to keep server running
-	std::cout << "Server is running. Press Ctrl+C to stop." << std::endl;
-	_pollFds.push_back((struct pollfd){_serverSocket, POLLIN, 0});
-	while (true)
-	{
-		int ret = poll(&_pollFds[0], _pollFds.size(), -1);
-		if (ret < 0)
-		{
-			perror("poll");
-			break;
-		}
-		for (size_t i = 0; i < _pollFds.size(); ++i)
-		{
-			if (_pollFds[i].revents & POLLIN)
-			{
-				if (_pollFds[i].fd == _serverSocket)
-					handleNewConnection();
-				else
-					handleClientData(_pollFds[i].fd);
-			}
-		}
-	}
-}
-
-// handle new connections
-
-void Server::handleNewConnection()
-{
-	struct sockaddr_in clientAddr;
-	socklen_t addrLen = sizeof(clientAddr);
-
-	int clientFd = accept(_serverSocket, (struct sockaddr *)&clientAddr, &addrLen);
-	if (clientFd < 0)
-	{
-		perror("accept");
-		return;
-	}
-	// Set new client socket to non-blocking
-	if (fcntl(clientFd, F_SETFL, O_NONBLOCK) < 0)
-	{
-		perror("fcntl");
-		close(clientFd);
-		return;
-	}
-	_pollFds.push_back((struct pollfd){clientFd, POLLIN, 0});
-	_clients[clientFd] = new Client(clientFd);
-	std::cout << "🔌 New client connected: fd=" << clientFd << std::endl;
-}
-
-// handle client data
-
-void Server::handleClientData(int clientFd)
-{
-	char tempBuffer[512];
-	Client *client = _clients[clientFd];
-
-	// Read new data from the socket
-	memset(tempBuffer, 0, sizeof(tempBuffer));
-	int bytesRead = recv(clientFd, tempBuffer, sizeof(tempBuffer) - 1, 0);
-
-	if (bytesRead <= 0)
-	{
-		// Client disconnection logic (your existing code is correct)
-		std::cout << "❌ Client disconnected: fd=" << clientFd << std::endl;
-		for (std::vector<pollfd>::iterator it = _pollFds.begin(); it != _pollFds.end(); ++it)
-		{
-			if (it->fd == clientFd)
-			{
-				_pollFds.erase(it);
-				break;
-			}
-		}
-		close(clientFd);
-		delete client;
-		_clients.erase(clientFd);
-		return;
-	}
-
-	// 1. Append new data to the client's persistent buffer
-	std::string receivedData(tempBuffer, bytesRead);
-	std::string clientBuffer = client->getBuffer() + receivedData;
-
-	// 2. Process all complete commands (ending in \n) from the buffer
-	size_t pos;
-	while ((pos = clientBuffer.find('\n')) != std::string::npos)
-	{
-		// Extract a single command line from the buffer
-		std::string line = clientBuffer.substr(0, pos);
-
-		// Remove the processed command (and the \n) from the start of the buffer
-		clientBuffer.erase(0, pos + 1);
-
-		// Trim the trailing \r if it exists
-		if (!line.empty() && line[line.size() - 1] == '\r')
-			line.erase(line.size() - 1);
-
-		// Handle the command if it's not empty
-		if (!line.empty())
-		{
-			std::cout << "📨 [" << clientFd << "] " << line << std::endl;
-			handleCommand(client, line);
-		}
-	}
-	// 3. Save any remaining partial command back to the client's buffer
-	client->setBuffer(clientBuffer);
-}
-
-void Server::handleCommand(Client *client, const std::string &line)
-{
-	if (line.empty())
-		return;
-
-	std::string command;
-	std::string args;
-
-	size_t spacePos = line.find(' ');
-	if (spacePos == std::string::npos)
-	{
-		command = line;
-	}
-	else
-	{
-		command = line.substr(0, spacePos);
-		args = line.substr(spacePos + 1);
-	}
-	for (size_t i = 0; i < command.length(); ++i)
-	{
-		command[i] = std::toupper(command[i]);
-	}
-	if (command == "PASS")
-		handlePassCommand(client, args);
-	else if (command == "NICK")
-		handleNickCommand(client, args);
-	else if (command == "USER")
-		handleUserCommand(client, args);
-	else if (command == "JOIN")
-		handleJoinCommand(client, args);
-	else if (command == "PRIVMSG")
-		handlePrivMsgCommand(client, args);
-	else if (command == "KICK")
-		OperatorCommands::handleKickCommand(this, client, args);
-	else if (command == "MODE")
-		OperatorCommands::handleModeCommand(this, client, args);
-	else if (command == "INVITE")
-		OperatorCommands::handleInviteCommand(this, client, args);
-	else if (command == "TOPIC")
-		OperatorCommands::handleTopicCommand(this, client, args);
-	else
-		sendToClient(client, "421 * " + command + " :Unknown command");
-}
-
-void Server::handlePassCommand(Client *client, const std::string &args)
-{
-	if (client->isRegistered())
-	{
-		sendError(client, "462", ":You may not reregister");
-		return;
-	}
-	if (_password.empty())
-	{
-		client->setPassAccepted(true);
-		std::cout << "✅ Client [" << client->getFd() << "] password accepted (no password required)" << std::endl;
-		checkRegistration(client);
-		return;
-	}
-	if (args == _password)
-	{
-		client->setPassAccepted(true);
-		std::cout << "✅ Client [" << client->getFd() << "] password accepted" << std::endl;
-	}
-	else
-	{
-		client->setPassAccepted(false);
-		sendToClient(client, "464 * :Password incorrect");
-		std::cout << "❌ Client [" << client->getFd() << "] wrong password" << std::endl;
-		return;
-	}
-
-	checkRegistration(client);
-}
-
-void Server::handleNickCommand(Client *client, const std::string &args)
-{
-	if (!_password.empty() && !client->hasSentPass())
-	{
-		sendError(client, "464", ":Password required");
-		return;
-	}
-	if (args.empty())
-	{
-		sendToClient(client, "431 * :No nickname given");
-		return;
-	}
-
-	std::string nick = args;
-	size_t spacePos = nick.find(' ');
-	if (spacePos != std::string::npos)
-	{
-		nick = nick.substr(0, spacePos);
-	}
-	if (isNicknameInUse(nick))
-	{
-		sendToClient(client, "433 * " + nick + " :Nickname is already in use");
-		return;
-	}
-	std::string oldNick = client->getNickname();
-	client->setNickname(nick);
-	if (oldNick.empty())
-		std::cout << "✅ Client [" << client->getFd() << "] set nickname: " << nick << std::endl;
-	else
-		std::cout << "✅ Client [" << client->getFd() << "] changed nickname from " << oldNick << " to " << nick << std::endl;
-
-	checkRegistration(client);
-}
-
-void Server::handleUserCommand(Client *client, const std::string &args)
-{
-	if (!_password.empty() && !client->hasSentPass())
-	{
-		sendError(client, "464", ":Password required");
-		return;
-	}
-	if (!client->hasSentNick())
-	{
-		sendError(client, "451", ":You have not registered");
-		return;
-	}
-	if (args.empty())
-	{
-		sendToClient(client, "461 * USER :Not enough parameters");
-		return;
-	}
-	std::string username = args;
-	size_t spacePos = username.find(' ');
-	if (spacePos != std::string::npos)
-		username = username.substr(0, spacePos);
-	client->setUsername(username);
-	std::cout << "✅ Client [" << client->getFd() << "] set username: " << username << std::endl;
-	checkRegistration(client);
-}
-
-void Server::handleJoinCommand(Client *client, const std::string &args)
-{
-	if (args.empty())
-	{
-		sendError(client, "461", "JOIN :Not enough parameters");
-		return;
-	}
-
-	std::istringstream iss(args);
-	std::string channelName;
-	std::string providedKey;
-
-	while (std::getline(iss, channelName, ','))
-	{
-		size_t spacePos = channelName.find(' ');
-		if (spacePos != std::string::npos)
-		{
-			providedKey = channelName.substr(spacePos + 1);
-			channelName = channelName.substr(0, spacePos);
-		}
-		else
-		{
-			providedKey.clear();
-		}
-
-		if (!isValidChannelName(channelName))
-		{
-			sendError(client, "403", channelName + " :No such channel");
-			continue;
-		}
-
-		Channel *channel;
-		bool isNewChannel = false;
-
-		if (!channelExists(channelName))
-		{
-			channel = createChannel(channelName);
-			channel->setTopic("");
-			isNewChannel = true;
-		}
-		else
-		{
-			channel = getChannel(channelName);
-		}
-
-		if (channel->hasClient(client))
-			continue;
-
-		if (channel->isInviteOnly() && !channel->isInvited(client))
-		{
-			sendError(client, "473", channelName + " :Cannot join channel (+i)");
-			continue;
-		}
-
-		if (channel->hasKey() && (providedKey.empty() || providedKey != channel->getKey()))
-		{
-			sendError(client, "475", channelName + " :Cannot join channel (+k)");
-			continue;
-		}
-
-		channel->addClient(client);
-
-		if (isNewChannel)
-			channel->addOperator(client);
-
-		sendToClient(client, ":" + client->getFullMask() + " JOIN :" + channelName);
-
-		sendToClient(client, ":ircserver 332 " + client->getNickname() + " " + channelName + " :" + channel->getTopic());
-
-		std::string namesList;
-		const std::set<Client *> &clientsInChannel = channel->getClients();
-		for (std::set<Client *>::const_iterator it = clientsInChannel.begin(); it != clientsInChannel.end(); ++it)
-		{
-			Client *c = *it;
-			if (channel->isOperator(c))
-				namesList += "@";
-			namesList += c->getNickname() + " ";
-		}
-
-		if (!namesList.empty() && namesList[namesList.length() - 1] == ' ')
-			namesList = namesList.substr(0, namesList.length() - 1);
-
-		sendToClient(client, ":ircserver 353 " + client->getNickname() + " = " + channelName + " :" + namesList);
-		sendToClient(client, ":ircserver 366 " + client->getNickname() + " " + channelName + " :End of NAMES list");
-
-		broadcastToChannels(channel, ":" + client->getFullMask() + " JOIN :" + channelName, client, true);
-	}
-}
-
-void Server::sendToClient(Client *client, const std::string &message)
-{
-	int fd = client->getFd();
-	std::string fullMsg = message;
-	if (fullMsg.length() < 2 || fullMsg.substr(fullMsg.length() - 2) != "\r\n")
-		fullMsg += "\r\n";
-
-	size_t totalSent = 0;
-	size_t toSend = fullMsg.length();
-	const char *data = fullMsg.c_str();
-
-	while (totalSent < toSend)
-	{
-		int sent = send(fd, data + totalSent, toSend - totalSent, 0);
-		if (sent <= 0)
-		{
-			break;
-		}
-		totalSent += sent;
-	}
-}
-
-bool Server::isNicknameInUse(const std::string &nick)
-{
-	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-	{
-		if (it->second->getNickname() == nick)
-			return true;
-	}
-	return false;
-}
-
-void Server::checkRegistration(Client *client)
-{
-	bool passOk = _password.empty() || client->hasSentPass();
-	bool nickOk = client->hasSentNick();
-	bool userOk = client->hasSentUser();
-
-	if (passOk && nickOk && userOk && !client->isRegistered())
-	{
-		client->markRegistered();
-		std::cout << "🎉 Client [" << client->getFd() << "] (" << client->getNickname() << ") is now registered!" << std::endl;
-
-		sendToClient(client, "001 " + client->getNickname() + " :Welcome to the IRC Network " + client->getNickname() + "!" + client->getUsername() + "@localhost");
-		sendToClient(client, "002 " + client->getNickname() + " :Your host is ircserver, running version 1.0");
-		sendToClient(client, "003 " + client->getNickname() + " :This server was created today");
-		sendToClient(client, "004 " + client->getNickname() + " ircserver 1.0 o o");
-	}
-}
-
-void Server::handlePrivMsgCommand(Client *client, const std::string &args)
-{
-	if (args.empty())
-	{
-		sendToClient(client, "461 * PRIVMSG :Not enough parameters");
-		return;
-	}
-	size_t spacePos = args.find(' ');
-	if (spacePos == std::string::npos)
-	{
-		sendToClient(client, "412 * PRIVMSG :No text to send");
-		return;
-	}
-
-	std::string receiver = args.substr(0, spacePos);
-	std::string message = args.substr(spacePos + 1);
-	if (message.empty() || message[0] != ':')
-	{
-		sendToClient(client, "412 * PRIVMSG :No text to send");
-		return;
-	}
-	message = message.substr(1);
-
-	if (receiver[0] == '#')
-	{
-		if (!channelExists(receiver))
-		{
-			sendToClient(client, "403 " + client->getNickname() + " " + receiver + " :No such channel");
-			return;
-		}
-		Channel *channel = getChannel(receiver);
-		if (!channel->hasClient(client))
-		{
-			sendToClient(client, "404 " + client->getNickname() + " " + receiver + " :Cannot send to channel");
-			return;
-		}
-		broadcastToChannels(channel, ":" + client->getFullMask() + " PRIVMSG " + receiver + " :" + message, client, true);
-	}
-	else
-	{
-		Client *target = getClientByNick(receiver);
-		if (!target)
-		{
-			sendToClient(client, "401 " + client->getNickname() + " " + receiver + " :No such nickname");
-			return;
-		}
-		sendToClient(target, ":" + client->getFullMask() + " PRIVMSG " + receiver + " :" + message);
-	}
-}
-
-bool Server::channelExists(const std::string &name) const
-{
-	return _channels.find(name) != _channels.end();
-}
-
-Channel *Server::getChannel(const std::string &name)
-{
-	std::map<std::string, Channel *>::iterator it = _channels.find(name);
-	if (it != _channels.end())
-		return it->second;
-	return NULL;
-}
-
-Channel *Server::createChannel(const std::string &name)
-{
-	if (channelExists(name))
-		return getChannel(name);
-	Channel *newChannel = new Channel(name);
-	_channels[name] = newChannel;
-	return newChannel;
-}
-
-void Server::removeChannel(const std::string &name)
-{
-	std::map<std::string, Channel *>::iterator it = _channels.find(name);
-	if (it != _channels.end())
-	{
-		delete it->second;
-		_channels.erase(it);
-	}
-}
-
-void Server::broadcastToChannels(Channel *channel, const std::string &message, Client *sender, bool skipSender)
-{
-	const std::set<Client *> &clients = channel->getClients();
-	for (std::set<Client *>::const_iterator it = clients.begin(); it != clients.end(); ++it)
-	{
-		Client *client = *it;
-		if (client == sender && skipSender)
-			continue;
-		sendToClient(client, message);
-	}
-}
-
-void Server::sendReply(Client *client, const std::string &message)
-{
-	sendToClient(client, ":" + client->getNickname() + " " + message);
-}
-
-void Server::sendError(Client *client, const std::string &errorCode, const std::string &errorMsg)
-{
-	std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
-	std::string fullMsg = ":" + std::string("ircserver") + " " + errorCode + " " + nick + " " + errorMsg;
-
-	sendToClient(client, fullMsg);
-}
-
-bool Server::isValidChannelName(const std::string &name)
-{
-	if (name.empty() || name[0] != '#')
-		return false;
-	if (name.length() > 50)
-		return false;
-	if (name.find_first_of(" ,:") != std::string::npos)
-		return false;
-	return true;
-}
-
-Client *Server::getClientByNick(const std::string &nickname)
-{
-	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
-	{
-		if (it->second->getNickname() == nickname)
-		{
-			return it->second;
-		}
-	}
-	return NULL;
-}
+#include "Server.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <cctype>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+#include "OperatorCommands.hpp"
+#include "HistoryCommands.hpp"
+#include "ListCommands.hpp"
+#include "WhoCommands.hpp"
+#include "MonitorCommands.hpp"
+#include "Secrets.hpp"
+
+// Bytes a ReplyStream adds per loop tick, once the client has drained the previous chunk
+static const size_t REPLY_STREAM_CHUNK = 32 * 1024;
+
+Server::Server(int port, const std::string &password, const ServerConfig &config) : _port(port), _password(password),
+																						_config(config), _sockets(&SystemSockets::instance()),
+																						_handshakeBudget(0),
+																						_useUring(false), _currentLink(NULL), _nextSessionExpiry(0), _nextCompaction(0),
+																						_saslSerial(0), _nextFilterId(1), _filter(NULL), _filterGeneration(0),
+																						_compression(), _publishFrames(0),
+																						_publishMessages(0), _overload(OVERLOAD_NORMAL), _loopLagNs(0),
+																						_lastTickNs(0), _tickStart(0), _overloadSince(0), _overloadTotals(),
+																						_nextNotice(0) {}
+
+Server::~Server()
+{
+	// Delete all dynamically allocated clients
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		TlsContext::destroySession(it->second->getSsl());
+		delete it->second;
+	}
+	_clients.clear();
+	for (std::map<std::string, Client *>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+		delete it->second;
+	_remoteClients.clear();
+	for (std::map<std::string, Client *>::iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+	{
+		if (it->second->isDetached())
+			delete it->second;
+	}
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		delete it->second;
+	}
+	_channels.clear();
+	for (std::map<int, ReplyStream *>::iterator it = _replyStreams.begin(); it != _replyStreams.end(); ++it)
+		delete it->second;
+	delete _filter;
+	for (size_t i = 0; i < _listeners.size(); ++i)
+	{
+		_sockets->close(_listeners[i].fd);
+		if (!_listeners[i].host.empty() && _listeners[i].host[0] == '/')
+			unlink(_listeners[i].host.c_str());
+	}
+}
+
+// Unix socket at `path`, replacing one left behind by an earlier run
+static int openUnixListener(const std::string &path)
+{
+	struct sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+	{
+		std::cerr << "Unix socket path too long: " << path << std::endl;
+		exit(1);
+	}
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		perror("socket");
+		exit(1);
+	}
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path.c_str());
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("bind");
+		exit(1);
+	}
+	return fd;
+}
+
+// An empty host binds every address: IPv6 with IPv4-mapped addresses on the
+// same socket, or plain IPv4 where the system has no IPv6. An explicit
+// address binds that address alone.
+int Server::openListener(const std::string &host, int port)
+{
+	int fd;
+	if (!host.empty() && host[0] == '/')
+		fd = openUnixListener(host);
+	else
+	{
+		struct sockaddr_storage addr;
+		socklen_t addrLen;
+		std::memset(&addr, 0, sizeof(addr));
+		struct sockaddr_in *v4 = reinterpret_cast<struct sockaddr_in *>(&addr);
+		struct sockaddr_in6 *v6 = reinterpret_cast<struct sockaddr_in6 *>(&addr);
+		if (host.find(':') != std::string::npos || host.empty())
+		{
+			v6->sin6_family = AF_INET6;
+			v6->sin6_port = htons(port);
+			v6->sin6_addr = in6addr_any;
+			addrLen = sizeof(*v6);
+			if (!host.empty() && inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) != 1)
+			{
+				std::cerr << "Invalid IPv6 address: " << host << std::endl;
+				exit(1);
+			}
+		}
+		else
+		{
+			v4->sin_family = AF_INET;
+			v4->sin_port = htons(port);
+			addrLen = sizeof(*v4);
+			if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) != 1)
+			{
+				std::cerr << "Invalid IPv4 address: " << host << std::endl;
+				exit(1);
+			}
+		}
+
+		fd = socket(addr.ss_family, SOCK_STREAM, 0);
+		if (fd < 0 && host.empty() && errno == EAFNOSUPPORT)
+		{
+			std::memset(&addr, 0, sizeof(addr));
+			v4->sin_family = AF_INET;
+			v4->sin_addr.s_addr = INADDR_ANY;
+			v4->sin_port = htons(port);
+			addrLen = sizeof(*v4);
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+		}
+		if (fd < 0)
+		{
+			perror("socket");
+			exit(1);
+		}
+
+		// Set socket options
+		int opt = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+		{
+			perror("setsockopt");
+			exit(1);
+		}
+		int v6only = !host.empty();
+		if (addr.ss_family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0)
+		{
+			perror("setsockopt");
+			exit(1);
+		}
+		if (bind(fd, (struct sockaddr *)&addr, addrLen) < 0)
+		{
+			perror("bind");
+			exit(1);
+		}
+	}
+
+	// Make socket non-blocking
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+	{
+		perror("fcntl");
+		exit(1);
+	}
+	// A connection storm (reconnects after a netsplit) must not overflow the
+	// accept queue: dropped SYNs are only retried after a second
+	if (listen(fd, SOMAXCONN) < 0)
+	{
+		perror("listen");
+		exit(1);
+	}
+	return fd;
+}
+
+void Server::addListener(const std::string &host, int port, ListenerKind kind)
+{
+	static const char *const kinds[] = {"", " (TLS)", " (WebSocket)", " (WebSocket over TLS)", " (publish API)"};
+	Listener listener = {openListener(host, port), port, kind, host};
+	_listeners.push_back(listener);
+	if (!host.empty() && host[0] == '/')
+		std::cout << "✅ Listening on " << host << kinds[kind] << std::endl;
+	else if (host.empty())
+		std::cout << "✅ Listening on port " << port << kinds[kind] << std::endl;
+	else if (host.find(':') != std::string::npos)
+		std::cout << "✅ Listening on [" << host << "]:" << port << kinds[kind] << std::endl;
+	else
+		std::cout << "✅ Listening on " << host << ":" << port << kinds[kind] << std::endl;
+}
+
+const Listener *Server::findListener(int fd) const
+{
+	for (size_t i = 0; i < _listeners.size(); ++i)
+	{
+		if (_listeners[i].fd == fd)
+			return &_listeners[i];
+	}
+	return NULL;
+}
+
+static volatile sig_atomic_t g_restartRequested = 0;
+
+static void requestRestart(int)
+{
+	g_restartRequested = 1;
+}
+
+void Server::start()
+{
+	if (_config.needsTls() &&
+		!_tls.init(_config.tlsCert, _config.tlsKey, _config.tlsSessionCacheSize, _config.tlsSessionTimeout))
+		exit(1);
+
+	if (_config.resumeFd >= 0)
+	{
+		// Started by a hot restart: listeners and connections come from the previous process
+		if (!restoreSnapshot(_config.resumeFd))
+		{
+			std::cerr << "Hot restart: could not restore the previous state" << std::endl;
+			exit(1);
+		}
+	}
+	else
+	{
+		addListener("", _port, LISTENER_PLAIN);
+		if (_config.tlsPort)
+			addListener("", _config.tlsPort, LISTENER_TLS);
+		if (_config.websocketPort)
+			addListener("", _config.websocketPort, LISTENER_WEBSOCKET);
+		if (_config.websocketTlsPort)
+			addListener("", _config.websocketTlsPort, LISTENER_WEBSOCKET_TLS);
+		for (size_t i = 0; i < _config.listens.size(); ++i)
+			addListener(_config.listens[i].host, _config.listens[i].port, _config.listens[i].kind);
+	}
+
+	if (!_config.accountsFile.empty() && !loadAccounts(_config.accountsFile))
+		exit(1);
+	// After a hot restart the rules come from the snapshot, runtime changes included
+	if (_config.resumeFd < 0 && !_config.filtersFile.empty() && !loadFilters(_config.filtersFile))
+		exit(1);
+	if (!_workers.start(_config.workerThreads))
+		exit(1);
+	// Only this thread: the workers, started above, stay off the event loop's core
+	if (_config.pinCpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(_config.pinCpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+			perror("sched_setaffinity");
+	}
+
+	if (_config.ioEngine == "uring")
+	{
+		if (!UringEngine::isAvailable() ||
+			!_uring.init(4096, _config.uringBuffers, _config.uringBufferSize))
+		{
+			std::cerr << "io_uring is not available on this system" << std::endl;
+			exit(1);
+		}
+		_useUring = true;
+	}
+	// Simple event loop to keep server running
+	std::cout << "Server is running (" << _config.ioEngine << "). Press Ctrl+C to stop." << std::endl;
+	for (size_t i = 0; i < _listeners.size(); ++i)
+		_pollFds.push_back(pollEntry(_listeners[i].fd, POLLIN));
+	_pollFds.push_back(pollEntry(_workers.notifyFd(), POLLIN));
+	if (_useUring)
+		_uring.addPollable(_workers.notifyFd(), POLLIN);
+	// Connections restored by a hot restart, with any output the old process had not sent yet
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (_useUring)
+			_uring.addStream(it->first);
+		// WebSocket output in the snapshot is framed already
+		if (it->second->getWebSocket())
+		{
+			if (!it->second->getSendQueue().empty())
+				_pendingSends.insert(it->first);
+			continue;
+		}
+		std::string pending;
+		pending.swap(it->second->getSendQueue());
+		if (!pending.empty())
+		{
+			struct iovec part = {const_cast<char *>(pending.data()), pending.size()};
+			sendParts(it->second, &part, 1);
+		}
+	}
+	signal(SIGUSR2, requestRestart);
+	connectLinks();
+	if (_useUring)
+		runUringLoop();
+	else
+		runPollLoop();
+}
+
+void Server::runPollLoop()
+{
+	while (pollOnce(loopTimeout()))
+	{
+	}
+}
+
+// One iteration of the poll loop; false when the loop cannot go on
+bool Server::pollOnce(int timeoutMs)
+{
+	flushQueuedSends();
+	int ret = _sockets->poll(&_pollFds[0], _pollFds.size(), timeoutMs);
+	if (g_restartRequested)
+	{
+		g_restartRequested = 0;
+		hotRestart();
+		return true;
+	}
+	if (ret < 0)
+	{
+		if (errno == EINTR)
+			return true;
+		perror("poll");
+		return false;
+	}
+	startTick();
+	// Handshakes are CPU heavy: cap them per tick so established clients keep being served
+	_handshakeBudget = _config.tlsHandshakesPerTick;
+	processBacklog();
+	for (size_t i = 0; i < _pollFds.size(); ++i)
+	{
+		if (_pollFds[i].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR))
+		{
+			if (_pollFds[i].revents & POLLOUT)
+				_pendingSends.insert(_pollFds[i].fd);
+			const Listener *listener = findListener(_pollFds[i].fd);
+			if (listener)
+				handleNewConnection(*listener);
+			else if (_pollFds[i].fd == _workers.notifyFd())
+				processWorkerResults();
+			else
+				handleClientData(_pollFds[i].fd);
+		}
+	}
+	connectLinks();
+	compactIdleClients();
+	expireSessions();
+	finishTick();
+	return true;
+}
+
+void Server::attachSockets(SocketLayer *sockets, int listenFd)
+{
+	_sockets = sockets;
+	Listener listener = {listenFd, 0, LISTENER_PLAIN, "simulated"};
+	_listeners.push_back(listener);
+	_pollFds.push_back(pollEntry(listenFd, POLLIN));
+}
+
+void Server::runOnce(int timeoutMs)
+{
+	pollOnce(timeoutMs);
+	flushQueuedSends();
+}
+
+// io_uring loop: accepts and plaintext reads arrive as completions, so a busy
+// tick costs one io_uring_enter for all reads, accepts and sends together.
+void Server::runUringLoop()
+{
+	for (size_t i = 0; i < _listeners.size(); ++i)
+		_uring.addListener(_listeners[i].fd);
+
+	std::vector<IoEvent> events;
+	while (true)
+	{
+		flushQueuedSends();
+		if (_uring.wait(events, loopTimeout()) < 0)
+		{
+			perror("io_uring_enter");
+			break;
+		}
+		startTick();
+		_handshakeBudget = _config.tlsHandshakesPerTick;
+		processBacklog();
+		for (size_t i = 0; i < events.size(); ++i)
+			handleIoEvent(events[i]);
+		connectLinks();
+		compactIdleClients();
+		expireSessions();
+		finishTick();
+		if (g_restartRequested)
+		{
+			g_restartRequested = 0;
+			hotRestart();
+		}
+	}
+}
+
+void Server::handleIoEvent(const IoEvent &event)
+{
+	if (event.type == IO_ACCEPT)
+	{
+		const Listener *listener = findListener(event.fd);
+		if (listener)
+			registerConnection(*listener, event.result);
+		else
+			close(event.result);
+		return;
+	}
+	if (event.fd == _workers.notifyFd())
+	{
+		processWorkerResults();
+		return;
+	}
+	// An earlier event of this batch may have dropped the client and its fd been reused
+	if (!_uring.isCurrent(event))
+		return;
+	std::map<int, Client *>::iterator it = _clients.find(event.fd);
+	if (it == _clients.end())
+		return;
+	Client *client = it->second;
+
+	switch (event.type)
+	{
+	case IO_DATA:
+		if (event.result == 0)
+			connectionLost(event.fd);
+		else
+			processInput(client, event.data, event.result);
+		break;
+	case IO_READY:
+		if (event.result & POLLOUT)
+			_pendingSends.insert(event.fd);
+		handleClientData(event.fd);
+		break;
+	case IO_SENT:
+		client->setSendInFlight(false);
+		if (event.result < 0)
+			connectionLost(event.fd, "Write error");
+		else if (client->pendingOutput())
+			_pendingSends.insert(event.fd);
+		break;
+	default:
+		connectionLost(event.fd);
+		break;
+	}
+}
+
+// End of a loop tick: everything queued for a client goes out in a single write
+// (or a single io_uring submission), however many replies produced it
+void Server::flushQueuedSends()
+{
+	pumpReplyStreams();
+	pumpFanout();
+	// Dropping a client queues QUIT lines for others, which are flushed in the next round
+	while (!_pendingSends.empty())
+	{
+		std::set<int> pending;
+		pending.swap(_pendingSends);
+		for (std::set<int>::iterator it = pending.begin(); it != pending.end(); ++it)
+		{
+			std::map<int, Client *>::iterator client = _clients.find(*it);
+			std::string error;
+			if (client != _clients.end() && !writeQueued(client->second, error))
+			{
+				if (error == "Write error")
+					connectionLost(*it, error);
+				else
+					disconnectClient(*it, error);
+			}
+		}
+	}
+}
+
+void Server::startReplyStream(Client *client, ReplyStream *stream)
+{
+	int fd = client->getFd();
+	std::map<int, ReplyStream *>::iterator it = _replyStreams.find(fd);
+	if (it != _replyStreams.end())
+		delete it->second;
+	if (stream->produce(this, client, REPLY_STREAM_CHUNK))
+		_replyStreams[fd] = stream;
+	else
+	{
+		delete stream;
+		_replyStreams.erase(fd);
+	}
+}
+
+// A stream advances only once its client has (nearly) drained what it got last time
+bool Server::hasReadyStreams() const
+{
+	if (_overload == OVERLOAD_CRITICAL)
+		return false;
+	for (std::map<int, ReplyStream *>::const_iterator it = _replyStreams.begin(); it != _replyStreams.end(); ++it)
+	{
+		std::map<int, Client *>::const_iterator client = _clients.find(it->first);
+		if (client != _clients.end() && !client->second->isSendInFlight() &&
+			client->second->pendingOutput() < REPLY_STREAM_CHUNK)
+			return true;
+	}
+	return false;
+}
+
+void Server::pumpReplyStreams()
+{
+	if (_overload == OVERLOAD_CRITICAL)
+		return;
+	std::map<int, ReplyStream *>::iterator it = _replyStreams.begin();
+	while (it != _replyStreams.end())
+	{
+		Client *client = _clients[it->first];
+		if (client->isSendInFlight() || client->pendingOutput() >= REPLY_STREAM_CHUNK ||
+			it->second->produce(this, client, REPLY_STREAM_CHUNK))
+		{
+			++it;
+			continue;
+		}
+		delete it->second;
+		_replyStreams.erase(it++);
+	}
+}
+
+// Bytes ready for the socket: the send queue itself or, on a compressed stream,
+// its DEFLATE output. Queued text is compressed here, so every flush of a tick
+// ends in one sync flush instead of one per line.
+std::string &Server::wireQueue(Client *client)
+{
+	StreamCompressor *compressor = client->getCompressor();
+	std::string &queue = client->getSendQueue();
+	if (!compressor)
+		return queue;
+	std::string &wire = compressor->getWire();
+	if (!queue.empty())
+	{
+		size_t before = wire.size();
+		long long start = StreamCompressor::cpuTimeNs();
+		compressor->compress(queue.data(), queue.size(), wire);
+		_compression.deflateNs += StreamCompressor::cpuTimeNs() - start;
+		_compression.plainOut += queue.size();
+		_compression.wireOut += wire.size() - before;
+		queue.clear();
+	}
+	return wire;
+}
+
+bool Server::inflateInput(Client *client, const char *data, size_t size, std::string &out)
+{
+	long long start = StreamCompressor::cpuTimeNs();
+	bool ok = client->getCompressor()->decompress(data, size, out);
+	_compression.inflateNs += StreamCompressor::cpuTimeNs() - start;
+	_compression.wireIn += size;
+	_compression.plainIn += out.size();
+	return ok;
+}
+
+// Returns false (with a quit reason) if the connection has to be dropped
+bool Server::writeQueued(Client *client, std::string &error)
+{
+	if (client->isLinkConnecting() || client->isTlsHandshaking())
+		return true;
+	std::string &queue = wireQueue(client);
+	if (queue.empty())
+		return true;
+	if (!client->isServerLink() && queue.size() > static_cast<size_t>(_config.sendQueueMax))
+	{
+		error = "Max SendQ exceeded";
+		return false;
+	}
+	int fd = client->getFd();
+	if (_useUring && !client->getSsl())
+	{
+		if (!client->isSendInFlight())
+		{
+			_uring.send(fd, queue);
+			client->setSendInFlight(true);
+		}
+		return true;
+	}
+
+	size_t written = 0;
+	bool blocked = false;
+	while (written < queue.size())
+	{
+		int sent;
+		if (client->getSsl())
+		{
+			TlsStatus status;
+			sent = _tls.write(client->getSsl(), queue.data() + written, queue.size() - written, status);
+			blocked = status == TLS_WANT_WRITE || status == TLS_WANT_READ;
+		}
+		else
+		{
+			sent = _sockets->send(fd, queue.data() + written, queue.size() - written);
+			blocked = sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+		if (sent <= 0)
+			break;
+		written += sent;
+	}
+	queue.erase(0, written);
+	if (!queue.empty() && !blocked)
+	{
+		error = "Write error";
+		return false;
+	}
+
+	// Leftover output: wait for the socket to drain instead of spinning on it.
+	// A drained queue gives its storage back: most connections are idle between
+	// bursts, and the welcome burst alone would otherwise stay with each of them
+	if (queue.empty())
+	{
+		std::string().swap(queue);
+		if (_blockedWrites.erase(fd))
+			setPollEvents(fd, POLLIN);
+	}
+	else if (_blockedWrites.insert(fd).second)
+		setPollEvents(fd, POLLIN | POLLOUT);
+	return true;
+}
+
+// handle new connections
+
+void Server::handleNewConnection(const Listener &listener)
+{
+	int clientFd = _sockets->accept(listener.fd);
+	if (clientFd < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			perror("accept");
+		return;
+	}
+	registerConnection(listener, clientFd);
+}
+
+// The peer address as the client's host: IPv4-mapped IPv6 peers of a dual-stack
+// listener show as plain IPv4, Unix socket peers as localhost
+static void setPeerHostname(Client *client, SocketLayer &sockets)
+{
+	struct sockaddr_storage peer;
+	char address[INET6_ADDRSTRLEN];
+	if (!sockets.peerAddress(client->getFd(), peer))
+		return;
+	if (peer.ss_family == AF_UNIX)
+		client->setHostname("localhost");
+	else if (peer.ss_family == AF_INET)
+	{
+		if (inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in *>(&peer)->sin_addr, address, sizeof(address)))
+			client->setHostname(address);
+	}
+	else if (peer.ss_family == AF_INET6)
+	{
+		const struct in6_addr &v6 = reinterpret_cast<struct sockaddr_in6 *>(&peer)->sin6_addr;
+		bool mapped = IN6_IS_ADDR_V4MAPPED(&v6);
+		if (!inet_ntop(mapped ? AF_INET : AF_INET6, mapped ? static_cast<const void *>(&v6.s6_addr[12]) : &v6,
+					   address, sizeof(address)))
+			return;
+		// A host starting with ':' would read as a trailing parameter (::1 -> 0::1)
+		client->setHostname(address[0] == ':' ? "0" + std::string(address) : std::string(address));
+	}
+}
+
+// --latency, --busy-poll and --socket-buffer on an accepted TCP socket. These
+// are hints: a kernel that refuses one (SO_BUSY_POLL above net.core.busy_read
+// needs CAP_NET_ADMIN) leaves the default in place.
+static void tuneSocket(int fd, const ServerConfig &config)
+{
+	int on = 1;
+	if (config.latencyMode)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (config.socketBuffer)
+	{
+		int size = config.socketBuffer;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+#ifdef SO_BUSY_POLL
+	if (config.busyPoll)
+	{
+		int usec = config.busyPoll;
+		setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+	}
+#endif
+}
+
+void Server::registerConnection(const Listener &listener, int clientFd)
+{
+	Client *client = new Client(clientFd);
+	if (listener.kind == LISTENER_WEBSOCKET || listener.kind == LISTENER_WEBSOCKET_TLS)
+		client->setWebSocket(new WebSocket());
+	if (listener.kind == LISTENER_PUBLISH)
+		client->markPublisher();
+	if (listener.kind == LISTENER_TLS || listener.kind == LISTENER_WEBSOCKET_TLS)
+	{
+		SSL *ssl = _tls.createSession(clientFd);
+		if (!ssl)
+		{
+			std::cerr << "TLS session setup failed for fd=" << clientFd << std::endl;
+			delete client;
+			close(clientFd);
+			return;
+		}
+		client->setSsl(ssl);
+	}
+	setPeerHostname(client, *_sockets);
+	if (listener.host.empty() || listener.host[0] != '/')
+		tuneSocket(clientFd, _config);
+	_pollFds.push_back(pollEntry(clientFd, POLLIN));
+	_clients[clientFd] = client;
+	if (_useUring)
+	{
+		// TLS needs readiness notifications; plaintext reads go straight into provided buffers
+		if (client->getSsl())
+			_uring.addPollable(clientFd, POLLIN);
+		else
+			_uring.addStream(clientFd);
+	}
+	std::cout << "🔌 New client connected: fd=" << clientFd << (client->getSsl() ? " (TLS)" : "")
+			  << (client->getWebSocket() ? " (WebSocket)" : "") << std::endl;
+}
+
+// Wake up periodically while server links are configured (to retry dropped ones) or
+// clients are connected (to compact idle buffers), and not at all while a long
+// reply can still make progress
+int Server::loopTimeout() const
+{
+	// Latency mode never sleeps in the kernel: the wakeup costs more than the spin
+	if (_config.latencyMode || hasReadyStreams() || !_inputBacklog.empty() || !_fanout.empty() ||
+		(_overload == OVERLOAD_NORMAL && !_deferredCommands.empty()))
+		return 0;
+	// Overloaded: keep ticking so the lag estimate can fall and the server recover
+	if (_overload != OVERLOAD_NORMAL)
+		return 100;
+	return _config.links.empty() && _clients.empty() && _sessions.empty() ? -1 : 1000;
+}
+
+void Server::setPollEvents(int fd, short events)
+{
+	for (size_t i = 0; i < _pollFds.size(); ++i)
+	{
+		if (_pollFds[i].fd == fd)
+		{
+			_pollFds[i].events = events;
+			break;
+		}
+	}
+	if (_useUring)
+		_uring.updatePollable(fd, events);
+}
+
+void Server::disconnectClient(int clientFd, const std::string &reason)
+{
+	std::cout << "❌ Client disconnected: fd=" << clientFd << std::endl;
+	forgetFd(clientFd);
+	std::map<int, Client *>::iterator it = _clients.find(clientFd);
+	if (it != _clients.end())
+	{
+		Client *client = it->second;
+		// Best effort for lines queued right before the drop (ERROR, KILL notices)
+		std::string &queue = wireQueue(client);
+		if (!queue.empty() && !client->isSendInFlight() && !client->isTlsHandshaking() && !client->isLinkConnecting())
+		{
+			TlsStatus status;
+			if (client->getSsl())
+				_tls.write(client->getSsl(), queue.data(), queue.size(), status);
+			else
+				_sockets->send(clientFd, queue.data(), queue.size());
+		}
+		if (client->isServerLink())
+			handleNetsplit(client);
+		else if (client->getLinkName().empty())
+			quitClient(client, reason);
+		const LinkConfig *link = findLinkConfig(client->getLinkName());
+		if (link && !link->host.empty())
+			_linkRetryAt[link->name] = time(NULL) + 10;
+		TlsContext::destroySession(client->getSsl());
+		forgetSession(client);
+		delete it->second;
+		_clients.erase(it);
+	}
+	_sockets->close(clientFd);
+}
+
+// Everything the event loop keeps per file descriptor
+void Server::forgetFd(int clientFd)
+{
+	for (std::vector<pollfd>::iterator it = _pollFds.begin(); it != _pollFds.end(); ++it)
+	{
+		if (it->fd == clientFd)
+		{
+			_pollFds.erase(it);
+			break;
+		}
+	}
+	if (_useUring)
+		_uring.removeFd(clientFd);
+	_pendingSends.erase(clientFd);
+	_blockedWrites.erase(clientFd);
+	forgetOverloadState(clientFd);
+	std::map<int, ReplyStream *>::iterator stream = _replyStreams.find(clientFd);
+	if (stream != _replyStreams.end())
+	{
+		delete stream->second;
+		_replyStreams.erase(stream);
+	}
+}
+
+// Returns false if the client was dropped
+bool Server::continueTlsHandshake(Client *client)
+{
+	// Out of budget: poll is level-triggered, so the client comes back next tick
+	if (_handshakeBudget <= 0)
+		return true;
+	_handshakeBudget--;
+
+	int fd = client->getFd();
+	switch (_tls.handshake(client->getSsl()))
+	{
+	case TLS_OK:
+		client->markTlsHandshakeDone();
+		setPollEvents(fd, POLLIN);
+		std::cout << "🔒 TLS handshake done: fd=" << fd << " (" << _tls.getResumedCount() << "/"
+				  << _tls.getHandshakeCount() << " resumed)" << std::endl;
+		return true;
+	case TLS_WANT_READ:
+		setPollEvents(fd, POLLIN);
+		return true;
+	case TLS_WANT_WRITE:
+		setPollEvents(fd, POLLIN | POLLOUT);
+		return true;
+	default:
+		disconnectClient(fd);
+		return false;
+	}
+}
+
+// Returns the number of bytes read, 0 when the connection is gone, -1 when there is nothing to read yet
+int Server::recvFromClient(Client *client, char *buffer, size_t size)
+{
+	if (!client->getSsl())
+	{
+		// EAGAIN is not a lost connection: the loop also lands here when a
+		// connection with blocked output became writable
+		int bytesRead = _sockets->recv(client->getFd(), buffer, size);
+		if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return -1;
+		return bytesRead < 0 ? 0 : bytesRead;
+	}
+	TlsStatus status;
+	int bytesRead = _tls.read(client->getSsl(), buffer, size, status);
+	if (status == TLS_OK)
+		return bytesRead;
+	if (status == TLS_CLOSED)
+		return 0;
+	return -1;
+}
+
+// handle client data
+
+void Server::handleClientData(int clientFd)
+{
+	char tempBuffer[512];
+	Client *client = _clients[clientFd];
+
+	if (client->isLinkConnecting())
+	{
+		finishLinkConnect(client);
+		return;
+	}
+	if (client->isTlsHandshaking())
+	{
+		// Application data may arrive in the same flight as the last handshake message
+		if (!continueTlsHandshake(client) || client->isTlsHandshaking())
+			return;
+	}
+
+	// Over its input budget: new data stays in the socket until the held lines are handled
+	if (_inputBacklog.count(clientFd) && inputBudget(client))
+		return;
+
+	// Read new data from the socket. TLS records are decrypted in chunks,
+	// so keep reading until the TLS layer has nothing buffered.
+	std::string receivedData;
+	while (true)
+	{
+		memset(tempBuffer, 0, sizeof(tempBuffer));
+		int bytesRead = recvFromClient(client, tempBuffer, sizeof(tempBuffer) - 1);
+		if (bytesRead == 0)
+		{
+			connectionLost(clientFd);
+			return;
+		}
+		if (bytesRead < 0)
+			break;
+		receivedData.append(tempBuffer, bytesRead);
+		if (!client->getSsl())
+			break;
+	}
+	if (receivedData.empty())
+		return;
+	processInput(client, receivedData.data(), receivedData.size());
+}
+
+// Split received bytes into IRC lines and dispatch them (shared by every I/O backend)
+void Server::processInput(Client *client, const char *data, size_t size)
+{
+	int clientFd = client->getFd();
+
+	client->touch(time(NULL));
+	if (client->isPublisher())
+	{
+		processPublishInput(client, data, size);
+		return;
+	}
+
+	// 0. WebSocket frames are unwrapped into lines; the upgrade response, pongs
+	// and the closing handshake go out as they are
+	std::string decoded;
+	bool closing = false;
+	WebSocket *websocket = client->getWebSocket();
+	if (websocket && size)
+	{
+		std::string reply;
+		closing = websocket->receive(data, size, decoded, reply) == WS_CLOSE;
+		if (!reply.empty())
+		{
+			client->getSendQueue() += reply;
+			_pendingSends.insert(clientFd);
+		}
+		data = decoded.data();
+		size = decoded.size();
+	}
+
+	// A compressed stream is inflated first; everything below sees plain text
+	std::string inflated;
+	bool compressed = client->getCompressor() != NULL;
+	if (compressed && size)
+	{
+		if (!inflateInput(client, data, size, inflated))
+		{
+			disconnectClient(clientFd, "Decompression error");
+			return;
+		}
+		data = inflated.data();
+		size = inflated.size();
+	}
+
+	// 1. Append new data to the client's persistent buffer
+	std::string clientBuffer = client->getBuffer() + std::string(data, size);
+
+	// 2. Process all complete commands (ending in \n) from the buffer, up to
+	// the client's budget for this tick when the server is overloaded. A
+	// client already over it this tick waits for processBacklog.
+	size_t budget = inputBudget(client);
+	if (budget && _inputBacklog.count(clientFd))
+	{
+		client->setBuffer(clientBuffer);
+		if (closing)
+			disconnectClient(clientFd, "WebSocket closed");
+		return;
+	}
+	size_t handled = 0;
+	size_t pos;
+	while ((pos = clientBuffer.find('\n')) != std::string::npos)
+	{
+		if (budget && handled == budget)
+		{
+			_overloadTotals.throttled++;
+			_inputBacklog.insert(clientFd);
+			break;
+		}
+		// Extract a single command line from the buffer
+		std::string line = clientBuffer.substr(0, pos);
+
+		// Remove the processed command (and the \n) from the start of the buffer
+		clientBuffer.erase(0, pos + 1);
+
+		// Trim the trailing \r if it exists
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+
+		// Handle the command if it's not empty
+		if (!line.empty())
+		{
+			++handled;
+			if (!_config.latencyMode)
+				std::cout << "📨 [" << clientFd << "] " << line << std::endl;
+			handleCommand(client, line);
+			// The command may have dropped this connection (e.g. a refused server link),
+			// or RESUME moved it onto the session it reattached
+			std::map<int, Client *>::iterator it = _clients.find(clientFd);
+			if (it == _clients.end())
+				return;
+			client = it->second;
+			// COMPRESS took effect: whatever followed it in this read is already deflated
+			if (!compressed && client->getCompressor())
+			{
+				compressed = true;
+				std::string rest;
+				if (!inflateInput(client, clientBuffer.data(), clientBuffer.size(), rest))
+				{
+					disconnectClient(clientFd, "Decompression error");
+					return;
+				}
+				clientBuffer.swap(rest);
+			}
+		}
+	}
+	// 3. Save any remaining partial command back to the client's buffer
+	client->setBuffer(clientBuffer);
+	if (closing)
+		disconnectClient(clientFd, "WebSocket closed");
+}
+
+void Server::handleCommand(Client *client, const std::string &line)
+{
+	if (line.empty())
+		return;
+	if (client->isServerLink())
+	{
+		handleServerMessage(client, line);
+		return;
+	}
+
+	// Client tags (message-tags) are not relayed: drop them
+	if (line[0] == '@')
+	{
+		size_t start = line.find(' ');
+		if (start != std::string::npos && (start = line.find_first_not_of(' ', start)) != std::string::npos)
+			handleCommand(client, line.substr(start));
+		return;
+	}
+
+	std::string command;
+	std::string args;
+
+	size_t spacePos = line.find(' ');
+	if (spacePos == std::string::npos)
+	{
+		command = line;
+	}
+	else
+	{
+		command = line.substr(0, spacePos);
+		args = line.substr(spacePos + 1);
+	}
+	for (size_t i = 0; i < command.length(); ++i)
+	{
+		command[i] = std::toupper(command[i]);
+	}
+	if (_overload != OVERLOAD_NORMAL && deferCommand(client, command, line))
+		return;
+	if (command == "PASS")
+		handlePassCommand(client, args);
+	else if (command == "NICK")
+		handleNickCommand(client, args);
+	else if (command == "USER")
+		handleUserCommand(client, args);
+	else if (command == "JOIN")
+		handleJoinCommand(client, args);
+	else if (command == "PRIVMSG" || command == "NOTICE")
+		handlePrivMsgCommand(client, args, command);
+	else if (command == "KICK")
+		OperatorCommands::handleKickCommand(this, client, args);
+	else if (command == "MODE")
+		OperatorCommands::handleModeCommand(this, client, args);
+	else if (command == "INVITE")
+		OperatorCommands::handleInviteCommand(this, client, args);
+	else if (command == "TOPIC")
+		OperatorCommands::handleTopicCommand(this, client, args);
+	else if (command == "LIST")
+		ListCommands::handleListCommand(this, client, args);
+	else if (command == "WHO")
+		WhoCommands::handleWhoCommand(this, client, args);
+	else if (command == "WHOIS")
+		WhoCommands::handleWhoisCommand(this, client, args);
+	else if (command == "CAP")
+		handleCapCommand(client, args);
+	else if (command == "AUTHENTICATE")
+		handleAuthenticateCommand(client, args);
+	else if (command == "OPER")
+		handleOperCommand(client, args);
+	else if (command == "FILTER")
+		handleFilterCommand(client, args);
+	else if (command == "MEMSTATS")
+		handleMemStatsCommand(client, args);
+	else if (command == "STATS")
+		handleStatsCommand(client, args);
+	else if (command == "COMPRESS")
+		handleCompressCommand(client, args);
+	else if (command == "CHATHISTORY")
+		HistoryCommands::handleChatHistoryCommand(this, client, args);
+	else if (command == "MONITOR")
+		MonitorCommands::handleMonitorCommand(this, client, args);
+	else if (command == "RESUME")
+		handleResumeCommand(client, args);
+	else if (command == "QUIT")
+		disconnectClient(client->getFd(), "Quit: " + (args.size() > 1 && args[0] == ':' ? args.substr(1) : args));
+	else if (command == "SERVER")
+		handleServerCommand(client, args);
+	else if (!client->getLinkName().empty())
+		return; // outbound link waiting for the peer's SERVER line
+	else
+		sendToClient(client, "421 * " + command + " :Unknown command");
+}
+
+void Server::handlePassCommand(Client *client, const std::string &args)
+{
+	if (client->isRegistered())
+	{
+		sendError(client, "462", ":You may not reregister");
+		return;
+	}
+	if (_password.empty())
+	{
+		client->setPassAccepted(true);
+		std::cout << "✅ Client [" << client->getFd() << "] password accepted (no password required)" << std::endl;
+		checkRegistration(client);
+		return;
+	}
+	if (args == _password)
+	{
+		client->setPassAccepted(true);
+		std::cout << "✅ Client [" << client->getFd() << "] password accepted" << std::endl;
+	}
+	else
+	{
+		client->setPassAccepted(false);
+		sendToClient(client, "464 * :Password incorrect");
+		std::cout << "❌ Client [" << client->getFd() << "] wrong password" << std::endl;
+		return;
+	}
+
+	checkRegistration(client);
+}
+
+void Server::handleNickCommand(Client *client, const std::string &args)
+{
+	// During CAP negotiation the password may still arrive as a SASL login
+	if (!passwordSatisfied(client) && !client->isCapNegotiating())
+	{
+		sendError(client, "464", ":Password required");
+		return;
+	}
+	if (args.empty())
+	{
+		sendToClient(client, "431 * :No nickname given");
+		return;
+	}
+
+	std::string nick = args;
+	size_t spacePos = nick.find(' ');
+	if (spacePos != std::string::npos)
+	{
+		nick = nick.substr(0, spacePos);
+	}
+	if (isNicknameInUse(nick))
+	{
+		sendToClient(client, "433 * " + nick + " :Nickname is already in use");
+		return;
+	}
+	std::string oldNick = client->getNickname();
+	std::string oldMask = client->getFullMask();
+	client->setNickname(nick);
+	_userIndex.update(client);
+	if (client->isRegistered())
+	{
+		propagateToLinks(":" + oldMask + " NICK " + nick, NULL);
+		MonitorCommands::notifyNickChange(this, client, oldNick);
+	}
+	if (oldNick.empty())
+		std::cout << "✅ Client [" << client->getFd() << "] set nickname: " << nick << std::endl;
+	else
+		std::cout << "✅ Client [" << client->getFd() << "] changed nickname from " << oldNick << " to " << nick << std::endl;
+
+	checkRegistration(client);
+}
+
+void Server::handleUserCommand(Client *client, const std::string &args)
+{
+	// During CAP negotiation the password may still arrive as a SASL login
+	if (!passwordSatisfied(client) && !client->isCapNegotiating())
+	{
+		sendError(client, "464", ":Password required");
+		return;
+	}
+	if (!client->hasSentNick())
+	{
+		sendError(client, "451", ":You have not registered");
+		return;
+	}
+	if (args.empty())
+	{
+		sendToClient(client, "461 * USER :Not enough parameters");
+		return;
+	}
+	std::string username = args;
+	size_t spacePos = username.find(' ');
+	if (spacePos != std::string::npos)
+		username = username.substr(0, spacePos);
+	client->setUsername(username);
+	size_t colon = args.find(" :");
+	if (colon != std::string::npos)
+		client->setRealname(args.substr(colon + 2));
+	std::cout << "✅ Client [" << client->getFd() << "] set username: " << username << std::endl;
+	checkRegistration(client);
+}
+
+void Server::handleJoinCommand(Client *client, const std::string &args)
+{
+	if (args.empty())
+	{
+		sendError(client, "461", "JOIN :Not enough parameters");
+		return;
+	}
+
+	std::istringstream iss(args);
+	std::string channelName;
+	std::string providedKey;
+
+	while (std::getline(iss, channelName, ','))
+	{
+		size_t spacePos = channelName.find(' ');
+		if (spacePos != std::string::npos)
+		{
+			providedKey = channelName.substr(spacePos + 1);
+			channelName = channelName.substr(0, spacePos);
+		}
+		else
+		{
+			providedKey.clear();
+		}
+
+		if (!isValidChannelName(channelName))
+		{
+			sendError(client, "403", channelName + " :No such channel");
+			continue;
+		}
+
+		Channel *channel;
+		bool isNewChannel = false;
+
+		if (!channelExists(channelName))
+		{
+			channel = createChannel(channelName);
+			channel->setTopic("");
+			isNewChannel = true;
+		}
+		else
+		{
+			channel = getChannel(channelName);
+		}
+
+		if (channel->hasClient(client))
+			continue;
+
+		if (channel->isInviteOnly() && !channel->isInvited(client))
+		{
+			sendError(client, "473", channelName + " :Cannot join channel (+i)");
+			continue;
+		}
+
+		if (channel->hasKey() && (providedKey.empty() || providedKey != channel->getKey()))
+		{
+			sendError(client, "475", channelName + " :Cannot join channel (+k)");
+			continue;
+		}
+
+		if (channel->isBanned(client))
+		{
+			sendError(client, "474", channelName + " :Cannot join channel (+b)");
+			continue;
+		}
+
+		channel->addClient(client);
+
+		if (isNewChannel)
+			channel->addOperator(client);
+
+		ReplyBuilder join;
+		join.source(client).command("JOIN").trailing(channelName);
+		sendToClient(client, join);
+
+		ReplyBuilder topic;
+		topic.source("ircserver").numeric(332).target(client).param(channelName).trailing(channel->getTopic());
+		sendToClient(client, topic);
+
+		sendNames(client, channel);
+
+		broadcastToChannels(channel, join, client, true);
+		propagateToLinks(join, channel);
+	}
+}
+
+// 353 lines are filled up to the 512-byte limit, then continued on a new one
+void Server::sendNames(Client *client, Channel *channel)
+{
+	ReplyBuilder head;
+	head.source("ircserver").numeric(353).target(client).param("=").param(channel->getName()).raw(" :", 2);
+	ReplyBuilder names = head;
+	size_t empty = names.size();
+	const std::set<Client *> &clientsInChannel = channel->getClients();
+	for (std::set<Client *>::const_iterator it = clientsInChannel.begin(); it != clientsInChannel.end(); ++it)
+	{
+		const std::string &nick = (*it)->getNickname();
+		bool op = channel->isOperator(*it);
+		size_t need = nick.size() + op + (names.size() > empty);
+		if (names.size() > empty && need > names.room())
+		{
+			sendToClient(client, names);
+			names = head;
+		}
+		if (names.size() > empty)
+			names.raw(" ", 1);
+		if (op)
+			names.raw("@", 1);
+		names.raw(nick);
+	}
+	sendToClient(client, names);
+
+	ReplyBuilder end;
+	end.source("ircserver").numeric(366).target(client).param(channel->getName()).trailing("End of NAMES list");
+	sendToClient(client, end);
+}
+
+const ServerConfig &Server::getConfig() const
+{
+	return _config;
+}
+
+// The message and, unless it already ends with one, a CRLF
+int Server::lineParts(const std::string &message, struct iovec *parts)
+{
+	bool hasCrlf = message.length() >= 2 && message.compare(message.length() - 2, 2, "\r\n") == 0;
+	parts[0].iov_base = const_cast<char *>(message.data());
+	parts[0].iov_len = message.length();
+	parts[1].iov_base = const_cast<char *>("\r\n");
+	parts[1].iov_len = 2;
+	return hasCrlf ? 1 : 2;
+}
+
+void Server::sendToClient(Client *client, const std::string &message)
+{
+	struct iovec parts[2];
+	sendParts(client, parts, lineParts(message, parts));
+}
+
+void Server::sendToClient(Client *client, const ReplyBuilder &reply)
+{
+	struct iovec part;
+	part.iov_base = const_cast<char *>(reply.data());
+	part.iov_len = reply.size();
+	sendParts(client, &part, 1);
+}
+
+// Write a message given as several pieces without joining them first
+void Server::sendParts(Client *client, const struct iovec *parts, int count)
+{
+	// Replies meant for users on other servers are dropped, relays go through routeToClient()
+	if (client->isRemote())
+		return;
+	// A dropped session keeps what it missed for RESUME
+	if (client->isDetached())
+	{
+		client->getSession()->record(parts, count);
+		return;
+	}
+	// Nothing can be written on a TLS connection before its handshake completes,
+	// nor on a WebSocket one before the HTTP upgrade
+	if (client->isTlsHandshaking() || (client->getWebSocket() && !client->getWebSocket()->isOpen()))
+		return;
+
+	// Replies are queued and written once per client at the end of the loop tick
+	// (flushQueuedSends), so JOIN or registration bursts cost a single syscall.
+	// A client already over its sendq gets nothing more; it is dropped at the flush.
+	std::string &queue = client->getSendQueue();
+	if (!client->isServerLink() && queue.size() > static_cast<size_t>(_config.sendQueueMax))
+		return;
+	if (client->getWebSocket())
+		client->getWebSocket()->appendMessage(queue, parts, count);
+	else
+	{
+		for (int i = 0; i < count; ++i)
+			queue.append(static_cast<const char *>(parts[i].iov_base), parts[i].iov_len);
+	}
+	_pendingSends.insert(client->getFd());
+}
+
+const ChannelSizeIndex &Server::getChannelSizeIndex() const
+{
+	return _channelSizeIndex;
+}
+
+const UserIndex &Server::getUserIndex() const
+{
+	return _userIndex;
+}
+
+MonitorIndex &Server::getMonitorIndex()
+{
+	return _monitorIndex;
+}
+
+// COMPRESS DEFLATE: the confirmation is the last plain line in each direction.
+// Whatever the client sends after its COMPRESS line is deflated, and so is all
+// output from the next flush on.
+void Server::handleCompressCommand(Client *client, const std::string &args)
+{
+	std::string method = args.substr(0, args.find(' '));
+	for (size_t i = 0; i < method.size(); ++i)
+		method[i] = std::toupper(method[i]);
+	if (!_config.compressLevel)
+		sendToClient(client, "FAIL COMPRESS DISABLED :Compression is not offered by this server");
+	else if (client->getWebSocket())
+		sendToClient(client, "FAIL COMPRESS NOT_AVAILABLE :Not available on WebSocket connections");
+	else if (client->getCompressor())
+		sendToClient(client, "FAIL COMPRESS ALREADY_ACTIVE :Compression is already enabled");
+	else if (method != "DEFLATE")
+		sendToClient(client, "FAIL COMPRESS UNKNOWN_METHOD " + (method.empty() ? "*" : method) + " :Only DEFLATE is supported");
+	else
+	{
+		StreamCompressor *compressor = new StreamCompressor();
+		if (!compressor->init(_config.compressLevel))
+		{
+			delete compressor;
+			sendToClient(client, "FAIL COMPRESS INTERNAL_ERROR :Could not set up compression");
+			return;
+		}
+		sendToClient(client, "NOTE COMPRESS ACTIVE DEFLATE :Compression enabled");
+		// The confirmation must leave uncompressed: push it out of the queue first
+		std::string pending;
+		pending.swap(client->getSendQueue());
+		compressor->getWire().swap(pending);
+		client->setCompressor(compressor);
+		std::cout << "🗜️ Client [" << client->getFd() << "] enabled DEFLATE (level " << _config.compressLevel << ")" << std::endl;
+	}
+}
+
+// OPER <name> <password>
+void Server::handleOperCommand(Client *client, const std::string &args)
+{
+	if (!client->isRegistered())
+	{
+		sendError(client, "451", ":You have not registered");
+		return;
+	}
+	std::istringstream iss(args);
+	std::string name, password;
+	iss >> name >> password;
+	if (password.empty())
+	{
+		sendToClient(client, "461 " + client->getNickname() + " OPER :Not enough parameters");
+		return;
+	}
+	if (_config.opers.empty())
+	{
+		sendToClient(client, "491 " + client->getNickname() + " :No O-lines for your host");
+		return;
+	}
+	std::map<std::string, std::string>::const_iterator it = _config.opers.find(name);
+	if (it == _config.opers.end() || !Secrets::equal(password, it->second))
+	{
+		sendToClient(client, "464 " + client->getNickname() + " :Password incorrect");
+		std::cout << "❌ Client [" << client->getFd() << "] failed OPER as " << name << std::endl;
+		return;
+	}
+	client->setServerOperator(true);
+	sendToClient(client, "381 " + client->getNickname() + " :You are now an IRC operator");
+	sendToClient(client, ":" + client->getNickname() + " MODE " + client->getNickname() + " :+o");
+	std::cout << "🛡️ Client [" << client->getFd() << "] (" << client->getNickname() << ") is now an operator" << std::endl;
+}
+
+bool Server::isNicknameInUse(const std::string &nick)
+{
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->second->getNickname() == nick)
+			return true;
+	}
+	return _remoteClients.find(nick) != _remoteClients.end() || findDetached(nick);
+}
+
+void Server::checkRegistration(Client *client)
+{
+	// Wait for CAP END and for a SASL check still running on a worker
+	if (client->isCapNegotiating() || client->getSaslStep() == SASL_PENDING)
+		return;
+	bool passOk = passwordSatisfied(client);
+	bool nickOk = client->hasSentNick();
+	bool userOk = client->hasSentUser();
+
+	if (passOk && nickOk && userOk && !client->isRegistered())
+	{
+		client->markRegistered();
+		std::cout << "🎉 Client [" << client->getFd() << "] (" << client->getNickname() << ") is now registered!" << std::endl;
+		client->setSignonTime(time(NULL));
+		_userIndex.add(client);
+		MonitorCommands::notifyOnline(this, client);
+		std::ostringstream uid;
+		uid << "UID " << client->getNickname() << " " << client->getSignonTime() << " " << client->getUsername() << " "
+			<< (client->getHostname().empty() ? "*" : client->getHostname()) << " :" << client->getRealname();
+		propagateToLinks(uid.str(), NULL);
+
+		sendWelcome(client);
+		if (client->hasCap(CAP_RESUME))
+			startSession(client);
+	}
+}
+
+// 001-005
+void Server::sendWelcome(Client *client)
+{
+	sendToClient(client, "001 " + client->getNickname() + " :Welcome to the IRC Network " + client->getNickname() + "!" + client->getUsername() + "@localhost");
+	sendToClient(client, "002 " + client->getNickname() + " :Your host is ircserver, running version 1.0");
+	sendToClient(client, "003 " + client->getNickname() + " :This server was created today");
+	sendToClient(client, "004 " + client->getNickname() + " ircserver 1.0 o o");
+	std::ostringstream isupport;
+	isupport << "005 " << client->getNickname() << " CHANTYPES=# PREFIX=(o)@ CHANMODES=be,k,l,it"
+			 << " EXCEPTS=e MAXLIST=be:" << _config.maxListEntries
+			 << " MAXTARGETS=" << _config.maxTargets << " TARGMAX=PRIVMSG:" << _config.maxTargets
+			 << ",NOTICE:" << _config.maxTargets << " ELIST=CMNTU SAFELIST WHOX MONITOR=" << _config.monitorLimit;
+	// Useful only with the replay's batch and time/msgid tags, which need the caps
+	if (!_config.historyDir.empty() && client->hasCap(CAP_BATCH) && client->hasCap(CAP_SERVER_TIME) &&
+		client->hasCap(CAP_MESSAGE_TAGS))
+		isupport << " CHATHISTORY=" << _config.historyMaxLimit;
+	if (_config.compressLevel)
+		isupport << " COMPRESS=DEFLATE";
+	isupport << " :are supported by this server";
+	sendToClient(client, isupport.str());
+}
+
+// PRIVMSG/NOTICE <target>{,<target>} :<text>
+// Every distinct target (channel or nick) gets one line naming it, formatted on
+// the stack and copied once into each recipient's queue, so a user in several
+// of the targeted channels sees the message once per channel and never twice
+// for the same one.
+// NOTICE never generates an error reply.
+void Server::handlePrivMsgCommand(Client *client, const std::string &args, const std::string &command)
+{
+	bool notice = command == "NOTICE";
+	if (args.empty())
+	{
+		if (!notice)
+			sendToClient(client, "461 * " + command + " :Not enough parameters");
+		return;
+	}
+	size_t spacePos = args.find(' ');
+	std::string message = spacePos == std::string::npos ? "" : args.substr(spacePos + 1);
+	if (message.empty() || message[0] != ':')
+	{
+		if (!notice)
+			sendToClient(client, "412 * " + command + " :No text to send");
+		return;
+	}
+
+	std::set<std::string> seen;
+	std::string receivers = args.substr(0, spacePos);
+	// One scan per message, before any target is looked at
+	if (!filterAllows(client, command, receivers, message))
+		return;
+	size_t start = 0;
+	while (start <= receivers.size())
+	{
+		size_t comma = receivers.find(',', start);
+		if (comma == std::string::npos)
+			comma = receivers.size();
+		std::string receiver = receivers.substr(start, comma - start);
+		start = comma + 1;
+		if (receiver.empty() || !seen.insert(receiver).second)
+			continue;
+		if (seen.size() > static_cast<size_t>(_config.maxTargets))
+		{
+			if (!notice)
+				sendToClient(client, "407 " + client->getNickname() + " " + receiver + " :Too many recipients");
+			break;
+		}
+
+		ReplyBuilder line;
+		line.source(client).param(command).param(receiver).param(message);
+		if (receiver[0] == '#')
+		{
+			Channel *channel = channelExists(receiver) ? getChannel(receiver) : NULL;
+			if (!channel)
+			{
+				if (!notice)
+					sendToClient(client, "403 " + client->getNickname() + " " + receiver + " :No such channel");
+				continue;
+			}
+			if (!channel->hasClient(client) || (!channel->isOperator(client) && channel->isBanned(client)))
+			{
+				if (!notice)
+					sendToClient(client, "404 " + client->getNickname() + " " + receiver + " :Cannot send to channel");
+				continue;
+			}
+			broadcastToChannels(channel, line, client, true);
+			recordHistory(channel, line);
+		}
+		else
+		{
+			Client *target = getClientByNick(receiver);
+			if (!target)
+			{
+				if (!notice)
+					sendToClient(client, "401 " + client->getNickname() + " " + receiver + " :No such nickname");
+				continue;
+			}
+			routeToClient(target, line);
+		}
+	}
+}
+
+ChannelHistory *Server::historyFor(Channel *channel)
+{
+	if (_config.historyDir.empty())
+		return NULL;
+	if (!channel->getHistory())
+	{
+		ChannelHistory *history = new ChannelHistory();
+		if (!history->open(ChannelHistory::pathFor(_config.historyDir, channel->getName()),
+						   _config.historySize, _config.historyMaxAge))
+		{
+			delete history;
+			return NULL;
+		}
+		channel->setHistory(history);
+	}
+	return channel->getHistory();
+}
+
+void Server::recordHistory(Channel *channel, const std::string &line)
+{
+	ChannelHistory *history = historyFor(channel);
+	if (history)
+		history->append(line, ChannelHistory::nowMs());
+}
+
+void Server::recordHistory(Channel *channel, const ReplyBuilder &line)
+{
+	ChannelHistory *history = historyFor(channel);
+	if (history)
+		history->append(line.data(), line.size() - 2, ChannelHistory::nowMs());
+}
+
+bool Server::channelExists(const std::string &name) const
+{
+	return _channels.find(name) != _channels.end();
+}
+
+Channel *Server::getChannel(const std::string &name)
+{
+	std::map<std::string, Channel *>::iterator it = _channels.find(name);
+	if (it != _channels.end())
+		return it->second;
+	return NULL;
+}
+
+Channel *Server::createChannel(const std::string &name)
+{
+	if (channelExists(name))
+		return getChannel(name);
+	Channel *newChannel = new Channel(name);
+	newChannel->setSizeIndex(&_channelSizeIndex);
+	_channels[name] = newChannel;
+	return newChannel;
+}
+
+void Server::removeChannel(const std::string &name)
+{
+	std::map<std::string, Channel *>::iterator it = _channels.find(name);
+	if (it != _channels.end())
+	{
+		std::map<Channel *, std::deque<FanoutJob> >::iterator jobs = _fanout.find(it->second);
+		if (jobs != _fanout.end())
+		{
+			for (size_t i = 0; i < jobs->second.size(); ++i)
+				finishFanoutJob(jobs->second[i]);
+			_fanout.erase(jobs);
+		}
+		delete it->second;
+		_channels.erase(it);
+	}
+}
+
+// Local members get the message directly; each server link with members behind it
+// gets it exactly once, whatever the number of remote members.
+void Server::broadcastToChannels(Channel *channel, const std::string &message, Client *sender, bool skipSender)
+{
+	struct iovec parts[2];
+	broadcastParts(channel, parts, lineParts(message, parts), sender, skipSender);
+}
+
+void Server::broadcastToChannels(Channel *channel, const ReplyBuilder &reply, Client *sender, bool skipSender)
+{
+	struct iovec part;
+	part.iov_base = const_cast<char *>(reply.data());
+	part.iov_len = reply.size();
+	broadcastParts(channel, &part, 1, sender, skipSender);
+}
+
+void Server::broadcastParts(Channel *channel, const struct iovec *parts, int count, Client *sender, bool skipSender)
+{
+	if (fanoutQueued(channel))
+	{
+		std::string line;
+		for (int i = 0; i < count; ++i)
+			line.append(static_cast<const char *>(parts[i].iov_base), parts[i].iov_len);
+		queueFanout(channel, line, line, sender, skipSender);
+		return;
+	}
+	std::set<Client *> links;
+	const std::set<Client *> &clients = channel->getClients();
+	for (std::set<Client *>::const_iterator it = clients.begin(); it != clients.end(); ++it)
+	{
+		Client *client = *it;
+		if (client == sender && skipSender)
+			continue;
+		if (client->isRemote())
+			links.insert(client->getUplink());
+		else
+			sendParts(client, parts, count);
+	}
+	for (std::set<Client *>::iterator it = links.begin(); it != links.end(); ++it)
+	{
+		if (*it != _currentLink)
+			sendParts(*it, parts, count);
+	}
+}
+
+// Remove a user from every channel, telling each local member once. Invites
+// go too: the Client is deleted next, and a new one may reuse its address.
+// In a channel with deliveries queued the QUIT is queued as well, behind the
+// user's earlier lines; a member of such a channel hears it from there only.
+void Server::quitClient(Client *client, const std::string &reason)
+{
+	ReplyBuilder message;
+	message.source(client).command("QUIT").trailing(reason);
+	bool online = _userIndex.contains(client);
+	_userIndex.remove(client);
+	_monitorIndex.clear(client);
+	if (online)
+		MonitorCommands::notifyOffline(this, client->getNickname());
+	for (std::map<unsigned long, QuitNotice>::iterator it = _quitNotices.begin(); it != _quitNotices.end(); ++it)
+		it->second.told.erase(client);
+	std::vector<Channel *> direct;
+	std::vector<Channel *> queued;
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		Channel *channel = it->second;
+		channel->removeInvited(client);
+		if (!channel->hasClient(client))
+			continue;
+		removeFromChannel(channel, client);
+		if (fanoutQueued(channel))
+			queued.push_back(channel);
+		else
+			direct.push_back(channel);
+	}
+	std::set<Client *> notified;
+	for (size_t i = 0; i < direct.size(); ++i)
+	{
+		const std::set<Client *> &clients = direct[i]->getClients();
+		for (std::set<Client *>::const_iterator m = clients.begin(); m != clients.end(); ++m)
+		{
+			if ((*m)->isRemote() || notified.count(*m))
+				continue;
+			size_t q = 0;
+			while (q < queued.size() && !queued[q]->hasClient(*m))
+				++q;
+			if (q == queued.size() && notified.insert(*m).second)
+				sendToClient(*m, message);
+		}
+	}
+	if (!queued.empty())
+		queueQuit(queued, message, client);
+	if (client->isRegistered())
+		propagateToLinks(message, NULL);
+}
+
+void Server::sendReply(Client *client, const std::string &message)
+{
+	ReplyBuilder reply;
+	reply.source(client->getNickname().c_str()).param(message);
+	sendToClient(client, reply);
+}
+
+void Server::sendError(Client *client, const std::string &errorCode, const std::string &errorMsg)
+{
+	ReplyBuilder reply;
+	reply.source("ircserver").param(errorCode).target(client).param(errorMsg);
+	sendToClient(client, reply);
+}
+
+bool Server::isValidChannelName(const std::string &name)
+{
+	if (name.empty() || name[0] != '#')
+		return false;
+	if (name.length() > 50)
+		return false;
+	if (name.find_first_of(" ,:") != std::string::npos)
+		return false;
+	return true;
+}
+
+Client *Server::getClientByNick(const std::string &nickname)
+{
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->second->getNickname() == nickname)
+		{
+			return it->second;
+		}
+	}
+	std::map<std::string, Client *>::iterator remote = _remoteClients.find(nickname);
+	if (remote != _remoteClients.end())
+		return remote->second;
+	return findDetached(nickname);
+}
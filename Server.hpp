@@ -1,55 +1,322 @@
-#ifndef SERVER_HPP
-#define SERVER_HPP
-
-#include <string>
-#include <vector>
-#include <poll.h>
-#include "Client.hpp"
-#include "Channel.hpp"
-#include "OperatorCommands.hpp"
-#include <map>
-
-class Server
-{
-private:
-	int _port;									// Port number to listen on
-	std::string _password;						// Connection password
-	int _serverSocket;							// File descriptor for the main listening socket
-	std::vector<struct pollfd> _pollFds;		// List of file descriptors to poll
-	std::map<int, Client *> _clients;			// fd -> Client * (Client pointer for each connected client)
-	std::map<std::string, Channel *> _channels; // channel name -> Channel*
-
-	void handleNewConnection();
-	void handleClientData(int clientFd);
-	void handleCommand(Client *client, const std::string &line);
-	void handlePassCommand(Client *client, const std::string &args);
-	void handleNickCommand(Client *client, const std::string &args);
-	void handleUserCommand(Client *client, const std::string &args);
-
-	// NEW
-	void handleJoinCommand(Client *client, const std::string &args);
-	void handlePrivMsgCommand(Client *client, const std::string &args);
-
-	public:
-
-	// Helpers
-	void sendToClient(Client *client, const std::string &message);
-	bool isNicknameInUse(const std::string &nick);
-	void checkRegistration(Client *client);
-	Client *getClientByNick(const std::string &nickname);
-	Channel *getChannel(const std::string &name);
-	Channel *createChannel(const std::string &name);
-	bool isValidChannelName(const std::string &name);
-	bool channelExists(const std::string &name) const;
-	void sendReply(Client *, const std::string &reply);
-	void sendError(Client *, const std::string &code, const std::string &err);
-	void removeChannel(const std::string &name);
-	void broadcastToChannels(Channel *channel, const std::string &message, Client *sender, bool skipSender);
-
-
-	Server(int port, const std::string &password);
-	~Server();
-	void start(); // Starts the server (binds, listens, etc.)
-};
-
-#endif
\ No newline at end of file
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/uio.h>
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "OperatorCommands.hpp"
+#include "ServerConfig.hpp"
+#include "TlsContext.hpp"
+#include "UringEngine.hpp"
+#include "ReplyStream.hpp"
+#include "UserIndex.hpp"
+#include "MonitorIndex.hpp"
+#include "WorkerPool.hpp"
+#include "StreamCompressor.hpp"
+#include "WebSocket.hpp"
+#include "ReplyBuilder.hpp"
+#include "ResumeSession.hpp"
+#include "SpamFilter.hpp"
+#include "SocketLayer.hpp"
+#include <map>
+#include <set>
+#include <deque>
+
+// COMPRESS DEFLATE traffic since startup, for STATS z
+struct CompressionTotals
+{
+	unsigned long long plainOut; // bytes before deflate
+	unsigned long long wireOut;	 // bytes after deflate
+	unsigned long long wireIn;
+	unsigned long long plainIn;
+	long long deflateNs; // CPU time spent in deflate / inflate
+	long long inflateNs;
+};
+
+// Graded response to event-loop lag (ServerOverload.cpp)
+enum OverloadLevel
+{
+	OVERLOAD_NORMAL,
+	OVERLOAD_BUSY,	   // LIST/WHO deferred, a per-tick input budget per client
+	OVERLOAD_CRITICAL, // also no new connections, reply streams paused, a tighter budget
+	OVERLOAD_LEVELS
+};
+
+// Overload history since startup, for STATS w
+struct OverloadTotals
+{
+	unsigned long entered[OVERLOAD_LEVELS]; // transitions into each level
+	long long timeNs[OVERLOAD_LEVELS];		// time spent in each level, up to the last transition
+	long long worstLagNs;					// longest single tick
+	unsigned long deferred;					// LIST/WHO parked until the load passes
+	unsigned long refused;					// answered 263 instead: the deferral queue was full
+	unsigned long throttled;				// reads whose remaining lines waited for a later tick
+};
+
+// Channel lines still being delivered to a large channel, a slice per loop
+// tick (ServerFanout.cpp). Members are walked in the channel's own order from
+// `cursor`: a member joining meanwhile may still be reached, one kicked gets
+// the rest first (removeFromChannel), one quitting is not.
+struct FanoutJob
+{
+	std::string line;	  // one or more lines, CRLF included
+	std::string linkLine; // what each server link with members behind it gets, empty for none
+	size_t lines;
+	Client *sender;		  // compared, never dereferenced: it may be gone by now
+	bool skipSender;
+	Client *origin;		  // link the message came from, not echoed back
+	bool started;
+	Client *cursor;		  // last member handled
+	std::set<Client *> links; // links already sent linkLine
+	unsigned long notice; // QUIT queued in several channels (_quitNotices), 0 otherwise
+};
+
+// One user's QUIT, queued in each of its channels with deliveries pending:
+// a member of several of them is told once, by the last of those jobs to
+// reach it, so the QUIT follows everything the user said in each channel
+struct QuitNotice
+{
+	std::vector<Channel *> channels;
+	std::set<Client *> told;
+	size_t jobs; // FanoutJobs still carrying it
+};
+
+struct Listener
+{
+	int fd;
+	int port;
+	ListenerKind kind;
+	std::string host; // bound address (empty: every IPv4 and IPv6 address) or Unix socket path
+};
+
+class Server
+{
+private:
+	int _port;									// Port number to listen on
+	std::string _password;						// Connection password
+	ServerConfig _config;						// Optional settings from the command line
+	std::vector<Listener> _listeners;			// Listening sockets (plaintext, TLS, WebSocket)
+	SocketLayer *_sockets;						// accept/recv/send/poll/close for the poll loop
+	TlsContext _tls;							// Certificate, session cache and ticket keys
+	int _handshakeBudget;						// TLS handshake steps left in the current loop tick
+	bool _useUring;								// io_uring backend instead of poll()
+	UringEngine _uring;
+	std::set<int> _pendingSends;				// fds with output queued during this tick
+	std::set<int> _blockedWrites;				// fds waiting for POLLOUT to write leftover output
+	std::map<std::string, Client *> _remoteClients; // nick -> user connected to another server
+	std::map<std::string, Client *> _links;		// server name -> established link to a peer
+	std::map<std::string, Client *> _remoteServers; // server name -> link it is reached through
+	std::map<std::string, time_t> _linkRetryAt;	// outbound link name -> next connect attempt
+	Client *_currentLink;						// Link whose line is being handled (never echo back to it)
+	std::vector<struct pollfd> _pollFds;		// List of file descriptors to poll
+	std::map<int, Client *> _clients;			// fd -> Client * (Client pointer for each connected client)
+	std::map<std::string, Channel *> _channels; // channel name -> Channel*
+	ChannelSizeIndex _channelSizeIndex;			// channels ordered by member count (LIST)
+	std::map<int, ReplyStream *> _replyStreams; // fd -> long reply still being produced
+	UserIndex _userIndex;						// registered users by nick/user/host (WHO)
+	MonitorIndex _monitorIndex;					// MONITOR lists, by watched nick and by watcher
+	std::map<std::string, Client *> _sessions;	// resume token -> user, connected or detached
+	time_t _nextSessionExpiry;					// next check for detached sessions past their grace period
+	time_t _nextCompaction;						// next pass over idle clients' buffers
+	WorkerPool _workers;						// threads for CPU-heavy jobs (password hashing)
+	std::map<std::string, std::string> _accounts; // SASL account -> crypt(3) hash
+	std::string _unknownAccountHash;				// same scheme and cost as the first account, salt replaced
+	unsigned long _saslSerial;					// last id handed to a SASL check
+	std::map<unsigned long, FilterRule> _filterRules; // FILTER entries by id
+	unsigned long _nextFilterId;
+	SpamFilter *_filter;						// compiled rules in use, NULL before the first build
+	unsigned long _filterGeneration;			// last build requested; older results are discarded
+	CompressionTotals _compression;
+	unsigned long long _publishFrames;			// publish API frames and messages handled
+	unsigned long long _publishMessages;
+	OverloadLevel _overload;
+	long long _loopLagNs;						// smoothed time from poll return to the end of the tick
+	long long _lastTickNs;
+	long long _tickStart;						// monotonic ns when the current tick's events arrived
+	long long _overloadSince;					// monotonic ns of the last level change
+	OverloadTotals _overloadTotals;
+	std::set<int> _inputBacklog;				// fds with complete lines held back by the input budget
+	std::deque<std::pair<int, std::string> > _deferredCommands; // fd, line: run once the load passes
+	std::map<Channel *, std::deque<FanoutJob> > _fanout; // large-channel deliveries in progress, in order
+	std::map<unsigned long, QuitNotice> _quitNotices;	 // FanoutJob::notice -> who has been told
+	unsigned long _nextNotice;
+
+	int openListener(const std::string &host, int port);
+	void addListener(const std::string &host, int port, ListenerKind kind);
+	const Listener *findListener(int fd) const;
+	void runPollLoop();
+	bool pollOnce(int timeoutMs);
+	void runUringLoop();
+	void handleIoEvent(const IoEvent &event);
+	void flushQueuedSends();
+	bool writeQueued(Client *client, std::string &error);
+	std::string &wireQueue(Client *client);
+	bool inflateInput(Client *client, const char *data, size_t size, std::string &out);
+	void handleCompressCommand(Client *client, const std::string &args);
+	void pumpReplyStreams();
+	bool hasReadyStreams() const;
+	void handleNewConnection(const Listener &listener);
+	void registerConnection(const Listener &listener, int clientFd);
+	void handleClientData(int clientFd);
+	void processInput(Client *client, const char *data, size_t size);
+	bool continueTlsHandshake(Client *client);
+	int recvFromClient(Client *client, char *buffer, size_t size);
+	int loopTimeout() const;
+	void setPollEvents(int fd, short events);
+	void disconnectClient(int clientFd, const std::string &reason = "Client closed connection");
+	void forgetFd(int clientFd);
+	void connectionLost(int clientFd, const std::string &reason = "Client closed connection");
+	void dropLocalUser(Client *user, const std::string &reason);
+
+	// Resumable sessions (ServerSessions.cpp)
+	void startSession(Client *client);
+	void detachSession(Client *client);
+	void endSession(Client *client, const std::string &reason);
+	void forgetSession(Client *client);
+	void expireSessions();
+	Client *findDetached(const std::string &nick) const;
+	void handleResumeCommand(Client *client, const std::string &args);
+	bool restoreSession(Client *client, const std::string &state);
+	void quitClient(Client *client, const std::string &reason);
+
+	// Overload protection (ServerOverload.cpp)
+	void startTick();
+	void finishTick();
+	void setOverload(OverloadLevel level);
+	size_t inputBudget(const Client *client) const;
+	bool deferCommand(Client *client, const std::string &command, const std::string &line);
+	void processBacklog();
+	void forgetOverloadState(int fd);
+	void reportOverload(Client *client);
+
+	// Budgeted fan-out to large channels (ServerFanout.cpp)
+	bool fanoutQueued(Channel *channel) const;
+	void queueFanout(Channel *channel, const std::string &line, const std::string &linkLine, Client *sender,
+					 bool skipSender, unsigned long notice = 0);
+	void queueQuit(const std::vector<Channel *> &channels, const ReplyBuilder &message, Client *client);
+	void releaseLinkCopies(Channel *channel);
+	void deliverFanout(FanoutJob &job, Client *member);
+	bool quitNoticeDue(const FanoutJob &job, Client *member);
+	void finishFanoutJob(const FanoutJob &job);
+	bool runFanoutJob(Channel *channel, FanoutJob &job, size_t &budget);
+	void pumpFanout();
+
+	// Memory accounting (ServerStats.cpp)
+	void handleMemStatsCommand(Client *client, const std::string &args);
+	void handleStatsCommand(Client *client, const std::string &args);
+	void compactIdleClients();
+
+	// CAP and SASL (ServerAuth.cpp)
+	bool loadAccounts(const std::string &path);
+	bool passwordSatisfied(Client *client) const;
+	bool capOffered(unsigned cap) const;
+	void handleCapCommand(Client *client, const std::string &args);
+	void handleAuthenticateCommand(Client *client, const std::string &args);
+	void processWorkerResults();
+
+	// Content filter (ServerFilters.cpp)
+	bool loadFilters(const std::string &path);
+	void rebuildFilter(bool inPlace);
+	bool filterAllows(Client *client, const std::string &command, const std::string &targets, const std::string &text);
+	void handleFilterCommand(Client *client, const std::string &args);
+
+	// Binary publish API (ServerPublish.cpp)
+	void processPublishInput(Client *client, const char *data, size_t size);
+	bool handlePublishFrame(Client *client, unsigned char type, const char *body, size_t size);
+	void publishBatch(Client *client, const char *body, size_t size);
+	void sendPublishFrame(Client *client, unsigned char type, const std::string &body);
+	bool failPublish(Client *client, unsigned short code, unsigned long entry, const std::string &text);
+
+	// Hot restart (HotRestart.cpp)
+	void hotRestart();
+	void writeSnapshot(std::string &out, std::vector<int> &fds);
+	bool restoreSnapshot(int fd);
+
+	// Server links (ServerLinks.cpp)
+	const LinkConfig *findLinkConfig(const std::string &name) const;
+	void connectLinks();
+	void finishLinkConnect(Client *link);
+	void handleServerCommand(Client *client, const std::string &args);
+	void handleServerMessage(Client *link, const std::string &line);
+	void sendBurst(Client *link);
+	void introduceRemoteUser(Client *link, const std::string &args);
+	void handleSjoin(Client *link, const std::string &args);
+	void resetChannelModes(Channel *channel);
+	void tellLocalMembers(Channel *channel, const std::string &line);
+	void remoteJoin(Client *user, const std::string &channelName);
+	void remoteNickChange(Client *user, const std::string &newNick);
+	void removeRemoteUser(Client *user, const std::string &reason);
+	void handleKill(const std::string &args);
+	void handleNetsplit(Client *link);
+	void linksWithMembers(Channel *channel, std::set<Client *> &links);
+	void handleCommand(Client *client, const std::string &line);
+	void handlePassCommand(Client *client, const std::string &args);
+	void handleNickCommand(Client *client, const std::string &args);
+	void handleUserCommand(Client *client, const std::string &args);
+	void handleOperCommand(Client *client, const std::string &args);
+
+	// NEW
+	void handleJoinCommand(Client *client, const std::string &args);
+	void handlePrivMsgCommand(Client *client, const std::string &args, const std::string &command);
+	void recordHistory(Channel *channel, const std::string &line);
+	void recordHistory(Channel *channel, const ReplyBuilder &line);
+	void sendNames(Client *client, Channel *channel);
+	void broadcastParts(Channel *channel, const struct iovec *parts, int count, Client *sender, bool skipSender);
+	void propagateParts(const struct iovec *parts, int count, Channel *channel);
+	void routeParts(Client *target, const struct iovec *parts, int count);
+	static int lineParts(const std::string &message, struct iovec *parts);
+
+	public:
+
+	// Helpers
+	const ServerConfig &getConfig() const;
+	void sendToClient(Client *client, const std::string &message);
+	void sendToClient(Client *client, const ReplyBuilder &reply);
+	void sendParts(Client *client, const struct iovec *parts, int count);
+	void startReplyStream(Client *client, ReplyStream *stream);
+	const ChannelSizeIndex &getChannelSizeIndex() const;
+	const UserIndex &getUserIndex() const;
+	MonitorIndex &getMonitorIndex();
+	ChannelHistory *historyFor(Channel *channel);
+	bool isNicknameInUse(const std::string &nick);
+	void checkRegistration(Client *client);
+	void sendWelcome(Client *client);
+	void finishSasl(int fd, unsigned long serial, const std::string &account, bool ok);
+	void installFilter(SpamFilter *filter);
+	Client *getClientByNick(const std::string &nickname);
+	Channel *getChannel(const std::string &name);
+	Channel *createChannel(const std::string &name);
+	bool isValidChannelName(const std::string &name);
+	bool channelExists(const std::string &name) const;
+	void sendReply(Client *, const std::string &reply);
+	void sendError(Client *, const std::string &code, const std::string &err);
+	void removeChannel(const std::string &name);
+	void removeFromChannel(Channel *channel, Client *member);
+	void publishToChannel(Channel *channel, const std::string &line);
+	void broadcastToChannels(Channel *channel, const std::string &message, Client *sender, bool skipSender);
+	void broadcastToChannels(Channel *channel, const ReplyBuilder &reply, Client *sender, bool skipSender);
+	void propagateToLinks(const std::string &message, Channel *channel);
+	void propagateToLinks(const ReplyBuilder &reply, Channel *channel);
+	void routeToClient(Client *target, const std::string &message);
+	void routeToClient(Client *target, const ReplyBuilder &reply);
+
+
+	Server(int port, const std::string &password, const ServerConfig &config);
+	~Server();
+	void start(); // Starts the server (binds, listens, etc.)
+
+	// Simulation: serve `listenFd` of another socket layer and drive the poll
+	// loop one iteration at a time instead of calling start()
+	void attachSockets(SocketLayer *sockets, int listenFd);
+	void runOnce(int timeoutMs);
+
+	static int runIdleBenchmark(long clients);
+	static int runLatencyBenchmark(long receivers);
+	static int runUringBenchmark(long receivers);
+	static int runSimulationBenchmark(long clients);
+};
+
+#endif
@@ -0,0 +1,381 @@
+#include "Server.hpp"
+#include "Secrets.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <crypt.h>
+
+// CAP negotiation and SASL PLAIN against an account file of crypt(3) hashes.
+// Hashing (bcrypt, yescrypt, sha512-crypt) is deliberately slow, so it runs on
+// the worker pool: the client's registration waits for the result while the
+// event loop keeps serving everyone else.
+
+namespace
+{
+	const size_t SASL_CHUNK = 400;		  // AUTHENTICATE lines carry at most 400 bytes of base64
+	const size_t SASL_MAX_PAYLOAD = 1200; // authzid, authcid and password together
+
+	struct CapName
+	{
+		unsigned cap;
+		const char *name;
+	};
+	const CapName CAP_NAMES[] = {{CAP_SASL, "sasl"},
+								 {CAP_RESUME, "draft/resume-0.5"},
+								 {CAP_BATCH, "batch"},
+								 {CAP_SERVER_TIME, "server-time"},
+								 {CAP_MESSAGE_TAGS, "message-tags"}};
+	const size_t CAP_COUNT = sizeof(CAP_NAMES) / sizeof(CAP_NAMES[0]);
+
+	bool decodeBase64(const std::string &in, std::string &out)
+	{
+		static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		unsigned value = 0;
+		int bits = 0;
+		size_t i = 0;
+		out.clear();
+		for (; i < in.size() && in[i] != '='; ++i)
+		{
+			size_t digit = alphabet.find(in[i]);
+			if (digit == std::string::npos)
+				return false;
+			value = (value << 6) | digit;
+			bits += 6;
+			if (bits >= 8)
+			{
+				bits -= 8;
+				out += static_cast<char>((value >> bits) & 0xFF);
+			}
+		}
+		for (; i < in.size(); ++i)
+		{
+			if (in[i] != '=')
+				return false;
+		}
+		return true;
+	}
+
+	// A real account's hash with its salt overwritten: checked against when the
+	// account does not exist, so a miss runs the same scheme at the same cost
+	// (bcrypt rounds, sha-crypt rounds=, yescrypt parameters) as a hit
+	std::string unknownAccountHash(const std::string &hash)
+	{
+		std::string setting(hash);
+		size_t last = hash.rfind('$');
+		size_t start = 0, end = 2; // traditional DES: two salt characters up front
+		if (last != std::string::npos && last > 0 && hash.compare(0, 2, "$2") == 0)
+		{
+			start = last + 1; // bcrypt: 22 salt characters, then the hash
+			end = start + 22;
+		}
+		else if (last != std::string::npos && last > 0)
+		{
+			start = hash.rfind('$', last - 1) + 1; // $id$[params$]salt$hash
+			end = last;
+		}
+		for (size_t i = start; i < end && i < setting.size(); ++i)
+			setting[i] = '.';
+		return setting;
+	}
+
+	class SaslPlainJob : public WorkerJob
+	{
+	private:
+		int _fd;
+		unsigned long _serial;
+		std::string _account;
+		std::string _password;
+		std::string _hash;
+		bool _known;
+		bool _ok;
+
+	public:
+		SaslPlainJob(int fd, unsigned long serial, const std::string &account, const std::string &password,
+					 const std::string &hash, bool known)
+			: _fd(fd), _serial(serial), _account(account), _password(password), _hash(hash), _known(known), _ok(false)
+		{
+		}
+
+		~SaslPlainJob()
+		{
+			// Do not leave the password lying around in freed memory
+			_password.replace(0, _password.size(), _password.size(), '\0');
+		}
+
+		void run()
+		{
+			struct crypt_data *data = new struct crypt_data();
+			const char *computed = crypt_r(_password.c_str(), _hash.c_str(), data);
+			_ok = _known && computed && computed[0] != '*' && Secrets::equal(computed, _hash);
+			delete data;
+		}
+
+		void complete(Server *server)
+		{
+			server->finishSasl(_fd, _serial, _account, _ok);
+		}
+	};
+}
+
+bool Server::loadAccounts(const std::string &path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		std::cerr << "Cannot read accounts file " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	for (int number = 1; std::getline(file, line); ++number)
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		size_t colon = line.find(':');
+		if (colon == 0 || colon == std::string::npos || colon + 1 == line.size())
+		{
+			std::cerr << path << ":" << number << ": expected NAME:HASH" << std::endl;
+			return false;
+		}
+		_accounts[line.substr(0, colon)] = line.substr(colon + 1);
+		if (_unknownAccountHash.empty())
+			_unknownAccountHash = unknownAccountHash(line.substr(colon + 1));
+	}
+	std::cout << "🔑 Loaded " << _accounts.size() << " SASL accounts" << std::endl;
+	return true;
+}
+
+bool Server::capOffered(unsigned cap) const
+{
+	if (cap == CAP_SASL)
+		return !_accounts.empty();
+	if (cap == CAP_RESUME)
+		return _config.resumeGrace > 0;
+	if (cap == CAP_BATCH || cap == CAP_SERVER_TIME || cap == CAP_MESSAGE_TAGS)
+		return !_config.historyDir.empty(); // only CHATHISTORY replies use them
+	return false;
+}
+
+// The shared server password, or an account login in its place
+bool Server::passwordSatisfied(Client *client) const
+{
+	return _password.empty() || client->hasSentPass() || !client->getAccount().empty();
+}
+
+// CAP LS [302] | LIST | REQ :<caps> | END
+void Server::handleCapCommand(Client *client, const std::string &args)
+{
+	std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
+	std::string sub = args.substr(0, args.find(' '));
+	for (size_t i = 0; i < sub.size(); ++i)
+		sub[i] = std::toupper(sub[i]);
+	std::string params = sub.size() < args.size() ? args.substr(sub.size() + 1) : "";
+	if (!params.empty() && params[0] == ':')
+		params.erase(0, 1);
+
+	if (sub == "LS")
+	{
+		if (!client->isRegistered())
+			client->setCapNegotiating(true);
+		std::string caps;
+		for (size_t i = 0; i < CAP_COUNT; ++i)
+		{
+			if (!capOffered(CAP_NAMES[i].cap))
+				continue;
+			caps += caps.empty() ? "" : " ";
+			caps += CAP_NAMES[i].name;
+			if (CAP_NAMES[i].cap == CAP_SASL && params == "302")
+				caps += "=PLAIN";
+		}
+		sendToClient(client, "CAP " + nick + " LS :" + caps);
+	}
+	else if (sub == "LIST")
+	{
+		std::string caps;
+		for (size_t i = 0; i < CAP_COUNT; ++i)
+		{
+			if (client->hasCap(CAP_NAMES[i].cap))
+				caps += (caps.empty() ? "" : " ") + std::string(CAP_NAMES[i].name);
+		}
+		sendToClient(client, "CAP " + nick + " LIST :" + caps);
+	}
+	else if (sub == "REQ")
+	{
+		if (!client->isRegistered())
+			client->setCapNegotiating(true);
+		// All or nothing: one unknown capability rejects the whole request
+		std::istringstream iss(params);
+		std::string cap;
+		bool ok = true;
+		unsigned enable = 0, disable = 0;
+		while (iss >> cap)
+		{
+			bool remove = cap[0] == '-';
+			size_t i = 0;
+			while (i < CAP_COUNT && cap.substr(remove) != CAP_NAMES[i].name)
+				++i;
+			if (i == CAP_COUNT || !capOffered(CAP_NAMES[i].cap))
+				ok = false;
+			else
+				(remove ? disable : enable) |= CAP_NAMES[i].cap;
+		}
+		// A session is bound to its token once issued
+		if (client->getSession() && (disable & CAP_RESUME))
+			ok = false;
+		if (ok && !params.empty())
+		{
+			client->setCap(enable, true);
+			client->setCap(disable, false);
+		}
+		sendToClient(client, "CAP " + nick + (ok && !params.empty() ? " ACK :" : " NAK :") + params);
+		if (ok && (enable & CAP_RESUME) && client->isRegistered())
+			startSession(client);
+	}
+	else if (sub == "END")
+	{
+		if (!client->isCapNegotiating())
+			return;
+		client->setCapNegotiating(false);
+		if (client->getSaslStep() == SASL_STARTED)
+		{
+			client->setSaslStep(SASL_NONE);
+			client->getSaslBuffer().clear();
+			sendToClient(client, "906 " + nick + " :SASL authentication aborted");
+		}
+		if (!client->isRegistered() && !passwordSatisfied(client) && client->getSaslStep() != SASL_PENDING &&
+			client->hasSentUser())
+			sendError(client, "464", ":Password required");
+		checkRegistration(client);
+	}
+	else
+		sendToClient(client, "410 " + nick + " " + sub + " :Invalid CAP command");
+}
+
+// AUTHENTICATE PLAIN, then AUTHENTICATE <base64 authzid\0authcid\0password> in
+// 400-byte chunks ("+" ends a payload that is an exact multiple of 400)
+void Server::handleAuthenticateCommand(Client *client, const std::string &args)
+{
+	std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
+	std::string param = args.substr(0, args.find(' '));
+	if (!client->hasCap(CAP_SASL))
+	{
+		sendToClient(client, "904 " + nick + " :SASL authentication failed");
+		return;
+	}
+	if (!client->getAccount().empty())
+	{
+		sendToClient(client, "907 " + nick + " :You have already authenticated using SASL");
+		return;
+	}
+	if (client->isRegistered() || client->getSaslStep() == SASL_PENDING)
+	{
+		sendToClient(client, "904 " + nick + " :SASL authentication failed");
+		return;
+	}
+	if (param == "*")
+	{
+		client->setSaslStep(SASL_NONE);
+		client->getSaslBuffer().clear();
+		sendToClient(client, "906 " + nick + " :SASL authentication aborted");
+		return;
+	}
+	if (client->getSaslStep() == SASL_NONE)
+	{
+		std::string mechanism = param;
+		for (size_t i = 0; i < mechanism.size(); ++i)
+			mechanism[i] = std::toupper(mechanism[i]);
+		if (mechanism != "PLAIN")
+		{
+			sendToClient(client, "908 " + nick + " PLAIN :are available SASL mechanisms");
+			sendToClient(client, "904 " + nick + " :SASL authentication failed");
+			return;
+		}
+		client->setSaslStep(SASL_STARTED);
+		sendToClient(client, "AUTHENTICATE +");
+		return;
+	}
+
+	std::string &buffer = client->getSaslBuffer();
+	if (param != "+")
+		buffer += param;
+	if (param.size() > SASL_CHUNK || buffer.size() > SASL_MAX_PAYLOAD * 4 / 3 + 4)
+	{
+		client->setSaslStep(SASL_NONE);
+		buffer.clear();
+		sendToClient(client, "905 " + nick + " :SASL message too long");
+		return;
+	}
+	if (param.size() == SASL_CHUNK)
+		return; // more to come
+
+	std::string payload;
+	bool decoded = decodeBase64(buffer, payload);
+	buffer.clear();
+	size_t first = payload.find('\0');
+	size_t second = first == std::string::npos ? first : payload.find('\0', first + 1);
+	if (!decoded || second == std::string::npos)
+	{
+		client->setSaslStep(SASL_NONE);
+		sendToClient(client, "904 " + nick + " :SASL authentication failed");
+		return;
+	}
+	std::string authzid = payload.substr(0, first);
+	std::string account = payload.substr(first + 1, second - first - 1);
+	std::string password = payload.substr(second + 1);
+	payload.replace(0, payload.size(), payload.size(), '\0');
+	// Logging in as someone else (authzid) is not supported
+	bool usable = !account.empty() && (authzid.empty() || authzid == account);
+
+	std::map<std::string, std::string>::const_iterator it = _accounts.find(account);
+	bool known = usable && it != _accounts.end();
+	client->setSaslStep(SASL_PENDING);
+	client->setSaslSerial(++_saslSerial);
+	_workers.submit(new SaslPlainJob(client->getFd(), _saslSerial, account, password,
+									 known ? it->second : _unknownAccountHash, known));
+	password.replace(0, password.size(), password.size(), '\0');
+}
+
+// Back on the loop thread. The client may have left, and its fd been reused,
+// while the hash was computed: the serial tells.
+void Server::finishSasl(int fd, unsigned long serial, const std::string &account, bool ok)
+{
+	std::map<int, Client *>::iterator it = _clients.find(fd);
+	if (it == _clients.end() || it->second->getSaslStep() != SASL_PENDING || it->second->getSaslSerial() != serial)
+		return;
+	Client *client = it->second;
+	std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
+	client->setSaslStep(SASL_NONE);
+	if (!ok)
+	{
+		std::cout << "❌ Client [" << fd << "] SASL login failed for " << account << std::endl;
+		sendToClient(client, "904 " + nick + " :SASL authentication failed");
+	}
+	else
+	{
+		client->setAccount(account);
+		std::cout << "🔑 Client [" << fd << "] logged in as " << account << std::endl;
+		sendToClient(client, "900 " + nick + " " + client->getFullMask() + " " + account +
+								 " :You are now logged in as " + account);
+		sendToClient(client, "903 " + nick + " :SASL authentication successful");
+	}
+	// CAP END may already have arrived while the check was running
+	if (!client->isCapNegotiating())
+	{
+		if (!passwordSatisfied(client) && client->hasSentUser())
+			sendError(client, "464", ":Password required");
+		checkRegistration(client);
+	}
+}
+
+void Server::processWorkerResults()
+{
+	std::vector<WorkerJob *> done;
+	_workers.takeCompleted(done);
+	for (size_t i = 0; i < done.size(); ++i)
+	{
+		done[i]->complete(this);
+		delete done[i];
+	}
+}
@@ -0,0 +1,442 @@
+#include "ServerConfig.hpp"
+#include <iostream>
+#include <cstdlib>
+
+ServerConfig::ServerConfig() : tlsPort(0),
+							   websocketPort(0),
+							   websocketTlsPort(0),
+							   tlsSessionCacheSize(20000),
+							   tlsSessionTimeout(3600),
+							   tlsHandshakesPerTick(16),
+							   ioEngine("poll"),
+							   uringBuffers(1024),
+							   uringBufferSize(4096),
+							   serverName("ircserver"),
+							   historySize(1024 * 1024),
+							   historyMaxAge(7 * 86400),
+							   historyMaxLimit(100),
+							   maxListEntries(500),
+							   maxTargets(20),
+							   whoLimit(500),
+							   monitorLimit(100),
+							   sendQueueMax(1024 * 1024),
+							   workerThreads(2),
+							   latencyMode(false),
+							   pinCpu(-1),
+							   busyPoll(0),
+							   socketBuffer(0),
+							   compressLevel(6),
+							   compactIdle(60),
+							   overloadLag(100),
+							   overloadLines(8),
+							   fanoutInline(1000),
+							   fanoutSlice(2000),
+							   resumeGrace(300),
+							   resumeBuffer(64 * 1024),
+							   resumeFd(-1)
+{
+}
+
+static bool parseNumber(const std::string &value, long min, long max, long &out)
+{
+	if (value.empty())
+		return false;
+	char *end = NULL;
+	long n = std::strtol(value.c_str(), &end, 10);
+	if (*end != '\0' || n < min || n > max)
+		return false;
+	out = n;
+	return true;
+}
+
+// PORT | ADDRESS:PORT | [IPV6]:PORT | /unix/path, optionally followed by
+// ,tls ,websocket ,wss or ,publish
+static bool parseListen(const std::string &value, ListenConfig &listen)
+{
+	std::string address = value;
+	listen.kind = LISTENER_PLAIN;
+	size_t comma = value.rfind(',');
+	if (comma != std::string::npos)
+	{
+		std::string kind = value.substr(comma + 1);
+		address = value.substr(0, comma);
+		if (kind == "tls")
+			listen.kind = LISTENER_TLS;
+		else if (kind == "websocket")
+			listen.kind = LISTENER_WEBSOCKET;
+		else if (kind == "wss")
+			listen.kind = LISTENER_WEBSOCKET_TLS;
+		else if (kind == "publish")
+			listen.kind = LISTENER_PUBLISH;
+		else if (kind != "plain")
+			return false;
+	}
+	if (!address.empty() && address[0] == '/')
+	{
+		listen.host = address;
+		listen.port = 0;
+		return true;
+	}
+	std::string port = address;
+	listen.host.clear();
+	size_t colon = address.rfind(':');
+	if (!address.empty() && address[0] == '[')
+	{
+		size_t close = address.find("]:");
+		if (close == std::string::npos || close != colon - 1)
+			return false;
+		listen.host = address.substr(1, close - 1);
+		port = address.substr(colon + 1);
+	}
+	else if (colon != std::string::npos)
+	{
+		listen.host = address.substr(0, colon);
+		port = address.substr(colon + 1);
+	}
+	long n;
+	if (!parseNumber(port, 1, 65535, n))
+		return false;
+	listen.port = n;
+	return true;
+}
+
+bool ServerConfig::needsTls() const
+{
+	for (size_t i = 0; i < listens.size(); ++i)
+	{
+		if (listens[i].kind == LISTENER_TLS || listens[i].kind == LISTENER_WEBSOCKET_TLS)
+			return true;
+	}
+	return tlsPort || websocketTlsPort;
+}
+
+bool ServerConfig::parseOption(const std::string &option)
+{
+	if (option.compare(0, 2, "--") != 0)
+		return false;
+	size_t eq = option.find('=');
+	if (eq == std::string::npos)
+		return false;
+	std::string name = option.substr(2, eq - 2);
+	std::string value = option.substr(eq + 1);
+	long n;
+
+	if (name == "tls-port")
+	{
+		if (!parseNumber(value, 1, 65535, n))
+			return false;
+		tlsPort = n;
+	}
+	else if (name == "websocket-port")
+	{
+		if (!parseNumber(value, 1, 65535, n))
+			return false;
+		websocketPort = n;
+	}
+	else if (name == "websocket-tls-port")
+	{
+		if (!parseNumber(value, 1, 65535, n))
+			return false;
+		websocketTlsPort = n;
+	}
+	else if (name == "tls-cert")
+		tlsCert = value;
+	else if (name == "tls-key")
+		tlsKey = value;
+	else if (name == "tls-cache")
+	{
+		if (!parseNumber(value, 0, 10000000, n))
+			return false;
+		tlsSessionCacheSize = n;
+	}
+	else if (name == "tls-session-timeout")
+	{
+		if (!parseNumber(value, 1, 86400 * 7, n))
+			return false;
+		tlsSessionTimeout = n;
+	}
+	else if (name == "tls-handshakes")
+	{
+		if (!parseNumber(value, 1, 100000, n))
+			return false;
+		tlsHandshakesPerTick = n;
+	}
+	else if (name == "io")
+	{
+		if (value != "poll" && value != "uring")
+			return false;
+		ioEngine = value;
+	}
+	else if (name == "uring-buffers")
+	{
+		if (!parseNumber(value, 1, 32768, n) || (n & (n - 1)) != 0)
+			return false;
+		uringBuffers = n;
+	}
+	else if (name == "uring-buffer-size")
+	{
+		if (!parseNumber(value, 512, 1 << 20, n))
+			return false;
+		uringBufferSize = n;
+	}
+	else if (name == "server-name")
+	{
+		if (value.empty() || value.find_first_of(" :,") != std::string::npos)
+			return false;
+		serverName = value;
+	}
+	else if (name == "listen")
+	{
+		ListenConfig listen;
+		if (!parseListen(value, listen))
+			return false;
+		listens.push_back(listen);
+	}
+	else if (name == "link")
+	{
+		// NAME:PASSWORD[:HOST:PORT]
+		LinkConfig link;
+		std::vector<std::string> parts;
+		size_t start = 0, colon;
+		while ((colon = value.find(':', start)) != std::string::npos)
+		{
+			parts.push_back(value.substr(start, colon - start));
+			start = colon + 1;
+		}
+		parts.push_back(value.substr(start));
+		if ((parts.size() != 2 && parts.size() != 4) || parts[0].empty() || parts[1].empty())
+			return false;
+		link.name = parts[0];
+		link.password = parts[1];
+		link.port = 0;
+		if (parts.size() == 4)
+		{
+			if (parts[2].empty() || !parseNumber(parts[3], 1, 65535, n))
+				return false;
+			link.host = parts[2];
+			link.port = n;
+		}
+		links.push_back(link);
+	}
+	else if (name == "oper")
+	{
+		// NAME:PASSWORD
+		size_t colon = value.find(':');
+		if (colon == std::string::npos || colon == 0 || colon + 1 == value.size())
+			return false;
+		opers[value.substr(0, colon)] = value.substr(colon + 1);
+	}
+	else if (name == "publisher")
+	{
+		// NAME:TOKEN
+		size_t colon = value.find(':');
+		if (colon == std::string::npos || colon == 0 || colon > 255 || colon + 1 == value.size())
+			return false;
+		publishers[value.substr(0, colon)] = value.substr(colon + 1);
+	}
+	else if (name == "history-dir")
+		historyDir = value;
+	else if (name == "history-size")
+	{
+		if (!parseNumber(value, 64 * 1024, 1L << 30, n))
+			return false;
+		historySize = n;
+	}
+	else if (name == "history-max-age")
+	{
+		if (!parseNumber(value, 60, 365L * 86400, n))
+			return false;
+		historyMaxAge = n;
+	}
+	else if (name == "history-limit")
+	{
+		if (!parseNumber(value, 1, 10000, n))
+			return false;
+		historyMaxLimit = n;
+	}
+	else if (name == "max-list")
+	{
+		if (!parseNumber(value, 1, 100000, n))
+			return false;
+		maxListEntries = n;
+	}
+	else if (name == "max-targets")
+	{
+		if (!parseNumber(value, 1, 1000, n))
+			return false;
+		maxTargets = n;
+	}
+	else if (name == "who-limit")
+	{
+		if (!parseNumber(value, 1, 1000000, n))
+			return false;
+		whoLimit = n;
+	}
+	else if (name == "monitor-limit")
+	{
+		if (!parseNumber(value, 1, 10000, n))
+			return false;
+		monitorLimit = n;
+	}
+	else if (name == "sendq")
+	{
+		if (!parseNumber(value, 4096, 1L << 30, n))
+			return false;
+		sendQueueMax = n;
+	}
+	else if (name == "accounts")
+	{
+		if (value.empty())
+			return false;
+		accountsFile = value;
+	}
+	else if (name == "latency")
+	{
+		if (value != "on" && value != "off")
+			return false;
+		latencyMode = value == "on";
+	}
+	else if (name == "pin-cpu")
+	{
+		if (!parseNumber(value, 0, 1023, n))
+			return false;
+		pinCpu = n;
+	}
+	else if (name == "busy-poll")
+	{
+		if (!parseNumber(value, 0, 1000000, n))
+			return false;
+		busyPoll = n;
+	}
+	else if (name == "socket-buffer")
+	{
+		if (!parseNumber(value, 0, 64L << 20, n))
+			return false;
+		socketBuffer = n;
+	}
+	else if (name == "filters")
+	{
+		if (value.empty())
+			return false;
+		filtersFile = value;
+	}
+	else if (name == "workers")
+	{
+		if (!parseNumber(value, 1, 64, n))
+			return false;
+		workerThreads = n;
+	}
+	else if (name == "compress-level")
+	{
+		if (!parseNumber(value, 0, 9, n))
+			return false;
+		compressLevel = n;
+	}
+	else if (name == "compact-idle")
+	{
+		if (!parseNumber(value, 1, 86400, n))
+			return false;
+		compactIdle = n;
+	}
+	else if (name == "overload-lag")
+	{
+		if (!parseNumber(value, 0, 60000, n))
+			return false;
+		overloadLag = n;
+	}
+	else if (name == "overload-lines")
+	{
+		if (!parseNumber(value, 1, 100000, n))
+			return false;
+		overloadLines = n;
+	}
+	else if (name == "fanout-inline")
+	{
+		if (!parseNumber(value, 0, 10000000, n))
+			return false;
+		fanoutInline = n;
+	}
+	else if (name == "fanout-slice")
+	{
+		if (!parseNumber(value, 1, 10000000, n))
+			return false;
+		fanoutSlice = n;
+	}
+	else if (name == "resume-grace")
+	{
+		if (!parseNumber(value, 0, 86400, n))
+			return false;
+		resumeGrace = n;
+	}
+	else if (name == "resume-buffer")
+	{
+		if (!parseNumber(value, 1024, 16 * 1024 * 1024, n))
+			return false;
+		resumeBuffer = n;
+	}
+	else if (name == "resume-fd")
+	{
+		if (!parseNumber(value, 0, 1 << 20, n))
+			return false;
+		resumeFd = n;
+	}
+	else
+		return false;
+	return true;
+}
+
+void ServerConfig::printUsage()
+{
+	std::cerr << "Usage: ./ircserv <port> <password> [options]" << std::endl;
+	std::cerr << "  --tls-port=N             TLS listener port (needs a TLS=1 build)" << std::endl;
+	std::cerr << "  --websocket-port=N       WebSocket listener for browser clients (ws://)" << std::endl;
+	std::cerr << "  --websocket-tls-port=N   WebSocket over TLS (wss://, needs a TLS=1 build)" << std::endl;
+	std::cerr << "  --listen=ADDR[,KIND]     extra listener (repeatable): PORT, IPV4:PORT, [IPV6]:PORT or" << std::endl;
+	std::cerr << "                           /path for a Unix socket; KIND is plain, tls, websocket, wss or" << std::endl;
+	std::cerr << "                           publish (binary publish API for bots, see ServerPublish.cpp)" << std::endl;
+	std::cerr << "  --tls-cert=FILE          PEM certificate" << std::endl;
+	std::cerr << "  --tls-key=FILE           PEM private key" << std::endl;
+	std::cerr << "  --tls-cache=N            server-side session cache size" << std::endl;
+	std::cerr << "  --tls-session-timeout=S  session/ticket lifetime in seconds" << std::endl;
+	std::cerr << "  --tls-handshakes=N       handshake steps allowed per loop tick" << std::endl;
+	std::cerr << "  --io=poll|uring          event loop backend (uring is Linux only)" << std::endl;
+	std::cerr << "  --uring-buffers=N        provided receive buffers, power of two" << std::endl;
+	std::cerr << "  --uring-buffer-size=N    bytes per provided receive buffer" << std::endl;
+	std::cerr << "  --server-name=NAME       name of this server on the network" << std::endl;
+	std::cerr << "  --link=NAME:PASS[:HOST:PORT]  peer allowed to link; with HOST:PORT we connect to it" << std::endl;
+	std::cerr << "  --oper=NAME:PASS         operator credentials for OPER (repeatable)" << std::endl;
+	std::cerr << "  --publisher=NAME:TOKEN   bot allowed on publish listeners (repeatable)" << std::endl;
+	std::cerr << "  --accounts=FILE          NAME:HASH lines (crypt(3) hashes, e.g. mkpasswd -m bcrypt)" << std::endl;
+	std::cerr << "                           enables CAP/SASL PLAIN" << std::endl;
+	std::cerr << "  --filters=FILE           content filter, one \"drop|block|kill <phrase>\" per line (see FILTER)" << std::endl;
+	std::cerr << "  --latency=on|off         spin on zero-timeout polls instead of sleeping, TCP_NODELAY," << std::endl;
+	std::cerr << "                           no per-line logging: lowest delivery latency, one busy core" << std::endl;
+	std::cerr << "  --pin-cpu=N              pin the event loop to core N" << std::endl;
+	std::cerr << "  --busy-poll=USEC         SO_BUSY_POLL on accepted sockets (NIC queues with NAPI)" << std::endl;
+	std::cerr << "  --socket-buffer=BYTES    SO_SNDBUF and SO_RCVBUF on accepted sockets" << std::endl;
+	std::cerr << "  --workers=N              threads for CPU-heavy work such as SASL checks (default 2)" << std::endl;
+	std::cerr << "  --history-dir=DIR        keep channel history in DIR (enables CHATHISTORY)" << std::endl;
+	std::cerr << "  --history-size=BYTES     log size per channel" << std::endl;
+	std::cerr << "  --history-max-age=S      drop messages older than S seconds" << std::endl;
+	std::cerr << "  --history-limit=N        max messages per CHATHISTORY request" << std::endl;
+	std::cerr << "  --max-list=N             entries per +b / +e list (default 500)" << std::endl;
+	std::cerr << "  --max-targets=N          targets per PRIVMSG/NOTICE (default 20)" << std::endl;
+	std::cerr << "  --who-limit=N            replies per WHO (default 500)" << std::endl;
+	std::cerr << "  --monitor-limit=N        nicknames per MONITOR list (default 100)" << std::endl;
+	std::cerr << "  --sendq=BYTES            unsent output allowed per user (default 1 MiB)" << std::endl;
+	std::cerr << "  --compress-level=N       zlib level for COMPRESS DEFLATE, 1 fast .. 9 small, 0 off (default 6)" << std::endl;
+	std::cerr << "  --compact-idle=SECONDS   trim buffers of clients idle this long (default 60)" << std::endl;
+	std::cerr << "  --overload-lag=MS        loop lag that defers LIST/WHO and budgets input, 4x that" << std::endl;
+	std::cerr << "                           also pauses accepts; 0 off (default 100)" << std::endl;
+	std::cerr << "  --overload-lines=N       lines per client per loop tick while overloaded (default 8)" << std::endl;
+	std::cerr << "  --fanout-inline=N        channels above N members get messages in slices (default 1000)" << std::endl;
+	std::cerr << "  --fanout-slice=N         members of those channels reached per loop tick (default 2000)" << std::endl;
+	std::cerr << "  --resume-grace=SECONDS   keep a dropped session for RESUME this long, 0 off (default 300)" << std::endl;
+	std::cerr << "  --resume-buffer=BYTES    missed lines kept per dropped session (default 64 KiB)" << std::endl;
+	std::cerr << "       ./ircserv --compress-bench=FILE   compression ratio and CPU cost on recorded traffic" << std::endl;
+	std::cerr << "       ./ircserv --idle-bench=N          server memory per idle registered client" << std::endl;
+	std::cerr << "       ./ircserv --latency-bench=N       delivery latency to N channel members, normal vs --latency=on" << std::endl;
+	std::cerr << "       ./ircserv --uring-bench=N         channel throughput to N members, --io=poll vs --io=uring" << std::endl;
+	std::cerr << "       ./ircserv --sim-bench=N           command and fan-out throughput for N clients on a simulated network" << std::endl;
+	std::cerr << "Send SIGUSR2 to restart into the current binary without dropping connections." << std::endl;
+}
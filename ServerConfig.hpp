@@ -0,0 +1,87 @@
+#ifndef SERVERCONFIG_HPP
+#define SERVERCONFIG_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+enum ListenerKind
+{
+	LISTENER_PLAIN,
+	LISTENER_TLS,
+	LISTENER_WEBSOCKET,
+	LISTENER_WEBSOCKET_TLS,
+	LISTENER_PUBLISH // binary publish API for bots (ServerPublish.cpp)
+};
+
+// An extra listening socket (--listen, repeatable)
+struct ListenConfig
+{
+	std::string host; // numeric IPv4/IPv6 address, empty for all of them, or a Unix socket path
+	int port;		  // 0 for a Unix socket
+	ListenerKind kind;
+};
+
+// A peer ircserv instance allowed to link with us
+struct LinkConfig
+{
+	std::string name;
+	std::string password;
+	std::string host; // empty: wait for the peer to connect
+	int port;
+};
+
+// Optional settings passed on the command line as --name=value after <port> <password>
+struct ServerConfig
+{
+	int tlsPort;				 // 0 = no TLS listener
+	std::string tlsCert;		 // PEM certificate chain
+	std::string tlsKey;			 // PEM private key
+	int websocketPort;			 // 0 = no WebSocket listener
+	int websocketTlsPort;		 // 0 = no WebSocket-over-TLS (wss://) listener
+	std::vector<ListenConfig> listens; // Extra listeners (--listen, repeatable)
+	long tlsSessionCacheSize;	 // Max sessions kept in the server-side cache
+	long tlsSessionTimeout;		 // Seconds a cached session / ticket stays resumable
+	int tlsHandshakesPerTick;	 // Max handshake steps per loop iteration
+	std::string ioEngine;		 // "poll" or "uring"
+	long uringBuffers;			 // Provided receive buffers (power of two)
+	long uringBufferSize;		 // Bytes per provided buffer
+	std::string serverName;		 // Unique name of this server on the network
+	std::vector<LinkConfig> links; // Peers allowed to link (--link, repeatable)
+	std::map<std::string, std::string> opers; // OPER name -> password (--oper, repeatable)
+	std::map<std::string, std::string> publishers; // publish API bot name -> token (--publisher, repeatable)
+	std::string historyDir;		 // Channel history logs (empty = history disabled)
+	long historySize;			 // Bytes mapped per channel log
+	long historyMaxAge;			 // Seconds a message is kept
+	long historyMaxLimit;		 // Max messages returned by one CHATHISTORY
+	long maxListEntries;		 // Max entries in a channel's +b or +e list
+	long maxTargets;			 // Max comma-separated targets per PRIVMSG/NOTICE
+	long whoLimit;				 // Max replies to one WHO before it is cut short
+	long monitorLimit;			 // Max nicknames on one MONITOR list
+	long sendQueueMax;			 // Unsent bytes a user may accumulate before being dropped
+	std::string accountsFile;	 // name:crypt-hash lines for SASL PLAIN (empty = no SASL)
+	std::string filtersFile;	 // "<action> <phrase>" lines loaded into the content filter
+	long workerThreads;			 // Worker pool size (SASL password checks)
+	bool latencyMode;			 // Spin on zero-timeout polls, TCP_NODELAY, no per-line logging
+	int pinCpu;					 // Core the event loop is pinned to (-1 = not pinned)
+	long busyPoll;				 // SO_BUSY_POLL microseconds on accepted sockets (0 = off)
+	long socketBuffer;			 // SO_SNDBUF / SO_RCVBUF on accepted sockets (0 = kernel default)
+	long compressLevel;			 // zlib level for COMPRESS DEFLATE, 0 = not offered
+	long compactIdle;			 // Seconds without input before a client's buffers are trimmed
+	long overloadLag;			 // Loop lag (ms) that starts overload protection, 0 = off
+	long overloadLines;			 // Lines handled per client per tick while overloaded
+	long fanoutInline;			 // Largest channel delivered to inside the command handler
+	long fanoutSlice;			 // Members of larger channels reached per loop tick
+	long resumeGrace;			 // Seconds a dropped session waits for RESUME, 0 = not offered
+	long resumeBuffer;			 // Bytes of missed lines kept per detached session
+	int resumeFd;				 // Hot restart: socket the previous process hands its state over
+	std::string execPath;		 // Binary to exec on hot restart
+	std::vector<std::string> execArgs; // Original command line, replayed on hot restart
+
+	ServerConfig();
+	bool parseOption(const std::string &option);
+	bool needsTls() const;
+	static void printUsage();
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "Server.hpp"
+#include <algorithm>
+#include <functional>
+
+// Budgeted fan-out: a message to a channel with more than --fanout-inline
+// members is not delivered inside the command handler. It is queued behind
+// the channel's earlier deliveries and handed out to --fanout-slice members
+// per loop tick, shared between the channels with work pending, so one line
+// to a huge announce channel does not stall every other client for the whole
+// walk. Anything sent to a channel while it has deliveries queued joins the
+// queue too, whatever the channel's size, so members see its lines in order.
+// Consecutive lines from one source share a job until it starts: a burst
+// then costs each member one visit (and one write) instead of one per line.
+// A user quitting joins the queues the same way (queueQuit), so its QUIT is
+// not read before what it said last.
+
+namespace
+{
+	const size_t MAX_BATCH_LINES = 64;
+}
+
+bool Server::fanoutQueued(Channel *channel) const
+{
+	return channel->getClients().size() > static_cast<size_t>(_config.fanoutInline) || _fanout.count(channel);
+}
+
+void Server::queueFanout(Channel *channel, const std::string &line, const std::string &linkLine, Client *sender,
+						 bool skipSender, unsigned long notice)
+{
+	std::deque<FanoutJob> &jobs = _fanout[channel];
+	if (!jobs.empty() && !notice)
+	{
+		FanoutJob &last = jobs.back();
+		if (!last.started && last.sender == sender && last.skipSender == skipSender && last.origin == _currentLink &&
+			!last.notice && last.lines < MAX_BATCH_LINES)
+		{
+			last.line += line;
+			last.linkLine += linkLine;
+			last.lines++;
+			return;
+		}
+	}
+	jobs.push_back(FanoutJob());
+	FanoutJob &job = jobs.back();
+	job.line = line;
+	job.linkLine = linkLine;
+	job.lines = 1;
+	job.sender = sender;
+	job.skipSender = skipSender;
+	job.origin = _currentLink;
+	job.started = false;
+	job.cursor = NULL;
+	job.notice = notice;
+}
+
+// A user leaving channels that have deliveries queued: its QUIT joins each
+// queue, behind the lines it sent before. Links hear the QUIT right after
+// this (quitClient), so the copies they are still owed go out first.
+void Server::queueQuit(const std::vector<Channel *> &channels, const ReplyBuilder &message, Client *client)
+{
+	unsigned long notice = ++_nextNotice;
+	_quitNotices[notice].channels = channels;
+	_quitNotices[notice].jobs = channels.size();
+	std::string line(message.data(), message.size());
+	for (size_t i = 0; i < channels.size(); ++i)
+	{
+		releaseLinkCopies(channels[i]);
+		queueFanout(channels[i], line, "", client, true, notice);
+	}
+}
+
+// Every link not sent a queued job's linkLine yet gets it now. Finding which
+// links have members would mean walking the channel, so all of them do.
+void Server::releaseLinkCopies(Channel *channel)
+{
+	std::map<Channel *, std::deque<FanoutJob> >::iterator it = _fanout.find(channel);
+	for (size_t i = 0; it != _fanout.end() && i < it->second.size(); ++i)
+	{
+		FanoutJob &job = it->second[i];
+		if (job.linkLine.empty())
+			continue;
+		for (std::map<std::string, Client *>::iterator link = _links.begin(); link != _links.end(); ++link)
+		{
+			if (link->second != job.origin && job.links.insert(link->second).second)
+				sendToClient(link->second, job.linkLine);
+		}
+	}
+}
+
+// One member reached by a job. Remote members cost their link one copy, the
+// first time one is reached.
+void Server::deliverFanout(FanoutJob &job, Client *member)
+{
+	if (member == job.sender && job.skipSender)
+		return;
+	if (member->isRemote())
+	{
+		if (!job.linkLine.empty() && member->getUplink() != job.origin && job.links.insert(member->getUplink()).second)
+			sendToClient(member->getUplink(), job.linkLine);
+	}
+	else if (!job.notice || quitNoticeDue(job, member))
+		sendToClient(member, job.line);
+}
+
+// False while another channel carrying the same QUIT still has its job ahead
+// of the member; that job tells it instead. The job is looked up before the
+// channel is touched: a channel gone since has no jobs left.
+bool Server::quitNoticeDue(const FanoutJob &job, Client *member)
+{
+	QuitNotice &notice = _quitNotices[job.notice];
+	for (size_t i = 0; i < notice.channels.size(); ++i)
+	{
+		std::map<Channel *, std::deque<FanoutJob> >::iterator it = _fanout.find(notice.channels[i]);
+		for (size_t j = 0; it != _fanout.end() && j < it->second.size(); ++j)
+		{
+			const FanoutJob &other = it->second[j];
+			if (&other == &job || other.notice != job.notice)
+				continue;
+			if ((!other.started || std::less<Client *>()(other.cursor, member)) && it->first->hasClient(member))
+				return false;
+		}
+	}
+	return notice.told.insert(member).second;
+}
+
+void Server::finishFanoutJob(const FanoutJob &job)
+{
+	std::map<unsigned long, QuitNotice>::iterator it = _quitNotices.find(job.notice);
+	if (it != _quitNotices.end() && --it->second.jobs == 0)
+		_quitNotices.erase(it);
+}
+
+// Up to `budget` more members; true once the job has reached the last one
+bool Server::runFanoutJob(Channel *channel, FanoutJob &job, size_t &budget)
+{
+	const std::set<Client *> &members = channel->getClients();
+	std::set<Client *>::const_iterator it = job.started ? members.upper_bound(job.cursor) : members.begin();
+	for (; it != members.end() && budget; ++it)
+	{
+		job.started = true;
+		job.cursor = *it;
+		--budget;
+		deliverFanout(job, *it);
+	}
+	return it == members.end();
+}
+
+// A member leaving while the channel has deliveries queued gets the lines it
+// has not been reached with yet, in order, the KICK removing it included
+void Server::removeFromChannel(Channel *channel, Client *member)
+{
+	std::map<Channel *, std::deque<FanoutJob> >::iterator it = _fanout.find(channel);
+	for (size_t i = 0; it != _fanout.end() && i < it->second.size(); ++i)
+	{
+		FanoutJob &job = it->second[i];
+		// Already reached: the walk follows the set's order, std::less on pointers
+		if (!job.started || std::less<Client *>()(job.cursor, member))
+			deliverFanout(job, member);
+	}
+	channel->removeClient(member);
+}
+
+// Once per loop tick, at the flush: each channel with deliveries pending gets
+// an equal share of the slice, its jobs run strictly one after the other
+void Server::pumpFanout()
+{
+	if (_fanout.empty())
+		return;
+	size_t share = std::max(static_cast<size_t>(1), static_cast<size_t>(_config.fanoutSlice) / _fanout.size());
+	std::map<Channel *, std::deque<FanoutJob> >::iterator it = _fanout.begin();
+	while (it != _fanout.end())
+	{
+		size_t budget = share;
+		std::deque<FanoutJob> &jobs = it->second;
+		while (budget && !jobs.empty() && runFanoutJob(it->first, jobs.front(), budget))
+		{
+			finishFanoutJob(jobs.front());
+			jobs.pop_front();
+		}
+		if (jobs.empty())
+			_fanout.erase(it++);
+		else
+			++it;
+	}
+}
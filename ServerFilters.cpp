@@ -0,0 +1,222 @@
+#include "Server.hpp"
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cctype>
+
+// Content filter: phrases operators want kept off the network (spam waves),
+// checked once per PRIVMSG/NOTICE before it fans out. Rules change with FILTER
+// at any time; the automaton is recompiled on a worker thread and swapped in
+// when ready, the previous one serving in the meantime. A removed rule stops
+// applying at once: matches are checked against the live rule list.
+
+namespace
+{
+	class FilterBuildJob : public WorkerJob
+	{
+	private:
+		SpamFilter *_filter;
+		std::vector<FilterRule> _rules;
+
+	public:
+		FilterBuildJob(unsigned long generation, const std::vector<FilterRule> &rules)
+			: _filter(new SpamFilter(generation)), _rules(rules)
+		{
+		}
+
+		~FilterBuildJob()
+		{
+			delete _filter;
+		}
+
+		void run()
+		{
+			_filter->build(_rules);
+		}
+
+		void complete(Server *server)
+		{
+			server->installFilter(_filter);
+			_filter = NULL;
+		}
+	};
+}
+
+bool Server::loadFilters(const std::string &path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		std::cerr << "Cannot read filters file " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	for (int number = 1; std::getline(file, line); ++number)
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		size_t space = line.find(' ');
+		FilterRule rule;
+		if (space == std::string::npos || space + 1 == line.size() ||
+			!FilterRule::parseAction(line.substr(0, space), rule.action))
+		{
+			std::cerr << path << ":" << number << ": expected drop|block|kill <phrase>" << std::endl;
+			return false;
+		}
+		rule.id = _nextFilterId++;
+		rule.phrase = line.substr(space + 1);
+		rule.hits = 0;
+		_filterRules[rule.id] = rule;
+	}
+	rebuildFilter(true);
+	std::cout << "🚫 Loaded " << _filterRules.size() << " content filter rules" << std::endl;
+	return true;
+}
+
+// inPlace: compile on this thread (startup, hot restart), before any message is read
+void Server::rebuildFilter(bool inPlace)
+{
+	std::vector<FilterRule> rules;
+	for (std::map<unsigned long, FilterRule>::const_iterator it = _filterRules.begin(); it != _filterRules.end(); ++it)
+		rules.push_back(it->second);
+	FilterBuildJob *job = new FilterBuildJob(++_filterGeneration, rules);
+	if (!inPlace)
+	{
+		_workers.submit(job);
+		return;
+	}
+	job->run();
+	job->complete(this);
+	delete job;
+}
+
+void Server::installFilter(SpamFilter *filter)
+{
+	// Builds may finish out of order: never replace a newer automaton
+	if (_filter && filter->generation() <= _filter->generation())
+	{
+		delete filter;
+		return;
+	}
+	delete _filter;
+	_filter = filter;
+	std::cout << "🚫 Content filter ready: " << filter->ruleCount() << " rules, " << filter->stateCount() << " states, "
+			  << filter->memoryBytes() << " bytes" << std::endl;
+}
+
+// False when the message must not go out; the rule's action has been applied
+// (for kill, `client` is gone)
+bool Server::filterAllows(Client *client, const std::string &command, const std::string &targets,
+						  const std::string &text)
+{
+	// Remote users were filtered by their own server; operators are trusted
+	if (!_filter || !_filter->ruleCount() || client->isRemote() || client->isServerOperator())
+		return true;
+	unsigned long id = _filter->scan(text.data(), text.size(), _filterRules);
+	std::map<unsigned long, FilterRule>::iterator rule = id ? _filterRules.find(id) : _filterRules.end();
+	if (rule == _filterRules.end())
+		return true;
+	rule->second.hits++;
+	std::cout << "🚫 Filter #" << id << " (" << FilterRule::actionName(rule->second.action) << ") stopped a "
+			  << command << " from " << client->getNickname() << " to " << targets << std::endl;
+	if (rule->second.action == FILTER_BLOCK && command != "NOTICE")
+		sendToClient(client, "FAIL " + command + " MESSAGE_FILTERED " + targets + " :Message blocked by the content filter");
+	else if (rule->second.action == FILTER_KILL)
+	{
+		sendToClient(client, "ERROR :Killed (Content filter)");
+		dropLocalUser(client, "Killed (Content filter)");
+	}
+	return false;
+}
+
+// FILTER ADD <drop|block|kill> :<phrase>
+// FILTER DEL <id>
+// FILTER LIST
+void Server::handleFilterCommand(Client *client, const std::string &args)
+{
+	if (!client->isRegistered())
+	{
+		sendError(client, "451", ":You have not registered");
+		return;
+	}
+	std::istringstream in(args);
+	std::string sub;
+	in >> sub;
+	for (size_t i = 0; i < sub.size(); ++i)
+		sub[i] = std::toupper(static_cast<unsigned char>(sub[i]));
+	if (sub.empty())
+	{
+		sendToClient(client, "461 " + client->getNickname() + " FILTER :Not enough parameters");
+		return;
+	}
+	if (!client->isServerOperator())
+	{
+		sendToClient(client, "481 " + client->getNickname() + " :Permission Denied- You're not an IRC operator");
+		return;
+	}
+
+	if (sub == "ADD")
+	{
+		std::string action;
+		in >> action;
+		std::string phrase;
+		std::getline(in >> std::ws, phrase);
+		if (!phrase.empty() && phrase[0] == ':')
+			phrase.erase(0, 1);
+		FilterRule rule;
+		if (phrase.empty())
+		{
+			sendToClient(client, "461 " + client->getNickname() + " FILTER :Not enough parameters");
+			return;
+		}
+		if (!FilterRule::parseAction(action, rule.action))
+		{
+			sendToClient(client, "FAIL FILTER INVALID_ACTION " + action + " :Action must be drop, block or kill");
+			return;
+		}
+		rule.id = _nextFilterId++;
+		rule.phrase = phrase;
+		rule.hits = 0;
+		_filterRules[rule.id] = rule;
+		rebuildFilter(false);
+		std::ostringstream reply;
+		reply << "NOTE FILTER ADDED " << rule.id << " " << action << " :" << phrase;
+		sendToClient(client, reply.str());
+		std::cout << "🚫 " << client->getNickname() << " added filter #" << rule.id << " (" << action << ")" << std::endl;
+	}
+	else if (sub == "DEL")
+	{
+		std::string id;
+		in >> id;
+		if (!_filterRules.erase(std::strtoul(id.c_str(), NULL, 10)))
+		{
+			sendToClient(client, "FAIL FILTER NO_SUCH_FILTER " + (id.empty() ? "*" : id) + " :No such filter");
+			return;
+		}
+		rebuildFilter(false);
+		sendToClient(client, "NOTE FILTER REMOVED " + id + " :Filter removed");
+		std::cout << "🚫 " << client->getNickname() << " removed filter #" << id << std::endl;
+	}
+	else if (sub == "LIST")
+	{
+		std::string prefix = "249 " + client->getNickname() + " :";
+		for (std::map<unsigned long, FilterRule>::const_iterator it = _filterRules.begin(); it != _filterRules.end(); ++it)
+		{
+			std::ostringstream line;
+			line << prefix << "#" << it->first << " " << FilterRule::actionName(it->second.action) << " hits "
+				 << it->second.hits << " " << it->second.phrase;
+			sendToClient(client, line.str());
+		}
+		std::ostringstream summary;
+		summary << prefix << _filterRules.size() << " rules, automaton " << (_filter ? _filter->stateCount() : 0)
+				<< " states, " << (_filter ? _filter->memoryBytes() : 0) << " bytes"
+				<< (_filter && _filter->generation() == _filterGeneration ? "" : " (rebuilding)");
+		sendToClient(client, summary.str());
+		sendToClient(client, "219 " + client->getNickname() + " F :End of /FILTER list");
+	}
+	else
+		sendToClient(client, "FAIL FILTER INVALID_COMMAND " + sub + " :Use ADD, DEL or LIST");
+}
@@ -0,0 +1,715 @@
+#include "Server.hpp"
+#include "Secrets.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sstream>
+#include "MonitorCommands.hpp"
+
+// Server-to-server protocol, loosely modelled on TS6:
+//   SERVER <name> <password> :<description>   handshake, sent by both ends
+//   SID <name> / SQUIT <name>                  servers reachable behind a link
+//   UID <nick> <ts> <user> <host> :<realname>  user introduction
+//   SJOIN <ts> <#chan> <modes> [params] :[@]nick ...   channel burst
+//   TB <#chan> :<topic>                        topic burst
+//   BMASK <ts> <#chan> <b|e> :<mask> ...       ban / exception list burst
+//   EOB                                        end of burst
+// After the burst, user commands travel with the user as prefix
+// (:nick!user@host PRIVMSG/JOIN/MODE/KICK/TOPIC/INVITE/NICK/QUIT).
+// The network must be a tree: a server already known is refused.
+
+static const int LINK_RETRY_SECONDS = 10;
+static const size_t SJOIN_MEMBERS_PER_LINE = 400;
+
+static std::string stripColon(const std::string &value)
+{
+	if (!value.empty() && value[0] == ':')
+		return value.substr(1);
+	return value;
+}
+
+const LinkConfig *Server::findLinkConfig(const std::string &name) const
+{
+	for (size_t i = 0; i < _config.links.size(); ++i)
+	{
+		if (_config.links[i].name == name)
+			return &_config.links[i];
+	}
+	return NULL;
+}
+
+// Start outbound connections for configured links that are down and due for a retry
+void Server::connectLinks()
+{
+	time_t now = time(NULL);
+	for (size_t i = 0; i < _config.links.size(); ++i)
+	{
+		const LinkConfig &cfg = _config.links[i];
+		if (cfg.host.empty() || _links.count(cfg.name))
+			continue;
+		std::map<std::string, time_t>::iterator retry = _linkRetryAt.find(cfg.name);
+		if (retry != _linkRetryAt.end() && (retry->second == 0 || retry->second > now))
+			continue; // attempt in progress, or backing off
+
+		struct addrinfo hints;
+		struct addrinfo *res = NULL;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_ADDRCONFIG;
+		std::ostringstream port;
+		port << cfg.port;
+		_linkRetryAt[cfg.name] = now + LINK_RETRY_SECONDS;
+		if (getaddrinfo(cfg.host.c_str(), port.str().c_str(), &hints, &res) != 0 || !res)
+		{
+			std::cerr << "Link " << cfg.name << ": cannot resolve " << cfg.host << std::endl;
+			continue;
+		}
+		int fd = socket(res->ai_family, SOCK_STREAM, 0);
+		if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+			(connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS))
+		{
+			perror("connect");
+			if (fd >= 0)
+				close(fd);
+			freeaddrinfo(res);
+			continue;
+		}
+		freeaddrinfo(res);
+
+		Client *link = new Client(fd);
+		link->setLinkName(cfg.name);
+		link->setLinkConnecting(true);
+		_clients[fd] = link;
+		_pollFds.push_back(pollEntry(fd, POLLOUT));
+		if (_useUring)
+			_uring.addPollable(fd, POLLOUT);
+		_linkRetryAt[cfg.name] = 0;
+		std::cout << "🔗 Connecting to " << cfg.name << " (" << cfg.host << ":" << cfg.port << ")" << std::endl;
+	}
+}
+
+void Server::finishLinkConnect(Client *link)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(link->getFd(), SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+	{
+		std::cerr << "Link " << link->getLinkName() << ": " << std::strerror(err ? err : errno) << std::endl;
+		disconnectClient(link->getFd());
+		return;
+	}
+	link->setLinkConnecting(false);
+	setPollEvents(link->getFd(), POLLIN);
+	const LinkConfig *cfg = findLinkConfig(link->getLinkName());
+	sendToClient(link, "SERVER " + _config.serverName + " " + cfg->password + " :ircserv");
+}
+
+void Server::handleServerCommand(Client *client, const std::string &args)
+{
+	if (client->isRegistered() || client->isServerLink())
+	{
+		sendError(client, "462", ":You may not reregister");
+		return;
+	}
+	std::istringstream iss(args);
+	std::string name, password;
+	iss >> name >> password;
+
+	const LinkConfig *cfg = findLinkConfig(name);
+	bool outbound = !client->getLinkName().empty();
+	if (!cfg || !Secrets::equal(password, cfg->password) || (outbound && client->getLinkName() != name))
+	{
+		std::cout << "❌ Rejected server link from fd=" << client->getFd() << " (" << name << ")" << std::endl;
+		sendToClient(client, "ERROR :Bad link credentials");
+		disconnectClient(client->getFd());
+		return;
+	}
+	if (name == _config.serverName || _links.count(name) || _remoteServers.count(name))
+	{
+		sendToClient(client, "ERROR :Server " + name + " already exists");
+		disconnectClient(client->getFd());
+		return;
+	}
+
+	client->setLinkName(name);
+	client->markServerLink();
+	_links[name] = client;
+	_linkRetryAt.erase(name);
+	if (!outbound)
+		sendToClient(client, "SERVER " + _config.serverName + " " + cfg->password + " :ircserv");
+	std::cout << "🔗 Linked with " << name << " (fd=" << client->getFd() << ")" << std::endl;
+
+	sendBurst(client);
+	_currentLink = client;
+	propagateToLinks("SID " + name, NULL);
+	_currentLink = NULL;
+}
+
+void Server::sendBurst(Client *link)
+{
+	for (std::map<std::string, Client *>::iterator it = _remoteServers.begin(); it != _remoteServers.end(); ++it)
+		sendToClient(link, "SID " + it->first);
+
+	std::vector<Client *> users;
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (it->second->isRegistered())
+			users.push_back(it->second);
+	}
+	for (std::map<std::string, Client *>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+		users.push_back(it->second);
+	// Detached sessions are still on the network and in their channels' SJOIN
+	for (std::map<std::string, Client *>::iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+	{
+		if (it->second->isDetached())
+			users.push_back(it->second);
+	}
+	for (size_t i = 0; i < users.size(); ++i)
+	{
+		std::ostringstream uid;
+		uid << "UID " << users[i]->getNickname() << " " << users[i]->getSignonTime() << " "
+			<< users[i]->getUsername() << " " << (users[i]->getHostname().empty() ? "*" : users[i]->getHostname())
+			<< " :" << users[i]->getRealname();
+		sendToClient(link, uid.str());
+	}
+
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		Channel *channel = it->second;
+		if (channel->getClients().empty())
+			continue;
+		std::ostringstream head;
+		std::string modes = "+";
+		std::string params;
+		if (channel->isInviteOnly())
+			modes += "i";
+		if (channel->isTopicProtected())
+			modes += "t";
+		if (channel->hasKey())
+		{
+			modes += "k";
+			params += " " + channel->getKey();
+		}
+		if (channel->getUserLimit() > 0)
+		{
+			std::ostringstream limit;
+			limit << channel->getUserLimit();
+			modes += "l";
+			params += " " + limit.str();
+		}
+		head << "SJOIN " << channel->getCreationTime() << " " << channel->getName() << " " << modes << params << " :";
+
+		std::string members;
+		const std::set<Client *> &clients = channel->getClients();
+		for (std::set<Client *>::const_iterator m = clients.begin(); m != clients.end(); ++m)
+		{
+			if (!(*m)->isRegistered())
+				continue;
+			if (!members.empty())
+				members += " ";
+			if (channel->isOperator(*m))
+				members += "@";
+			members += (*m)->getNickname();
+			if (members.size() > SJOIN_MEMBERS_PER_LINE)
+			{
+				sendToClient(link, head.str() + members);
+				members.clear();
+			}
+		}
+		if (!members.empty())
+			sendToClient(link, head.str() + members);
+		if (channel->hasTopic())
+			sendToClient(link, "TB " + channel->getName() + " :" + channel->getTopic());
+		for (const char *list = "be"; *list; ++list)
+		{
+			const std::vector<MaskEntry> &entries = channel->getMasks(*list);
+			std::ostringstream bmask;
+			bmask << "BMASK " << channel->getCreationTime() << " " << channel->getName() << " " << *list << " :";
+			std::string masks;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				masks += (masks.empty() ? "" : " ") + entries[i].mask;
+				if (masks.size() > SJOIN_MEMBERS_PER_LINE || i + 1 == entries.size())
+				{
+					sendToClient(link, bmask.str() + masks);
+					masks.clear();
+				}
+			}
+		}
+	}
+	sendToClient(link, "EOB");
+}
+
+void Server::handleServerMessage(Client *link, const std::string &line)
+{
+	std::string prefix;
+	std::string rest = line;
+	if (!rest.empty() && rest[0] == ':')
+	{
+		size_t space = rest.find(' ');
+		if (space == std::string::npos)
+			return;
+		prefix = rest.substr(1, space - 1);
+		rest = rest.substr(space + 1);
+	}
+	std::string command = rest;
+	std::string args;
+	size_t space = rest.find(' ');
+	if (space != std::string::npos)
+	{
+		command = rest.substr(0, space);
+		args = rest.substr(space + 1);
+	}
+
+	_currentLink = link;
+	if (command == "SID")
+	{
+		if (args == _config.serverName || _links.count(args) || _remoteServers.count(args))
+		{
+			std::cerr << "Link " << link->getLinkName() << " introduced known server " << args << ", dropping" << std::endl;
+			sendToClient(link, "ERROR :Server " + args + " already exists (loop)");
+			disconnectClient(link->getFd());
+		}
+		else
+		{
+			_remoteServers[args] = link;
+			propagateToLinks("SID " + args, NULL);
+		}
+	}
+	else if (command == "SQUIT")
+	{
+		std::map<std::string, Client *>::iterator it = _remoteServers.find(args);
+		if (it != _remoteServers.end() && it->second == link)
+		{
+			_remoteServers.erase(it);
+			propagateToLinks("SQUIT " + args, NULL);
+		}
+	}
+	else if (command == "UID")
+		introduceRemoteUser(link, args);
+	else if (command == "SJOIN")
+		handleSjoin(link, args);
+	else if (command == "TB")
+	{
+		size_t colon = args.find(" :");
+		Channel *channel = getChannel(args.substr(0, colon));
+		if (channel && colon != std::string::npos && !channel->hasTopic())
+		{
+			channel->setTopic(args.substr(colon + 2));
+			propagateToLinks("TB " + args, NULL);
+		}
+	}
+	else if (command == "BMASK")
+	{
+		// Masks are merged unless our channel is older, in which case ours stand alone
+		std::istringstream iss(args);
+		time_t ts = 0;
+		std::string name, list, mask;
+		iss >> ts >> name >> list;
+		Channel *channel = getChannel(name);
+		if (channel && ts <= channel->getCreationTime() && (list == "b" || list == "e"))
+		{
+			while (iss >> mask)
+				channel->addMask(list[0], stripColon(mask), link->getLinkName(), time(NULL));
+			propagateToLinks("BMASK " + args, NULL);
+		}
+	}
+	else if (command == "PUBMSG")
+	{
+		// :<bot>!publish@<server> PRIVMSG|NOTICE <#channel> :<text>, from a publish API bot
+		std::istringstream iss(args);
+		std::string source, verb, name;
+		iss >> source >> verb >> name;
+		Channel *channel = getChannel(name);
+		if (channel)
+			publishToChannel(channel, args);
+	}
+	else if (command == "EOB")
+		std::cout << "🔗 Burst from " << link->getLinkName() << " complete" << std::endl;
+	else if (command == "KILL")
+		handleKill(args);
+	else if (command == "PING")
+		sendToClient(link, "PONG " + args);
+	else if (command == "ERROR")
+	{
+		std::cerr << "Link " << link->getLinkName() << " closed: " << stripColon(args) << std::endl;
+		disconnectClient(link->getFd());
+	}
+	else
+	{
+		// Everything else is a user command relayed from the other side
+		std::map<std::string, Client *>::iterator it = _remoteClients.find(prefix.substr(0, prefix.find('!')));
+		if (it != _remoteClients.end() && it->second->getUplink() == link)
+		{
+			Client *user = it->second;
+			if (command == "NICK")
+				remoteNickChange(user, stripColon(args));
+			else if (command == "QUIT")
+				removeRemoteUser(user, stripColon(args));
+			else if (command == "JOIN")
+				remoteJoin(user, stripColon(args));
+			else if (command == "PRIVMSG" || command == "NOTICE")
+				handlePrivMsgCommand(user, args, command);
+			else if (command == "MODE")
+				OperatorCommands::handleModeCommand(this, user, args);
+			else if (command == "KICK")
+				OperatorCommands::handleKickCommand(this, user, args);
+			else if (command == "TOPIC")
+				OperatorCommands::handleTopicCommand(this, user, args);
+			else if (command == "INVITE")
+			{
+				size_t colon = args.find(" :");
+				std::string invite = colon == std::string::npos ? args : args.substr(0, colon) + " " + args.substr(colon + 2);
+				OperatorCommands::handleInviteCommand(this, user, invite);
+			}
+		}
+	}
+	_currentLink = NULL;
+}
+
+void Server::introduceRemoteUser(Client *link, const std::string &args)
+{
+	std::istringstream iss(args);
+	std::string nick, user, host;
+	time_t ts = 0;
+	iss >> nick >> ts >> user >> host;
+	if (nick.empty() || user.empty() || host.empty())
+		return;
+
+	Client *existing = getClientByNick(nick);
+	if (existing)
+	{
+		// Nick collision: the older nick survives, on a tie both are killed
+		time_t mine = existing->getSignonTime();
+		if (ts >= mine)
+			sendToClient(link, ":" + _config.serverName + " KILL " + nick + " :Nick collision");
+		if (mine >= ts)
+		{
+			std::cout << "💥 Nick collision on " << nick << ", killing our copy" << std::endl;
+			if (existing->isRemote())
+			{
+				sendToClient(existing->getUplink(), ":" + _config.serverName + " KILL " + nick + " :Nick collision");
+				removeRemoteUser(existing, "Nick collision");
+			}
+			else
+			{
+				sendToClient(existing, "ERROR :Nick collision");
+				dropLocalUser(existing, "Nick collision");
+			}
+		}
+		if (ts >= mine)
+			return;
+	}
+
+	Client *remote = new Client(-1);
+	remote->setUplink(link);
+	remote->setNickname(nick);
+	remote->setUsername(user);
+	remote->setHostname(host);
+	remote->setSignonTime(ts);
+	size_t colon = args.find(" :");
+	if (colon != std::string::npos)
+		remote->setRealname(args.substr(colon + 2));
+	remote->markRegistered();
+	_remoteClients[nick] = remote;
+	_userIndex.add(remote);
+	MonitorCommands::notifyOnline(this, remote);
+	propagateToLinks("UID " + args, NULL);
+}
+
+void Server::handleSjoin(Client *link, const std::string &args)
+{
+	size_t colon = args.find(" :");
+	if (colon == std::string::npos)
+		return;
+	std::istringstream head(args.substr(0, colon));
+	std::istringstream members(args.substr(colon + 2));
+	time_t ts = 0;
+	std::string name, modes;
+	head >> ts >> name >> modes;
+	if (!isValidChannelName(name))
+		return;
+
+	// TS rules: the older channel's modes and ops win. An older SJOIN wipes
+	// ours first; a newer one only adds members, without modes or @; the same
+	// TS merges both sides.
+	Channel *channel = getChannel(name);
+	bool theirsCount = true;
+	if (!channel)
+	{
+		channel = createChannel(name);
+		resetChannelModes(channel);
+	}
+	else if (ts < channel->getCreationTime())
+		resetChannelModes(channel);
+	else if (ts > channel->getCreationTime())
+		theirsCount = false;
+	if (theirsCount)
+	{
+		channel->setCreationTime(ts);
+		std::string added, params, param;
+		if (modes.find('i') != std::string::npos && !channel->isInviteOnly())
+		{
+			channel->setInviteOnly(true);
+			added += "i";
+		}
+		if (modes.find('t') != std::string::npos && !channel->isTopicProtected())
+		{
+			channel->setTopicProtected(true);
+			added += "t";
+		}
+		for (size_t i = 0; i < modes.size(); ++i)
+		{
+			// Merging equal TS: both ends keep the same key and the higher limit
+			if (modes[i] == 'k' && head >> param && (!channel->hasKey() || param > channel->getKey()))
+			{
+				channel->setKey(param);
+				added += "k";
+				params += " " + param;
+			}
+			else if (modes[i] == 'l' && head >> param && std::atol(param.c_str()) > channel->getUserLimit())
+			{
+				channel->setUserLimit(std::atol(param.c_str()));
+				added += "l";
+				params += " " + param;
+			}
+		}
+		if (!added.empty())
+			tellLocalMembers(channel, ":" + _config.serverName + " MODE " + name + " +" + added + params);
+	}
+
+	std::string token;
+	while (members >> token)
+	{
+		bool op = token[0] == '@';
+		std::map<std::string, Client *>::iterator it = _remoteClients.find(op ? token.substr(1) : token);
+		if (it == _remoteClients.end() || it->second->getUplink() != link)
+			continue;
+		Client *user = it->second;
+		if (!channel->hasClient(user))
+		{
+			channel->addClient(user);
+			// Only local members need to see the join, other links get the SJOIN itself
+			std::string joinMsg = ":" + user->getFullMask() + " JOIN :" + name;
+			const std::set<Client *> &clients = channel->getClients();
+			for (std::set<Client *>::const_iterator m = clients.begin(); m != clients.end(); ++m)
+			{
+				if (*m != user && !(*m)->isRemote())
+					sendToClient(*m, joinMsg);
+			}
+		}
+		if (op && theirsCount && !channel->isOperator(user))
+		{
+			channel->addOperator(user);
+			tellLocalMembers(channel, ":" + _config.serverName + " MODE " + name + " +o " + user->getNickname());
+		}
+	}
+	propagateToLinks("SJOIN " + args, NULL);
+}
+
+// Our side of a channel lost to an older one from a link: drop the modes and
+// ops set here before the winner's are applied, and tell local members.
+void Server::resetChannelModes(Channel *channel)
+{
+	std::vector<std::string> changes;
+	std::string cleared = std::string(channel->isInviteOnly() ? "i" : "") + (channel->isTopicProtected() ? "t" : "") +
+						  (channel->getUserLimit() > 0 ? "l" : "");
+	if (channel->hasKey())
+		changes.push_back("-" + cleared + "k " + channel->getKey());
+	else if (!cleared.empty())
+		changes.push_back("-" + cleared);
+	channel->setInviteOnly(false);
+	channel->setTopicProtected(false);
+	channel->setKey("");
+	channel->setUserLimit(0);
+	const std::set<Client *> &clients = channel->getClients();
+	for (std::set<Client *>::const_iterator m = clients.begin(); m != clients.end(); ++m)
+	{
+		if (!channel->isOperator(*m))
+			continue;
+		changes.push_back("-o " + (*m)->getNickname());
+		channel->removeOperator(*m);
+	}
+	for (size_t i = 0; i < changes.size(); ++i)
+		tellLocalMembers(channel, ":" + _config.serverName + " MODE " + channel->getName() + " " + changes[i]);
+}
+
+// Mode changes a burst made here: every server applies the burst itself, so
+// links are not told
+void Server::tellLocalMembers(Channel *channel, const std::string &line)
+{
+	const std::set<Client *> &clients = channel->getClients();
+	for (std::set<Client *>::const_iterator m = clients.begin(); m != clients.end(); ++m)
+	{
+		if (!(*m)->isRemote())
+			sendToClient(*m, line);
+	}
+}
+
+void Server::remoteJoin(Client *user, const std::string &channelName)
+{
+	if (!isValidChannelName(channelName))
+		return;
+	bool isNewChannel = !channelExists(channelName);
+	Channel *channel = createChannel(channelName);
+	if (channel->hasClient(user))
+		return;
+	channel->addClient(user);
+	if (isNewChannel)
+		channel->addOperator(user);
+
+	std::string joinMsg = ":" + user->getFullMask() + " JOIN :" + channelName;
+	broadcastToChannels(channel, joinMsg, user, true);
+	propagateToLinks(joinMsg, channel);
+}
+
+void Server::remoteNickChange(Client *user, const std::string &newNick)
+{
+	std::string oldMask = user->getFullMask();
+	if (newNick.empty())
+		return;
+	if (getClientByNick(newNick))
+	{
+		// Raced with another user taking the nick: drop the renamed user everywhere
+		sendToClient(user->getUplink(), ":" + _config.serverName + " KILL " + newNick + " :Nick collision");
+		removeRemoteUser(user, "Nick collision");
+		return;
+	}
+	std::string oldNick = user->getNickname();
+	_remoteClients.erase(oldNick);
+	user->setNickname(newNick);
+	_userIndex.update(user);
+	_remoteClients[newNick] = user;
+	MonitorCommands::notifyNickChange(this, user, oldNick);
+	propagateToLinks(":" + oldMask + " NICK " + newNick, NULL);
+}
+
+void Server::removeRemoteUser(Client *user, const std::string &reason)
+{
+	quitClient(user, reason);
+	_remoteClients.erase(user->getNickname());
+	delete user;
+}
+
+void Server::handleKill(const std::string &args)
+{
+	std::string nick = args.substr(0, args.find(' '));
+	size_t colon = args.find(" :");
+	std::string reason = colon == std::string::npos ? "Killed" : args.substr(colon + 2);
+	Client *target = getClientByNick(nick);
+	if (!target)
+		return;
+	if (target->isRemote())
+	{
+		// Never bounce a kill back where it came from: that side already resolved it
+		if (target->getUplink() != _currentLink)
+			sendToClient(target->getUplink(), ":" + _config.serverName + " KILL " + args);
+		return;
+	}
+	std::cout << "💀 " << nick << " killed by the network (" << reason << ")" << std::endl;
+	sendToClient(target, "ERROR :Killed (" + reason + ")");
+	dropLocalUser(target, "Killed (" + reason + ")");
+}
+
+// A link went away: every user and server behind it leaves the network
+void Server::handleNetsplit(Client *link)
+{
+	std::string name = link->getLinkName();
+	_links.erase(name);
+	std::cout << "💔 Netsplit: lost " << name << std::endl;
+
+	std::vector<Client *> lost;
+	for (std::map<std::string, Client *>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+	{
+		if (it->second->getUplink() == link)
+			lost.push_back(it->second);
+	}
+	std::string reason = _config.serverName + " " + name;
+	for (size_t i = 0; i < lost.size(); ++i)
+		removeRemoteUser(lost[i], reason);
+
+	std::vector<std::string> servers;
+	for (std::map<std::string, Client *>::iterator it = _remoteServers.begin(); it != _remoteServers.end(); ++it)
+	{
+		if (it->second == link)
+			servers.push_back(it->first);
+	}
+	servers.push_back(name);
+	for (size_t i = 0; i < servers.size(); ++i)
+	{
+		_remoteServers.erase(servers[i]);
+		propagateToLinks("SQUIT " + servers[i], NULL);
+	}
+}
+
+void Server::linksWithMembers(Channel *channel, std::set<Client *> &links)
+{
+	const std::set<Client *> &clients = channel->getClients();
+	for (std::set<Client *>::const_iterator it = clients.begin(); it != clients.end(); ++it)
+	{
+		if ((*it)->isRemote())
+			links.insert((*it)->getUplink());
+	}
+}
+
+// State changes must reach every server. broadcastToChannels already covered the
+// links with members in channel, so only the remaining ones are sent to here.
+void Server::propagateToLinks(const std::string &message, Channel *channel)
+{
+	struct iovec parts[2];
+	propagateParts(parts, lineParts(message, parts), channel);
+}
+
+void Server::propagateToLinks(const ReplyBuilder &reply, Channel *channel)
+{
+	struct iovec part;
+	part.iov_base = const_cast<char *>(reply.data());
+	part.iov_len = reply.size();
+	propagateParts(&part, 1, channel);
+}
+
+void Server::propagateParts(const struct iovec *parts, int count, Channel *channel)
+{
+	if (_links.empty())
+		return;
+	std::set<Client *> covered;
+	if (channel)
+		linksWithMembers(channel, covered);
+	for (std::map<std::string, Client *>::iterator it = _links.begin(); it != _links.end(); ++it)
+	{
+		if (it->second != _currentLink && covered.find(it->second) == covered.end())
+			sendParts(it->second, parts, count);
+	}
+}
+
+// Deliver a message addressed to one user, wherever it is connected
+void Server::routeToClient(Client *target, const std::string &message)
+{
+	struct iovec parts[2];
+	routeParts(target, parts, lineParts(message, parts));
+}
+
+void Server::routeToClient(Client *target, const ReplyBuilder &reply)
+{
+	struct iovec part;
+	part.iov_base = const_cast<char *>(reply.data());
+	part.iov_len = reply.size();
+	routeParts(target, &part, 1);
+}
+
+void Server::routeParts(Client *target, const struct iovec *parts, int count)
+{
+	if (target->isRemote())
+	{
+		if (target->getUplink() != _currentLink)
+			sendParts(target->getUplink(), parts, count);
+		return;
+	}
+	sendParts(target, parts, count);
+}
@@ -0,0 +1,177 @@
+#include "Server.hpp"
+#include "Clock.hpp"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+// Overload protection: each loop tick measures how long its handlers took,
+// from poll (or io_uring_enter) returning to the end of the tick, and the
+// smoothed lag moves the server between levels. Busy parks LIST and WHO until
+// the load passes and lets each client have a few lines per tick; critical
+// also stops accepting connections, pauses long replies already streaming
+// and tightens the per-client budget. Escalation is immediate; stepping down
+// goes one level at a time, once the lag has stayed well under the level's
+// threshold for a while, so a burst does not make the listeners flap.
+
+namespace
+{
+	const long long HOLD_NS = 1000000000LL; // least time in a level before stepping down
+	const long CRITICAL_FACTOR = 4;			// critical threshold, in multiples of --overload-lag
+	const size_t MAX_DEFERRED = 256;		// parked commands, server-wide
+	const size_t REPLAYS_PER_TICK = 16;		// parked commands run per tick after recovery
+
+	const char *const LEVEL_NAMES[OVERLOAD_LEVELS] = {"normal", "busy", "critical"};
+}
+
+void Server::startTick()
+{
+	_tickStart = Clock::monotonicNs();
+}
+
+void Server::finishTick()
+{
+	long long now = Clock::monotonicNs();
+	_lastTickNs = now - _tickStart;
+	_overloadTotals.worstLagNs = std::max(_overloadTotals.worstLagNs, _lastTickNs);
+	_loopLagNs += (_lastTickNs - _loopLagNs) / 4;
+	if (!_config.overloadLag)
+		return;
+	long long threshold = _config.overloadLag * 1000000LL;
+	OverloadLevel target = OVERLOAD_NORMAL;
+	if (_loopLagNs >= CRITICAL_FACTOR * threshold)
+		target = OVERLOAD_CRITICAL;
+	else if (_loopLagNs >= threshold)
+		target = OVERLOAD_BUSY;
+	if (target > _overload)
+		setOverload(target);
+	else if (target < _overload && now - _overloadSince >= HOLD_NS)
+	{
+		long long current = _overload == OVERLOAD_CRITICAL ? CRITICAL_FACTOR * threshold : threshold;
+		if (_loopLagNs < current / 2)
+			setOverload(static_cast<OverloadLevel>(_overload - 1));
+	}
+}
+
+void Server::setOverload(OverloadLevel level)
+{
+	long long now = Clock::monotonicNs();
+	if (_overloadSince)
+		_overloadTotals.timeNs[_overload] += now - _overloadSince;
+	std::cout << "🚦 Overload: " << LEVEL_NAMES[_overload] << " -> " << LEVEL_NAMES[level] << " (loop lag "
+			  << _loopLagNs / 1000000 << " ms, last tick " << _lastTickNs / 1000000 << " ms)" << std::endl;
+	// Pending connections wait in the kernel's accept queue meanwhile
+	bool accepting = level != OVERLOAD_CRITICAL;
+	if (accepting != (_overload != OVERLOAD_CRITICAL) && _useUring)
+	{
+		if (accepting)
+			_uring.resumeAccepts();
+		else
+			_uring.pauseAccepts();
+	}
+	else if (accepting != (_overload != OVERLOAD_CRITICAL))
+	{
+		for (size_t i = 0; i < _listeners.size(); ++i)
+			setPollEvents(_listeners[i].fd, accepting ? POLLIN : 0);
+	}
+	_overload = level;
+	_overloadSince = now;
+	_overloadTotals.entered[level]++;
+}
+
+// Lines a client may have handled per tick, 0 for no limit. Links carry a
+// whole other server's users and are never budgeted.
+size_t Server::inputBudget(const Client *client) const
+{
+	if (_overload == OVERLOAD_NORMAL || client->isServerLink())
+		return 0;
+	if (_overload == OVERLOAD_BUSY)
+		return _config.overloadLines;
+	return std::max(1L, _config.overloadLines / CRITICAL_FACTOR);
+}
+
+// LIST and WHO walk every channel or user: while overloaded they wait for the
+// load to pass, one per client; past that, or with the queue full, 263
+bool Server::deferCommand(Client *client, const std::string &command, const std::string &line)
+{
+	if ((command != "LIST" && command != "WHO") || !client->isRegistered())
+		return false;
+	bool waiting = _deferredCommands.size() >= MAX_DEFERRED;
+	for (std::deque<std::pair<int, std::string> >::iterator it = _deferredCommands.begin();
+		 !waiting && it != _deferredCommands.end(); ++it)
+		waiting = it->first == client->getFd();
+	if (waiting)
+	{
+		_overloadTotals.refused++;
+		sendToClient(client, "263 " + client->getNickname() + " " + command +
+								 " :Server load is temporarily too heavy. Please wait a while and try again.");
+		return true;
+	}
+	_overloadTotals.deferred++;
+	_deferredCommands.push_back(std::make_pair(client->getFd(), line));
+	return true;
+}
+
+// Start of a tick: clients left over their budget get this tick's, and once
+// the server is back to normal the parked commands run, a few per tick
+void Server::processBacklog()
+{
+	std::set<int> backlog;
+	backlog.swap(_inputBacklog);
+	for (std::set<int>::iterator it = backlog.begin(); it != backlog.end(); ++it)
+	{
+		std::map<int, Client *>::iterator client = _clients.find(*it);
+		if (client != _clients.end())
+			processInput(client->second, "", 0);
+	}
+	for (size_t n = 0; _overload == OVERLOAD_NORMAL && n < REPLAYS_PER_TICK && !_deferredCommands.empty(); ++n)
+	{
+		std::pair<int, std::string> deferred = _deferredCommands.front();
+		_deferredCommands.pop_front();
+		std::map<int, Client *>::iterator client = _clients.find(deferred.first);
+		if (client != _clients.end())
+			handleCommand(client->second, deferred.second);
+	}
+}
+
+void Server::forgetOverloadState(int fd)
+{
+	_inputBacklog.erase(fd);
+	std::deque<std::pair<int, std::string> >::iterator it = _deferredCommands.begin();
+	while (it != _deferredCommands.end())
+	{
+		if (it->first == fd)
+			it = _deferredCommands.erase(it);
+		else
+			++it;
+	}
+}
+
+// STATS w: loop lag and the overload levels since startup
+void Server::reportOverload(Client *client)
+{
+	long long now = Clock::monotonicNs();
+	long long timeNs[OVERLOAD_LEVELS];
+	for (int i = 0; i < OVERLOAD_LEVELS; ++i)
+		timeNs[i] = _overloadTotals.timeNs[i] + (i == _overload && _overloadSince ? now - _overloadSince : 0);
+	const std::string prefix = "249 " + client->getNickname() + " w :";
+	std::ostringstream line;
+	line << std::fixed;
+	line.precision(1);
+	line << prefix << "level " << LEVEL_NAMES[_overload] << ", loop lag " << _loopLagNs / 1e6 << " ms (last tick "
+		 << _lastTickNs / 1e6 << " ms, worst " << _overloadTotals.worstLagNs / 1e6 << " ms), threshold ";
+	if (_config.overloadLag)
+		line << _config.overloadLag << " ms";
+	else
+		line << "off";
+	sendToClient(client, line.str());
+	line.str("");
+	line << prefix << "busy " << _overloadTotals.entered[OVERLOAD_BUSY] << " times for "
+		 << timeNs[OVERLOAD_BUSY] / 1e9 << " s, critical " << _overloadTotals.entered[OVERLOAD_CRITICAL]
+		 << " times for " << timeNs[OVERLOAD_CRITICAL] / 1e9 << " s";
+	sendToClient(client, line.str());
+	line.str("");
+	line << prefix << "deferred " << _overloadTotals.deferred << " (" << _deferredCommands.size() << " waiting), refused "
+		 << _overloadTotals.refused << ", throttled reads " << _overloadTotals.throttled << " ("
+		 << _inputBacklog.size() << " clients waiting)";
+	sendToClient(client, line.str());
+}
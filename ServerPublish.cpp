@@ -0,0 +1,232 @@
+#include "Server.hpp"
+#include "Secrets.hpp"
+#include <iostream>
+#include <cstring>
+
+// Binary publish API for bots on a local listener (--listen=/path,publish).
+// Messages go straight to channel fan-out: no line parsing, no per-line round
+// trip, and any number of channel messages per frame.
+//
+// Every frame is  u32 length | u8 type | body  (length counts type and body,
+// integers are big-endian):
+//   1 AUTH     u8 name length, name, token              -> 0x81 AUTH_OK, body = name
+//   2 PUBLISH  entries until the end of the body:
+//              u8 flags (1 = NOTICE), u8 channel length, channel,
+//              u16 text length, text
+//   3 SYNC     u32 cookie                               -> 0x83 SYNC_OK, same cookie
+// Errors come back as 0x82 ERROR: u16 code, u32 entry index, message. Codes
+// 1-3 close the connection; a bad entry is reported and the rest of the batch
+// still goes out. SYNC_OK means every earlier publish has been queued.
+//
+// Messages appear from <name>!publish@<server name> and reach local members,
+// history and linked servers like a PRIVMSG from a member.
+
+namespace
+{
+	const size_t MAX_FRAME = 1024 * 1024;
+	const size_t MAX_LINE = 512; // CRLF included, as for any IRC line
+
+	enum PublishType
+	{
+		PUBLISH_AUTH = 1,
+		PUBLISH_MESSAGES = 2,
+		PUBLISH_SYNC = 3,
+		PUBLISH_AUTH_OK = 0x81,
+		PUBLISH_ERROR = 0x82,
+		PUBLISH_SYNC_OK = 0x83
+	};
+
+	enum PublishError
+	{
+		ERR_BAD_FRAME = 1,
+		ERR_AUTH_FAILED = 2,
+		ERR_NOT_AUTHENTICATED = 3,
+		ERR_NO_SUCH_CHANNEL = 4,
+		ERR_BAD_TEXT = 5,
+		ERR_TOO_LONG = 6
+	};
+
+	unsigned long get32(const char *p)
+	{
+		const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+		return (static_cast<unsigned long>(u[0]) << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+	}
+
+	void put32(std::string &out, unsigned long value)
+	{
+		for (int i = 3; i >= 0; --i)
+			out += static_cast<char>((value >> (i * 8)) & 0xFF);
+	}
+}
+
+void Server::sendPublishFrame(Client *client, unsigned char type, const std::string &body)
+{
+	std::string &queue = client->getSendQueue();
+	put32(queue, body.size() + 1);
+	queue += static_cast<char>(type);
+	queue += body;
+	_pendingSends.insert(client->getFd());
+}
+
+// Reports an error; returns false once the connection has been dropped for it
+bool Server::failPublish(Client *client, unsigned short code, unsigned long entry, const std::string &text)
+{
+	std::string body;
+	body += static_cast<char>(code >> 8);
+	body += static_cast<char>(code & 0xFF);
+	put32(body, entry);
+	body += text;
+	sendPublishFrame(client, PUBLISH_ERROR, body);
+	if (code > ERR_NOT_AUTHENTICATED)
+		return true;
+	std::cerr << "Publish API [" << client->getFd() << "]: " << text << std::endl;
+	disconnectClient(client->getFd(), text);
+	return false;
+}
+
+// Frames are decoded in place from the read buffer; only a frame split across
+// reads is kept back
+void Server::processPublishInput(Client *client, const char *data, size_t size)
+{
+	std::string joined;
+	if (!client->getBuffer().empty())
+	{
+		joined = client->getBuffer();
+		joined.append(data, size);
+		data = joined.data();
+		size = joined.size();
+	}
+	size_t pos = 0;
+	while (size - pos >= 4)
+	{
+		unsigned long length = get32(data + pos);
+		if (length == 0 || length > MAX_FRAME)
+		{
+			failPublish(client, ERR_BAD_FRAME, 0, "Bad frame length");
+			return;
+		}
+		if (size - pos - 4 < length)
+			break;
+		if (!handlePublishFrame(client, data[pos + 4], data + pos + 5, length - 1))
+			return;
+		pos += 4 + length;
+	}
+	client->setBuffer(std::string(data + pos, size - pos));
+}
+
+bool Server::handlePublishFrame(Client *client, unsigned char type, const char *body, size_t size)
+{
+	++_publishFrames;
+	if (type == PUBLISH_AUTH)
+	{
+		size_t nameLength = size ? static_cast<unsigned char>(body[0]) : 0;
+		if (!size || 1 + nameLength > size)
+			return failPublish(client, ERR_BAD_FRAME, 0, "Malformed AUTH");
+		std::string name(body + 1, nameLength);
+		std::string token(body + 1 + nameLength, size - 1 - nameLength);
+		std::map<std::string, std::string>::const_iterator it = _config.publishers.find(name);
+		bool ok = Secrets::equal(token, it != _config.publishers.end() ? it->second : token + "?");
+		token.replace(0, token.size(), token.size(), '\0');
+		if (!ok || !client->getAccount().empty())
+			return failPublish(client, ERR_AUTH_FAILED, 0, "Authentication failed");
+		client->setAccount(name);
+		sendPublishFrame(client, PUBLISH_AUTH_OK, name);
+		std::cout << "📡 Publisher [" << client->getFd() << "] authenticated as " << name << std::endl;
+		return true;
+	}
+	if (client->getAccount().empty())
+		return failPublish(client, ERR_NOT_AUTHENTICATED, 0, "Not authenticated");
+	if (type == PUBLISH_MESSAGES)
+	{
+		int fd = client->getFd();
+		publishBatch(client, body, size);
+		std::map<int, Client *>::iterator it = _clients.find(fd);
+		return it != _clients.end() && it->second == client;
+	}
+	if (type == PUBLISH_SYNC && size == 4)
+	{
+		sendPublishFrame(client, PUBLISH_SYNC_OK, std::string(body, 4));
+		return true;
+	}
+	return failPublish(client, ERR_BAD_FRAME, 0, "Unknown frame type");
+}
+
+void Server::publishBatch(Client *client, const char *body, size_t size)
+{
+	std::string prefix = ":" + client->getAccount() + "!publish@" + _config.serverName;
+	std::string line;
+	size_t pos = 0;
+	for (unsigned long entry = 0; pos < size; ++entry)
+	{
+		if (size - pos < 2 || size - pos - 2 < static_cast<unsigned char>(body[pos + 1]) + 2u)
+		{
+			failPublish(client, ERR_BAD_FRAME, entry, "Truncated entry");
+			return;
+		}
+		bool notice = body[pos] & 1;
+		size_t channelLength = static_cast<unsigned char>(body[pos + 1]);
+		const char *channelName = body + pos + 2;
+		const char *lengthField = channelName + channelLength;
+		size_t textLength = (static_cast<unsigned char>(lengthField[0]) << 8) | static_cast<unsigned char>(lengthField[1]);
+		const char *text = lengthField + 2;
+		if (static_cast<size_t>(text - body) + textLength > size)
+		{
+			failPublish(client, ERR_BAD_FRAME, entry, "Truncated entry");
+			return;
+		}
+		pos = text - body + textLength;
+
+		Channel *channel = getChannel(std::string(channelName, channelLength));
+		if (!channel)
+		{
+			failPublish(client, ERR_NO_SUCH_CHANNEL, entry, "No such channel");
+			continue;
+		}
+		if (!textLength || std::memchr(text, '\r', textLength) || std::memchr(text, '\n', textLength) ||
+			std::memchr(text, '\0', textLength))
+		{
+			failPublish(client, ERR_BAD_TEXT, entry, "Text must be one non-empty line");
+			continue;
+		}
+		line.reserve(prefix.size() + 10 + channelLength + textLength);
+		line.assign(prefix);
+		line += notice ? " NOTICE " : " PRIVMSG ";
+		line.append(channelName, channelLength);
+		line += " :";
+		line.append(text, textLength);
+		if (line.size() + 2 > MAX_LINE)
+		{
+			failPublish(client, ERR_TOO_LONG, entry, "Line longer than 512 bytes");
+			continue;
+		}
+		publishToChannel(channel, line);
+		++_publishMessages;
+	}
+}
+
+// Fan-out for a published message: local members directly, each link once as
+// PUBMSG (the sender is not a user the other side knows), then history
+void Server::publishToChannel(Channel *channel, const std::string &line)
+{
+	if (fanoutQueued(channel))
+	{
+		queueFanout(channel, line + "\r\n", "PUBMSG " + line + "\r\n", NULL, false);
+		recordHistory(channel, line);
+		return;
+	}
+	std::set<Client *> links;
+	const std::set<Client *> &members = channel->getClients();
+	for (std::set<Client *>::const_iterator it = members.begin(); it != members.end(); ++it)
+	{
+		if ((*it)->isRemote())
+			links.insert((*it)->getUplink());
+		else
+			sendToClient(*it, line);
+	}
+	for (std::set<Client *>::iterator it = links.begin(); it != links.end(); ++it)
+	{
+		if (*it != _currentLink)
+			sendToClient(*it, "PUBMSG " + line);
+	}
+	recordHistory(channel, line);
+}
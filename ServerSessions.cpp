@@ -0,0 +1,161 @@
+#include "Server.hpp"
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+// Resumable sessions, after the IRCv3 draft/resume-0.5 capability. A client
+// that enabled it receives "RESUME TOKEN <token>" once registered. When its
+// connection is lost (not on QUIT, KILL or an error it caused), the user stays
+// in every channel and on MONITOR lists, and whatever would have been sent to
+// it is kept in a bounded ring (--resume-buffer). A new connection sends
+// "RESUME <token>" before CAP END and takes the session over:
+//
+//   RESUME SUCCESS <nick>, 001-005, RESUME TOKEN <new token>, the missed lines
+//
+// Channel peers see nothing of it. If lines had to be dropped from the ring,
+// the topic and names of every channel follow so the client's state is right
+// again. A session not resumed within --resume-grace seconds quits as usual.
+
+void Server::startSession(Client *client)
+{
+	std::string token = ResumeSession::newToken();
+	if (token.empty() || client->getSession())
+		return;
+	client->setSession(new ResumeSession(token, _config.resumeBuffer));
+	_sessions[token] = client;
+	sendToClient(client, "RESUME TOKEN " + token);
+}
+
+// Lost connections of users holding a session detach instead of quitting
+void Server::connectionLost(int clientFd, const std::string &reason)
+{
+	std::map<int, Client *>::iterator it = _clients.find(clientFd);
+	if (it != _clients.end() && it->second->getSession() && it->second->isRegistered())
+		detachSession(it->second);
+	else
+		disconnectClient(clientFd, reason);
+}
+
+void Server::detachSession(Client *client)
+{
+	int fd = client->getFd();
+	std::cout << "⏸️  Client [" << fd << "] (" << client->getNickname() << ") detached, session kept for "
+			  << _config.resumeGrace << "s" << std::endl;
+	forgetFd(fd);
+	TlsContext::destroySession(client->getSsl());
+	client->releaseConnection();
+	client->getSession()->detach(time(NULL));
+	_clients.erase(fd);
+	_sockets->close(fd);
+}
+
+// The session's user leaves the network for good
+void Server::endSession(Client *client, const std::string &reason)
+{
+	std::cout << "⌛ Session of " << client->getNickname() << " ended: " << reason << std::endl;
+	quitClient(client, reason);
+	forgetSession(client);
+	delete client;
+}
+
+void Server::forgetSession(Client *client)
+{
+	if (client->getSession())
+		_sessions.erase(client->getSession()->getToken());
+}
+
+// Local users leaving for good (KILL, nick collision), connected or not
+void Server::dropLocalUser(Client *user, const std::string &reason)
+{
+	if (user->isDetached())
+		endSession(user, reason);
+	else
+		disconnectClient(user->getFd(), reason);
+}
+
+void Server::expireSessions()
+{
+	time_t now = time(NULL);
+	if (_sessions.empty() || now < _nextSessionExpiry)
+		return;
+	_nextSessionExpiry = now + 1;
+	std::vector<Client *> expired;
+	for (std::map<std::string, Client *>::iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+	{
+		if (it->second->isDetached() && now - it->second->getSession()->getDetachedAt() >= _config.resumeGrace)
+			expired.push_back(it->second);
+	}
+	for (size_t i = 0; i < expired.size(); ++i)
+		endSession(expired[i], "Connection lost");
+}
+
+Client *Server::findDetached(const std::string &nick) const
+{
+	for (std::map<std::string, Client *>::const_iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+	{
+		if (it->second->isDetached() && it->second->getNickname() == nick)
+			return it->second;
+	}
+	return NULL;
+}
+
+// RESUME <token>, from a connection that has not completed registration
+void Server::handleResumeCommand(Client *client, const std::string &args)
+{
+	std::string token = args.substr(0, args.find(' '));
+	if (client->isRegistered())
+	{
+		sendToClient(client, "FAIL RESUME REGISTRATION_IS_COMPLETED :Cannot resume, registration has completed");
+		return;
+	}
+	std::map<std::string, Client *>::iterator it = token.empty() ? _sessions.end() : _sessions.find(token);
+	if (!client->hasCap(CAP_RESUME) || client->getSaslStep() == SASL_PENDING || it == _sessions.end())
+	{
+		sendToClient(client, "FAIL RESUME INVALID_TOKEN :Cannot resume connection, token is invalid");
+		return;
+	}
+	Client *user = it->second;
+	// The old connection may not have noticed it is gone yet
+	if (!user->isDetached())
+		detachSession(user);
+
+	int fd = client->getFd();
+	user->takeConnection(*client);
+	_clients[fd] = user;
+	delete client;
+
+	ResumeSession *session = user->getSession();
+	std::vector<std::string> missed = session->takeMissed();
+	unsigned long dropped = session->getDropped();
+	session->attach();
+	_sessions.erase(token);
+	session->setToken(ResumeSession::newToken());
+	_sessions[session->getToken()] = user;
+	std::cout << "▶️  Client [" << fd << "] resumed " << user->getNickname() << " (" << missed.size()
+			  << " missed lines, " << dropped << " dropped)" << std::endl;
+
+	sendToClient(user, "RESUME SUCCESS " + user->getNickname());
+	sendWelcome(user);
+	sendToClient(user, "RESUME TOKEN " + session->getToken());
+	for (size_t i = 0; i < missed.size(); ++i)
+	{
+		struct iovec part;
+		part.iov_base = const_cast<char *>(missed[i].data());
+		part.iov_len = missed[i].size();
+		sendParts(user, &part, 1);
+	}
+	if (!dropped)
+		return;
+	std::ostringstream note;
+	note << "NOTE RESUME LINES_DROPPED :" << dropped << " missed lines did not fit the session buffer";
+	sendToClient(user, note.str());
+	for (std::map<std::string, Channel *>::iterator c = _channels.begin(); c != _channels.end(); ++c)
+	{
+		if (!c->second->hasClient(user))
+			continue;
+		ReplyBuilder topic;
+		topic.source("ircserver").numeric(332).target(user).param(c->first).trailing(c->second->getTopic());
+		sendToClient(user, topic);
+		sendNames(user, c->second);
+	}
+}
@@ -0,0 +1,941 @@
+#include "Server.hpp"
+#include "Clock.hpp"
+#include "MemoryStats.hpp"
+#include "SimulatedNetwork.hpp"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+// Memory accounting: MEMSTATS reports what each connection and channel holds
+// (see MemoryStats.hpp for what is counted), and buffers of clients that went
+// quiet are trimmed so a burst of long partial lines does not stay resident.
+
+namespace
+{
+	const size_t LARGEST_CLIENTS_SHOWN = 5;
+
+	void addUsage(ClientMemory &sum, const ClientMemory &usage)
+	{
+		sum.object += usage.object;
+		sum.strings += usage.strings;
+		sum.recvBuffer += usage.recvBuffer;
+		sum.sendQueue += usage.sendQueue;
+		sum.compression += usage.compression;
+	}
+
+	void addUsage(ChannelMemory &sum, const ChannelMemory &usage)
+	{
+		sum.object += usage.object;
+		sum.strings += usage.strings;
+		sum.members += usage.members;
+		sum.masks += usage.masks;
+		sum.history += usage.history;
+		sum.mapped += usage.mapped;
+	}
+}
+
+// MEMSTATS [<nick> | <#channel>]
+void Server::handleMemStatsCommand(Client *client, const std::string &args)
+{
+	if (!client->isRegistered())
+	{
+		sendError(client, "451", ":You have not registered");
+		return;
+	}
+	if (!client->isServerOperator())
+	{
+		sendToClient(client, "481 " + client->getNickname() + " :Permission Denied- You're not an IRC operator");
+		return;
+	}
+	std::string target = args.substr(0, args.find(' '));
+	std::string prefix = "249 " + client->getNickname() + " :";
+
+	// Channel entries are charged to the channel; the per-client view shows them too
+	ChannelMemory channels = ChannelMemory();
+	for (std::map<std::string, Channel *>::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+		ChannelMemory usage;
+		it->second->memoryUsage(usage);
+		addUsage(channels, usage);
+	}
+
+	std::ostringstream line;
+	if (!target.empty() && target[0] == '#')
+	{
+		Channel *channel = getChannel(target);
+		if (!channel)
+		{
+			sendToClient(client, "403 " + client->getNickname() + " " + target + " :No such channel");
+			return;
+		}
+		ChannelMemory usage;
+		channel->memoryUsage(usage);
+		line << prefix << channel->getName() << " " << usage.total() << " bytes: object " << usage.object
+			 << ", strings " << usage.strings << ", members " << usage.members << " (" << channel->getClients().size()
+			 << "), masks " << usage.masks << ", history index " << usage.history << ", history mapped " << usage.mapped;
+		sendToClient(client, line.str());
+	}
+	else if (!target.empty())
+	{
+		Client *user = getClientByNick(target);
+		if (!user)
+		{
+			sendToClient(client, "401 " + client->getNickname() + " " + target + " :No such nick/channel");
+			return;
+		}
+		ClientMemory usage;
+		user->memoryUsage(usage);
+		size_t channelBytes = user->getChannels().size() * Channel::membershipBytes();
+		line << prefix << user->getNickname() << " " << usage.total() + channelBytes << " bytes: object "
+			 << usage.object << ", strings " << usage.strings << ", recv buffer " << usage.recvBuffer << ", send queue "
+			 << usage.sendQueue << ", compression " << usage.compression << ", channel entries " << channelBytes << " (" << user->getChannels().size() << ")";
+		if (!user->isRemote())
+			line << ", idle " << time(NULL) - user->getLastActivity() << "s";
+		sendToClient(client, line.str());
+	}
+	else
+	{
+		ClientMemory local = ClientMemory();
+		ClientMemory remote = ClientMemory();
+		std::vector<std::pair<size_t, Client *> > largest;
+		for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		{
+			ClientMemory usage;
+			it->second->memoryUsage(usage);
+			addUsage(local, usage);
+			largest.push_back(std::make_pair(usage.total() + it->second->getChannels().size() * Channel::membershipBytes(),
+											 it->second));
+		}
+		for (std::map<std::string, Client *>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it)
+		{
+			ClientMemory usage;
+			it->second->memoryUsage(usage);
+			addUsage(remote, usage);
+		}
+
+		line << prefix << "local clients " << _clients.size() << ": " << local.total() << " bytes (objects "
+			 << local.object << ", strings " << local.strings << ", recv buffers " << local.recvBuffer
+			 << ", send queues " << local.sendQueue << ", compression " << local.compression << ")";
+		sendToClient(client, line.str());
+		line.str("");
+		line << prefix << "remote users " << _remoteClients.size() << ": " << remote.total() << " bytes";
+		sendToClient(client, line.str());
+		line.str("");
+		line << prefix << "channels " << _channels.size() << ": " << channels.total() << " bytes (objects "
+			 << channels.object << ", strings " << channels.strings << ", members " << channels.members << ", masks "
+			 << channels.masks << ", history index " << channels.history << "), history mapped " << channels.mapped;
+		sendToClient(client, line.str());
+		line.str("");
+		line << prefix << "indexes: users " << _userIndex.memoryBytes() << " bytes, channel sizes "
+			 << MemoryStats::setBytes(_channelSizeIndex) << " bytes, monitor " << _monitorIndex.memoryBytes()
+			 << " bytes (" << _monitorIndex.size() << " nicks), interned names " << InternedString::memoryBytes()
+			 << " bytes (" << InternedString::poolSize() << "), filter " << (_filter ? _filter->memoryBytes() : 0)
+			 << " bytes (" << _filterRules.size() << " rules)";
+		sendToClient(client, line.str());
+		line.str("");
+		size_t detached = 0, sessionBytes = 0;
+		for (std::map<std::string, Client *>::const_iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+		{
+			detached += it->second->isDetached();
+			sessionBytes += it->second->getSession()->memoryBytes();
+		}
+		line << prefix << "sessions: " << _sessions.size() << " resumable (" << detached << " detached), "
+			 << sessionBytes << " bytes";
+		sendToClient(client, line.str());
+		line.str("");
+		line << prefix << "io: " << _replyStreams.size() << " reply streams, uring buffers " << _uring.bufferBytes()
+			 << " bytes";
+		sendToClient(client, line.str());
+
+		size_t shown = std::min(largest.size(), LARGEST_CLIENTS_SHOWN);
+		std::partial_sort(largest.begin(), largest.begin() + shown, largest.end(),
+						  std::greater<std::pair<size_t, Client *> >());
+		line.str("");
+		line << prefix << "largest clients:";
+		for (size_t i = 0; i < shown; ++i)
+		{
+			Client *c = largest[i].second;
+			line << " " << (c->getNickname().empty() ? "*" : c->getNickname()) << "[" << c->getFd() << "]="
+				 << largest[i].first;
+		}
+		sendToClient(client, line.str());
+	}
+	sendToClient(client, "219 " + client->getNickname() + " M :End of /MEMSTATS report");
+}
+
+// STATS z: COMPRESS DEFLATE totals since startup
+// STATS p: publish API connections and traffic
+// STATS w: event-loop lag and overload levels
+void Server::handleStatsCommand(Client *client, const std::string &args)
+{
+	if (!client->isRegistered())
+	{
+		sendError(client, "451", ":You have not registered");
+		return;
+	}
+	std::string query = args.substr(0, args.find(' '));
+	if (query.empty())
+	{
+		sendToClient(client, "461 " + client->getNickname() + " STATS :Not enough parameters");
+		return;
+	}
+	if (!client->isServerOperator())
+	{
+		sendToClient(client, "481 " + client->getNickname() + " :Permission Denied- You're not an IRC operator");
+		return;
+	}
+	if (query == "z")
+	{
+		size_t streams = 0, state = 0;
+		for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		{
+			if (it->second->getCompressor())
+			{
+				++streams;
+				state += it->second->getCompressor()->memoryBytes();
+			}
+		}
+		const CompressionTotals &z = _compression;
+		std::ostringstream line;
+		line << std::fixed;
+		line.precision(2);
+		line << "249 " << client->getNickname() << " z :streams " << streams << ", zlib state " << state
+			 << " bytes, level " << _config.compressLevel;
+		sendToClient(client, line.str());
+		line.str("");
+		line << "249 " << client->getNickname() << " z :out " << z.plainOut << " -> " << z.wireOut << " bytes (ratio "
+			 << (z.wireOut ? static_cast<double>(z.plainOut) / z.wireOut : 0) << "), deflate "
+			 << (z.plainOut ? z.deflateNs / 1e6 / (z.plainOut / 1048576.0) : 0) << " ms/MB";
+		sendToClient(client, line.str());
+		line.str("");
+		line << "249 " << client->getNickname() << " z :in " << z.wireIn << " -> " << z.plainIn << " bytes (ratio "
+			 << (z.wireIn ? static_cast<double>(z.plainIn) / z.wireIn : 0) << "), inflate "
+			 << (z.plainIn ? z.inflateNs / 1e6 / (z.plainIn / 1048576.0) : 0) << " ms/MB";
+		sendToClient(client, line.str());
+	}
+	else if (query == "p")
+	{
+		size_t publishers = 0;
+		for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+			publishers += it->second->isPublisher();
+		std::ostringstream line;
+		line << "249 " << client->getNickname() << " p :publishers " << publishers << ", frames " << _publishFrames
+			 << ", messages " << _publishMessages;
+		sendToClient(client, line.str());
+	}
+	else if (query == "w")
+		reportOverload(client);
+	sendToClient(client, "219 " + client->getNickname() + " " + query + " :End of /STATS report");
+}
+
+// Runs once a second at most; clients without input for --compact-idle seconds
+// get their receive buffer and send queue shrunk to what they actually hold
+void Server::compactIdleClients()
+{
+	time_t now = time(NULL);
+	if (now < _nextCompaction)
+		return;
+	_nextCompaction = now + 1;
+	size_t released = 0;
+	for (std::map<int, Client *>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+		if (now - it->second->getLastActivity() >= _config.compactIdle)
+			released += it->second->compactBuffers();
+	}
+	if (released)
+		std::cout << "🧹 Released " << released << " bytes of idle client buffers" << std::endl;
+}
+
+namespace
+{
+	long residentKb(pid_t pid)
+	{
+		std::ostringstream path;
+		path << "/proc/" << pid << "/status";
+		std::ifstream status(path.str().c_str());
+		std::string line;
+		while (std::getline(status, line))
+		{
+			if (line.compare(0, 6, "VmRSS:") == 0)
+				return std::atol(line.c_str() + 6);
+		}
+		return -1;
+	}
+
+	// Loopback source addresses cycle through 127.0.0.0/8 so the ephemeral
+	// port range of a single address is never the limit
+	int openBenchClient(int port, long n, const char *nick)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		struct sockaddr_in source;
+		std::memset(&source, 0, sizeof(source));
+		source.sin_family = AF_INET;
+		source.sin_addr.s_addr = htonl(0x7F000001 + static_cast<unsigned long>(n / 20000));
+		struct sockaddr_in server = source;
+		server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		server.sin_port = htons(port);
+		if (bind(fd, reinterpret_cast<struct sockaddr *>(&source), sizeof(source)) < 0 ||
+			connect(fd, reinterpret_cast<struct sockaddr *>(&server), sizeof(server)) < 0)
+		{
+			close(fd);
+			return -1;
+		}
+		std::ostringstream registration;
+		registration << "NICK " << nick << n << "\r\nUSER " << nick << " 0 * :bench\r\n";
+		std::string lines = registration.str();
+		send(fd, lines.data(), lines.size(), MSG_NOSIGNAL);
+		return fd;
+	}
+
+	// A server on a free loopback port in a child process, its output discarded
+	pid_t forkBenchServer(const ServerConfig &config, int &port)
+	{
+		int probe = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr;
+		socklen_t length = sizeof(addr);
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (probe < 0 || bind(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+			getsockname(probe, reinterpret_cast<struct sockaddr *>(&addr), &length) < 0)
+		{
+			perror("bench");
+			return -1;
+		}
+		port = ntohs(addr.sin_port);
+		close(probe);
+
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			int null = open("/dev/null", O_WRONLY);
+			dup2(null, STDOUT_FILENO);
+			Server server(port, "", config);
+			server.start();
+			_exit(0);
+		}
+		return pid;
+	}
+
+	// Client n of a bench, retried while the server is still starting
+	int firstBenchClient(int port, long n, const char *nick)
+	{
+		int fd = -1;
+		for (int attempt = 0; attempt < 100 && fd < 0; ++attempt)
+		{
+			usleep(20000);
+			fd = openBenchClient(port, n, nick);
+		}
+		if (fd < 0)
+			std::cerr << "bench: server did not start" << std::endl;
+		return fd;
+	}
+
+	void stopBenchServer(pid_t pid)
+	{
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+}
+
+// ./ircserv --idle-bench=N: a server in a child process, N loopback clients that
+// register and then stay silent, and the server's resident memory per client.
+// The descriptor limit of the two processes caps N; clients over it are not
+// opened and the report says how many were.
+int Server::runIdleBenchmark(long clients)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	int port;
+	pid_t pid = forkBenchServer(ServerConfig(), port);
+	if (pid < 0)
+		return 1;
+	int first = firstBenchClient(port, 0, "idle");
+	if (first < 0)
+	{
+		stopBenchServer(pid);
+		return 1;
+	}
+	usleep(200000);
+	long baseKb = residentKb(pid);
+
+	std::vector<struct pollfd> fds;
+	fds.push_back(pollEntry(first, POLLIN));
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	for (long n = 1; n < clients; ++n)
+	{
+		int fd = openBenchClient(port, n, "idle");
+		if (fd < 0)
+			break;
+		fds.push_back(pollEntry(fd, POLLIN));
+	}
+	// Registered once the welcome burst arrives; read it, then stay idle
+	size_t registered = 0;
+	char buffer[4096];
+	while (registered < fds.size())
+	{
+		if (poll(&fds[0], fds.size(), 5000) <= 0)
+			break;
+		for (size_t i = 0; i < fds.size(); ++i)
+		{
+			if (!(fds[i].revents & POLLIN))
+				continue;
+			if (recv(fds[i].fd, buffer, sizeof(buffer), 0) > 0 && fds[i].events)
+				++registered;
+			fds[i].events = 0;
+		}
+	}
+	gettimeofday(&end, NULL);
+	sleep(2);
+	long rssKb = residentKb(pid);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+	std::cout << "clients      " << registered << " registered of " << clients << " requested" << std::endl;
+	std::cout << "setup        " << seconds << " s" << std::endl;
+	std::cout << "server RSS   " << baseKb << " KiB idle, " << rssKb << " KiB with clients" << std::endl;
+	if (registered)
+		std::cout << "per client   " << (rssKb - baseKb) * 1024 / static_cast<long>(registered) << " bytes"
+				  << " (sizeof(Client) " << sizeof(Client) << ")" << std::endl;
+	stopBenchServer(pid);
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i].fd);
+	return registered ? 0 : 1;
+}
+
+namespace
+{
+	const long LATENCY_MESSAGES = 2000;
+	const useconds_t LATENCY_GAP_US = 200; // quiet time between messages, as on a real desk
+
+	// utime + stime of a process, in clock ticks
+	long cpuTicks(pid_t pid)
+	{
+		std::ostringstream path;
+		path << "/proc/" << pid << "/stat";
+		std::ifstream stat(path.str().c_str());
+		std::string line;
+		std::getline(stat, line);
+		std::istringstream fields(line.substr(line.rfind(')') + 2));
+		std::string field;
+		long utime = 0, stime = 0;
+		for (int i = 3; i <= 15 && fields >> field; ++i)
+		{
+			if (i == 14)
+				utime = std::atol(field.c_str());
+			else if (i == 15)
+				stime = std::atol(field.c_str());
+		}
+		return utime + stime;
+	}
+
+	void drain(int fd)
+	{
+		char buffer[4096];
+		while (recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+		{
+		}
+	}
+
+	// One member sends LATENCY_MESSAGES lines to #bench, one at a time; each
+	// sample is the time until one of the other members has read it
+	bool measureLatency(const ServerConfig &config, long receivers, std::vector<long long> &samples, double &cpu)
+	{
+		int port;
+		pid_t pid = forkBenchServer(config, port);
+		if (pid < 0)
+			return false;
+		std::vector<int> fds;
+		int fd = firstBenchClient(port, 0, "lat");
+		for (long n = 1; fd >= 0; ++n)
+		{
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			send(fd, "JOIN #bench\r\n", 13, MSG_NOSIGNAL);
+			fds.push_back(fd);
+			fd = n <= receivers ? openBenchClient(port, n, "lat") : -1;
+		}
+		if (static_cast<long>(fds.size()) != receivers + 1)
+		{
+			stopBenchServer(pid);
+			for (size_t i = 0; i < fds.size(); ++i)
+				close(fds[i]);
+			return false;
+		}
+		usleep(500000);
+		for (size_t i = 0; i < fds.size(); ++i)
+			drain(fds[i]);
+
+		std::vector<struct pollfd> polled;
+		std::vector<std::string> pending(fds.size());
+		for (size_t i = 1; i < fds.size(); ++i)
+			polled.push_back(pollEntry(fds[i], POLLIN));
+		long startTicks = cpuTicks(pid);
+		long long start = Clock::monotonicNs();
+		for (long m = 0; m < LATENCY_MESSAGES; ++m)
+		{
+			std::ostringstream line;
+			long long sent = Clock::monotonicNs();
+			line << "PRIVMSG #bench :" << m << " " << sent << "\r\n";
+			send(fds[0], line.str().data(), line.str().size(), MSG_NOSIGNAL);
+			long waiting = receivers;
+			while (waiting > 0 && poll(&polled[0], polled.size(), 1000) > 0)
+			{
+				long long now = Clock::monotonicNs();
+				for (size_t i = 0; i < polled.size(); ++i)
+				{
+					if (!(polled[i].revents & POLLIN))
+						continue;
+					char buffer[4096];
+					ssize_t got = recv(polled[i].fd, buffer, sizeof(buffer), 0);
+					if (got > 0)
+						pending[i].append(buffer, got);
+					size_t eol;
+					while ((eol = pending[i].find('\n')) != std::string::npos)
+					{
+						size_t text = pending[i].find(" PRIVMSG #bench :");
+						if (text < eol && std::atol(pending[i].c_str() + text + 17) == m)
+						{
+							samples.push_back(now - sent);
+							--waiting;
+						}
+						pending[i].erase(0, eol + 1);
+					}
+				}
+			}
+			usleep(LATENCY_GAP_US);
+		}
+		cpu = static_cast<double>(cpuTicks(pid) - startTicks) / sysconf(_SC_CLK_TCK) / ((Clock::monotonicNs() - start) / 1e9);
+		stopBenchServer(pid);
+		for (size_t i = 0; i < fds.size(); ++i)
+			close(fds[i]);
+		return true;
+	}
+
+	double percentileUs(const std::vector<long long> &sorted, double p)
+	{
+		if (sorted.empty())
+			return 0;
+		return sorted[static_cast<size_t>(p * (sorted.size() - 1))] / 1000.0;
+	}
+}
+
+// ./ircserv --latency-bench=N: PRIVMSG delivery latency to the N other members
+// of a channel, against a server in its default mode and one with --latency=on
+// (pinned to the last core when there is more than one).
+int Server::runLatencyBenchmark(long receivers)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	std::printf("%-22s %9s %9s %9s %9s %11s\n", "mode", "samples", "p50 us", "p99 us", "max us", "server CPU");
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ServerConfig config;
+		config.latencyMode = mode == 1;
+		if (config.latencyMode && cpus > 1)
+			config.pinCpu = cpus - 1;
+		std::vector<long long> samples;
+		double cpu = 0;
+		if (!measureLatency(config, receivers, samples, cpu))
+		{
+			std::cerr << "latency bench: could not set up " << receivers << " members" << std::endl;
+			return 1;
+		}
+		std::sort(samples.begin(), samples.end());
+		std::ostringstream name;
+		name << (mode ? "latency=on" : "default");
+		if (config.pinCpu >= 0)
+			name << " (cpu " << config.pinCpu << ")";
+		std::printf("%-22s %9lu %9.1f %9.1f %9.1f %10.0f%%\n", name.str().c_str(),
+					static_cast<unsigned long>(samples.size()), percentileUs(samples, 0.5),
+					percentileUs(samples, 0.99), percentileUs(samples, 1.0), cpu * 100);
+	}
+	if (cpus < 2)
+		std::cout << "note: one CPU online, the spinning server and this benchmark share it" << std::endl;
+	return 0;
+}
+
+namespace
+{
+	const long THROUGHPUT_MESSAGES = 5000;
+	const long THROUGHPUT_WINDOW = 1024; // lines the sender may run ahead of the slowest member
+	const long THROUGHPUT_BATCH = 16;  // lines per send() from the sender
+
+	// Reads what has arrived for one member and counts its #bench lines
+	void countDeliveries(int fd, std::string &pending, long &count)
+	{
+		char buffer[16384];
+		ssize_t got;
+		while ((got = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+			pending.append(buffer, got);
+		size_t begin = 0, eol;
+		while ((eol = pending.find('\n', begin)) != std::string::npos)
+		{
+			if (pending.compare(begin, 1, ":") == 0 && pending.find(" PRIVMSG #bench :", begin) < eol)
+				++count;
+			begin = eol + 1;
+		}
+		pending.erase(0, begin);
+	}
+
+	// Reads a member's registration and JOIN replies up to the end of NAMES
+	bool awaitJoined(int fd)
+	{
+		std::string received;
+		char buffer[4096];
+		struct pollfd entry = pollEntry(fd, POLLIN);
+		while (received.find(" 366 ") == std::string::npos)
+		{
+			ssize_t got;
+			if (poll(&entry, 1, 5000) <= 0 || (got = recv(fd, buffer, sizeof(buffer), 0)) <= 0)
+				return false;
+			received.append(buffer, got);
+		}
+		drain(fd);
+		return true;
+	}
+
+	// One member pipelines THROUGHPUT_MESSAGES lines to #bench, never more than
+	// THROUGHPUT_WINDOW ahead of the slowest of the other members, until every
+	// member has read every line
+	bool measureThroughput(const ServerConfig &config, long receivers, double &seconds, double &cpu)
+	{
+		int port;
+		pid_t pid = forkBenchServer(config, port);
+		if (pid < 0)
+			return false;
+		std::vector<int> fds;
+		int fd = firstBenchClient(port, 0, "io");
+		for (long n = 1; fd >= 0; ++n)
+		{
+			int on = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			send(fd, "JOIN #bench\r\n", 13, MSG_NOSIGNAL);
+			fds.push_back(fd);
+			fd = n <= receivers ? openBenchClient(port, n, "io") : -1;
+		}
+		bool complete = static_cast<long>(fds.size()) == receivers + 1;
+		for (size_t i = 0; complete && i < fds.size(); ++i)
+			complete = awaitJoined(fds[i]);
+
+		std::vector<struct pollfd> polled;
+		for (size_t i = 1; complete && i < fds.size(); ++i)
+			polled.push_back(pollEntry(fds[i], POLLIN));
+		std::vector<std::string> pending(polled.size());
+		std::vector<long> counts(polled.size(), 0);
+		long sent = 0;
+		long startTicks = cpuTicks(pid);
+		long long start = Clock::monotonicNs();
+		while (complete)
+		{
+			long slowest = *std::min_element(counts.begin(), counts.end());
+			if (slowest == THROUGHPUT_MESSAGES)
+				break;
+			if (sent < THROUGHPUT_MESSAGES && sent - slowest < THROUGHPUT_WINDOW)
+			{
+				std::ostringstream lines;
+				for (long n = 0; n < THROUGHPUT_BATCH && sent < THROUGHPUT_MESSAGES; ++n)
+					lines << "PRIVMSG #bench :" << sent++ << "\r\n";
+				send(fds[0], lines.str().data(), lines.str().size(), MSG_NOSIGNAL);
+			}
+			if (poll(&polled[0], polled.size(), 2000) <= 0)
+				complete = false;
+			for (size_t i = 0; complete && i < polled.size(); ++i)
+			{
+				if (polled[i].revents & POLLIN)
+					countDeliveries(polled[i].fd, pending[i], counts[i]);
+			}
+		}
+		seconds = (Clock::monotonicNs() - start) / 1e9;
+		cpu = static_cast<double>(cpuTicks(pid) - startTicks) / sysconf(_SC_CLK_TCK) / seconds;
+		stopBenchServer(pid);
+		for (size_t i = 0; i < fds.size(); ++i)
+			close(fds[i]);
+		return complete;
+	}
+}
+
+// ./ircserv --uring-bench=N: channel throughput to N members, the same load
+// against a server with --io=poll and one with --io=uring. Deliveries per
+// second is wall-clock; server CPU is the share of one core it used meanwhile.
+int Server::runUringBenchmark(long receivers)
+{
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	static const char *const engines[] = {"poll", "uring"};
+	std::printf("%-8s %9s %12s %9s %14s %11s\n", "io", "members", "deliveries", "seconds", "deliveries/s",
+				"server CPU");
+	for (int engine = 0; engine < 2; ++engine)
+	{
+		ServerConfig config;
+		config.ioEngine = engines[engine];
+		if (config.ioEngine == "uring" && !UringEngine::isAvailable())
+		{
+			std::printf("%-8s io_uring is not available on this system\n", engines[engine]);
+			continue;
+		}
+		double seconds = 0, cpu = 0;
+		if (!measureThroughput(config, receivers, seconds, cpu))
+		{
+			std::cerr << "uring bench: could not deliver to " << receivers << " members (" << engines[engine] << ")"
+					  << std::endl;
+			return 1;
+		}
+		double deliveries = static_cast<double>(THROUGHPUT_MESSAGES) * receivers;
+		std::printf("%-8s %9ld %12.0f %9.3f %14.0f %10.0f%%\n", engines[engine], receivers, deliveries, seconds,
+					deliveries / seconds, cpu * 100);
+	}
+	return 0;
+}
+
+namespace
+{
+	const char *const SIM_PASSWORD = "sim";
+	const int SIM_ROUNDS = 20;	// PRIVMSGs each client sends to the next one
+	const int SIM_FANOUT = 200; // lines the first client sends to #sim
+	const int SIM_STEP_LIMIT = 100000;
+
+	struct SimClient
+	{
+		int fd;
+		std::string input;
+		std::string output; // not yet taken by the network
+	};
+
+	// What the simulated clients read; PRIVMSG lines are the deliveries
+	struct SimTally
+	{
+		unsigned long welcomes;
+		unsigned long joins;
+		unsigned long delivered;
+		unsigned long long bytes;
+		unsigned long checksum; // FNV-1a over delivered lines, in arrival order
+		long long cpuNs;		// thread CPU time spent inside the server
+		long long worstStepNs;	// longest single loop iteration: what every other client waits
+
+		SimTally() : welcomes(0), joins(0), delivered(0), bytes(0), checksum(2166136261UL), cpuNs(0), worstStepNs(0) {}
+
+		void line(const std::string &line)
+		{
+			if (line.compare(0, 4, "001 ") == 0 || line.find(" 001 ") != std::string::npos)
+				++welcomes;
+			else if (line.find(" 366 ") != std::string::npos)
+				++joins;
+			else if (line.find(" PRIVMSG ") != std::string::npos)
+			{
+				++delivered;
+				bytes += line.size() + 1;
+				for (size_t i = 0; i < line.size(); ++i)
+					checksum = ((checksum ^ static_cast<unsigned char>(line[i])) * 16777619UL) & 0xFFFFFFFFUL;
+			}
+		}
+	};
+
+	long long threadCpuNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+	}
+
+	// One step: clients write what they can, the server runs one loop
+	// iteration, clients read everything that has arrived
+	void simStep(Server &server, SimulatedNetwork &net, std::vector<SimClient> &clients, SimTally &tally)
+	{
+		std::vector<struct pollfd> polled;
+		for (size_t i = 0; i < clients.size(); ++i)
+		{
+			SimClient &c = clients[i];
+			ssize_t sent;
+			while (!c.output.empty() && (sent = net.send(c.fd, c.output.data(), c.output.size())) > 0)
+				c.output.erase(0, sent);
+			polled.push_back(pollEntry(c.fd, static_cast<short>(c.output.empty() ? POLLIN : POLLIN | POLLOUT)));
+		}
+		// A client with something left to read or write goes again right away:
+		// the server only waits (moving the clock) when every client would too
+		bool clientsReady = net.poll(&polled[0], polled.size(), 0) > 0;
+		long long start = threadCpuNs();
+		server.runOnce(clientsReady ? 0 : 1000);
+		long long step = threadCpuNs() - start;
+		tally.cpuNs += step;
+		tally.worstStepNs = std::max(tally.worstStepNs, step);
+		char buffer[16384];
+		for (size_t i = 0; i < clients.size(); ++i)
+		{
+			SimClient &c = clients[i];
+			ssize_t got;
+			while ((got = net.recv(c.fd, buffer, sizeof(buffer))) > 0)
+				c.input.append(buffer, got);
+			size_t begin = 0, eol;
+			while ((eol = c.input.find('\n', begin)) != std::string::npos)
+			{
+				tally.line(c.input.substr(begin, eol - begin));
+				begin = eol + 1;
+			}
+			c.input.erase(0, begin);
+		}
+	}
+
+	bool simUntil(Server &server, SimulatedNetwork &net, std::vector<SimClient> &clients, SimTally &tally,
+				  const unsigned long &counter, unsigned long target)
+	{
+		for (int step = 0; counter < target && step < SIM_STEP_LIMIT; ++step)
+			simStep(server, net, clients, tally);
+		return counter == target;
+	}
+
+	// What --sim-bench=N delivers at the sizes `make check` runs. A change that
+	// is meant to alter what clients receive updates these in the same commit.
+	struct SimExpected
+	{
+		long clients;
+		unsigned long directLines;
+		unsigned long long directBytes;
+		unsigned long directChecksum;
+		unsigned long fanoutLines;
+		unsigned long long fanoutBytes;
+		unsigned long fanoutChecksum;
+	};
+
+	const SimExpected SIM_EXPECTED[] = {
+		{2, 40, 2100, 0x6a8d6b37UL, 200, 16290, 0x420709a9UL},
+		{200, 4000, 233240, 0xedefca3dUL, 39800, 3241710, 0x5d25ee01UL},
+	};
+
+	bool checkWorkload(const char *name, const SimTally &tally, unsigned long lines, unsigned long long bytes,
+					   unsigned long checksum)
+	{
+		if (tally.delivered == lines && tally.bytes == bytes && tally.checksum == checksum)
+			return true;
+		std::printf("regression   %s: expected %lu lines, %llu bytes, checksum %08lx\n", name, lines, bytes, checksum);
+		return false;
+	}
+
+	void printWorkload(const char *name, const SimTally &tally, long long simNs)
+	{
+		double seconds = tally.cpuNs / 1e9;
+		std::printf("%-16s %9lu %11llu   %08lx %9.3f %9.1f %11.0f %9.0f %10.2f\n", name, tally.delivered, tally.bytes,
+					tally.checksum, simNs / 1e6, tally.cpuNs / 1e6, seconds > 0 ? tally.delivered / seconds : 0.0,
+					tally.delivered ? static_cast<double>(tally.cpuNs) / tally.delivered : 0.0, tally.worstStepNs / 1e6);
+	}
+}
+
+// ./ircserv --sim-bench=N: command processing and channel fan-out through the
+// whole server core, with N clients on a SimulatedNetwork (scripted latency,
+// partial writes and EAGAIN) instead of the kernel. Everything but the CPU
+// columns is deterministic: a change in lines, bytes, checksum or simulated
+// time is a change in behaviour, not noise. For the sizes in SIM_EXPECTED
+// the run fails when lines, bytes or checksum differ (`make check`).
+int Server::runSimulationBenchmark(long clients)
+{
+	if (clients < 2)
+	{
+		std::cerr << "--sim-bench needs at least 2 clients" << std::endl;
+		return 1;
+	}
+	NetworkScript script;
+	script.latencyNs = 50000;
+	script.maxWrite = 1400;
+	script.window = 64 * 1024;
+	script.eagainEvery = 7;
+	SimulatedNetwork net(script);
+	int listenFd = net.listen();
+
+	// The server logs every connection and command to stdout
+	std::cout.setstate(std::ios::failbit);
+	// Overload protection follows the real clock, which would make results
+	// depend on the machine
+	ServerConfig config;
+	config.overloadLag = 0;
+	Server server(0, SIM_PASSWORD, config);
+	server.attachSockets(&net, listenFd);
+	std::vector<SimClient> sims(clients);
+	for (long n = 0; n < clients; ++n)
+	{
+		std::ostringstream hello;
+		hello << "PASS " << SIM_PASSWORD << "\r\nNICK sim" << n << "\r\nUSER sim 0 * :sim\r\nJOIN #sim\r\n";
+		sims[n].fd = net.connect(listenFd);
+		sims[n].output = hello.str();
+	}
+	SimTally setup;
+	bool ok = simUntil(server, net, sims, setup, setup.joins, clients);
+
+	SimTally direct;
+	long long simStart = net.now();
+	for (long n = 0; ok && n < clients; ++n)
+	{
+		for (int r = 0; r < SIM_ROUNDS; ++r)
+		{
+			std::ostringstream line;
+			line << "PRIVMSG sim" << (n + 1) % clients << " :round " << r << " from sim" << n << "\r\n";
+			sims[n].output += line.str();
+		}
+	}
+	ok = ok && simUntil(server, net, sims, direct, direct.delivered, clients * SIM_ROUNDS);
+	long long directNs = net.now() - simStart;
+
+	SimTally fanout;
+	simStart = net.now();
+	for (int m = 0; ok && m < SIM_FANOUT; ++m)
+	{
+		std::ostringstream line;
+		line << "PRIVMSG #sim :tick " << m << " EURUSD 1.08734 bid 1.08731 ask 1.08737\r\n";
+		sims[0].output += line.str();
+	}
+	ok = ok && simUntil(server, net, sims, fanout, fanout.delivered, (clients - 1) * SIM_FANOUT);
+	long long fanoutNs = net.now() - simStart;
+	std::cout.clear();
+
+	std::cout << "network      latency " << script.latencyNs / 1000 << " us, writes <= " << script.maxWrite
+			  << " bytes, EAGAIN every " << script.eagainEvery << "th call, window " << script.window << " bytes"
+			  << std::endl;
+	std::cout << "clients      " << setup.welcomes << " registered, " << setup.joins << " in #sim of " << clients
+			  << std::endl;
+	std::printf("%-16s %9s %11s %10s %9s %9s %11s %9s %10s\n", "workload", "lines", "bytes", "checksum", "sim ms",
+				"cpu ms", "lines/s", "ns/line", "worst ms");
+	printWorkload("privmsg 1:1", direct, directNs);
+	printWorkload("channel fan-out", fanout, fanoutNs);
+	const SimulatedNetwork::Counters &counters = net.counters();
+	std::cout << "network      " << counters.sends << " sends, " << counters.bytesSent << " bytes, "
+			  << counters.partialWrites << " partial writes, " << counters.eagains << " EAGAIN" << std::endl;
+	if (!ok)
+		std::cerr << "incomplete: expected " << clients * SIM_ROUNDS << " direct and "
+				  << (clients - 1) * SIM_FANOUT << " channel deliveries" << std::endl;
+	for (size_t i = 0; ok && i < sizeof(SIM_EXPECTED) / sizeof(SIM_EXPECTED[0]); ++i)
+	{
+		const SimExpected &expected = SIM_EXPECTED[i];
+		if (expected.clients != clients)
+			continue;
+		ok = checkWorkload("privmsg 1:1", direct, expected.directLines, expected.directBytes, expected.directChecksum);
+		ok = checkWorkload("channel fan-out", fanout, expected.fanoutLines, expected.fanoutBytes,
+						   expected.fanoutChecksum) && ok;
+		std::cout << "regression   " << (ok ? "matches" : "differs from") << " the expected results for " << clients
+				  << " clients" << std::endl;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+#include "SimulatedNetwork.hpp"
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+NetworkScript::NetworkScript() : latencyNs(0), maxWrite(0), window(256 * 1024), eagainEvery(0) {}
+
+SimulatedNetwork::SimulatedNetwork(const NetworkScript &script)
+	: _script(script), _nextFd(FIRST_FD), _now(0), _recvCalls(0), _sendCalls(0), _counters()
+{
+}
+
+SimulatedNetwork::Endpoint *SimulatedNetwork::find(int fd)
+{
+	std::map<int, Endpoint>::iterator it = _endpoints.find(fd);
+	return it == _endpoints.end() ? NULL : &it->second;
+}
+
+bool SimulatedNetwork::scriptedEagain(unsigned long &calls)
+{
+	if (!_script.eagainEvery || ++calls % _script.eagainEvery)
+		return false;
+	_counters.eagains++;
+	errno = EAGAIN;
+	return true;
+}
+
+int SimulatedNetwork::listen()
+{
+	int fd = _nextFd++;
+	_endpoints[fd].listening = true;
+	return fd;
+}
+
+int SimulatedNetwork::connect(int listenFd)
+{
+	Endpoint *listener = find(listenFd);
+	if (!listener || !listener->listening)
+	{
+		errno = ECONNREFUSED;
+		return -1;
+	}
+	int client = _nextFd++;
+	int server = _nextFd++;
+	_endpoints[client].peer = server;
+	_endpoints[server].peer = client;
+	_endpoints[listenFd].backlog.push_back(server);
+	return client;
+}
+
+long long SimulatedNetwork::now() const
+{
+	return _now;
+}
+
+void SimulatedNetwork::advance(long long ns)
+{
+	_now += ns;
+}
+
+const SimulatedNetwork::Counters &SimulatedNetwork::counters() const
+{
+	return _counters;
+}
+
+int SimulatedNetwork::accept(int listenFd)
+{
+	Endpoint *listener = find(listenFd);
+	if (!listener || listener->backlog.empty())
+	{
+		errno = listener ? EAGAIN : EBADF;
+		return -1;
+	}
+	int fd = listener->backlog.front();
+	listener->backlog.pop_front();
+	return fd;
+}
+
+ssize_t SimulatedNetwork::recv(int fd, void *buffer, size_t size)
+{
+	Endpoint *end = find(fd);
+	if (!end)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if (scriptedEagain(_recvCalls))
+		return -1;
+	size_t copied = 0;
+	while (copied < size && !end->inbound.empty() && end->inbound.front().readyAt <= _now)
+	{
+		Chunk &chunk = end->inbound.front();
+		size_t n = std::min(size - copied, chunk.data.size() - end->readOffset);
+		std::memcpy(static_cast<char *>(buffer) + copied, chunk.data.data() + end->readOffset, n);
+		copied += n;
+		end->readOffset += n;
+		end->inboundBytes -= n;
+		if (end->readOffset == chunk.data.size())
+		{
+			end->inbound.pop_front();
+			end->readOffset = 0;
+		}
+	}
+	if (copied)
+		return copied;
+	if (end->peer < 0 && end->inbound.empty())
+		return 0;
+	errno = EAGAIN;
+	return -1;
+}
+
+ssize_t SimulatedNetwork::send(int fd, const void *data, size_t size)
+{
+	Endpoint *end = find(fd);
+	if (!end)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if (end->peer < 0)
+	{
+		errno = EPIPE;
+		return -1;
+	}
+	if (scriptedEagain(_sendCalls))
+		return -1;
+	Endpoint &peer = _endpoints[end->peer];
+	size_t room = peer.inboundBytes < _script.window ? _script.window - peer.inboundBytes : 0;
+	size_t n = std::min(size, room);
+	if (_script.maxWrite)
+		n = std::min(n, _script.maxWrite);
+	if (!n)
+	{
+		_counters.eagains++;
+		errno = EAGAIN;
+		return -1;
+	}
+	long long readyAt = _now + _script.latencyNs;
+	if (peer.inbound.empty() || peer.inbound.back().readyAt != readyAt)
+	{
+		peer.inbound.push_back(Chunk());
+		peer.inbound.back().readyAt = readyAt;
+	}
+	peer.inbound.back().data.append(static_cast<const char *>(data), n);
+	peer.inboundBytes += n;
+	_counters.bytesSent += n;
+	_counters.sends++;
+	if (n < size)
+		_counters.partialWrites++;
+	return n;
+}
+
+short SimulatedNetwork::readiness(int fd, short events)
+{
+	Endpoint *end = find(fd);
+	if (!end)
+		return 0;
+	short ready = 0;
+	if (end->listening)
+		return (events & POLLIN) && !end->backlog.empty() ? POLLIN : 0;
+	if ((events & POLLIN) && !end->inbound.empty() && end->inbound.front().readyAt <= _now)
+		ready |= POLLIN;
+	if (end->peer < 0 && end->inbound.empty())
+		ready |= POLLHUP;
+	else if ((events & POLLOUT) && end->peer >= 0 && _endpoints[end->peer].inboundBytes < _script.window)
+		ready |= POLLOUT;
+	return ready;
+}
+
+long long SimulatedNetwork::nextDelivery() const
+{
+	long long next = -1;
+	for (std::map<int, Endpoint>::const_iterator it = _endpoints.begin(); it != _endpoints.end(); ++it)
+	{
+		if (!it->second.inbound.empty() && it->second.inbound.front().readyAt > _now &&
+			(next < 0 || it->second.inbound.front().readyAt < next))
+			next = it->second.inbound.front().readyAt;
+	}
+	return next;
+}
+
+// Nothing ready and allowed to wait: the clock jumps to the next delivery (or
+// by the whole timeout when nothing is on its way), then readiness is checked again
+int SimulatedNetwork::poll(struct pollfd *fds, nfds_t count, int timeoutMs)
+{
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		int ready = 0;
+		for (nfds_t i = 0; i < count; ++i)
+		{
+			fds[i].revents = readiness(fds[i].fd, fds[i].events);
+			ready += fds[i].revents != 0;
+		}
+		if (ready || timeoutMs == 0 || pass)
+			return ready;
+		long long next = nextDelivery();
+		long long limit = timeoutMs < 0 ? -1 : _now + timeoutMs * 1000000LL;
+		if (next < 0 && limit < 0)
+			return 0; // would sleep forever: nothing can ever arrive
+		_now = next >= 0 && (limit < 0 || next < limit) ? next : limit;
+	}
+	return 0;
+}
+
+int SimulatedNetwork::close(int fd)
+{
+	Endpoint *end = find(fd);
+	if (!end)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	if (end->peer >= 0)
+		_endpoints[end->peer].peer = -1;
+	for (std::deque<int>::iterator it = end->backlog.begin(); it != end->backlog.end(); ++it)
+	{
+		Endpoint *waiting = find(*it);
+		if (waiting && waiting->peer >= 0)
+			_endpoints[waiting->peer].peer = -1;
+		_endpoints.erase(*it);
+	}
+	_endpoints.erase(fd);
+	return 0;
+}
+
+// Every connection gets its own address in 10.0.0.0/8, from its descriptor
+bool SimulatedNetwork::peerAddress(int fd, struct sockaddr_storage &address)
+{
+	if (!find(fd))
+		return false;
+	std::memset(&address, 0, sizeof(address));
+	struct sockaddr_in *in = reinterpret_cast<struct sockaddr_in *>(&address);
+	in->sin_family = AF_INET;
+	in->sin_addr.s_addr = htonl(0x0A000000 | ((fd - FIRST_FD) & 0xFFFFFF));
+	return true;
+}
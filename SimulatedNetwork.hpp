@@ -0,0 +1,91 @@
+#ifndef SIMULATEDNETWORK_HPP
+#define SIMULATEDNETWORK_HPP
+
+#include "SocketLayer.hpp"
+#include <string>
+#include <deque>
+#include <map>
+
+// Scripted network conditions for a SimulatedNetwork
+struct NetworkScript
+{
+	long long latencyNs; // bytes become readable this long after they were sent
+	size_t maxWrite;	 // largest chunk one send() takes (0 = no limit): partial writes
+	size_t window;		 // bytes in flight per direction before send() fails with EAGAIN
+	unsigned eagainEvery; // every Nth recv() and send() fails with EAGAIN (0 = never)
+
+	NetworkScript();
+};
+
+// An in-memory network behind the SocketLayer calls: no kernel, no real time.
+// Its clock only moves when poll() finds nothing ready and may wait, and then
+// jumps straight to the next delivery, so the same script and the same calls
+// always give the same results. Both ends of a connection are served by the
+// same object: the server's through SocketLayer, the driver's (the simulated
+// clients) through connect() and the same recv/send/close.
+//
+// Descriptors start at FIRST_FD, far above anything the kernel hands out, so
+// a stray system call on one fails instead of hitting a real file.
+class SimulatedNetwork : public SocketLayer
+{
+public:
+	static const int FIRST_FD = 1 << 24;
+
+	struct Counters
+	{
+		unsigned long long bytesSent;
+		unsigned long long sends;
+		unsigned long long partialWrites; // send() took less than it was given
+		unsigned long long eagains;		  // scripted and window-full EAGAINs
+	};
+
+private:
+	struct Chunk
+	{
+		long long readyAt;
+		std::string data;
+	};
+
+	struct Endpoint
+	{
+		int peer;				  // -1 once the other end is closed
+		std::deque<Chunk> inbound; // bytes on their way to this end
+		size_t inboundBytes;
+		size_t readOffset;		  // consumed from inbound.front()
+		bool listening;
+		std::deque<int> backlog; // listener: accepted-side fds waiting for accept()
+
+		Endpoint() : peer(-1), inboundBytes(0), readOffset(0), listening(false) {}
+	};
+
+	NetworkScript _script;
+	std::map<int, Endpoint> _endpoints;
+	int _nextFd;
+	long long _now;
+	unsigned long _recvCalls;
+	unsigned long _sendCalls;
+	Counters _counters;
+
+	Endpoint *find(int fd);
+	bool scriptedEagain(unsigned long &calls);
+	short readiness(int fd, short events);
+	long long nextDelivery() const;
+
+public:
+	explicit SimulatedNetwork(const NetworkScript &script);
+
+	int listen();
+	int connect(int listenFd); // the client end; the other end waits for accept()
+	long long now() const;	   // simulated nanoseconds since creation
+	void advance(long long ns);
+	const Counters &counters() const;
+
+	int accept(int listenFd);
+	ssize_t recv(int fd, void *buffer, size_t size);
+	ssize_t send(int fd, const void *data, size_t size);
+	int poll(struct pollfd *fds, nfds_t count, int timeoutMs);
+	int close(int fd);
+	bool peerAddress(int fd, struct sockaddr_storage &address);
+};
+
+#endif
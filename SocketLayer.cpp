@@ -0,0 +1,52 @@
+#include "SocketLayer.hpp"
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+SystemSockets &SystemSockets::instance()
+{
+	static SystemSockets sockets;
+	return sockets;
+}
+
+int SystemSockets::accept(int listenFd)
+{
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	int fd = ::accept(listenFd, reinterpret_cast<struct sockaddr *>(&address), &length);
+	if (fd < 0)
+		return -1;
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+	{
+		perror("fcntl");
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+ssize_t SystemSockets::recv(int fd, void *buffer, size_t size)
+{
+	return ::recv(fd, buffer, size, 0);
+}
+
+ssize_t SystemSockets::send(int fd, const void *data, size_t size)
+{
+	return ::send(fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+int SystemSockets::poll(struct pollfd *fds, nfds_t count, int timeoutMs)
+{
+	return ::poll(fds, count, timeoutMs);
+}
+
+int SystemSockets::close(int fd)
+{
+	return ::close(fd);
+}
+
+bool SystemSockets::peerAddress(int fd, struct sockaddr_storage &address)
+{
+	socklen_t length = sizeof(address);
+	return getpeername(fd, reinterpret_cast<struct sockaddr *>(&address), &length) == 0;
+}
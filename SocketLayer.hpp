@@ -0,0 +1,54 @@
+#ifndef SOCKETLAYER_HPP
+#define SOCKETLAYER_HPP
+
+#include <cstddef>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// One poll() entry, as push_back((struct pollfd){fd, events, 0}) would be
+// if C++98 had compound literals
+inline struct pollfd pollEntry(int fd, short events)
+{
+	struct pollfd entry;
+	entry.fd = fd;
+	entry.events = events;
+	entry.revents = 0;
+	return entry;
+}
+
+// The socket calls the poll() event loop makes on listeners and client
+// connections, so the loop can run on something other than the kernel:
+// SystemSockets in production, SimulatedNetwork for deterministic benchmarks.
+// Connecting out to a linked server, the worker pipe, TLS and the io_uring
+// backend always use the kernel directly.
+class SocketLayer
+{
+public:
+	virtual ~SocketLayer() {}
+
+	// A pending connection on `listenFd`, already non-blocking; -1 and errno otherwise
+	virtual int accept(int listenFd) = 0;
+	// -1 with errno EAGAIN when nothing is readable, 0 at end of stream
+	virtual ssize_t recv(int fd, void *buffer, size_t size) = 0;
+	// Never blocks and never raises SIGPIPE; may accept fewer bytes than given
+	virtual ssize_t send(int fd, const void *data, size_t size) = 0;
+	virtual int poll(struct pollfd *fds, nfds_t count, int timeoutMs) = 0;
+	virtual int close(int fd) = 0;
+	virtual bool peerAddress(int fd, struct sockaddr_storage &address) = 0;
+};
+
+class SystemSockets : public SocketLayer
+{
+public:
+	static SystemSockets &instance();
+
+	int accept(int listenFd);
+	ssize_t recv(int fd, void *buffer, size_t size);
+	ssize_t send(int fd, const void *data, size_t size);
+	int poll(struct pollfd *fds, nfds_t count, int timeoutMs);
+	int close(int fd);
+	bool peerAddress(int fd, struct sockaddr_storage &address);
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "SpamFilter.hpp"
+#include "MemoryStats.hpp"
+#include <cctype>
+#include <deque>
+
+bool FilterRule::parseAction(const std::string &name, FilterAction &action)
+{
+	if (name == "drop")
+		action = FILTER_DROP;
+	else if (name == "block")
+		action = FILTER_BLOCK;
+	else if (name == "kill")
+		action = FILTER_KILL;
+	else
+		return false;
+	return true;
+}
+
+const char *FilterRule::actionName(FilterAction action)
+{
+	static const char *const names[] = {"drop", "block", "kill"};
+	return names[action];
+}
+
+const unsigned SpamFilter::NO_MATCH;
+
+SpamFilter::SpamFilter(unsigned long generation) : _generation(generation), _columns(1)
+{
+	for (int b = 0; b < 256; ++b)
+		_column[b] = 0;
+	_next.assign(1, 0);
+	_match.assign(1, NO_MATCH);
+	_ends.assign(1, NO_MATCH);
+	_suffix.assign(1, 0);
+}
+
+unsigned SpamFilter::severer(unsigned a, unsigned b) const
+{
+	if (a == NO_MATCH)
+		return b;
+	if (b == NO_MATCH)
+		return a;
+	if (_rules[a].action != _rules[b].action)
+		return _rules[a].action > _rules[b].action ? a : b;
+	return _rules[a].id < _rules[b].id ? a : b;
+}
+
+void SpamFilter::build(const std::vector<FilterRule> &rules)
+{
+	_rules.clear();
+	for (size_t i = 0; i < rules.size(); ++i)
+	{
+		if (!rules[i].phrase.empty())
+			_rules.push_back(rules[i]);
+	}
+
+	// Columns: one per distinct (lowercased) byte used by a phrase, 0 for the rest
+	_columns = 1;
+	for (size_t i = 0; i < _rules.size(); ++i)
+	{
+		const std::string &phrase = _rules[i].phrase;
+		for (size_t j = 0; j < phrase.size(); ++j)
+		{
+			unsigned char c = std::tolower(static_cast<unsigned char>(phrase[j]));
+			if (!_column[c])
+				_column[c] = _columns++;
+		}
+	}
+	for (int b = 0; b < 256; ++b)
+		_column[b] = _column[std::tolower(b)];
+
+	// Trie: state 0 is the root and never a child, so 0 also means "no edge yet"
+	_next.assign(_columns, 0);
+	_match.assign(1, NO_MATCH);
+	_ends.assign(1, NO_MATCH);
+	_sameEnd.assign(_rules.size(), NO_MATCH);
+	for (size_t i = 0; i < _rules.size(); ++i)
+	{
+		const std::string &phrase = _rules[i].phrase;
+		unsigned state = 0;
+		for (size_t j = 0; j < phrase.size(); ++j)
+		{
+			unsigned &edge = _next[state * _columns + _column[static_cast<unsigned char>(phrase[j])]];
+			if (!edge)
+			{
+				edge = _match.size();
+				_match.push_back(NO_MATCH);
+				_ends.push_back(NO_MATCH);
+				_next.resize(_next.size() + _columns, 0);
+			}
+			state = _next[state * _columns + _column[static_cast<unsigned char>(phrase[j])]];
+		}
+		_match[state] = severer(_match[state], i);
+		_sameEnd[i] = _ends[state];
+		_ends[state] = i;
+	}
+
+	// Breadth first: a state's failure target is shallower, so its row is complete
+	// by the time the state is reached and missing edges can be copied from it
+	std::vector<unsigned> fail(_match.size(), 0);
+	_suffix.assign(_match.size(), 0);
+	std::deque<unsigned> queue;
+	for (unsigned c = 0; c < _columns; ++c)
+	{
+		if (_next[c])
+			queue.push_back(_next[c]);
+	}
+	while (!queue.empty())
+	{
+		unsigned state = queue.front();
+		queue.pop_front();
+		_match[state] = severer(_match[state], _match[fail[state]]);
+		_suffix[state] = _ends[fail[state]] != NO_MATCH ? fail[state] : _suffix[fail[state]];
+		for (unsigned c = 0; c < _columns; ++c)
+		{
+			unsigned &edge = _next[state * _columns + c];
+			unsigned fallback = _next[fail[state] * _columns + c];
+			if (edge)
+			{
+				fail[edge] = fallback;
+				queue.push_back(edge);
+			}
+			else
+				edge = fallback;
+		}
+	}
+}
+
+// Every rule ending at `state`, its own and those of its suffixes: only walked
+// when the precomputed most severe one has been deleted
+unsigned SpamFilter::severestLive(unsigned state, const std::map<unsigned long, FilterRule> &live) const
+{
+	unsigned found = NO_MATCH;
+	for (; state; state = _suffix[state])
+	{
+		for (unsigned rule = _ends[state]; rule != NO_MATCH; rule = _sameEnd[rule])
+		{
+			if (live.count(_rules[rule].id))
+				found = severer(found, rule);
+		}
+	}
+	return found;
+}
+
+unsigned long SpamFilter::scan(const char *text, size_t size, const std::map<unsigned long, FilterRule> &live) const
+{
+	unsigned state = 0;
+	unsigned found = NO_MATCH;
+	for (size_t i = 0; i < size; ++i)
+	{
+		state = _next[state * _columns + _column[static_cast<unsigned char>(text[i])]];
+		if (_match[state] == NO_MATCH)
+			continue;
+		unsigned rule = _match[state];
+		if (!live.count(_rules[rule].id))
+			rule = severestLive(state, live);
+		found = severer(found, rule);
+		if (found != NO_MATCH && _rules[found].action == FILTER_KILL)
+			break;
+	}
+	return found == NO_MATCH ? 0 : _rules[found].id;
+}
+
+unsigned long SpamFilter::generation() const
+{
+	return _generation;
+}
+
+size_t SpamFilter::ruleCount() const
+{
+	return _rules.size();
+}
+
+size_t SpamFilter::stateCount() const
+{
+	return _match.size();
+}
+
+size_t SpamFilter::memoryBytes() const
+{
+	size_t bytes = sizeof(SpamFilter) + MemoryStats::vectorBytes(_next) + MemoryStats::vectorBytes(_match) +
+				   MemoryStats::vectorBytes(_ends) + MemoryStats::vectorBytes(_sameEnd) +
+				   MemoryStats::vectorBytes(_suffix) + MemoryStats::vectorBytes(_rules);
+	for (size_t i = 0; i < _rules.size(); ++i)
+		bytes += MemoryStats::stringBytes(_rules[i].phrase);
+	return bytes;
+}
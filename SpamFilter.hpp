@@ -0,0 +1,70 @@
+#ifndef SPAMFILTER_HPP
+#define SPAMFILTER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+
+// What happens to a message containing a filtered phrase, least severe first
+enum FilterAction
+{
+	FILTER_DROP,  // discarded, the sender is not told
+	FILTER_BLOCK, // refused with FAIL <command> MESSAGE_FILTERED
+	FILTER_KILL	  // discarded and the sender disconnected
+};
+
+// A server-wide FILTER entry
+struct FilterRule
+{
+	unsigned long id;
+	FilterAction action;
+	std::string phrase;
+	unsigned long hits; // messages this rule decided
+
+	static bool parseAction(const std::string &name, FilterAction &action);
+	static const char *actionName(FilterAction action);
+};
+
+// Every filtered phrase compiled into one Aho-Corasick automaton, with the
+// failure links folded into a complete transition table: scanning a message
+// is one table lookup per byte, whatever the number of phrases. Matching
+// ignores ASCII case. Bytes that appear in no phrase share one column, so the
+// table stays states x (distinct phrase bytes + 1).
+//
+// Built once and never changed: a new rule list means a new SpamFilter, put
+// together on a worker thread while the old one keeps serving.
+class SpamFilter
+{
+private:
+	static const unsigned NO_MATCH = ~0u;
+
+	unsigned long _generation;
+	unsigned char _column[256];		 // byte -> column of the transition table
+	unsigned _columns;
+	std::vector<unsigned> _next;	 // state * _columns + column -> state
+	std::vector<unsigned> _match;	 // state -> most severe rule ending here (index), or NO_MATCH
+	std::vector<unsigned> _ends;	 // state -> first rule whose own phrase ends here, or NO_MATCH
+	std::vector<unsigned> _sameEnd;	 // rule -> next rule with the same phrase, or NO_MATCH
+	std::vector<unsigned> _suffix;	 // state -> longest proper suffix state in _ends, 0 if none
+	std::vector<FilterRule> _rules; // id, action and phrase of each compiled rule
+
+	unsigned severer(unsigned a, unsigned b) const;
+	unsigned severestLive(unsigned state, const std::map<unsigned long, FilterRule> &live) const;
+
+public:
+	explicit SpamFilter(unsigned long generation);
+
+	void build(const std::vector<FilterRule> &rules);
+	// Id of the most severe rule in `live` whose phrase occurs in `text`, 0 if
+	// none does. Rules deleted since the build are skipped, not mistaken for
+	// "no match": another live rule may match the same text.
+	unsigned long scan(const char *text, size_t size, const std::map<unsigned long, FilterRule> &live) const;
+
+	unsigned long generation() const;
+	size_t ruleCount() const;
+	size_t stateCount() const;
+	size_t memoryBytes() const;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "StreamCompressor.hpp"
+#include <zlib.h>
+#include <ctime>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	const int WINDOW_BITS = -15; // raw deflate, 32 KiB window
+	const int MEM_LEVEL = 8;
+	const size_t MAX_INFLATE_PER_CALL = 1024 * 1024; // refuses decompression bombs
+	const size_t BENCH_BATCH_LINES = 16;			  // flush boundary when the recording has no blank lines
+}
+
+StreamCompressor::StreamCompressor() : _deflate(NULL), _inflate(NULL), _level(0) {}
+
+StreamCompressor::~StreamCompressor()
+{
+	if (_deflate)
+		deflateEnd(_deflate);
+	if (_inflate)
+		inflateEnd(_inflate);
+	delete _deflate;
+	delete _inflate;
+}
+
+bool StreamCompressor::init(int level)
+{
+	_deflate = new z_stream();
+	_inflate = new z_stream();
+	_level = level;
+	if (deflateInit2(_deflate, level, Z_DEFLATED, WINDOW_BITS, MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		delete _deflate;
+		_deflate = NULL;
+		return false;
+	}
+	if (inflateInit2(_inflate, WINDOW_BITS) != Z_OK)
+	{
+		delete _inflate;
+		_inflate = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool StreamCompressor::compress(const char *data, size_t size, std::string &out)
+{
+	if (!size)
+		return true;
+	size_t start = out.size();
+	out.resize(start + deflateBound(_deflate, size) + 16);
+	_deflate->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	_deflate->avail_in = size;
+	_deflate->next_out = reinterpret_cast<Bytef *>(&out[start]);
+	_deflate->avail_out = out.size() - start;
+	int ret = deflate(_deflate, Z_SYNC_FLUSH);
+	out.resize(out.size() - _deflate->avail_out);
+	return ret == Z_OK && _deflate->avail_in == 0;
+}
+
+bool StreamCompressor::decompress(const char *data, size_t size, std::string &out)
+{
+	char chunk[16384];
+	size_t produced = 0;
+	_inflate->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+	_inflate->avail_in = size;
+	while (_inflate->avail_in > 0)
+	{
+		_inflate->next_out = reinterpret_cast<Bytef *>(chunk);
+		_inflate->avail_out = sizeof(chunk);
+		int ret = inflate(_inflate, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+			return false;
+		size_t have = sizeof(chunk) - _inflate->avail_out;
+		out.append(chunk, have);
+		produced += have;
+		if (produced > MAX_INFLATE_PER_CALL || (ret == Z_BUF_ERROR && !have))
+			return produced <= MAX_INFLATE_PER_CALL;
+	}
+	return true;
+}
+
+std::string &StreamCompressor::getWire()
+{
+	return _wire;
+}
+
+size_t StreamCompressor::wireSize() const
+{
+	return _wire.size();
+}
+
+// Per zconf.h: deflate needs (1 << (windowBits + 2)) + (1 << (memLevel + 9)),
+// inflate 1 << windowBits plus about 7 KiB of tables
+size_t StreamCompressor::memoryBytes() const
+{
+	size_t bytes = _wire.capacity();
+	if (_deflate)
+		bytes += (1 << (-WINDOW_BITS + 2)) + (1 << (MEM_LEVEL + 9));
+	if (_inflate)
+		bytes += (1 << -WINDOW_BITS) + 7 * 1024;
+	return bytes;
+}
+
+long long StreamCompressor::cpuTimeNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// ./ircserv --compress-bench=FILE
+// Replays recorded traffic (IRC lines as sent to one client; a blank line marks
+// the end of a loop tick, otherwise every 16 lines are one batch) through a
+// fresh stream at each level, flushing at batch boundaries like the server does.
+int StreamCompressor::runBenchmark(const std::string &path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		std::cerr << "Cannot read " << path << std::endl;
+		return 1;
+	}
+	std::vector<std::string> recorded;
+	std::string line;
+	bool marked = false;
+	while (std::getline(file, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		marked = marked || line.empty();
+		recorded.push_back(line);
+	}
+	std::vector<std::string> batches;
+	std::string batch;
+	size_t lines = 0, total = 0, inBatch = 0;
+	for (size_t i = 0; i <= recorded.size(); ++i)
+	{
+		bool last = i == recorded.size();
+		if (!last && !recorded[i].empty())
+		{
+			batch += recorded[i] + "\r\n";
+			total += recorded[i].size() + 2;
+			lines++;
+			inBatch++;
+		}
+		if (last || recorded[i].empty() || (!marked && inBatch == BENCH_BATCH_LINES))
+		{
+			if (!batch.empty())
+				batches.push_back(batch);
+			batch.clear();
+			inBatch = 0;
+		}
+	}
+	if (!total)
+	{
+		std::cerr << path << ": no traffic recorded" << std::endl;
+		return 1;
+	}
+	double megabytes = total / (1024.0 * 1024.0);
+	printf("%s: %lu lines, %lu bytes in %lu batches\n", path.c_str(), static_cast<unsigned long>(lines),
+		   static_cast<unsigned long>(total), static_cast<unsigned long>(batches.size()));
+	printf("level  compressed      ratio  deflate ms/MB  inflate ms/MB\n");
+	for (int level = 1; level <= 9; ++level)
+	{
+		StreamCompressor sender, receiver;
+		if (!sender.init(level) || !receiver.init(level))
+			return 1;
+		std::string wire, plain;
+		std::vector<size_t> cuts;
+		long long start = cpuTimeNs();
+		for (size_t i = 0; i < batches.size(); ++i)
+		{
+			sender.compress(batches[i].data(), batches[i].size(), wire);
+			cuts.push_back(wire.size());
+		}
+		long long deflateNs = cpuTimeNs() - start;
+		start = cpuTimeNs();
+		size_t from = 0;
+		for (size_t i = 0; i < cuts.size(); ++i)
+		{
+			if (!receiver.decompress(wire.data() + from, cuts[i] - from, plain))
+				break;
+			from = cuts[i];
+		}
+		long long inflateNs = cpuTimeNs() - start;
+		printf("%5d  %10lu  %8.2f:1  %13.2f  %13.2f%s\n", level, static_cast<unsigned long>(wire.size()),
+			   static_cast<double>(total) / wire.size(), deflateNs / 1e6 / megabytes, inflateNs / 1e6 / megabytes,
+			   plain.size() == total ? "" : "  (round trip mismatch)");
+	}
+	return 0;
+}
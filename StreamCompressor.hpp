@@ -0,0 +1,38 @@
+#ifndef STREAMCOMPRESSOR_HPP
+#define STREAMCOMPRESSOR_HPP
+
+#include <string>
+
+typedef struct z_stream_s z_stream;
+
+// zlib DEFLATE for one connection (COMPRESS DEFLATE): a raw deflate stream in
+// each direction, kept for the life of the connection so repeated prefixes
+// and numerics compress against everything sent before. Output is sync-flushed
+// once per batch, so the peer can decode all of it without waiting for more.
+class StreamCompressor
+{
+private:
+	z_stream *_deflate;
+	z_stream *_inflate;
+	int _level;
+	std::string _wire; // compressed bytes not yet handed to the kernel
+
+	StreamCompressor(const StreamCompressor &);
+	StreamCompressor &operator=(const StreamCompressor &);
+
+public:
+	StreamCompressor();
+	~StreamCompressor();
+
+	bool init(int level);
+	bool compress(const char *data, size_t size, std::string &out);	 // appends, ends with a sync flush
+	bool decompress(const char *data, size_t size, std::string &out); // appends; false on corrupt input
+	std::string &getWire();
+	size_t wireSize() const;
+	size_t memoryBytes() const; // zlib's own state (windows, hash chains)
+
+	static long long cpuTimeNs(); // CPU time of the calling thread
+	static int runBenchmark(const std::string &path);
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "TlsContext.hpp"
+#include <iostream>
+
+#ifdef IRC_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static const unsigned char SESSION_ID_CONTEXT[] = "ircserv";
+
+TlsContext::TlsContext() : _ctx(NULL), _handshakes(0), _resumed(0) {}
+
+TlsContext::~TlsContext()
+{
+	if (_ctx)
+		SSL_CTX_free(_ctx);
+}
+
+bool TlsContext::isAvailable()
+{
+	return true;
+}
+
+bool TlsContext::init(const std::string &certFile, const std::string &keyFile, long cacheSize, long sessionTimeout)
+{
+	_ctx = SSL_CTX_new(TLS_server_method());
+	if (!_ctx)
+	{
+		ERR_print_errors_fp(stderr);
+		return false;
+	}
+	SSL_CTX_set_min_proto_version(_ctx, TLS1_2_VERSION);
+	if (SSL_CTX_use_certificate_chain_file(_ctx, certFile.c_str()) != 1 ||
+		SSL_CTX_use_PrivateKey_file(_ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+		SSL_CTX_check_private_key(_ctx) != 1)
+	{
+		ERR_print_errors_fp(stderr);
+		return false;
+	}
+
+	// Writes may be retried with a different buffer once the outbound data moves
+	SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+	// Stateful resumption: sessions stay in a server-side cache keyed by session id
+	SSL_CTX_set_session_id_context(_ctx, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+	SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(_ctx, cacheSize);
+	SSL_CTX_set_timeout(_ctx, sessionTimeout);
+
+	// Stateless resumption: tickets encrypted with keys OpenSSL generates per context
+	SSL_CTX_clear_options(_ctx, SSL_OP_NO_TICKET);
+	SSL_CTX_set_num_tickets(_ctx, 2);
+	return true;
+}
+
+SSL *TlsContext::createSession(int fd)
+{
+	SSL *ssl = SSL_new(_ctx);
+	if (!ssl)
+		return NULL;
+	if (SSL_set_fd(ssl, fd) != 1)
+	{
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_accept_state(ssl);
+	return ssl;
+}
+
+void TlsContext::destroySession(SSL *ssl)
+{
+	if (!ssl)
+		return;
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+}
+
+static TlsStatus translateError(SSL *ssl, int ret)
+{
+	switch (SSL_get_error(ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		return TLS_WANT_READ;
+	case SSL_ERROR_WANT_WRITE:
+		return TLS_WANT_WRITE;
+	default:
+		ERR_clear_error();
+		return TLS_CLOSED;
+	}
+}
+
+TlsStatus TlsContext::handshake(SSL *ssl)
+{
+	int ret = SSL_do_handshake(ssl);
+	if (ret == 1)
+	{
+		_handshakes++;
+		if (SSL_session_reused(ssl))
+			_resumed++;
+		return TLS_OK;
+	}
+	return translateError(ssl, ret);
+}
+
+int TlsContext::read(SSL *ssl, char *buf, int len, TlsStatus &status)
+{
+	int ret = SSL_read(ssl, buf, len);
+	status = ret > 0 ? TLS_OK : translateError(ssl, ret);
+	return ret;
+}
+
+int TlsContext::write(SSL *ssl, const char *buf, int len, TlsStatus &status)
+{
+	int ret = SSL_write(ssl, buf, len);
+	status = ret > 0 ? TLS_OK : translateError(ssl, ret);
+	return ret;
+}
+
+#else
+
+TlsContext::TlsContext() : _ctx(NULL), _handshakes(0), _resumed(0) {}
+
+TlsContext::~TlsContext() {}
+
+bool TlsContext::isAvailable()
+{
+	return false;
+}
+
+bool TlsContext::init(const std::string &, const std::string &, long, long)
+{
+	std::cerr << "TLS support not compiled in (rebuild with make TLS=1)" << std::endl;
+	return false;
+}
+
+SSL *TlsContext::createSession(int)
+{
+	return NULL;
+}
+
+void TlsContext::destroySession(SSL *) {}
+
+TlsStatus TlsContext::handshake(SSL *)
+{
+	return TLS_CLOSED;
+}
+
+int TlsContext::read(SSL *, char *, int, TlsStatus &status)
+{
+	status = TLS_CLOSED;
+	return -1;
+}
+
+int TlsContext::write(SSL *, const char *, int, TlsStatus &status)
+{
+	status = TLS_CLOSED;
+	return -1;
+}
+
+#endif
+
+unsigned long TlsContext::getHandshakeCount() const
+{
+	return _handshakes;
+}
+
+unsigned long TlsContext::getResumedCount() const
+{
+	return _resumed;
+}
@@ -0,0 +1,47 @@
+#ifndef TLSCONTEXT_HPP
+#define TLSCONTEXT_HPP
+
+#include <string>
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+// Result of a non-blocking TLS operation
+enum TlsStatus
+{
+	TLS_OK,
+	TLS_WANT_READ,
+	TLS_WANT_WRITE,
+	TLS_CLOSED
+};
+
+// Server-side TLS state shared by every TLS connection: certificate,
+// session cache and ticket keys. Compiled as stubs unless built with TLS=1.
+class TlsContext
+{
+private:
+	SSL_CTX *_ctx;
+	unsigned long _handshakes;
+	unsigned long _resumed;
+
+	TlsContext(const TlsContext &);
+	TlsContext &operator=(const TlsContext &);
+
+public:
+	TlsContext();
+	~TlsContext();
+
+	static bool isAvailable();
+	bool init(const std::string &certFile, const std::string &keyFile, long cacheSize, long sessionTimeout);
+	SSL *createSession(int fd);
+	static void destroySession(SSL *ssl);
+
+	TlsStatus handshake(SSL *ssl);
+	int read(SSL *ssl, char *buf, int len, TlsStatus &status);
+	int write(SSL *ssl, const char *buf, int len, TlsStatus &status);
+
+	unsigned long getHandshakeCount() const;
+	unsigned long getResumedCount() const;
+};
+
+#endif
@@ -0,0 +1,585 @@
+#include "UringEngine.hpp"
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <cstddef>
+
+enum UringOp
+{
+	OP_ACCEPT = 1,
+	OP_RECV,
+	OP_POLL,
+	OP_POLL_REMOVE,
+	OP_SEND,
+	OP_CANCEL
+};
+
+static const unsigned BUFFER_GROUP = 0;
+
+UringEngine::UringEngine() : _ringFd(-1), _sqEntries(0), _cqEntries(0), _sqRing(NULL), _cqRing(NULL),
+							 _sqRingSize(0), _cqRingSize(0), _sqes(NULL), _sqesSize(0), _sqHead(NULL),
+							 _sqTail(NULL), _sqMask(NULL), _sqArray(NULL), _cqHead(NULL), _cqTail(NULL),
+							 _cqMask(NULL), _cqes(NULL), _sqLocalTail(0), _pendingSubmit(0), _bufRing(NULL),
+							 _bufMemory(NULL), _bufCount(0), _bufSize(0), _bufTail(0), _paused(false),
+							 _acceptsPaused(false)
+{
+}
+
+UringEngine::~UringEngine()
+{
+	if (_ringFd != -1)
+		close(_ringFd);
+	if (_sqes)
+		munmap(_sqes, _sqesSize);
+	if (_cqRing && _cqRing != _sqRing)
+		munmap(_cqRing, _cqRingSize);
+	if (_sqRing)
+		munmap(_sqRing, _sqRingSize);
+	if (_bufRing)
+		munmap(_bufRing, _bufCount * sizeof(struct io_uring_buf));
+	std::free(_bufMemory);
+}
+
+bool UringEngine::isAvailable()
+{
+	struct io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, 1, &params);
+	if (fd < 0)
+		return false;
+	close(fd);
+	return true;
+}
+
+bool UringEngine::init(unsigned entries, unsigned bufferCount, unsigned bufferSize)
+{
+	struct io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 4;
+	_ringFd = syscall(__NR_io_uring_setup, entries, &params);
+	if (_ringFd < 0)
+	{
+		perror("io_uring_setup");
+		return false;
+	}
+	_sqEntries = params.sq_entries;
+	_cqEntries = params.cq_entries;
+
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (_cqRingSize > _sqRingSize)
+			_sqRingSize = _cqRingSize;
+		_cqRingSize = _sqRingSize;
+	}
+	_sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+	if (_sqRing == MAP_FAILED)
+	{
+		_sqRing = NULL;
+		perror("mmap");
+		return false;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		_cqRing = _sqRing;
+	else
+	{
+		_cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+		if (_cqRing == MAP_FAILED)
+		{
+			_cqRing = NULL;
+			perror("mmap");
+			return false;
+		}
+	}
+	_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	_sqes = mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+	if (_sqes == MAP_FAILED)
+	{
+		_sqes = NULL;
+		perror("mmap");
+		return false;
+	}
+
+	char *sq = static_cast<char *>(_sqRing);
+	char *cq = static_cast<char *>(_cqRing);
+	_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+	_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+	_sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+	_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+	_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+	_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+	_cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+	_cqes = cq + params.cq_off.cqes;
+	_sqLocalTail = *_sqTail;
+
+	// Provided buffer ring: the kernel picks a free buffer for each multishot recv completion
+	_bufCount = bufferCount;
+	_bufSize = bufferSize;
+	_bufRing = mmap(NULL, _bufCount * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (_bufRing == MAP_FAILED)
+	{
+		_bufRing = NULL;
+		perror("mmap");
+		return false;
+	}
+	_bufMemory = static_cast<char *>(std::malloc(static_cast<size_t>(_bufCount) * _bufSize));
+	if (!_bufMemory)
+		return false;
+
+	struct io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<unsigned long>(_bufRing);
+	reg.ring_entries = _bufCount;
+	reg.bgid = BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		perror("io_uring_register(PBUF_RING)");
+		return false;
+	}
+	for (unsigned i = 0; i < _bufCount; ++i)
+		provideBuffer(i);
+	return true;
+}
+
+void UringEngine::provideBuffer(unsigned short bid)
+{
+	struct io_uring_buf *bufs = static_cast<struct io_uring_buf *>(_bufRing);
+	struct io_uring_buf *buf = &bufs[_bufTail & (_bufCount - 1)];
+	buf->addr = reinterpret_cast<unsigned long>(_bufMemory + static_cast<size_t>(bid) * _bufSize);
+	buf->len = _bufSize;
+	buf->bid = bid;
+	_bufTail++;
+	// The ring tail overlays the resv field of the first entry
+	unsigned short *tail = reinterpret_cast<unsigned short *>(
+		static_cast<char *>(_bufRing) + offsetof(struct io_uring_buf, resv));
+	__atomic_store_n(tail, _bufTail, __ATOMIC_RELEASE);
+}
+
+void *UringEngine::getSqe()
+{
+	unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+	if (_sqLocalTail - head >= _sqEntries)
+	{
+		submit(0, -1);
+		head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+		if (_sqLocalTail - head >= _sqEntries)
+			return NULL;
+	}
+	unsigned index = _sqLocalTail & *_sqMask;
+	struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(_sqes) + index;
+	std::memset(sqe, 0, sizeof(*sqe));
+	_sqArray[index] = index;
+	_sqLocalTail++;
+	__atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+	_pendingSubmit++;
+	return sqe;
+}
+
+int UringEngine::submit(unsigned waitFor, int timeoutMs)
+{
+	unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+	if (waitFor && timeoutMs >= 0)
+	{
+		struct __kernel_timespec ts;
+		ts.tv_sec = timeoutMs / 1000;
+		ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+		struct io_uring_getevents_arg arg;
+		std::memset(&arg, 0, sizeof(arg));
+		arg.ts = reinterpret_cast<unsigned long>(&ts);
+		ret = syscall(__NR_io_uring_enter, _ringFd, _pendingSubmit, waitFor, flags | IORING_ENTER_EXT_ARG,
+					  &arg, sizeof(arg));
+	}
+	else
+		ret = syscall(__NR_io_uring_enter, _ringFd, _pendingSubmit, waitFor, flags, NULL, 0);
+	if (ret < 0)
+	{
+		if (errno == ETIME || errno == EINTR)
+			return 0;
+		return -1;
+	}
+	_pendingSubmit = 0;
+	return ret;
+}
+
+unsigned long long UringEngine::makeTag(int op, int fd)
+{
+	unsigned long long gen = _generation[fd] & 0xFFFFFF;
+	return (static_cast<unsigned long long>(op) << 56) | (gen << 32) | static_cast<unsigned>(fd);
+}
+
+void UringEngine::armAccept(int fd)
+{
+	struct io_uring_sqe *sqe = _paused || _acceptsPaused ? NULL : static_cast<struct io_uring_sqe *>(getSqe());
+	if (!sqe)
+	{
+		_rearmAccept.push_back(fd);
+		return;
+	}
+	_activeAccept.insert(fd);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	sqe->user_data = makeTag(OP_ACCEPT, fd);
+}
+
+void UringEngine::armRecv(int fd)
+{
+	struct io_uring_sqe *sqe = _paused ? NULL : static_cast<struct io_uring_sqe *>(getSqe());
+	if (!sqe)
+	{
+		_rearmRecv.push_back(fd);
+		return;
+	}
+	_activeRecv.insert(fd);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = makeTag(OP_RECV, fd);
+}
+
+void UringEngine::armPoll(int fd)
+{
+	struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(getSqe());
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = static_cast<unsigned short>(_pollMask[fd]);
+	sqe->user_data = makeTag(OP_POLL, fd);
+	_pollArmed[fd] = true;
+}
+
+void UringEngine::submitSend(unsigned long long tag, InFlightSend &send)
+{
+	struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(getSqe());
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = static_cast<int>(tag & 0xFFFFFFFF);
+	sqe->addr = reinterpret_cast<unsigned long>(send.data.data() + send.offset);
+	sqe->len = send.data.size() - send.offset;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = tag;
+}
+
+void UringEngine::addListener(int fd)
+{
+	_generation[fd]++;
+	armAccept(fd);
+}
+
+void UringEngine::addStream(int fd)
+{
+	_generation[fd]++;
+	armRecv(fd);
+}
+
+void UringEngine::addPollable(int fd, short events)
+{
+	_generation[fd]++;
+	_pollMask[fd] = events;
+	armPoll(fd);
+}
+
+void UringEngine::updatePollable(int fd, short events)
+{
+	std::map<int, short>::iterator it = _pollMask.find(fd);
+	if (it == _pollMask.end() || it->second == events)
+		return;
+	it->second = events;
+	if (!_pollArmed[fd])
+		return;
+	// The armed request waits on the old mask: cancel it, wait() re-arms with the new one
+	struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(getSqe());
+	if (!sqe)
+		return;
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = makeTag(OP_POLL, fd);
+	sqe->user_data = makeTag(OP_POLL_REMOVE, fd);
+}
+
+void UringEngine::removeFd(int fd)
+{
+	if (_generation.find(fd) == _generation.end())
+		return;
+	// Cancel everything still pending on the fd before the caller closes it
+	struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(getSqe());
+	if (sqe)
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = fd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = makeTag(OP_CANCEL, fd);
+		submit(0, -1);
+	}
+	// Completions that still carry the old generation are dropped in wait()
+	_generation[fd]++;
+	_activeRecv.erase(fd);
+	_activeAccept.erase(fd);
+	_pollMask.erase(fd);
+	_pollArmed.erase(fd);
+}
+
+void UringEngine::send(int fd, std::string &data)
+{
+	if (data.empty())
+		return;
+	unsigned long long tag = makeTag(OP_SEND, fd);
+	InFlightSend &send = _sends[tag];
+	send.data.swap(data);
+	send.offset = 0;
+	submitSend(tag, send);
+}
+
+void UringEngine::pause()
+{
+	_paused = true;
+	std::set<int> fds(_activeRecv);
+	fds.insert(_activeAccept.begin(), _activeAccept.end());
+	for (std::set<int>::iterator it = fds.begin(); it != fds.end(); ++it)
+	{
+		struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(getSqe());
+		if (!sqe)
+			break;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = makeTag(_activeAccept.count(*it) ? OP_ACCEPT : OP_RECV, *it);
+		sqe->user_data = makeTag(OP_CANCEL, *it);
+	}
+	submit(0, -1);
+}
+
+bool UringEngine::idle() const
+{
+	return _activeRecv.empty() && _activeAccept.empty() && _sends.empty();
+}
+
+size_t UringEngine::bufferBytes() const
+{
+	size_t bytes = static_cast<size_t>(_bufCount) * _bufSize;
+	for (std::map<unsigned long long, InFlightSend>::const_iterator it = _sends.begin(); it != _sends.end(); ++it)
+		bytes += it->second.data.capacity();
+	return bytes;
+}
+
+void UringEngine::resume()
+{
+	_paused = false;
+	rearmAccepts();
+}
+
+void UringEngine::pauseAccepts()
+{
+	_acceptsPaused = true;
+	for (std::set<int>::iterator it = _activeAccept.begin(); it != _activeAccept.end(); ++it)
+	{
+		struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(getSqe());
+		if (!sqe)
+			break;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = makeTag(OP_ACCEPT, *it);
+		sqe->user_data = makeTag(OP_CANCEL, *it);
+	}
+	submit(0, -1);
+}
+
+void UringEngine::resumeAccepts()
+{
+	_acceptsPaused = false;
+	rearmAccepts();
+}
+
+// Accepts stopped by pause() or pauseAccepts(), once neither holds them back
+void UringEngine::rearmAccepts()
+{
+	if (_paused || _acceptsPaused)
+		return;
+	std::vector<int> accepts;
+	accepts.swap(_rearmAccept);
+	for (size_t i = 0; i < accepts.size(); ++i)
+	{
+		if (_generation.find(accepts[i]) != _generation.end())
+			armAccept(accepts[i]);
+	}
+}
+
+bool UringEngine::isCurrent(const IoEvent &event) const
+{
+	std::map<int, unsigned>::const_iterator it = _generation.find(event.fd);
+	return it != _generation.end() && (it->second & 0xFFFFFF) == event.generation;
+}
+
+int UringEngine::wait(std::vector<IoEvent> &events, int timeoutMs)
+{
+	events.clear();
+
+	// Buffers handed out in the previous batch have been consumed by now
+	for (size_t i = 0; i < _recycle.size(); ++i)
+		provideBuffer(_recycle[i]);
+	_recycle.clear();
+
+	std::vector<int> rearm;
+	if (!_paused)
+		rearm.swap(_rearmRecv);
+	for (size_t i = 0; i < rearm.size(); ++i)
+	{
+		if (_generation.find(rearm[i]) != _generation.end())
+			armRecv(rearm[i]);
+	}
+	if (!_rearmAccept.empty())
+		rearmAccepts();
+	for (std::map<int, short>::iterator it = _pollMask.begin(); it != _pollMask.end(); ++it)
+	{
+		if (!_pollArmed[it->first])
+			armPoll(it->first);
+	}
+
+	unsigned head = *_cqHead;
+	bool ready = head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+	if (submit(ready ? 0 : 1, timeoutMs) < 0)
+		return -1;
+
+	unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head)
+	{
+		struct io_uring_cqe *cqe = static_cast<struct io_uring_cqe *>(_cqes) + (head & *_cqMask);
+		unsigned long long tag = cqe->user_data;
+		int op = static_cast<int>(tag >> 56);
+		IoEvent event;
+		event.fd = static_cast<int>(tag & 0xFFFFFFFF);
+		event.generation = static_cast<unsigned>((tag >> 32) & 0xFFFFFF);
+		event.result = cqe->res;
+		event.data = NULL;
+		bool current = isCurrent(event);
+		bool more = cqe->flags & IORING_CQE_F_MORE;
+
+		switch (op)
+		{
+		case OP_ACCEPT:
+			if (!current)
+			{
+				if (cqe->res >= 0)
+					close(cqe->res);
+				break;
+			}
+			if (cqe->res >= 0)
+			{
+				event.type = IO_ACCEPT;
+				events.push_back(event);
+			}
+			if (!more)
+			{
+				_activeAccept.erase(event.fd);
+				armAccept(event.fd);
+			}
+			break;
+		case OP_RECV:
+			if (cqe->flags & IORING_CQE_F_BUFFER)
+			{
+				unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				_recycle.push_back(bid);
+				if (current && cqe->res > 0)
+				{
+					event.type = IO_DATA;
+					event.data = _bufMemory + static_cast<size_t>(bid) * _bufSize;
+					events.push_back(event);
+				}
+			}
+			if (!current)
+				break;
+			if (!more)
+				_activeRecv.erase(event.fd);
+			if (cqe->res == 0)
+			{
+				event.type = IO_DATA;
+				events.push_back(event);
+			}
+			else if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED || (cqe->res > 0 && !more))
+				_rearmRecv.push_back(event.fd);
+			else if (cqe->res < 0)
+			{
+				event.type = IO_ERROR;
+				events.push_back(event);
+			}
+			break;
+		case OP_POLL:
+			if (!current)
+				break;
+			_pollArmed[event.fd] = false;
+			if (cqe->res > 0)
+			{
+				event.type = IO_READY;
+				events.push_back(event);
+			}
+			break;
+		case OP_SEND:
+		{
+			std::map<unsigned long long, InFlightSend>::iterator it = _sends.find(tag);
+			if (it == _sends.end())
+				break;
+			if (current && cqe->res > 0 && it->second.offset + cqe->res < it->second.data.size())
+			{
+				// Short send: push the remainder before anything else queued for this fd
+				it->second.offset += cqe->res;
+				submitSend(tag, it->second);
+				break;
+			}
+			_sends.erase(it);
+			if (current)
+			{
+				event.type = IO_SENT;
+				event.result = cqe->res < 0 ? cqe->res : 0;
+				events.push_back(event);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+	return events.size();
+}
+
+#else
+
+UringEngine::UringEngine() : _ringFd(-1) {}
+UringEngine::~UringEngine() {}
+bool UringEngine::isAvailable() { return false; }
+bool UringEngine::init(unsigned, unsigned, unsigned) { return false; }
+void UringEngine::addListener(int) {}
+void UringEngine::addStream(int) {}
+void UringEngine::addPollable(int, short) {}
+void UringEngine::updatePollable(int, short) {}
+void UringEngine::removeFd(int) {}
+void UringEngine::send(int, std::string &) {}
+void UringEngine::pause() {}
+bool UringEngine::idle() const { return true; }
+size_t UringEngine::bufferBytes() const { return 0; }
+void UringEngine::resume() {}
+void UringEngine::pauseAccepts() {}
+void UringEngine::resumeAccepts() {}
+bool UringEngine::isCurrent(const IoEvent &) const { return false; }
+int UringEngine::wait(std::vector<IoEvent> &events, int)
+{
+	events.clear();
+	return -1;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef URINGENGINE_HPP
+#define URINGENGINE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+enum IoEventType
+{
+	IO_ACCEPT, // result = accepted fd (or -errno)
+	IO_DATA,   // result = byte count, data points into a provided buffer (0 = peer closed)
+	IO_READY,  // result = poll revents, for fds driven through the readiness path
+	IO_SENT,   // result = 0 once a whole send buffer is out, -errno on failure
+	IO_ERROR   // result = -errno from a multishot recv that cannot continue
+};
+
+struct IoEvent
+{
+	IoEventType type;
+	int fd;
+	int result;
+	unsigned generation;
+	const char *data; // valid until the next call to wait()
+};
+
+// io_uring event loop backend (raw syscalls, no liburing):
+//  - listeners use multishot accept
+//  - plain clients use multishot recv into a kernel-provided buffer ring
+//  - fds that need readiness semantics (TLS) use re-armed poll requests
+//  - outbound buffers queued during a tick are submitted in a single io_uring_enter
+class UringEngine
+{
+private:
+	struct InFlightSend
+	{
+		std::string data;
+		size_t offset;
+	};
+
+	int _ringFd;
+	unsigned _sqEntries;
+	unsigned _cqEntries;
+	void *_sqRing;
+	void *_cqRing;
+	size_t _sqRingSize;
+	size_t _cqRingSize;
+	void *_sqes;
+	size_t _sqesSize;
+	unsigned *_sqHead;
+	unsigned *_sqTail;
+	unsigned *_sqMask;
+	unsigned *_sqArray;
+	unsigned *_cqHead;
+	unsigned *_cqTail;
+	unsigned *_cqMask;
+	void *_cqes;
+	unsigned _sqLocalTail;
+	unsigned _pendingSubmit;
+
+	void *_bufRing;			// struct io_uring_buf_ring shared with the kernel
+	char *_bufMemory;		// backing storage for the provided buffers
+	unsigned _bufCount;
+	unsigned _bufSize;
+	unsigned short _bufTail;
+	std::vector<unsigned short> _recycle; // buffers handed out in the last batch
+
+	std::map<int, unsigned> _generation;	  // fd -> current generation
+	std::map<int, short> _pollMask;			  // readiness fds -> wanted events
+	std::map<int, bool> _pollArmed;			  // readiness fds with a request in flight
+	std::vector<int> _rearmRecv;			  // multishot recvs that stopped (ENOBUFS, no F_MORE)
+	std::vector<int> _rearmAccept;			  // multishot accepts to re-arm once resumed
+	std::set<int> _activeRecv;				  // fds with a multishot recv in the kernel
+	std::set<int> _activeAccept;			  // listeners with a multishot accept in the kernel
+	bool _paused;							  // pause(): no accept/recv is re-armed
+	bool _acceptsPaused;					  // pauseAccepts(): no accept is re-armed
+	std::map<unsigned long long, InFlightSend> _sends;
+
+	UringEngine(const UringEngine &);
+	UringEngine &operator=(const UringEngine &);
+
+	void *getSqe();
+	int submit(unsigned waitFor, int timeoutMs);
+	unsigned long long makeTag(int op, int fd);
+	void provideBuffer(unsigned short bid);
+	void armRecv(int fd);
+	void armPoll(int fd);
+	void armAccept(int fd);
+	void rearmAccepts();
+	void submitSend(unsigned long long tag, InFlightSend &send);
+
+public:
+	UringEngine();
+	~UringEngine();
+
+	static bool isAvailable();
+	bool init(unsigned entries, unsigned bufferCount, unsigned bufferSize);
+
+	void addListener(int fd);
+	void addStream(int fd);
+	void addPollable(int fd, short events);
+	void updatePollable(int fd, short events);
+	void removeFd(int fd);
+	void send(int fd, std::string &data); // takes ownership of data (swapped out)
+
+	// Stop pulling data off sockets (hot restart): cancels every accept and recv,
+	// completions keep arriving until idle() is true.
+	void pause();
+	bool idle() const;
+	void resume();
+
+	// Leave new connections in the listeners' backlog (overload): cancels the
+	// multishot accepts until resumeAccepts()
+	void pauseAccepts();
+	void resumeAccepts();
+
+	size_t bufferBytes() const; // provided receive buffers plus sends still in the kernel
+	bool isCurrent(const IoEvent &event) const;
+	int wait(std::vector<IoEvent> &events, int timeoutMs);
+};
+
+#endif
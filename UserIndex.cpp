@@ -0,0 +1,71 @@
+#include "UserIndex.hpp"
+#include "Client.hpp"
+#include "MemoryStats.hpp"
+#include <cctype>
+
+std::string UserIndex::key(Field field, const std::string &value)
+{
+	std::string k(value);
+	for (size_t i = 0; i < k.size(); ++i)
+		k[i] = std::tolower(static_cast<unsigned char>(k[i]));
+	if (field == BY_HOST_REVERSED)
+		k = std::string(k.rbegin(), k.rend());
+	return k;
+}
+
+void UserIndex::add(Client *client)
+{
+	if (_entries.count(client))
+		return;
+	Entry &entry = _entries[client];
+	entry.at[BY_NICK] = _keys[BY_NICK].insert(std::make_pair(key(BY_NICK, client->getNickname()), client)).first;
+	entry.at[BY_USER] = _keys[BY_USER].insert(std::make_pair(key(BY_USER, client->getUsername()), client)).first;
+	entry.at[BY_HOST] = _keys[BY_HOST].insert(std::make_pair(key(BY_HOST, client->getHost()), client)).first;
+	entry.at[BY_HOST_REVERSED] =
+		_keys[BY_HOST_REVERSED].insert(std::make_pair(key(BY_HOST_REVERSED, client->getHost()), client)).first;
+}
+
+void UserIndex::remove(Client *client)
+{
+	std::map<Client *, Entry>::iterator it = _entries.find(client);
+	if (it == _entries.end())
+		return;
+	for (int f = 0; f < FIELD_COUNT; ++f)
+		_keys[f].erase(it->second.at[f]);
+	_entries.erase(it);
+}
+
+void UserIndex::update(Client *client)
+{
+	if (!_entries.count(client))
+		return;
+	remove(client);
+	add(client);
+}
+
+bool UserIndex::contains(Client *client) const
+{
+	return _entries.find(client) != _entries.end();
+}
+
+size_t UserIndex::size() const
+{
+	return _entries.size();
+}
+
+size_t UserIndex::memoryBytes() const
+{
+	size_t bytes = MemoryStats::mapBytes(_entries);
+	for (int f = 0; f < FIELD_COUNT; ++f)
+	{
+		bytes += MemoryStats::setBytes(_keys[f]);
+		for (Keys::const_iterator it = _keys[f].begin(); it != _keys[f].end(); ++it)
+			bytes += MemoryStats::stringBytes(it->first);
+	}
+	return bytes;
+}
+
+const UserIndex::Keys &UserIndex::byField(Field field) const
+{
+	return _keys[field];
+}
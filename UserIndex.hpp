@@ -0,0 +1,50 @@
+#ifndef USERINDEX_HPP
+#define USERINDEX_HPP
+
+#include <string>
+#include <set>
+#include <map>
+
+class Client;
+
+// Sorted views of every registered user, local or remote, by nickname,
+// username and hostname (plus hostnames reversed). Keys are lowercased. A WHO
+// mask with a literal prefix ("ali*") or host suffix ("*.example.net") becomes a
+// range scan over one of them instead of a pass over every user.
+class UserIndex
+{
+public:
+	enum Field
+	{
+		BY_NICK,
+		BY_USER,
+		BY_HOST,
+		BY_HOST_REVERSED,
+		FIELD_COUNT
+	};
+	typedef std::set<std::pair<std::string, Client *> > Keys;
+
+private:
+	// Where each user was filed: the set nodes hold its keys, so removing it
+	// after a nick or host change needs no copy of the old ones
+	struct Entry
+	{
+		Keys::iterator at[FIELD_COUNT];
+	};
+
+	Keys _keys[FIELD_COUNT];
+	std::map<Client *, Entry> _entries;
+
+public:
+	void add(Client *client);
+	void remove(Client *client);
+	void update(Client *client);
+	bool contains(Client *client) const;
+	size_t size() const;
+	size_t memoryBytes() const;
+	const Keys &byField(Field field) const;
+
+	static std::string key(Field field, const std::string &value);
+};
+
+#endif
@@ -0,0 +1,476 @@
+#include "WebSocket.hpp"
+#include "MemoryStats.hpp"
+#include <cctype>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+	const size_t MAX_REQUEST = 8192;		// HTTP upgrade request, headers included
+	const size_t MAX_MESSAGE = 16384;		// one IRC line with tags fits comfortably
+	const char *const ACCEPT_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	enum Opcode
+	{
+		OP_CONTINUATION = 0x0,
+		OP_TEXT = 0x1,
+		OP_BINARY = 0x2,
+		OP_CLOSE = 0x8,
+		OP_PING = 0x9,
+		OP_PONG = 0xA
+	};
+
+	enum CloseCode
+	{
+		CLOSE_NORMAL = 1000,
+		CLOSE_PROTOCOL_ERROR = 1002,
+		CLOSE_TOO_BIG = 1009
+	};
+
+	// SHA-1 of one short string, for Sec-WebSocket-Accept only
+	void sha1(const std::string &input, unsigned char digest[20])
+	{
+		unsigned int h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+		std::string message = input;
+		unsigned long long bits = static_cast<unsigned long long>(input.size()) * 8;
+		message += static_cast<char>(0x80);
+		while (message.size() % 64 != 56)
+			message += '\0';
+		for (int i = 7; i >= 0; --i)
+			message += static_cast<char>((bits >> (i * 8)) & 0xFF);
+
+		for (size_t block = 0; block < message.size(); block += 64)
+		{
+			unsigned int w[80];
+			for (int i = 0; i < 16; ++i)
+			{
+				const unsigned char *p = reinterpret_cast<const unsigned char *>(message.data() + block + i * 4);
+				w[i] = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+			}
+			for (int i = 16; i < 80; ++i)
+			{
+				unsigned int x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+				w[i] = (x << 1) | (x >> 31);
+			}
+			unsigned int a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+			for (int i = 0; i < 80; ++i)
+			{
+				unsigned int f, k;
+				if (i < 20)
+					f = (b & c) | (~b & d), k = 0x5A827999;
+				else if (i < 40)
+					f = b ^ c ^ d, k = 0x6ED9EBA1;
+				else if (i < 60)
+					f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+				else
+					f = b ^ c ^ d, k = 0xCA62C1D6;
+				unsigned int t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+				e = d;
+				d = c;
+				c = (b << 30) | (b >> 2);
+				b = a;
+				a = t;
+			}
+			h[0] += a;
+			h[1] += b;
+			h[2] += c;
+			h[3] += d;
+			h[4] += e;
+		}
+		for (int i = 0; i < 20; ++i)
+			digest[i] = (h[i / 4] >> (24 - (i % 4) * 8)) & 0xFF;
+	}
+
+	std::string encodeBase64(const unsigned char *data, size_t size)
+	{
+		static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		std::string out;
+		for (size_t i = 0; i < size; i += 3)
+		{
+			unsigned int value = data[i] << 16;
+			if (i + 1 < size)
+				value |= data[i + 1] << 8;
+			if (i + 2 < size)
+				value |= data[i + 2];
+			out += alphabet[(value >> 18) & 0x3F];
+			out += alphabet[(value >> 12) & 0x3F];
+			out += i + 1 < size ? alphabet[(value >> 6) & 0x3F] : '=';
+			out += i + 2 < size ? alphabet[value & 0x3F] : '=';
+		}
+		return out;
+	}
+
+	std::string lowercase(std::string s)
+	{
+		for (size_t i = 0; i < s.size(); ++i)
+			s[i] = std::tolower(static_cast<unsigned char>(s[i]));
+		return s;
+	}
+
+	std::string trim(const std::string &s)
+	{
+		size_t begin = s.find_first_not_of(" \t");
+		if (begin == std::string::npos)
+			return "";
+		return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+	}
+
+	// Whether a comma-separated header value lists `token` (case-insensitive)
+	bool hasToken(const std::string &value, const std::string &token)
+	{
+		std::istringstream iss(value);
+		std::string item;
+		while (std::getline(iss, item, ','))
+		{
+			if (lowercase(trim(item)) == token)
+				return true;
+		}
+		return false;
+	}
+
+	// Length of the well-formed UTF-8 sequence at p, 0 if there is none
+	size_t utf8Length(const unsigned char *p, size_t left)
+	{
+		if (p[0] < 0x80)
+			return 1;
+		size_t length = p[0] >= 0xF0 ? 4 : p[0] >= 0xE0 ? 3 : 2;
+		if (p[0] < 0xC2 || p[0] > 0xF4 || length > left)
+			return 0;
+		for (size_t i = 1; i < length; ++i)
+		{
+			if ((p[i] & 0xC0) != 0x80)
+				return 0;
+		}
+		// Overlong forms, UTF-16 surrogates and code points past U+10FFFF
+		if ((p[0] == 0xE0 && p[1] < 0xA0) || (p[0] == 0xED && p[1] >= 0xA0) || (p[0] == 0xF0 && p[1] < 0x90) ||
+			(p[0] == 0xF4 && p[1] >= 0x90))
+			return 0;
+		return length;
+	}
+
+	bool isValidUtf8(const char *data, size_t size)
+	{
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+		for (size_t i = 0, length; i < size; i += length)
+		{
+			length = utf8Length(p + i, size - i);
+			if (!length)
+				return false;
+		}
+		return true;
+	}
+
+	// Text frames must be UTF-8, IRC lines need not be: invalid bytes become U+FFFD
+	std::string sanitizeUtf8(const char *data, size_t size)
+	{
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+		std::string out;
+		for (size_t i = 0, length; i < size; i += length)
+		{
+			length = utf8Length(p + i, size - i);
+			if (length)
+				out.append(data + i, length);
+			else
+			{
+				out += "\xEF\xBF\xBD";
+				length = 1;
+			}
+		}
+		return out;
+	}
+
+	// Server frames are never masked: FIN, opcode, then the shortest length encoding
+	void appendHeader(std::string &out, unsigned char opcode, size_t size)
+	{
+		out += static_cast<char>(0x80 | opcode);
+		if (size < 126)
+			out += static_cast<char>(size);
+		else if (size <= 0xFFFF)
+		{
+			out += static_cast<char>(126);
+			out += static_cast<char>(size >> 8);
+			out += static_cast<char>(size & 0xFF);
+		}
+		else
+		{
+			out += static_cast<char>(127);
+			for (int i = 7; i >= 0; --i)
+				out += static_cast<char>((static_cast<unsigned long long>(size) >> (i * 8)) & 0xFF);
+		}
+	}
+
+	void appendClose(std::string &out, unsigned short code)
+	{
+		char status[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xFF)};
+		WebSocket::appendFrame(out, OP_CLOSE, status, sizeof(status));
+	}
+}
+
+WebSocket::WebSocket() : _open(false), _binary(false), _fragmented(false) {}
+
+// Answers the HTTP upgrade request (everything up to the blank line)
+bool WebSocket::upgrade(const std::string &request, std::string &reply)
+{
+	std::istringstream lines(request);
+	std::string line, method, path, version;
+	std::getline(lines, line);
+	std::istringstream requestLine(line);
+	requestLine >> method >> path >> version;
+
+	std::string upgradeHeader, connection, key, wsVersion, protocols;
+	while (std::getline(lines, line))
+	{
+		if (!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		size_t colon = line.find(':');
+		if (colon == std::string::npos)
+			continue;
+		std::string name = lowercase(trim(line.substr(0, colon)));
+		std::string value = trim(line.substr(colon + 1));
+		if (name == "upgrade")
+			upgradeHeader = value;
+		else if (name == "connection")
+			connection = value;
+		else if (name == "sec-websocket-key")
+			key = value;
+		else if (name == "sec-websocket-version")
+			wsVersion = value;
+		else if (name == "sec-websocket-protocol")
+			protocols += (protocols.empty() ? "" : ",") + value;
+	}
+
+	if (method != "GET" || version != "HTTP/1.1" || !hasToken(upgradeHeader, "websocket") ||
+		!hasToken(connection, "upgrade") || key.empty())
+	{
+		reply = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+		return false;
+	}
+	if (wsVersion != "13")
+	{
+		reply = "HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\n"
+				"Content-Length: 0\r\n\r\n";
+		return false;
+	}
+
+	// The first subprotocol the client lists that we speak; none offered means text
+	std::string chosen;
+	std::istringstream offered(protocols);
+	std::string protocol;
+	while (chosen.empty() && std::getline(offered, protocol, ','))
+	{
+		protocol = trim(protocol);
+		if (protocol == "text.ircv3.net" || protocol == "binary.ircv3.net")
+			chosen = protocol;
+	}
+	_binary = chosen == "binary.ircv3.net";
+
+	unsigned char digest[20];
+	sha1(key + ACCEPT_GUID, digest);
+	reply = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+			"Sec-WebSocket-Accept: " + encodeBase64(digest, sizeof(digest)) + "\r\n";
+	if (!chosen.empty())
+		reply += "Sec-WebSocket-Protocol: " + chosen + "\r\n";
+	reply += "\r\n";
+	return true;
+}
+
+// Each message is one IRC line; the newline hands it to the usual line splitter
+void WebSocket::deliver(const std::string &payload, std::string &lines) const
+{
+	lines += payload;
+	lines += '\n';
+}
+
+// Decoded lines are appended to `lines`, anything to send back (the upgrade
+// response, pongs, the closing handshake) to `reply`
+WebSocketResult WebSocket::receive(const char *data, size_t size, std::string &lines, std::string &reply)
+{
+	_input.append(data, size);
+	if (!_open)
+	{
+		size_t end = _input.find("\r\n\r\n");
+		if (end == std::string::npos)
+		{
+			if (_input.size() <= MAX_REQUEST)
+				return WS_CONTINUE;
+			reply = "HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+			return WS_CLOSE;
+		}
+		if (!upgrade(_input.substr(0, end + 2), reply))
+			return WS_CLOSE;
+		_input.erase(0, end + 4);
+		_open = true;
+	}
+
+	size_t pos = 0;
+	WebSocketResult result = WS_CONTINUE;
+	while (result == WS_CONTINUE && _input.size() - pos >= 2)
+	{
+		const unsigned char *frame = reinterpret_cast<const unsigned char *>(_input.data() + pos);
+		size_t available = _input.size() - pos;
+		bool fin = frame[0] & 0x80;
+		unsigned char opcode = frame[0] & 0x0F;
+		unsigned long long length = frame[1] & 0x7F;
+		size_t header = 2;
+		if (length == 126)
+		{
+			if (available < 4)
+				break;
+			length = (frame[2] << 8) | frame[3];
+			header = 4;
+		}
+		else if (length == 127)
+		{
+			if (available < 10)
+				break;
+			length = 0;
+			for (int i = 2; i < 10; ++i)
+				length = (length << 8) | frame[i];
+			header = 10;
+		}
+		// Clients must mask, and must not use extensions nobody negotiated
+		if ((frame[0] & 0x70) || !(frame[1] & 0x80) || (opcode >= OP_CLOSE && (!fin || length > 125)))
+		{
+			appendClose(reply, CLOSE_PROTOCOL_ERROR);
+			return WS_CLOSE;
+		}
+		if (length > MAX_MESSAGE || _message.size() + length > MAX_MESSAGE)
+		{
+			appendClose(reply, CLOSE_TOO_BIG);
+			return WS_CLOSE;
+		}
+		if (available < header + 4 + length)
+			break;
+
+		const unsigned char *mask = frame + header;
+		std::string payload(reinterpret_cast<const char *>(mask + 4), length);
+		for (size_t i = 0; i < payload.size(); ++i)
+			payload[i] ^= mask[i % 4];
+		pos += header + 4 + length;
+
+		switch (opcode)
+		{
+		case OP_TEXT:
+		case OP_BINARY:
+			if (_fragmented)
+			{
+				appendClose(reply, CLOSE_PROTOCOL_ERROR);
+				return WS_CLOSE;
+			}
+			if (fin)
+				deliver(payload, lines);
+			else
+			{
+				_message = payload;
+				_fragmented = true;
+			}
+			break;
+		case OP_CONTINUATION:
+			if (!_fragmented)
+			{
+				appendClose(reply, CLOSE_PROTOCOL_ERROR);
+				return WS_CLOSE;
+			}
+			_message += payload;
+			if (fin)
+			{
+				deliver(_message, lines);
+				_message.clear();
+				_fragmented = false;
+			}
+			break;
+		case OP_PING:
+			appendFrame(reply, OP_PONG, payload.data(), payload.size());
+			break;
+		case OP_PONG:
+			break;
+		case OP_CLOSE:
+			// Echo the status code, then the connection goes
+			if (payload.size() >= 2)
+				appendFrame(reply, OP_CLOSE, payload.data(), 2);
+			else
+				appendClose(reply, CLOSE_NORMAL);
+			result = WS_CLOSE;
+			break;
+		default:
+			appendClose(reply, CLOSE_PROTOCOL_ERROR);
+			return WS_CLOSE;
+		}
+	}
+	_input.erase(0, pos);
+	return result;
+}
+
+void WebSocket::appendFrame(std::string &out, unsigned char opcode, const char *data, size_t size)
+{
+	appendHeader(out, opcode, size);
+	out.append(data, size);
+}
+
+// One frame per IRC line, written straight into `out` from the caller's pieces
+void WebSocket::appendMessage(std::string &out, const struct iovec *parts, int count) const
+{
+	size_t length = 0;
+	for (int i = 0; i < count; ++i)
+		length += parts[i].iov_len;
+	const struct iovec &last = parts[count - 1];
+	size_t crlf = 0;
+	if (last.iov_len >= 2 && std::memcmp(static_cast<const char *>(last.iov_base) + last.iov_len - 2, "\r\n", 2) == 0)
+		crlf = 2;
+	length -= crlf;
+
+	size_t start = out.size();
+	appendHeader(out, _binary ? OP_BINARY : OP_TEXT, length);
+	size_t payload = out.size();
+	for (int i = 0; i < count; ++i)
+		out.append(static_cast<const char *>(parts[i].iov_base), parts[i].iov_len - (i == count - 1 ? crlf : 0));
+	if (!_binary && !isValidUtf8(out.data() + payload, length))
+	{
+		std::string text = sanitizeUtf8(out.data() + payload, length);
+		out.erase(start);
+		appendFrame(out, OP_TEXT, text.data(), text.size());
+	}
+}
+
+bool WebSocket::isOpen() const
+{
+	return _open;
+}
+
+bool WebSocket::isBinary() const
+{
+	return _binary;
+}
+
+size_t WebSocket::memoryBytes() const
+{
+	return sizeof(WebSocket) + MemoryStats::stringBytes(_input) + MemoryStats::stringBytes(_message);
+}
+
+// flags, input length (4 bytes, big-endian), input, pending fragments
+std::string WebSocket::serialize() const
+{
+	std::string state;
+	state += static_cast<char>((_open ? 1 : 0) | (_binary ? 2 : 0) | (_fragmented ? 4 : 0));
+	for (int i = 3; i >= 0; --i)
+		state += static_cast<char>((_input.size() >> (i * 8)) & 0xFF);
+	state += _input;
+	state += _message;
+	return state;
+}
+
+bool WebSocket::restore(const std::string &state)
+{
+	if (state.size() < 5)
+		return false;
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(state.data());
+	size_t inputSize = (static_cast<size_t>(p[1]) << 24) | (p[2] << 16) | (p[3] << 8) | p[4];
+	if (5 + inputSize > state.size())
+		return false;
+	_open = p[0] & 1;
+	_binary = p[0] & 2;
+	_fragmented = p[0] & 4;
+	_input = state.substr(5, inputSize);
+	_message = state.substr(5 + inputSize);
+	return true;
+}
@@ -0,0 +1,46 @@
+#ifndef WEBSOCKET_HPP
+#define WEBSOCKET_HPP
+
+#include <string>
+#include <sys/uio.h>
+
+enum WebSocketResult
+{
+	WS_CONTINUE, // keep reading
+	WS_CLOSE	 // closed by the peer or a protocol error: send `reply`, then drop the connection
+};
+
+// Server side of one WebSocket connection (RFC 6455) carrying IRC the IRCv3
+// way: one line per message, without CRLF, as UTF-8 text (text.ircv3.net, the
+// default) or raw bytes (binary.ircv3.net). receive() answers the HTTP upgrade,
+// unmasks frames and joins fragments; appendMessage() frames outbound lines
+// straight into the send queue.
+class WebSocket
+{
+private:
+	bool _open;			  // upgrade answered, frames follow
+	bool _binary;		  // binary.ircv3.net negotiated
+	bool _fragmented;	  // a message is missing its FIN frame
+	std::string _input;	  // bytes not decoded yet: the HTTP request or a partial frame
+	std::string _message; // fragments received so far
+
+	bool upgrade(const std::string &request, std::string &reply);
+	void deliver(const std::string &payload, std::string &lines) const;
+
+public:
+	WebSocket();
+
+	WebSocketResult receive(const char *data, size_t size, std::string &lines, std::string &reply);
+	void appendMessage(std::string &out, const struct iovec *parts, int count) const; // drops the trailing CRLF
+	bool isOpen() const;
+	bool isBinary() const;
+	size_t memoryBytes() const;
+
+	// Hot restart: the whole session is plain data
+	std::string serialize() const;
+	bool restore(const std::string &state);
+
+	static void appendFrame(std::string &out, unsigned char opcode, const char *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "WhoCommands.hpp"
+#include "ListCommands.hpp"
+#include "ReplyStream.hpp"
+#include "UserIndex.hpp"
+#include "Server.hpp"
+#include "Channel.hpp"
+#include "Client.hpp"
+#include <sstream>
+#include <cctype>
+#include <vector>
+#include <set>
+
+namespace WhoCommands
+{
+    // Index entries examined per chunk, as in LIST
+    static const size_t MAX_SCAN_PER_CHUNK = 4096;
+
+    // WHOX fields, in the order they appear in a 354 reply
+    static const std::string WHOX_FIELDS = "tcuihsnfdlaor";
+
+    struct WhoQuery
+    {
+        std::string mask;
+        bool whox;
+        std::string fields; // requested WHOX fields, in reply order
+        std::string token;
+    };
+
+    // One ordered range of the user index: every key starting with prefix
+    struct WhoRange
+    {
+        UserIndex::Field field;
+        std::string prefix;
+
+        WhoRange(UserIndex::Field f, const std::string &p) : field(f), prefix(p) {}
+    };
+
+    static std::string serverOf(Server *server, Client *user)
+    {
+        return user->isRemote() ? user->getUplink()->getLinkName() : server->getConfig().serverName;
+    }
+
+    static std::string lower(const std::string &text)
+    {
+        std::string out(text);
+        for (size_t i = 0; i < out.size(); ++i)
+            out[i] = std::tolower(static_cast<unsigned char>(out[i]));
+        return out;
+    }
+
+    // Literal text before the first wildcard / after the last one
+    static std::string literalPrefix(const std::string &mask)
+    {
+        return lower(mask.substr(0, mask.find_first_of("*?")));
+    }
+
+    static std::string literalSuffix(const std::string &mask)
+    {
+        size_t last = mask.find_last_of("*?");
+        return lower(last == std::string::npos ? mask : mask.substr(last + 1));
+    }
+
+    static void sendWhoReply(Server *server, Client *client, const WhoQuery &query, Client *user,
+                             const std::string &channel, bool op)
+    {
+        std::ostringstream line;
+        std::string flags = op ? "H@" : "H";
+        int hops = user->isRemote() ? 1 : 0;
+        if (!query.whox)
+        {
+            line << "352 " << client->getNickname() << " " << channel << " " << user->getUsername() << " "
+                 << user->getHost() << " " << serverOf(server, user) << " " << user->getNickname() << " "
+                 << flags << " :" << hops << " " << user->getRealname();
+            server->sendToClient(client, line.str());
+            return;
+        }
+        line << "354 " << client->getNickname();
+        for (size_t i = 0; i < query.fields.size(); ++i)
+        {
+            line << " ";
+            switch (query.fields[i])
+            {
+            case 't': line << query.token; break;
+            case 'c': line << channel; break;
+            case 'u': line << user->getUsername(); break;
+            case 'i': line << (user->isRemote() ? "255.255.255.255" : user->getHost()); break;
+            case 'h': line << user->getHost(); break;
+            case 's': line << serverOf(server, user); break;
+            case 'n': line << user->getNickname(); break;
+            case 'f': line << flags; break;
+            case 'd': line << hops; break;
+            case 'l': line << 0; break;
+            case 'a': line << (user->getAccount().empty() ? "0" : user->getAccount()); break;
+            case 'o': line << "n/a"; break;
+            case 'r': line << ":" << user->getRealname(); break;
+            }
+        }
+        server->sendToClient(client, line.str());
+    }
+
+    static void sendEnd(Server *server, Client *client, const WhoQuery &query)
+    {
+        server->sendToClient(client, "315 " + client->getNickname() + " " + (query.mask.empty() ? "*" : query.mask) +
+                                         " :End of /WHO list");
+    }
+
+    // WHO #channel: members in pointer order, resuming after the last one sent
+    class ChannelWhoStream : public ReplyStream
+    {
+    private:
+        WhoQuery _query;
+        Client *_cursor;
+        bool _started;
+
+    public:
+        ChannelWhoStream(const WhoQuery &query) : _query(query), _cursor(NULL), _started(false) {}
+
+        bool produce(Server *server, Client *client, size_t budget)
+        {
+            std::string &queue = client->getSendQueue();
+            size_t limit = queue.size() + budget;
+            // The channel may be gone, or its membership changed, between chunks
+            Channel *channel = server->getChannel(_query.mask);
+            if (channel)
+            {
+                const std::set<Client *> &members = channel->getClients();
+                std::set<Client *>::const_iterator it = _started ? members.upper_bound(_cursor) : members.begin();
+                for (; it != members.end() && queue.size() < limit; ++it)
+                {
+                    sendWhoReply(server, client, _query, *it, channel->getName(), channel->isOperator(*it));
+                    _cursor = *it;
+                    _started = true;
+                }
+                if (it != members.end())
+                    return true;
+            }
+            sendEnd(server, client, _query);
+            return false;
+        }
+    };
+
+    // WHO <mask>: one or more ranges of the user index, each entry checked against the mask.
+    // A user found in an earlier range is skipped in later ones, so nothing is sent twice
+    // and no per-query set of seen users is needed.
+    class MaskWhoStream : public ReplyStream
+    {
+    private:
+        WhoQuery _query;
+        bool _fullMask; // nick!user@host form, otherwise nick, user or host may match
+        std::vector<WhoRange> _ranges;
+        size_t _range;
+        std::pair<std::string, Client *> _cursor;
+        bool _started;
+        size_t _sent;
+
+        bool matches(Client *user) const
+        {
+            if (_query.mask.empty() || _query.mask == "0")
+                return true;
+            if (_fullMask)
+                return ListCommands::matchMask(_query.mask, user->getFullMask());
+            return ListCommands::matchMask(_query.mask, user->getNickname()) ||
+                   ListCommands::matchMask(_query.mask, user->getUsername()) ||
+                   ListCommands::matchMask(_query.mask, user->getHost());
+        }
+
+        bool seenEarlier(Client *user) const
+        {
+            for (size_t i = 0; i < _range; ++i)
+            {
+                const WhoRange &r = _ranges[i];
+                std::string key = r.field == UserIndex::BY_NICK   ? user->getNickname()
+                                  : r.field == UserIndex::BY_USER ? user->getUsername()
+                                                                  : user->getHost();
+                key = UserIndex::key(r.field, key);
+                if (key.compare(0, r.prefix.size(), r.prefix) == 0)
+                    return true;
+            }
+            return false;
+        }
+
+        void planFullMask()
+        {
+            size_t bang = _query.mask.find('!');
+            size_t at = _query.mask.find('@', bang);
+            std::string nick = _query.mask.substr(0, bang);
+            std::string user = _query.mask.substr(bang + 1, at - bang - 1);
+            std::string host = _query.mask.substr(at + 1);
+            std::string hostSuffix = literalSuffix(host);
+            if (!literalPrefix(nick).empty())
+                _ranges.push_back(WhoRange(UserIndex::BY_NICK, literalPrefix(nick)));
+            else if (!literalPrefix(user).empty())
+                _ranges.push_back(WhoRange(UserIndex::BY_USER, literalPrefix(user)));
+            else if (!hostSuffix.empty())
+                _ranges.push_back(WhoRange(UserIndex::BY_HOST_REVERSED, std::string(hostSuffix.rbegin(), hostSuffix.rend())));
+            else
+                _ranges.push_back(WhoRange(UserIndex::BY_HOST, literalPrefix(host)));
+        }
+
+    public:
+        MaskWhoStream(const WhoQuery &query) : _query(query), _range(0), _started(false), _sent(0)
+        {
+            _fullMask = _query.mask.find_first_of("!@") != std::string::npos;
+            if (_fullMask)
+            {
+                _query.mask = Channel::normalizeMask(_query.mask);
+                planFullMask();
+            }
+            else if (_query.mask.empty() || _query.mask == "0" || literalPrefix(_query.mask).empty())
+                _ranges.push_back(WhoRange(UserIndex::BY_NICK, ""));
+            else
+            {
+                std::string prefix = literalPrefix(_query.mask);
+                _ranges.push_back(WhoRange(UserIndex::BY_NICK, prefix));
+                _ranges.push_back(WhoRange(UserIndex::BY_USER, prefix));
+                _ranges.push_back(WhoRange(UserIndex::BY_HOST, prefix));
+            }
+        }
+
+        bool produce(Server *server, Client *client, size_t budget)
+        {
+            std::string &queue = client->getSendQueue();
+            size_t limit = queue.size() + budget;
+            size_t cap = server->getConfig().whoLimit;
+            size_t scanned = 0;
+            while (_range < _ranges.size())
+            {
+                // Re-seek from the cursor on every chunk: users may come and go in between
+                const WhoRange &range = _ranges[_range];
+                const UserIndex::Keys &keys = server->getUserIndex().byField(range.field);
+                UserIndex::Keys::const_iterator it = _started ? keys.upper_bound(_cursor)
+                                                              : keys.lower_bound(std::make_pair(range.prefix, static_cast<Client *>(NULL)));
+                for (; it != keys.end() && it->first.compare(0, range.prefix.size(), range.prefix) == 0; ++it)
+                {
+                    if (queue.size() >= limit || scanned++ == MAX_SCAN_PER_CHUNK)
+                        return true;
+                    _cursor = *it;
+                    _started = true;
+                    if (!matches(it->second) || seenEarlier(it->second))
+                        continue;
+                    if (_sent == cap)
+                    {
+                        server->sendToClient(client, "416 " + client->getNickname() + " WHO :Output too large, truncated");
+                        sendEnd(server, client, _query);
+                        return false;
+                    }
+                    sendWhoReply(server, client, _query, it->second, "*", false);
+                    _sent++;
+                }
+                _range++;
+                _started = false;
+            }
+            sendEnd(server, client, _query);
+            return false;
+        }
+    };
+
+    // WHO [<mask> [<flags>][%<fields>[,<token>]]]
+    void handleWhoCommand(Server *server, Client *client, const std::string &args)
+    {
+        if (!client->isRegistered())
+        {
+            server->sendError(client, "451", ":You have not registered");
+            return;
+        }
+        std::istringstream iss(args);
+        WhoQuery query;
+        std::string options;
+        iss >> query.mask >> options;
+        if (!query.mask.empty() && query.mask[0] == ':')
+            query.mask.erase(0, 1);
+        size_t percent = options.find('%');
+        query.whox = percent != std::string::npos;
+        if (query.whox)
+        {
+            std::string spec = options.substr(percent + 1);
+            size_t comma = spec.find(',');
+            if (comma != std::string::npos)
+            {
+                query.token = spec.substr(comma + 1, 3);
+                spec.erase(comma);
+            }
+            for (size_t i = 0; i < WHOX_FIELDS.size(); ++i)
+            {
+                if (spec.find(WHOX_FIELDS[i]) != std::string::npos)
+                    query.fields += WHOX_FIELDS[i];
+            }
+            if (query.token.empty())
+                query.token = "0";
+        }
+        if (!query.mask.empty() && query.mask[0] == '#')
+            server->startReplyStream(client, new ChannelWhoStream(query));
+        else
+            server->startReplyStream(client, new MaskWhoStream(query));
+    }
+
+    // Channel lists can be long: split them so each 319 stays well under 512 bytes
+    static void sendChannels(Server *server, Client *client, Client *target)
+    {
+        std::string prefix = "319 " + client->getNickname() + " " + target->getNickname() + " :";
+        std::string list;
+        const std::set<Channel *> &channels = target->getChannels();
+        for (std::set<Channel *>::const_iterator it = channels.begin(); it != channels.end(); ++it)
+        {
+            Channel *channel = *it;
+            std::string entry = (channel->isOperator(target) ? "@" : "") + channel->getName();
+            if (!list.empty() && prefix.size() + list.size() + entry.size() > 400)
+            {
+                server->sendToClient(client, prefix + list);
+                list.clear();
+            }
+            list += (list.empty() ? "" : " ") + entry;
+        }
+        if (!list.empty())
+            server->sendToClient(client, prefix + list);
+    }
+
+    // WHOIS [<server>] <nick>{,<nick>}
+    void handleWhoisCommand(Server *server, Client *client, const std::string &args)
+    {
+        if (!client->isRegistered())
+        {
+            server->sendError(client, "451", ":You have not registered");
+            return;
+        }
+        std::istringstream iss(args);
+        std::string first, second;
+        iss >> first >> second;
+        std::string targets = second.empty() ? first : second;
+        if (targets.empty())
+        {
+            server->sendToClient(client, "431 " + client->getNickname() + " :No nickname given");
+            return;
+        }
+        std::stringstream ss(targets);
+        std::string nick;
+        std::set<std::string> done;
+        long count = 0;
+        while (std::getline(ss, nick, ','))
+        {
+            if (nick.empty() || !done.insert(nick).second)
+                continue;
+            if (++count > server->getConfig().maxTargets)
+            {
+                server->sendToClient(client, "407 " + client->getNickname() + " " + nick + " :Too many targets");
+                break;
+            }
+            Client *target = server->getClientByNick(nick);
+            if (!target)
+                server->sendToClient(client, "401 " + client->getNickname() + " " + nick + " :No such nick/channel");
+            else
+            {
+                server->sendToClient(client, "311 " + client->getNickname() + " " + target->getNickname() + " " +
+                                                 target->getUsername() + " " + target->getHost() + " * :" +
+                                                 target->getRealname());
+                sendChannels(server, client, target);
+                server->sendToClient(client, "312 " + client->getNickname() + " " + target->getNickname() + " " +
+                                                 serverOf(server, target) + " :ft_irc server");
+            }
+            server->sendToClient(client, "318 " + client->getNickname() + " " + nick + " :End of /WHOIS list");
+        }
+    }
+}
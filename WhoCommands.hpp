@@ -0,0 +1,10 @@
+#pragma once
+#include <string>
+class Client;
+class Server;
+
+namespace WhoCommands
+{
+    void handleWhoCommand(Server *server, Client *client, const std::string &args);
+    void handleWhoisCommand(Server *server, Client *client, const std::string &args);
+}
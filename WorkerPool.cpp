@@ -0,0 +1,137 @@
+#include "WorkerPool.hpp"
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+
+WorkerPool::WorkerPool() : _running(0), _stopping(false), _signalled(false)
+{
+	pthread_mutex_init(&_lock, NULL);
+	pthread_cond_init(&_wake, NULL);
+	pthread_cond_init(&_drained, NULL);
+	_pipe[0] = -1;
+	_pipe[1] = -1;
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+	for (size_t i = 0; i < _queue.size(); ++i)
+		delete _queue[i];
+	for (size_t i = 0; i < _completed.size(); ++i)
+		delete _completed[i];
+	if (_pipe[0] >= 0)
+		close(_pipe[0]);
+	if (_pipe[1] >= 0)
+		close(_pipe[1]);
+	pthread_cond_destroy(&_drained);
+	pthread_cond_destroy(&_wake);
+	pthread_mutex_destroy(&_lock);
+}
+
+bool WorkerPool::start(size_t threads)
+{
+	if (pipe(_pipe) < 0)
+	{
+		perror("pipe");
+		return false;
+	}
+	for (int i = 0; i < 2; ++i)
+		fcntl(_pipe[i], F_SETFD, FD_CLOEXEC);
+	fcntl(_pipe[0], F_SETFL, O_NONBLOCK);
+	for (size_t i = 0; i < threads; ++i)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, threadMain, this) != 0)
+		{
+			perror("pthread_create");
+			return false;
+		}
+		_threads.push_back(thread);
+	}
+	return true;
+}
+
+void WorkerPool::stop()
+{
+	pthread_mutex_lock(&_lock);
+	_stopping = true;
+	pthread_cond_broadcast(&_wake);
+	pthread_mutex_unlock(&_lock);
+	for (size_t i = 0; i < _threads.size(); ++i)
+		pthread_join(_threads[i], NULL);
+	_threads.clear();
+}
+
+int WorkerPool::notifyFd() const
+{
+	return _pipe[0];
+}
+
+void WorkerPool::submit(WorkerJob *job)
+{
+	pthread_mutex_lock(&_lock);
+	_queue.push_back(job);
+	pthread_cond_signal(&_wake);
+	pthread_mutex_unlock(&_lock);
+}
+
+void WorkerPool::takeCompleted(std::vector<WorkerJob *> &jobs)
+{
+	char drain[64];
+	while (read(_pipe[0], drain, sizeof(drain)) > 0)
+		;
+	pthread_mutex_lock(&_lock);
+	jobs.swap(_completed);
+	_completed.clear();
+	_signalled = false;
+	pthread_mutex_unlock(&_lock);
+}
+
+// Hot restart: let queued and running jobs finish so their results can be applied
+// before the state is written down
+void WorkerPool::waitIdle()
+{
+	pthread_mutex_lock(&_lock);
+	while (!_threads.empty() && (!_queue.empty() || _running))
+		pthread_cond_wait(&_drained, &_lock);
+	pthread_mutex_unlock(&_lock);
+}
+
+void *WorkerPool::threadMain(void *arg)
+{
+	static_cast<WorkerPool *>(arg)->work();
+	return NULL;
+}
+
+void WorkerPool::work()
+{
+	pthread_mutex_lock(&_lock);
+	while (true)
+	{
+		while (_queue.empty() && !_stopping)
+			pthread_cond_wait(&_wake, &_lock);
+		if (_stopping)
+			break;
+		WorkerJob *job = _queue.front();
+		_queue.pop_front();
+		_running++;
+		pthread_mutex_unlock(&_lock);
+
+		job->run();
+
+		pthread_mutex_lock(&_lock);
+		_running--;
+		_completed.push_back(job);
+		// One byte per batch: the loop takes every completed job when it wakes up
+		if (!_signalled)
+		{
+			_signalled = true;
+			char byte = 1;
+			if (write(_pipe[1], &byte, 1) < 0)
+				perror("write");
+		}
+		if (_queue.empty() && !_running)
+			pthread_cond_broadcast(&_drained);
+	}
+	pthread_mutex_unlock(&_lock);
+}
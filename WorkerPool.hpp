@@ -0,0 +1,55 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+class Server;
+
+// A unit of CPU-heavy work: run() executes on a worker thread and must not
+// touch server state; complete() runs afterwards on the event-loop thread.
+class WorkerJob
+{
+public:
+	virtual ~WorkerJob() {}
+	virtual void run() = 0;
+	virtual void complete(Server *server) = 0;
+};
+
+// Fixed set of threads fed from one queue. Finished jobs are handed back to the
+// event loop through a pipe: its read end is watched like any other fd, and
+// takeCompleted() collects everything that finished since the last call.
+class WorkerPool
+{
+private:
+	std::vector<pthread_t> _threads;
+	pthread_mutex_t _lock;
+	pthread_cond_t _wake;	  // workers: a job was queued (or stopping)
+	pthread_cond_t _drained; // waitIdle(): nothing queued or running
+	std::deque<WorkerJob *> _queue;
+	std::vector<WorkerJob *> _completed;
+	size_t _running;
+	bool _stopping;
+	bool _signalled; // a byte is sitting in the pipe
+	int _pipe[2];
+
+	WorkerPool(const WorkerPool &);
+	WorkerPool &operator=(const WorkerPool &);
+
+	static void *threadMain(void *arg);
+	void work();
+
+public:
+	WorkerPool();
+	~WorkerPool();
+
+	bool start(size_t threads);
+	void stop();
+	int notifyFd() const; // readable while completed jobs are waiting
+	void submit(WorkerJob *job);
+	void takeCompleted(std::vector<WorkerJob *> &jobs);
+	void waitIdle();
+};
+
+#endif
@@ -1,21 +1,58 @@
-#include "Server.hpp"
-#include "Client.hpp"
-#include <iostream>
-
-int main(int argc, char **argv)
-{
-	if (argc != 3)
-	{
-		std::cerr << "Usage: ./ircserv <port> <password>" << std::endl;
-		return 1;
-	}
-	int port = std::atoi(argv[1]);
-	std::string password = argv[2];
-	if (port <= 0 || port > 65535) {
-		std::cerr << "Invalid port number" << std::endl;
-		return 1;
-	}
-	Server server(port, password);
-	server.start();
-	return 0;
-}
+#include "Server.hpp"
+#include "Client.hpp"
+#include "ServerConfig.hpp"
+#include "StreamCompressor.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <csignal>
+#include <climits>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && std::string(argv[1]).compare(0, 17, "--compress-bench=") == 0)
+		return StreamCompressor::runBenchmark(std::string(argv[1]).substr(17));
+	if (argc == 2 && std::string(argv[1]).compare(0, 13, "--idle-bench=") == 0)
+		return Server::runIdleBenchmark(std::atol(argv[1] + 13));
+	if (argc == 2 && std::string(argv[1]).compare(0, 16, "--latency-bench=") == 0)
+		return Server::runLatencyBenchmark(std::atol(argv[1] + 16));
+	if (argc == 2 && std::string(argv[1]).compare(0, 14, "--uring-bench=") == 0)
+		return Server::runUringBenchmark(std::atol(argv[1] + 14));
+	if (argc == 2 && std::string(argv[1]).compare(0, 12, "--sim-bench=") == 0)
+		return Server::runSimulationBenchmark(std::atol(argv[1] + 12));
+	if (argc < 3)
+	{
+		ServerConfig::printUsage();
+		return 1;
+	}
+	int port = std::atoi(argv[1]);
+	std::string password = argv[2];
+	if (port <= 0 || port > 65535) {
+		std::cerr << "Invalid port number" << std::endl;
+		return 1;
+	}
+	ServerConfig config;
+	for (int i = 3; i < argc; ++i)
+	{
+		if (!config.parseOption(argv[i]))
+		{
+			std::cerr << "Invalid option: " << argv[i] << std::endl;
+			ServerConfig::printUsage();
+			return 1;
+		}
+	}
+	// Remember how we were started so a hot restart can exec the (new) binary the same way
+	char exePath[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+	config.execPath = len > 0 ? std::string(exePath, len) : argv[0];
+	for (int i = 0; i < argc; ++i)
+	{
+		if (std::string(argv[i]).compare(0, 12, "--resume-fd=") != 0)
+			config.execArgs.push_back(argv[i]);
+	}
+	// A peer closing mid-write must not kill the whole server
+	signal(SIGPIPE, SIG_IGN);
+	Server server(port, password, config);
+	server.start();
+	return 0;
+}